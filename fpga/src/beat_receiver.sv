@@ -1,58 +1,163 @@
 // beat_receiver.sv
-// Receives 1 byte from STM32. Bottom 4 bits = lane mask.
+// Full-duplex SPI slave (mode 0) for the STM32. Every transaction returns a
+// 12-byte status frame on sdo while the MCU clocks it:
+//   byte 0     0xA5
+//   byte 1     {overflow, events in this frame[2:0], events still queued[3:0]}
+//   bytes 2-3  score, MSB first
+//   bytes 4-11 two events from hit_queue, MSB first (unused ones are zero)
+// The first byte the MCU sends is a note: bottom 4 bits = lane mask, 0 for none.
+// It sends zeros for the rest of the frame.
+//
+// The frame is assembled in the clk domain while cs_n is high and only read in the
+// SCK domain while it is low. The constant first byte covers the few clk cycles the
+// clk domain needs to see cs_n fall, so no field changes while it is being shifted.
+// Events leave the frame only once all 96 bits have been clocked; a cut-short
+// transaction sends the same events again.
+//
+// frame_toggle flips before cs_n rises, but each synchroniser may take a cycle
+// longer to settle than the other. cs_n goes through one more flop than
+// frame_toggle, so the idle top-up never runs before the delivered frame is
+// cleared: an event loaded into the frame then would be cleared unsent.
 module beat_receiver (
-    input  logic clk,       // System clock (48MHz)
+    input  logic clk,       // System clock (24MHz)
     input  logic reset,
     input  logic sck,       // SPI Clock (from STM32)
     input  logic sdi,       // SPI MOSI (from STM32)
     input  logic cs_n,      // SPI Chip Select (from STM32 PB0)
-    output logic [3:0] lane_mask,  // The decoded beat (to pattern_gen)
-    output logic new_beat          // Pulse when new data arrives
+    output logic sdo,       // SPI MISO; the top level drives the pin only while cs_n is low
+    output logic [3:0] lane_mask,  // The decoded beat (to pattern_gen), one cycle
+    output logic new_beat,         // Pulse when new data arrives
+    // Status source (hit_queue)
+    output logic ev_pop,
+    input  logic ev_valid,
+    input  logic [31:0] ev_data,
+    input  logic [4:0] ev_count,
+    input  logic ev_overflow,
+    output logic ev_overflow_clear,
+    input  logic [15:0] score
 );
 
-    logic [7:0] shift_reg;
-    logic [3:0] bit_count;
-    logic ready_sck;
+    localparam int FRAME_BITS = 96;
+    localparam logic [7:0] FRAME_SYNC = 8'hA5;
+
+    // --- Frame fields (clk domain) ---
+    logic [31:0] f_ev0, f_ev1;
+    logic [1:0]  f_count;      // Events in the frame
+    logic [3:0]  f_pending;    // Events still in hit_queue, saturated
+    logic        f_overflow;
+    logic [15:0] f_score;
+    logic [FRAME_BITS-1:0] frame;
+
+    assign frame = {FRAME_SYNC, f_overflow, 1'b0, f_count, f_pending, f_score, f_ev0, f_ev1};
 
     // --- SPI Domain (Fast/Async) ---
+    logic [6:0] rx_count;      // Bits sampled this transaction, saturated
+    logic [6:0] tx_count;      // Bits shifted out this transaction, saturated
+    logic [7:0] shift_reg;
+    logic [7:0] note_sck;      // First byte of the last transaction
+    logic note_toggle = 1'b0;  // Flips when note_sck is written
+    logic frame_toggle = 1'b0; // Flips when a whole frame has been clocked
+
     always_ff @(posedge sck or posedge cs_n) begin
         if (cs_n) begin
-            bit_count <= '0;
-            ready_sck <= '0;
-        end else begin
+            rx_count <= '0;
+        end else if (rx_count != 7'h7F) begin
+            rx_count <= rx_count + 1;
+        end
+    end
+
+    // Not cleared by cs_n: the clk domain watches these across transactions
+    always_ff @(posedge sck) begin
+        if (!cs_n) begin
             shift_reg <= {shift_reg[6:0], sdi}; // Shift MSB first
-            bit_count <= bit_count + 1;
-            
-            // Trigger after 8 bits (0-7)
-            if (bit_count == 7) begin
-                ready_sck <= 1'b1;
-            end else begin
-                ready_sck <= 1'b0;
+            if (rx_count == 7) begin
+                note_sck <= {shift_reg[6:0], sdi};
+                note_toggle <= ~note_toggle;
             end
+            if (rx_count == FRAME_BITS - 1) frame_toggle <= ~frame_toggle;
+        end
+    end
+
+    // Mode 0: the first bit is out as soon as cs_n falls, the rest change on falling edges
+    always_ff @(negedge sck or posedge cs_n) begin
+        if (cs_n) begin
+            tx_count <= '0;
+        end else if (tx_count != 7'h7F) begin
+            tx_count <= tx_count + 1;
         end
     end
-    
+
+    assign sdo = (tx_count < FRAME_BITS) ? frame[FRAME_BITS - 1 - tx_count] : 1'b0;
+
     // --- System Clock Domain (Synchronizer) ---
-    logic [2:0] sync_pipe;
+    logic [2:0] cs_sync;       // One flop longer than frame_sync, see above
+    logic [2:0] note_sync, frame_sync;
+    logic pop_busy;
 
     always_ff @(posedge clk) begin
         if (reset) begin
-            sync_pipe <= '0;
-            lane_mask <= '0;
-            new_beat  <= 0;
+            cs_sync    <= 3'b111;
+            note_sync  <= '0;
+            frame_sync <= '0;
+            lane_mask  <= '0;
+            new_beat   <= 0;
+            f_ev0 <= '0; f_ev1 <= '0;
+            f_count <= '0;
+            f_pending <= '0;
+            f_overflow <= 0;
+            f_score <= '0;
+            ev_pop <= 0;
+            ev_overflow_clear <= 0;
+            pop_busy <= 0;
         end else begin
-            sync_pipe <= {sync_pipe[1:0], ready_sck};
+            cs_sync    <= {cs_sync[1:0], cs_n};
+            note_sync  <= {note_sync[1:0], note_toggle};
+            frame_sync <= {frame_sync[1:0], frame_toggle};
+            ev_pop <= 0;
+            ev_overflow_clear <= 0;
 
-            // Rising edge detection of the synced signal
-            if (sync_pipe[1] && ~sync_pipe[2]) begin
-                new_beat  <= 1'b1;
-                lane_mask <= shift_reg[3:0]; // Capture lanes
+            // A note arrived: pulse its lanes (0 is a status poll only)
+            if (note_sync[2] != note_sync[1]) begin
+                lane_mask <= note_sck[3:0];
+                new_beat  <= |note_sck[3:0];
             end else begin
-                new_beat <= 0;
-                // Optional: Clear lane_mask after 1 cycle if you want pulses
-                // But keeping it latched usually looks better for debug
+                lane_mask <= '0;
+                new_beat  <= 0;
+            end
+
+            if (frame_sync[2] != frame_sync[1]) begin
+                // Frame delivered: its events and overflow flag are the MCU's now.
+                // A pop landing in the same cycle starts the next frame.
+                f_count <= ev_valid ? 2'd1 : 2'd0;
+                f_ev0 <= ev_valid ? ev_data : '0;
+                f_ev1 <= '0;
+                if (ev_valid) pop_busy <= 0;
+                if (f_overflow) begin
+                    f_overflow <= 0;
+                    ev_overflow_clear <= 1;
+                end
+            end else if (cs_sync[2]) begin
+                // Idle: keep the frame current and top it up from the queue
+                f_score   <= score;
+                f_pending <= (ev_count > 15) ? 4'd15 : ev_count[3:0];
+                if (ev_overflow && !ev_overflow_clear) f_overflow <= 1; // Not the flag being cleared
+                if (ev_valid) begin
+                    if (f_count == 0) f_ev0 <= ev_data;
+                    else              f_ev1 <= ev_data;
+                    f_count <= f_count + 1;
+                    pop_busy <= 0;
+                end else if (!pop_busy && f_count < 2 && ev_count != 0) begin
+                    ev_pop <= 1;
+                    pop_busy <= 1;
+                end
+            end else if (ev_valid) begin
+                // A pop that was in flight as cs_n fell lands during the sync byte
+                if (f_count == 0) f_ev0 <= ev_data;
+                else              f_ev1 <= ev_data;
+                f_count <= f_count + 1;
+                pop_busy <= 0;
             end
         end
     end
 
-endmodule
\ No newline at end of file
+endmodule
@@ -21,7 +21,7 @@ module hit_detector(
                 hit_okay[i] <= '0;
                 hit_miss[i] <= '0;
 
-                if (sync_drum_beat) begin
+                if (sync_drum_beat[i]) begin
                     if (lane_active_perfect[i]) begin
                         hit_perfect[i] <= 1'b1;
                     end else if (lane_active_okay[i]) begin
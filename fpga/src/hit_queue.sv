@@ -0,0 +1,108 @@
+// hit_queue.sv
+// Time-stamps the judgments from hit_detector and queues them for the MCU, and
+// keeps the running score (perfect +3, okay +1, as pattern_gen shows it).
+// All four lanes can be judged in the same cycle, so each lane has a holding
+// register that drains into the FIFO one per cycle. The debouncer lockout keeps a
+// lane from being judged again for 100 ms, long before its register is free, so
+// events are only lost if the MCU stops reading and FIFO and registers all fill.
+//
+// Event: {lane[1:0], judgment[1:0], time_us[27:0]}, judgment 1 perfect, 2 okay, 3 miss.
+module hit_queue #(
+    parameter CLK_FREQ   = 24000000,
+    parameter DEPTH_LOG2 = 4
+) (
+    input  logic clk, reset,
+    input  logic [3:0] hit_perfect, hit_okay, hit_miss,
+    input  logic pop,                   // Request the oldest event
+    output logic pop_valid,             // pop_data holds it (the cycle after pop)
+    output logic [31:0] pop_data,
+    output logic [DEPTH_LOG2:0] count,  // Events in the FIFO
+    output logic overflow,              // An event was lost; held until overflow_clear
+    input  logic overflow_clear,
+    output logic [15:0] score
+);
+
+    localparam int DEPTH = 1 << DEPTH_LOG2;
+    localparam int US_DIV = CLK_FREQ / 1000000;
+
+    // --- Microsecond timestamp ---
+    logic [$clog2(US_DIV)-1:0] us_div;
+    logic [27:0] time_us;
+
+    always_ff @(posedge clk) begin
+        if (reset) begin
+            us_div <= '0;
+            time_us <= '0;
+        end else if (us_div == US_DIV - 1) begin
+            us_div <= '0;
+            time_us <= time_us + 1;
+        end else begin
+            us_div <= us_div + 1;
+        end
+    end
+
+    // --- Per-lane holding registers ---
+    logic [3:0] hold_valid;
+    logic [31:0] hold_ev [0:3];
+    logic [1:0] sel;
+    logic wr_en;
+    logic [DEPTH_LOG2:0] wr_ptr, rd_ptr;
+    logic [31:0] mem [0:DEPTH-1];
+
+    assign count = wr_ptr - rd_ptr;
+
+    // Lowest lane waiting goes into the FIFO first
+    always_comb begin
+        sel = 2'd0;
+        if (hold_valid[0])      sel = 2'd0;
+        else if (hold_valid[1]) sel = 2'd1;
+        else if (hold_valid[2]) sel = 2'd2;
+        else                    sel = 2'd3;
+    end
+    assign wr_en = |hold_valid && (count != DEPTH);
+
+    logic [2:0] n_perfect, n_okay; // Lanes judged this cycle
+    assign n_perfect = hit_perfect[0] + hit_perfect[1] + hit_perfect[2] + hit_perfect[3];
+    assign n_okay    = hit_okay[0] + hit_okay[1] + hit_okay[2] + hit_okay[3];
+
+    integer i;
+    always_ff @(posedge clk) begin
+        if (reset) begin
+            hold_valid <= '0;
+            overflow <= 1'b0;
+            score <= '0;
+        end else begin
+            if (wr_en) hold_valid[sel] <= 1'b0;
+            if (overflow_clear) overflow <= 1'b0;
+
+            for (i = 0; i < 4; i = i + 1) begin
+                if (hit_perfect[i] | hit_okay[i] | hit_miss[i]) begin
+                    if (hold_valid[i] && !(wr_en && sel == i)) overflow <= 1'b1; // Replaces an unqueued event
+                    hold_valid[i] <= 1'b1;
+                    hold_ev[i] <= {i[1:0], hit_perfect[i] ? 2'd1 : hit_okay[i] ? 2'd2 : 2'd3, time_us};
+                end
+            end
+
+            score <= score + {n_perfect, 1'b0} + n_perfect + n_okay;
+        end
+    end
+
+    // --- FIFO: synchronous read, so it maps to block RAM ---
+    always_ff @(posedge clk) begin
+        if (wr_en) mem[wr_ptr[DEPTH_LOG2-1:0]] <= hold_ev[sel];
+        pop_data <= mem[rd_ptr[DEPTH_LOG2-1:0]];
+    end
+
+    always_ff @(posedge clk) begin
+        if (reset) begin
+            wr_ptr <= '0;
+            rd_ptr <= '0;
+            pop_valid <= 1'b0;
+        end else begin
+            if (wr_en) wr_ptr <= wr_ptr + 1;
+            pop_valid <= pop && (count != 0);
+            if (pop && (count != 0)) rd_ptr <= rd_ptr + 1;
+        end
+    end
+
+endmodule
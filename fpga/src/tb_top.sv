@@ -0,0 +1,366 @@
+// tb_top.sv
+// Simulation of top's hit path: debouncers, hit_detector, hit_queue and
+// beat_receiver, against a model of the MCU's fpga_link. All four drums are hit as
+// fast as the debouncers let through, first in step so every lane is judged in the
+// same cycle, then independently. Meanwhile the MCU runs fpga_task once per DAC
+// half: a poll when the last frame said more is queued or after FPGA_POLL_EVERY
+// halves without a frame, and now and then a note. Frames are clocked at
+// FPGA_SPI_BR (5 MHz). Every judged event must reach the MCU once, in order, with
+// its lane, judgment and timestamp; the score must match and overflow must never
+// be set.
+//
+// The lockout and DAC half are both SCALE times shorter than on the board, so the
+// run stays short with the same number of hits per poll. The SPI clock is not scaled.
+//
+// A frame that leaves events queued is where beat_receiver refills the frame just
+// after the MCU has read it. Those frames end with cs_n rising 0 to 4 clk cycles
+// after the last SCK edge, with frame_toggle's synchroniser settling on time or a
+// cycle late, so the clk domain sees cs_n before, with and after the frame.
+//
+// Run:  make sim  (make wave dumps blinky.vcd and opens it)
+`timescale 1ns / 1ps
+
+module tb_top;
+
+    localparam int  CLK_FREQ    = 24000000;
+    localparam real CLK_NS      = 1.0e9 / CLK_FREQ;
+    localparam int  SCALE       = 100;
+    localparam real SCK_NS      = 200.0;            // FPGA_SPI_BR: 80 MHz / 16
+    localparam int  HALF_NS     = 16000000 / SCALE; // DAC half: 256 samples at 16 kHz
+    localparam int  POLL_EVERY  = 3;                // FPGA_POLL_EVERY
+    localparam int  NOTE_ODDS   = 4;                // One DAC half in this many sends a note
+    localparam int  CUT_ODDS    = 16;               // One frame in this many is cut short
+    localparam int  IN_STEP_NS  = 80000000 / SCALE; // Lanes hit in the same cycle
+    localparam int  APART_NS    = 40000000 / SCALE; // Lanes hit independently
+    localparam int  N_DELAYS    = 20;
+    localparam real DELAY_STEP  = 4.0 * CLK_NS / N_DELAYS;
+
+    // --- Design ---
+    logic clk = 0, reset = 1;
+    logic [3:0] drum_beat = '0;
+    logic [3:0] target_perfect = '0, target_okay = '0;
+    logic sck = 0, sdi = 0, cs_n = 0;
+    logic sdo;
+
+    logic [3:0] sync_drum_beat;
+    logic [3:0] hit_perfect, hit_okay, hit_miss;
+    logic [3:0] lane_mask;
+    logic new_beat;
+    logic hq_pop, hq_pop_valid, hq_overflow, hq_overflow_clear;
+    logic [31:0] hq_pop_data;
+    logic [4:0] hq_count;
+    logic [15:0] hq_score;
+
+    always #(CLK_NS / 2) clk = ~clk;
+
+    genvar g;
+    generate
+        for (g = 0; g < 4; g = g + 1) begin : gen_sync
+            debouncer #(
+                .CLK_FREQ(CLK_FREQ / SCALE),
+                .LOCKOUT_MS(100)
+            ) debounce (
+                .clk(clk),
+                .reset(reset),
+                .unsync_hit(drum_beat[g]),
+                .sync_hit(sync_drum_beat[g])
+            );
+        end
+    endgenerate
+
+    hit_detector game_logic (
+        .clk(clk),
+        .reset(reset),
+        .sync_drum_beat(sync_drum_beat),
+        .lane_active_perfect(target_perfect),
+        .lane_active_okay(target_okay),
+        .hit_perfect(hit_perfect),
+        .hit_okay(hit_okay),
+        .hit_miss(hit_miss)
+    );
+
+    hit_queue #(
+        .CLK_FREQ(CLK_FREQ),
+        .DEPTH_LOG2(4)
+    ) hits (
+        .clk(clk),
+        .reset(reset),
+        .hit_perfect(hit_perfect),
+        .hit_okay(hit_okay),
+        .hit_miss(hit_miss),
+        .pop(hq_pop),
+        .pop_valid(hq_pop_valid),
+        .pop_data(hq_pop_data),
+        .count(hq_count),
+        .overflow(hq_overflow),
+        .overflow_clear(hq_overflow_clear),
+        .score(hq_score)
+    );
+
+    beat_receiver spi_inst (
+        .clk(clk),
+        .reset(reset),
+        .sck(sck),
+        .sdi(sdi),
+        .cs_n(cs_n),
+        .sdo(sdo),
+        .lane_mask(lane_mask),
+        .new_beat(new_beat),
+        .ev_pop(hq_pop),
+        .ev_valid(hq_pop_valid),
+        .ev_data(hq_pop_data),
+        .ev_count(hq_count),
+        .ev_overflow(hq_overflow),
+        .ev_overflow_clear(hq_overflow_clear),
+        .score(hq_score)
+    );
+
+    // --- Expected events: judged lanes in cycle order, lowest lane first ---
+    logic [31:0] expected [$];
+    int expected_score = 0;
+    int judged = 0;
+
+    always @(posedge clk) begin
+        if (!reset) begin
+            for (int l = 0; l < 4; l++) begin
+                if (hit_perfect[l] | hit_okay[l] | hit_miss[l]) begin
+                    expected.push_back({l[1:0], hit_perfect[l] ? 2'd1 : hit_okay[l] ? 2'd2 : 2'd3, hits.time_us});
+                    expected_score += hit_perfect[l] ? 3 : hit_okay[l] ? 1 : 0;
+                    judged++;
+                end
+            end
+            if (hq_overflow) $fatal(1, "hit_queue overflow at %0t", $time);
+        end
+    end
+
+    // --- Notes the MCU sent must come out as one lane_mask pulse each ---
+    int beats_seen = 0;
+    logic [3:0] last_mask;
+
+    always @(posedge clk) begin
+        if (new_beat) begin
+            beats_seen++;
+            last_mask = lane_mask;
+        end
+    end
+
+    // --- Which synchroniser saw the end of the frame first ---
+    int clk_n = 0;
+    int frame_seen_at = 0, cs_seen_at = 0;
+    wire frame_seen = spi_inst.frame_sync[0];
+    wire cs_seen = spi_inst.cs_sync[0];
+
+    always @(posedge clk) clk_n++;
+    always @(frame_seen) frame_seen_at = clk_n;
+    always @(posedge cs_seen) cs_seen_at = clk_n;
+
+    // A late synchroniser: frame_sync holds through the next clk edge, so the
+    // frame_toggle flip that has just happened is taken a cycle later
+    event frame_clocked;
+    bit late_sync = 0;
+
+    always @(frame_clocked) begin
+        if (late_sync) begin : late
+            logic [2:0] held;
+            held = spi_inst.frame_sync;
+            force spi_inst.frame_sync = held;
+            @(posedge clk);
+            #1 release spi_inst.frame_sync;
+        end
+    end
+
+    // --- Drums and targets ---
+    integer seed = 1;
+    bit stimulus_done = 0;
+
+    function automatic int unsigned rand_below(int unsigned n);
+        return $unsigned($random(seed)) % n;
+    endfunction
+
+    // Rising edges every few microseconds, so each lane is hit again as soon as
+    // its lockout ends
+    task automatic drums(input bit in_step, input int ns);
+        int t, step, l;
+        t = 0;
+        while (t < ns) begin
+            step = 1000 + rand_below(4000);
+            if (in_step) begin
+                drum_beat = {4{~drum_beat[0]}};
+            end else begin
+                l = rand_below(4);
+                drum_beat[l] = ~drum_beat[l];
+            end
+            #(step);
+            t += step;
+        end
+        drum_beat = '0;
+    endtask
+
+    // pattern_gen's windows, changed between clk edges
+    task automatic targets;
+        while (!stimulus_done) begin
+            repeat (24 + rand_below(72)) @(posedge clk);
+            @(negedge clk);
+            target_perfect = rand_below(16);
+            target_okay = rand_below(16);
+        end
+    endtask
+
+    // --- MCU ---
+    int frames = 0, cut = 0, notes_sent = 0;
+    int refills = 0;                     // Frames that left events queued
+    int cs_first = 0, same_cycle = 0, frame_first = 0;
+    int received = 0;
+    logic [15:0] last_score = '0;
+    bit more = 0;
+
+    // One SpiBusTransfer: the note in the first byte, zeros after, over bits SCK
+    // edges. By the last edge the frame's pending count is in, which picks how
+    // cs_n rises.
+    task automatic transfer(input logic [3:0] note, input int bits, output logic [95:0] rx);
+        logic [95:0] tx;
+        real delay;
+        bit refill;
+        tx = {4'b0, note, 88'd0};
+        rx = '0;
+        cs_n = 0;
+        for (int b = 0; b < bits; b++) begin
+            if (b != 0) begin
+                #(SCK_NS / 2);
+                sck = 0;
+            end
+            sdi = tx[95 - b];
+            #(SCK_NS / 2);
+            rx[95 - b] = sdo;
+            sck = 1;
+        end
+
+        refill = (bits == 96) && (rx[83:80] != 0);
+        if (refill) begin
+            delay = DELAY_STEP * (refills % N_DELAYS);
+            late_sync = (refills / N_DELAYS) % 2;
+            refills++;
+        end else begin
+            delay = DELAY_STEP * (frames % N_DELAYS);
+            late_sync = 0;
+        end
+        -> frame_clocked;
+
+        // cs_n may rise with the last falling SCK edge or after it
+        if (delay < SCK_NS / 2) begin
+            #(delay);
+        end else begin
+            #(SCK_NS / 2);
+            sck = 0;
+            #(delay - SCK_NS / 2);
+        end
+        sck = 0;
+        sdi = 0;
+        cs_n = 1;
+        if (note != 0 && bits >= 8) notes_sent++;
+
+        repeat (6) @(posedge clk); // Both synchronisers and the note pulse are through
+        if (refill) begin
+            if (cs_seen_at < frame_seen_at)       cs_first++;
+            else if (cs_seen_at == frame_seen_at) same_cycle++;
+            else                                  frame_first++;
+        end
+    endtask
+
+    // fpga_link_send and frame_done, with the events checked against the ones judged
+    task automatic send(input logic [3:0] note);
+        logic [95:0] rx;
+        logic [31:0] ev;
+        int count;
+        if (rand_below(CUT_ODDS) == 0) begin
+            // Cut short: these events must come again in the next frame
+            transfer(note, 8 + rand_below(88), rx);
+            cut++;
+        end else begin
+            transfer(note, 96, rx);
+            frames++;
+            if (rx[95:88] != 8'hA5) $fatal(1, "frame %0d: sync byte %h", frames, rx[95:88]);
+            if (rx[87]) $fatal(1, "frame %0d: overflow set", frames);
+            count = rx[86:84];
+            if (count > 2) $fatal(1, "frame %0d: %0d events", frames, count);
+            for (int i = 0; i < count; i++) begin
+                ev = (i == 0) ? rx[63:32] : rx[31:0];
+                if (expected.size() == 0) $fatal(1, "frame %0d: event %h was never judged", frames, ev);
+                if (ev != expected[0]) $fatal(1, "frame %0d: event %h, expected %h", frames, ev, expected[0]);
+                ev = expected.pop_front();
+                received++;
+            end
+            if ((count < 2 && rx[31:0] != 0) || (count < 1 && rx[63:32] != 0))
+                $fatal(1, "frame %0d: unused event not zero", frames);
+            if (rx[79:64] < last_score || rx[79:64] > expected_score)
+                $fatal(1, "frame %0d: score %0d after %0d, %0d judged", frames, rx[79:64], last_score, expected_score);
+            last_score = rx[79:64];
+            more = (rx[83:80] != 0);
+        end
+        if (beats_seen != notes_sent || (note != 0 && last_mask != note))
+            $fatal(1, "note %h: %0d lane_mask pulses for %0d notes, last %h", note, beats_seen, notes_sent, last_mask);
+    endtask
+
+    // fpga_task once per DAC half: fpga_link_service, then maybe a note from task_notes
+    task automatic mcu;
+        int idle_calls;
+        idle_calls = 0;
+        while (!stimulus_done) begin
+            #(HALF_NS);
+            if (!more) idle_calls++;
+            if (more || idle_calls >= POLL_EVERY) begin
+                send(4'd0);
+                idle_calls = 0;
+            end
+            if (rand_below(NOTE_ODDS) == 0) begin
+                send(1 + rand_below(15));
+                idle_calls = 0;
+            end
+        end
+    endtask
+
+    initial begin
+        int polls;
+        if ($test$plusargs("vcd")) begin
+            $dumpfile("blinky.vcd");
+            $dumpvars(0, tb_top);
+        end
+        cs_n = 1; // The MCU deselects the FPGA as its pin comes up: the SCK-domain counters start at 0
+        repeat (10) @(posedge clk);
+        @(negedge clk);
+        reset = 0;
+
+        fork
+            begin
+                drums(1, IN_STEP_NS);
+                drums(0, APART_NS);
+                repeat (8) @(posedge clk); // Holding registers drain
+                stimulus_done = 1;
+            end
+            targets;
+            mcu;
+        join
+
+        // Poll until everything judged has come in, then once more for the score
+        polls = 0;
+        while (expected.size() != 0 || more) begin
+            polls++;
+            if (polls > 64) $fatal(1, "%0d events judged but never sent", expected.size());
+            send(4'd0);
+        end
+        polls = frames;
+        while (frames == polls) send(4'd0);
+        if (last_score != expected_score[15:0]) $fatal(1, "score %0d, expected %0d", last_score, expected_score);
+
+        if (refills < 2 * N_DELAYS) $fatal(1, "%0d frames left events queued, the cs_n sweep needs %0d", refills, 2 * N_DELAYS);
+        if (cs_first == 0 || same_cycle == 0 || frame_first == 0)
+            $fatal(1, "cs_n not seen before (%0d), with (%0d) and after (%0d) the frame", cs_first, same_cycle, frame_first);
+
+        $display("%0d events judged and received in order, score %0d, no overflow", received, last_score);
+        $display("%0d frames (%0d cut short), %0d notes; %0d left events queued, cs_n seen before the frame %0d, with it %0d, after it %0d",
+                 frames, cut, notes_sent, refills, cs_first, same_cycle, frame_first);
+        $display("PASSED");
+        $finish;
+    end
+
+endmodule
@@ -13,6 +13,7 @@ module top #(
 	input logic reset_n,
 	input logic [3:0] drum_beat,
 	input logic sck, sdi, cs_n,
+	output wire sdo,
 	output logic [5:0] matrix_data,
 	output logic [4:0] matrix_row,
 	output logic matrix_clk, matrix_lat, matrix_oe
@@ -30,6 +31,13 @@ module top #(
 	logic [3:0] score_perfect, score_okay, score_miss;
 	logic [3:0] spi_beat_mask;
 	logic spi_new_data;
+	logic spi_sdo;
+
+	// Hit events and score for the MCU
+	logic hq_pop, hq_pop_valid, hq_overflow, hq_overflow_clear;
+	logic [31:0] hq_pop_data;
+	logic [4:0] hq_count;
+	logic [15:0] hq_score;
 	
 	// Internal high-speed oscillator
 	SB_HFOSC #(.CLKHF_DIV("0b01")) 
@@ -65,14 +73,50 @@ module top #(
 		.hit_miss(score_miss)
 	);
 
+	hit_queue #(
+		.CLK_FREQ(24000000),
+		.DEPTH_LOG2(4)
+	) hits (
+		.clk(int_osc),
+		.reset(reset),
+		.hit_perfect(score_perfect),
+		.hit_okay(score_okay),
+		.hit_miss(score_miss),
+		.pop(hq_pop),
+		.pop_valid(hq_pop_valid),
+		.pop_data(hq_pop_data),
+		.count(hq_count),
+		.overflow(hq_overflow),
+		.overflow_clear(hq_overflow_clear),
+		.score(hq_score)
+	);
+
 	beat_receiver spi_inst(
 		.clk(int_osc),
 		.reset(reset),
 		.sck(sck),
 		.sdi(sdi),
 		.cs_n(cs_n),
+		.sdo(spi_sdo),
 		.lane_mask(spi_beat_mask),
-		.new_beat(spi_new_data)
+		.new_beat(spi_new_data),
+		.ev_pop(hq_pop),
+		.ev_valid(hq_pop_valid),
+		.ev_data(hq_pop_data),
+		.ev_count(hq_count),
+		.ev_overflow(hq_overflow),
+		.ev_overflow_clear(hq_overflow_clear),
+		.score(hq_score)
+	);
+
+	// MISO is shared with the SD card: drive it only while selected
+	SB_IO #(
+		.PIN_TYPE(6'b1010_01),
+		.PULLUP(1'b0)
+	) sdo_io (
+		.PACKAGE_PIN(sdo),
+		.OUTPUT_ENABLE(~cs_n),
+		.D_OUT_0(spi_sdo)
 	);
 	
 	// top level HUB75 module from no2hub75
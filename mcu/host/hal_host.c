@@ -0,0 +1,480 @@
+// hal_host.c
+// Host versions of the peripheral drivers, run on simulated time.
+//
+// Time is counted in 80 MHz CPU cycles. Firmware code itself takes no time; what
+// does is SPI traffic (8 bit times at the clock set in SPI1->CR1) and waiting. A
+// polled byte stalls the CPU, a DMA transfer only holds the bus and completes as
+// an event, and the DAC consumes one sample per TIM6 period. Busy-waits call
+// hal_idle, which lets time run on to the next event. The SPI bytes a DMA
+// completion handler polls are charged to the bus, not to the interrupted code.
+
+#include "hal_host.h"
+#include "sd_emu.h"
+#include "STM32L432KC.h"
+#include "STM32L432KC_DAC.h"
+#include "STM32L432KC_HAL.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CPU_HZ           80000000u
+#define IDLE_STEP        1600     // Cycles one pass of a busy-wait loop advances (20 us)
+#define NEXT_BLOCK_BYTES 2        // Filler between the blocks of a CMD18 run
+#define NOISE_ONE_IN     2000     // Corrupted data bytes above the -sdmax clock
+#define FPGA_TRAVEL      (2ull * CPU_HZ) // Note sent to hit line, as NOTE_TRAVEL_SECONDS
+#define FPGA_NOTES       64       // Notes falling on the emulated display
+#define FPGA_HITS        16       // Hit events queued on the emulated FPGA
+#define FPGA_FRAME       12       // Status frame, as fpga/src/beat_receiver.sv
+#define NEVER            UINT64_MAX
+
+// Register storage for stm32l432xx.h
+GPIO_TypeDef host_gpioa, host_gpiob;
+RCC_TypeDef host_rcc;
+SPI_TypeDef host_spi1;
+DAC_TypeDef host_dac1;
+DMA_TypeDef host_dma1, host_dma2;
+DMA_Channel_TypeDef host_dma1_ch[7];
+TIM_TypeDef host_tim6;
+USART_TypeDef host_usart1, host_usart2;
+DWT_Type host_dwt;
+CoreDebug_Type host_coredebug;
+uint32_t SystemCoreClock = CPU_HZ;
+
+static HostConfig config;
+
+// --- Clock and events ---
+
+static uint64_t cpu_now = 0;     // Main-line code
+static uint64_t bus_free_at = 0; // SPI bus held by DMA (and its handler) until then
+static int      in_isr = 0;
+static uint64_t isr_now = 0;     // Time inside a DMA completion handler
+
+// SPI DMA
+static uint64_t dma_at = NEVER;  // Completion of the transfer in flight
+static void   (*dma_done)(int err) = 0;
+static volatile int dma_busy = 0;
+
+// DAC stream
+static uint16_t* dac_buf = 0;
+static uint16_t  dac_half = 0;     // Frames per half
+static uint8_t   dac_channels = 1; // Values per frame: 2 in stereo, left first
+static uint32_t  dac_pos = 0;      // Next frame the DMA takes
+static uint64_t  dac_period = 0;
+static uint64_t  next_tick = NEVER;
+static volatile uint8_t half_free[2];
+static uint8_t   fill_half = 0;
+static void    (*on_half)(void) = 0;
+
+// Internal flash
+static uint8_t   flash[FLASH_PAGES][FLASH_PAGE_BYTES];
+static uint32_t  flash_erases = 0;
+static uint32_t  underruns = 0;
+
+// Chip selects
+static int sd_selected = 0;
+static int fpga_selected = 0;
+
+// FPGA: a perfect player, who hits every note as it reaches the hit line
+static uint64_t fpga_note_due[FPGA_NOTES];
+static uint8_t  fpga_note_lane[FPGA_NOTES];
+static uint32_t fpga_note_head = 0, fpga_note_tail = 0;
+static uint32_t fpga_hits[FPGA_HITS];
+static uint32_t fpga_num_hits = 0;
+static uint16_t fpga_score = 0;
+static uint8_t  fpga_frame[FPGA_FRAME];
+static int      fpga_idx = 0;
+
+// Report
+static uint64_t dac_samples = 0;
+static uint32_t dac_rate = 0;
+static uint64_t sd_bytes = 0;
+static uint64_t fpga_bytes = 0;
+static uint64_t freed_at[2];      // When each DAC half last finished playing
+static uint64_t worst_stall = 0;  // Longest wait from a half freeing to the firmware taking it
+static int64_t  least_slack = INT64_MAX; // Shortest lead of a refill over its playback
+static FILE*    wav = 0;
+static FILE*    fpga_log = 0;
+
+static uint64_t byte_cycles(void) {
+    return 8ull << (_FLD2VAL(SPI_CR1_BR, SPI1->CR1) + 1);
+}
+
+static void dac_tick(void) {
+    const uint16_t* v = &dac_buf[dac_pos * dac_channels];
+    if (dac_channels == 2) DAC1->DHR12RD = v[0] | ((uint32_t)v[1] << 16);
+    else DAC1->DHR12R2 = v[0];
+    if (wav) {
+        for (int c = 0; c < dac_channels; c++) {
+            int16_t s = (int16_t)(((int32_t)(v[c] & 0xFFF) - 2048) << 4);
+            fwrite(&s, 2, 1, wav);
+        }
+    }
+    dac_samples++;
+
+    // Half and full transfer, as the DMA interrupt sees them
+    if (++dac_pos == dac_half || dac_pos == 2u * dac_half) {
+        int played = (dac_pos == dac_half) ? 0 : 1;
+        if (dac_pos == 2u * dac_half) dac_pos = 0;
+        half_free[played] = 1;
+        freed_at[played] = next_tick;
+        if (half_free[played ^ 1]) underruns++;
+        if (on_half) on_half();
+    }
+    next_tick += dac_period;
+}
+
+static void dma_complete(void) {
+    void (*done)(int err) = dma_done;
+    in_isr = 1;
+    isr_now = dma_at;
+    dma_at = NEVER;
+    dma_busy = 0;
+    if (done) done(0);
+    in_isr = 0;
+    if (isr_now > bus_free_at) bus_free_at = isr_now;
+}
+
+// Runs every event up to time t
+static void advance(uint64_t t) {
+    for (;;) {
+        uint64_t next = (dma_at < next_tick) ? dma_at : next_tick;
+        if (next > t) break;
+        DWT->CYCCNT = (uint32_t)next; // As an interrupt handler would read it
+        if (dma_at <= next_tick) dma_complete();
+        else dac_tick();
+    }
+    if (t > cpu_now) cpu_now = t;
+    DWT->CYCCNT = (uint32_t)cpu_now;
+}
+
+void hal_idle(void) {
+    uint64_t next = (dma_at < next_tick) ? dma_at : next_tick;
+    if (next == NEVER) {
+        // Nothing left that could wake the firmware: the run is over
+        host_finish();
+        exit(0);
+    }
+    uint64_t step = cpu_now + IDLE_STEP;
+    advance(next < step ? next : step);
+}
+
+// --- GPIO / RCC / FLASH ---
+
+void configureFlash() {}
+
+// --- Flash ---
+// Programming only clears bits, as on the chip; the time it takes is not simulated.
+
+const uint8_t* flashPage(int page) {
+    return flash[page];
+}
+
+int flashErasePage(int page) {
+    if (page < 0 || page >= FLASH_PAGES) return -1;
+    memset(flash[page], 0xFF, FLASH_PAGE_BYTES);
+    flash_erases++;
+    return 0;
+}
+
+int flashProgram(int page, uint32_t offset, const void* data, uint32_t len) {
+    if (page < 0 || page >= FLASH_PAGES || (offset | len) & 7 || offset + len > FLASH_PAGE_BYTES) return -1;
+    const uint8_t* src = (const uint8_t*)data;
+    for (uint32_t i = 0; i < len; i++) flash[page][offset + i] &= src[i];
+    return 0;
+}
+void configureClock() {}
+
+// --- FPGA ---
+
+static void put_be32(uint8_t* b, uint32_t v) {
+    b[0] = (uint8_t)(v >> 24);
+    b[1] = (uint8_t)(v >> 16);
+    b[2] = (uint8_t)(v >> 8);
+    b[3] = (uint8_t)v;
+}
+
+// Judges the notes that have reached the hit line and loads the next status frame
+static void fpga_begin_frame(void) {
+    uint64_t now = in_isr ? isr_now : cpu_now;
+    int overflow = 0;
+    while (fpga_note_tail != fpga_note_head && fpga_note_due[fpga_note_tail % FPGA_NOTES] <= now) {
+        uint32_t slot = fpga_note_tail++ % FPGA_NOTES;
+        if (fpga_num_hits == FPGA_HITS) {
+            overflow = 1;
+            continue;
+        }
+        uint32_t us = (uint32_t)(fpga_note_due[slot] / (CPU_HZ / 1000000u)) & 0x0FFFFFFF;
+        fpga_hits[fpga_num_hits++] = ((uint32_t)fpga_note_lane[slot] << 30) | (1u << 28) | us;
+        fpga_score += 3;
+    }
+
+    memset(fpga_frame, 0, sizeof(fpga_frame));
+    uint32_t n = fpga_num_hits < 2 ? fpga_num_hits : 2;
+    for (uint32_t i = 0; i < n; i++) put_be32(&fpga_frame[4 + 4 * i], fpga_hits[i]);
+    fpga_num_hits -= n;
+    memmove(fpga_hits, fpga_hits + n, fpga_num_hits * sizeof(fpga_hits[0]));
+    fpga_frame[0] = 0xA5;
+    fpga_frame[1] = (uint8_t)((overflow << 7) | (n << 4) | (fpga_num_hits < 15 ? fpga_num_hits : 15));
+    fpga_frame[2] = (uint8_t)(fpga_score >> 8);
+    fpga_frame[3] = (uint8_t)fpga_score;
+    fpga_idx = 0;
+}
+
+// First byte of a frame: the note, which starts falling now
+static void fpga_note(uint8_t lanes) {
+    uint64_t now = in_isr ? isr_now : cpu_now;
+    for (int lane = 0; lane < 4; lane++) {
+        if (!(lanes & (1u << lane)) || fpga_note_head - fpga_note_tail == FPGA_NOTES) continue;
+        fpga_note_due[fpga_note_head % FPGA_NOTES] = now + FPGA_TRAVEL;
+        fpga_note_lane[fpga_note_head % FPGA_NOTES] = (uint8_t)lane;
+        fpga_note_head++;
+    }
+}
+void pinMode(int gpio_pin, int function) { (void)gpio_pin; (void)function; }
+
+void hal_chip_select(int device, int active) {
+    if (device == HAL_DEV_SD) {
+        sd_selected = active;
+        // Card latency in bytes at the current SPI clock
+        uint64_t first = (uint64_t)config.sd_latency_us * (CPU_HZ / 1000000u) / byte_cycles();
+        sd_emu_set_latency((uint32_t)first, NEXT_BLOCK_BYTES);
+        uint32_t khz = (uint32_t)(CPU_HZ / 1000u * 8u / byte_cycles());
+        sd_emu_set_noise((config.sd_max_khz && khz > config.sd_max_khz) ? NOISE_ONE_IN : 0);
+        sd_emu_select(active);
+    } else {
+        fpga_selected = active;
+        if (active) fpga_begin_frame();
+    }
+}
+
+// --- SPI ---
+
+void initSPI(int br, int cpol, int cpha) {
+    (void)cpol;
+    (void)cpha;
+    SPI1->CR1 = _VAL2FLD(SPI_CR1_BR, br) | SPI_CR1_SPE;
+}
+
+static uint8_t bus_xfer(uint8_t mosi) {
+    uint8_t miso = 0xFF;
+    if (sd_selected) {
+        miso = sd_emu_xfer(mosi);
+        sd_bytes++;
+    }
+    if (fpga_selected) {
+        if (fpga_idx == 0 && (mosi & 0x0F)) {
+            if (fpga_log) fprintf(fpga_log, "%llu,%u\n", (unsigned long long)dac_samples, (unsigned)mosi);
+            fpga_note(mosi);
+        }
+        miso = (fpga_idx < FPGA_FRAME) ? fpga_frame[fpga_idx] : 0;
+        fpga_idx++;
+        fpga_bytes++;
+    }
+    return miso;
+}
+
+char spiSendReceive(char send) {
+    uint64_t bc = byte_cycles();
+    if (in_isr) {
+        isr_now += bc;
+    } else {
+        // Wait for any DMA transfer to release the bus, then clock the byte
+        while (dma_at != NEVER) advance(dma_at);
+        if (bus_free_at > cpu_now) advance(bus_free_at);
+        advance(cpu_now + bc);
+        bus_free_at = cpu_now;
+    }
+    return (char)bus_xfer((uint8_t)send);
+}
+
+void initSPIDMA(void) {}
+
+void spiDMAReceive(uint8_t* rx, uint16_t len, void (*done)(int err)) {
+    uint64_t start = in_isr ? isr_now : (bus_free_at > cpu_now ? bus_free_at : cpu_now);
+    // The data is taken from the card now but only counts as arrived at dma_at
+    for (uint16_t i = 0; i < len; i++) rx[i] = bus_xfer(0xFF);
+    dma_done = done;
+    dma_busy = 1;
+    dma_at = start + len * byte_cycles();
+    bus_free_at = dma_at;
+}
+
+int spiDMABusy(void) {
+    return dma_busy;
+}
+
+// --- DAC ---
+
+void Audio_DAC_Init(int stereo) {
+    (void)stereo;
+}
+
+void Audio_Stream_Start(uint16_t* buf, uint16_t samples, uint32_t sampleRate, int stereo) {
+    if (sampleRate == 0) sampleRate = 16000;
+    dac_buf = buf;
+    dac_half = samples / 2;
+    dac_channels = stereo ? 2 : 1;
+    dac_pos = 0;
+    half_free[0] = half_free[1] = 0;
+    fill_half = 0;
+    underruns = 0;
+    dac_rate = sampleRate;
+    dac_period = SystemCoreClock / sampleRate; // TIM6 period, ARR + 1
+    next_tick = cpu_now + dac_period;
+}
+
+void Audio_Stream_Stop(void) {
+    next_tick = NEVER;
+    if (dac_channels == 2) DAC1->DHR12RD = DAC_MIDSCALE | ((uint32_t)DAC_MIDSCALE << 16);
+    else DAC1->DHR12R2 = DAC_MIDSCALE;
+}
+
+uint16_t* Audio_Stream_FreeHalf(void) {
+    if (!half_free[fill_half]) return 0;
+    if (next_tick != NEVER && cpu_now - freed_at[fill_half] > worst_stall) {
+        worst_stall = cpu_now - freed_at[fill_half];
+    }
+    return dac_buf + (fill_half * dac_half * dac_channels);
+}
+
+void Audio_Stream_Commit(void) {
+    // Time left before the DMA reaches the half just filled; negative if it already has
+    if (next_tick != NEVER) {
+        uint32_t start = fill_half * dac_half;
+        uint32_t into = (dac_pos + 2u * dac_half - start) % (2u * dac_half);
+        int64_t slack;
+        if (into < dac_half) slack = -(int64_t)(into * dac_period);
+        else slack = (int64_t)((2u * dac_half - into) * dac_period + (next_tick - cpu_now)) - (int64_t)dac_period;
+        if (slack < least_slack) least_slack = slack;
+    }
+    half_free[fill_half] = 0;
+    fill_half ^= 1;
+}
+
+void Audio_Stream_OnHalf(void (*fn)(void)) {
+    on_half = fn;
+}
+
+uint32_t Audio_Stream_Underruns(void) {
+    return underruns;
+}
+
+// --- Console ---
+// printf already reaches stdout, and no commands are typed
+
+USART_TypeDef* initUSARTDMA(int USART_ID, int baud_rate) {
+    (void)baud_rate;
+    return USART_ID == USART2_ID ? USART2 : 0;
+}
+
+int usartWrite(const char* data, int len) {
+    return (int)fwrite(data, 1, (size_t)len, stdout);
+}
+
+uint32_t usartDropped(void) {
+    return 0;
+}
+
+int usartReadLine(char* line, int size) {
+    static int typed = 0;
+    if (!config.console || typed) return -1;
+    typed = 1;
+    snprintf(line, (size_t)size, "%s", config.console);
+    return (int)strlen(line);
+}
+
+uint32_t usartOverruns(void) {
+    return 0;
+}
+
+// --- Run control and report ---
+
+static void write_wav_header(FILE* f, uint32_t rate, uint16_t channels, uint32_t frames) {
+    uint8_t h[44];
+    uint32_t data = frames * 2 * channels;
+    memcpy(h, "RIFF", 4);
+    uint32_t v[] = { 36 + data, 16, rate, rate * 2 * channels, data };
+    memcpy(h + 4, &v[0], 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    memcpy(h + 16, &v[1], 4);
+    uint16_t fmt[] = { 1, channels };
+    memcpy(h + 20, fmt, 4);
+    memcpy(h + 24, &v[2], 4);
+    memcpy(h + 28, &v[3], 4);
+    uint16_t align[] = { (uint16_t)(2 * channels), 16 };
+    memcpy(h + 32, align, 4);
+    memcpy(h + 36, "data", 4);
+    memcpy(h + 40, &v[4], 4);
+    fseek(f, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), f);
+}
+
+void host_start(const HostConfig* cfg) {
+    config = *cfg;
+    SPI1->CR1 = _VAL2FLD(SPI_CR1_BR, 7);
+    memset(flash, 0xFF, sizeof(flash));
+    if (config.flash_file) {
+        FILE* f = fopen(config.flash_file, "rb");
+        if (f) {
+            if (fread(flash, 1, sizeof(flash), f) != sizeof(flash)) memset(flash, 0xFF, sizeof(flash));
+            fclose(f);
+        }
+    }
+    if (config.dac_wav) {
+        wav = fopen(config.dac_wav, "wb");
+        if (wav) write_wav_header(wav, 16000, 1, 0);
+    }
+    if (config.fpga_log) fpga_log = fopen(config.fpga_log, "w");
+}
+
+uint64_t host_cycles(void) {
+    return cpu_now;
+}
+
+uint64_t host_sd_bytes(void) {
+    return sd_bytes;
+}
+
+void host_finish(void) {
+    if (wav) {
+        write_wav_header(wav, dac_rate ? dac_rate : 16000, dac_channels, (uint32_t)dac_samples);
+        fclose(wav);
+        wav = 0;
+    }
+    if (fpga_log) {
+        fclose(fpga_log);
+        fpga_log = 0;
+    }
+    if (config.flash_file) {
+        FILE* f = fopen(config.flash_file, "wb");
+        if (f) {
+            fwrite(flash, 1, sizeof(flash), f);
+            fclose(f);
+        }
+    }
+
+    const SdEmuStats* s = sd_emu_stats();
+    double audio_s = dac_rate ? (double)dac_samples / dac_rate : 0.0;
+    uint32_t other = 0;
+    for (int i = 0; i < 64; i++) {
+        if (i != 12 && i != 17 && i != 18 && i != 24) other += s->commands[i];
+    }
+    printf("\n--- Host run ---\n");
+    printf("Simulated time:  %.3f s\n", (double)cpu_now / CPU_HZ);
+    printf("Audio played:    %.3f s (%llu samples at %lu Hz)\n", audio_s,
+           (unsigned long long)dac_samples, (unsigned long)dac_rate);
+    printf("SPI bytes:       SD %llu, FPGA %llu", (unsigned long long)sd_bytes, (unsigned long long)fpga_bytes);
+    if (audio_s > 0) printf(" (%.0f per audio second)", (double)(sd_bytes + fpga_bytes) / audio_s);
+    printf("\n");
+    printf("SD commands:     CMD17 %lu, CMD18 %lu, CMD12 %lu, CMD24 %lu, other %lu\n",
+           (unsigned long)s->commands[17], (unsigned long)s->commands[18], (unsigned long)s->commands[12],
+           (unsigned long)s->commands[24], (unsigned long)other);
+    printf("SD blocks:       %llu read, %llu sent corrupted\n", (unsigned long long)s->blocks_read,
+           (unsigned long long)s->blocks_corrupted);
+    printf("Flash erases:    %lu\n", (unsigned long)flash_erases);
+    printf("Underruns:       %lu\n", (unsigned long)underruns);
+    printf("Worst stall:     %.3f ms from a DAC half freeing to its refill\n", worst_stall * 1000.0 / CPU_HZ);
+    if (least_slack != INT64_MAX) {
+        printf("Least slack:     %.3f ms between a refill and its playback\n", least_slack * 1000.0 / CPU_HZ);
+    }
+}
@@ -0,0 +1,27 @@
+// hal_host.h
+// Simulation controls and results of the host backend
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include <stdint.h>
+
+typedef struct {
+    const char* dac_wav;       // DAC capture, 16-bit WAV, stereo in stereo builds (0: none)
+    const char* fpga_log;      // FPGA packets as "sample,byte" lines (0: none)
+    uint32_t    sd_latency_us; // Card access time before the first block of a read
+    uint32_t    sd_max_khz;    // Fastest clock the wiring carries cleanly; above it data bits flip (0: no limit)
+    const char* flash_file;    // Internal flash contents, loaded at start and saved at finish (0: erased, not kept)
+    const char* console;       // Line typed on the console once playback starts (0: none)
+} HostConfig;
+
+void host_start(const HostConfig* cfg);
+
+// Writes the output files and prints the benchmark report
+void host_finish(void);
+
+// Simulated time in CPU cycles, and SPI bytes clocked to the SD card, so far
+uint64_t host_cycles(void);
+uint64_t host_sd_bytes(void);
+
+#endif
@@ -0,0 +1,50 @@
+// host_main.c
+// Runs the firmware on the host against an SD card image: the DAC output is
+// captured to a WAV file, notes sent to the FPGA are logged with the sample they
+// went out at, and a report of SPI traffic, SD commands and DAC stalls is printed.
+//
+// Build (Linux, from mcu/host; char is unsigned on the target, as the SD driver assumes):
+//     gcc -O2 -funsigned-char -DHOST_BUILD -Dmain=firmware_main -I. -I../lib -I../src
+//         -o ddrum_host host_main.c hal_host.c sd_emu.c ../src/*.c ../lib/STM32L432KC_SD.c
+//         ../lib/STM32L432KC_CRC.c ../lib/STM32L432KC_SPIBUS.c -lm
+// Usage:
+//     ./ddrum_host [-o dac.wav] [-fpga notes.csv] [-latency us] [-sdmax kHz] [-flash flash.bin] [-console line] sd.img
+
+#undef main // The firmware's main is built as firmware_main
+
+#include "hal_host.h"
+#include "sd_emu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int firmware_main(void);
+
+int main(int argc, char** argv) {
+    HostConfig cfg = { "dac.wav", 0, 250, 0, 0, 0 };
+    const char* image = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) cfg.dac_wav = argv[++i];
+        else if (strcmp(argv[i], "-fpga") == 0 && i + 1 < argc) cfg.fpga_log = argv[++i];
+        else if (strcmp(argv[i], "-latency") == 0 && i + 1 < argc) cfg.sd_latency_us = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "-sdmax") == 0 && i + 1 < argc) cfg.sd_max_khz = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "-flash") == 0 && i + 1 < argc) cfg.flash_file = argv[++i];
+        else if (strcmp(argv[i], "-console") == 0 && i + 1 < argc) cfg.console = argv[++i];
+        else image = argv[i];
+    }
+    if (!image) {
+        fprintf(stderr, "usage: ddrum_host [-o dac.wav] [-fpga notes.csv] [-latency us] [-sdmax kHz] [-flash flash.bin] [-console line] sd.img\n");
+        return 2;
+    }
+    if (sd_emu_open(image) != 0) {
+        fprintf(stderr, "ddrum_host: cannot open %s\n", image);
+        return 1;
+    }
+
+    host_start(&cfg);
+    int res = firmware_main(); // Only returns if start-up failed
+    printf("Firmware returned %d.\n", res);
+    host_finish();
+    sd_emu_close();
+    return 1;
+}
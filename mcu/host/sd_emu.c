@@ -0,0 +1,246 @@
+// sd_emu.c
+// SPI-mode SD card emulator over a disk image
+
+#include "sd_emu.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE 512
+#define OUT_LEN    8192 // Response queue; a block and its filler always fit
+#define MAX_GAP    (OUT_LEN - BLOCK_SIZE - 16)
+#define WRITE_BUSY 64   // Busy bytes after a block write
+
+enum { MODE_IDLE, MODE_MULTI, MODE_WRITE_TOKEN, MODE_WRITE_DATA };
+
+static FILE*    img = 0;
+static uint32_t img_blocks = 0;
+static int      selected = 0;
+static int      initialized = 0;  // ACMD41 has completed
+static int      app_cmd = 0;      // Last command was CMD55
+static uint8_t  cmd[6];
+static int      cmd_len = 0;
+static int      mode = MODE_IDLE;
+static uint32_t multi_block = 0;
+static uint32_t write_block = 0;
+static uint8_t  write_buf[BLOCK_SIZE + 2]; // Data and CRC
+static int      write_len = 0;
+static uint32_t gap_first = 8;
+static uint32_t gap_next = 2;
+static uint32_t noise = 0;
+static uint32_t noise_seed = 12345;
+static SdEmuStats stats;
+
+// MISO bytes queued for the master
+static uint8_t  out[OUT_LEN];
+static uint32_t out_head = 0;
+static uint32_t out_count = 0;
+
+static void push(uint8_t b) {
+    if (out_count < OUT_LEN) out[(out_head + out_count++) % OUT_LEN] = b;
+}
+
+static void push_fill(uint32_t n, uint8_t b) {
+    while (n--) push(b);
+}
+
+static void clear_out(void) {
+    out_head = 0;
+    out_count = 0;
+}
+
+// R1 after one byte of Ncr
+static void respond(uint8_t r1) {
+    push(0xFF);
+    push(r1);
+}
+
+// CRC-16/XMODEM, bit by bit, as the card computes it
+static uint16_t crc16(const uint8_t* p, int n) {
+    uint16_t crc = 0;
+    while (n--) {
+        crc ^= (uint16_t)(*p++ << 8);
+        for (int i = 0; i < 8; i++) crc = (uint16_t)((crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1);
+    }
+    return crc;
+}
+
+// Filler, data token, the block, CRC. Blocks past the end of the image read as zeros.
+static void push_block(uint32_t block, uint32_t gap) {
+    uint8_t data[BLOCK_SIZE];
+    memset(data, 0, sizeof(data));
+    if (block < img_blocks) {
+        fseek(img, (long)block * BLOCK_SIZE, SEEK_SET);
+        if (fread(data, 1, BLOCK_SIZE, img) != BLOCK_SIZE) memset(data, 0, sizeof(data));
+    }
+    uint16_t crc = crc16(data, BLOCK_SIZE);
+    int corrupted = 0;
+    for (int i = 0; noise && i < BLOCK_SIZE; i++) {
+        noise_seed = noise_seed * 1103515245u + 12345u;
+        if ((noise_seed >> 8) % noise == 0) {
+            data[i] ^= (uint8_t)(1 << ((noise_seed >> 4) & 7));
+            corrupted = 1;
+        }
+    }
+    push_fill(gap < MAX_GAP ? gap : MAX_GAP, 0xFF);
+    push(0xFE);
+    for (int i = 0; i < BLOCK_SIZE; i++) push(data[i]);
+    push((uint8_t)(crc >> 8));
+    push((uint8_t)crc);
+    stats.blocks_read++;
+    stats.blocks_corrupted += (uint64_t)corrupted;
+}
+
+static void command(void) {
+    uint8_t index = cmd[0] & 0x3F;
+    uint32_t arg = ((uint32_t)cmd[1] << 24) | ((uint32_t)cmd[2] << 16) | ((uint32_t)cmd[3] << 8) | cmd[4];
+    uint8_t idle = initialized ? 0x00 : 0x01;
+    stats.commands[index]++;
+
+    if (app_cmd) {
+        app_cmd = 0;
+        if (index == 41) {
+            respond(idle); // Ready from the second ACMD41 on
+            initialized = 1;
+            return;
+        }
+    }
+
+    switch (index) {
+    case 0:
+        clear_out();
+        mode = MODE_IDLE;
+        initialized = 0;
+        respond(0x01);
+        break;
+    case 8: // Echo the check pattern: 2.7-3.6 V accepted
+        respond(idle);
+        push(0x00);
+        push(0x00);
+        push((uint8_t)(arg >> 8) & 0x0F);
+        push((uint8_t)arg);
+        break;
+    case 55:
+        app_cmd = 1;
+        respond(idle);
+        break;
+    case 58: // OCR with CCS set: block addressing
+        respond(idle);
+        push(0xC0);
+        push(0xFF);
+        push(0x80);
+        push(0x00);
+        break;
+    case 12: // Cuts a CMD18 run short: stuff byte, R1, busy
+        clear_out();
+        mode = MODE_IDLE;
+        push(0xFF);
+        push(0x00);
+        push_fill(4, 0x00);
+        break;
+    case 17:
+        if (arg >= img_blocks) {
+            respond(0x40); // Parameter error
+            break;
+        }
+        respond(0x00);
+        push_block(arg, gap_first);
+        break;
+    case 18:
+        if (arg >= img_blocks) {
+            respond(0x40);
+            break;
+        }
+        respond(0x00);
+        mode = MODE_MULTI;
+        multi_block = arg;
+        push_block(multi_block++, gap_first);
+        break;
+    case 24:
+        if (arg >= img_blocks) {
+            respond(0x40);
+            break;
+        }
+        respond(0x00);
+        mode = MODE_WRITE_TOKEN;
+        write_block = arg;
+        break;
+    default:
+        respond(0x04 | idle); // Illegal command
+        break;
+    }
+}
+
+int sd_emu_open(const char* path) {
+    img = fopen(path, "r+b");
+    if (!img) return -1;
+    fseek(img, 0, SEEK_END);
+    img_blocks = (uint32_t)(ftell(img) / BLOCK_SIZE);
+    memset(&stats, 0, sizeof(stats));
+    return 0;
+}
+
+void sd_emu_close(void) {
+    if (img) fclose(img);
+    img = 0;
+}
+
+void sd_emu_select(int active) {
+    selected = active;
+    if (!active) cmd_len = 0;
+}
+
+void sd_emu_set_latency(uint32_t first_bytes, uint32_t next_bytes) {
+    gap_first = first_bytes;
+    gap_next = next_bytes;
+}
+
+void sd_emu_set_noise(uint32_t one_in) {
+    noise = one_in;
+}
+
+uint8_t sd_emu_xfer(uint8_t mosi) {
+    if (!selected) return 0xFF;
+
+    // The card answers from the next byte on, so output is taken before input is handled
+    if (out_count == 0 && mode == MODE_MULTI) push_block(multi_block++, gap_next);
+    uint8_t miso = 0xFF;
+    if (out_count > 0) {
+        miso = out[out_head];
+        out_head = (out_head + 1) % OUT_LEN;
+        out_count--;
+    }
+
+    if (mode == MODE_WRITE_TOKEN) {
+        if (mosi == 0xFE) {
+            mode = MODE_WRITE_DATA;
+            write_len = 0;
+        }
+        return miso;
+    }
+    if (mode == MODE_WRITE_DATA) {
+        write_buf[write_len++] = mosi;
+        if (write_len == BLOCK_SIZE + 2) {
+            fseek(img, (long)write_block * BLOCK_SIZE, SEEK_SET);
+            fwrite(write_buf, 1, BLOCK_SIZE, img);
+            fflush(img);
+            stats.blocks_written++;
+            mode = MODE_IDLE;
+            push(0xE5);            // Data response "accepted" (xxx0 0101)
+            push_fill(WRITE_BUSY, 0x00);
+        }
+        return miso;
+    }
+
+    if (cmd_len > 0 || (mosi & 0xC0) == 0x40) {
+        cmd[cmd_len++] = mosi;
+        if (cmd_len == 6) {
+            cmd_len = 0;
+            command();
+        }
+    }
+    return miso;
+}
+
+const SdEmuStats* sd_emu_stats(void) {
+    return &stats;
+}
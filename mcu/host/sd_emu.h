@@ -0,0 +1,38 @@
+// sd_emu.h
+// SD card in SPI mode, emulated over a raw disk image (e.g. a FAT32 .img file).
+// Speaks what the firmware's driver uses: CMD0/8/55/ACMD41/58 for start-up,
+// CMD17/18/12 for reads and CMD24 for writes, with block addressing (SDHC).
+
+#ifndef SD_EMU_H
+#define SD_EMU_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t commands[64];   // Count per command index (ACMD41 counts under 41)
+    uint64_t blocks_read;
+    uint64_t blocks_written;
+    uint64_t blocks_corrupted; // Sent with a flipped bit (see sd_emu_set_noise)
+} SdEmuStats;
+
+// Opens the image for reading and writing. Returns 0, or -1 if it cannot be opened.
+int sd_emu_open(const char* path);
+void sd_emu_close(void);
+
+// Chip select; deselecting drops any half-sent command
+void sd_emu_select(int active);
+
+// Filler bytes the card sends before the data token: for the first block of a
+// read, and between the blocks of a CMD18 run
+void sd_emu_set_latency(uint32_t first_bytes, uint32_t next_bytes);
+
+// Flips one bit in about one of every one_in data bytes sent, as marginal wiring
+// would at too high a clock; the CRC still matches the original data. 0 turns it off.
+void sd_emu_set_noise(uint32_t one_in);
+
+// One SPI byte: takes MOSI, returns MISO
+uint8_t sd_emu_xfer(uint8_t mosi);
+
+const SdEmuStats* sd_emu_stats(void);
+
+#endif
@@ -0,0 +1,103 @@
+// sdbench.c
+// Reads one file from an SD card image through the firmware's driver, first a
+// sector per CMD17 as the player used to, then in CMD18 runs of increasing length,
+// and reports the SPI bytes, commands and simulated time each way takes. Bytes
+// beyond the 512 of each block are command overhead: the command and response,
+// filler before each data token, the CRC, and CMD12 with its busy wait.
+//
+// Build (Linux, from mcu/host):
+//     gcc -O2 -funsigned-char -DHOST_BUILD -I. -I../lib -I../src -o sdbench sdbench.c hal_host.c
+//         sd_emu.c ../lib/STM32L432KC_SD.c ../lib/STM32L432KC_CRC.c ../lib/STM32L432KC_SPIBUS.c -lm
+// Usage:
+//     ./sdbench [-latency us] sd.img [NAME.EXT]
+
+#include "hal_host.h"
+#include "sd_emu.h"
+#include "STM32L432KC_SD.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CPU_HZ   80000000.0
+#define MAX_RUN  16
+
+static const uint32_t runs[] = { 1, 4, MAX_RUN }; // 4 is STREAM_RUN_SECTORS in main.c
+
+static uint32_t sd_commands(void) {
+    const SdEmuStats* s = sd_emu_stats();
+    uint32_t n = 0;
+    for (int i = 0; i < 64; i++) n += s->commands[i];
+    return n;
+}
+
+static int read_file(uint32_t start_cluster, uint32_t size, uint32_t run) {
+    static uint8_t buf[MAX_RUN * SECTOR_SIZE];
+    AudioFile f;
+    if (FAT32_OpenFile(start_cluster, size, &f) != 0) return -1;
+
+    const SdEmuStats* s = sd_emu_stats();
+    uint64_t bytes0 = host_sd_bytes(), cycles0 = host_cycles();
+    uint32_t cmds0 = sd_commands();
+    uint32_t cmd17 = s->commands[17], cmd18 = s->commands[18], cmd12 = s->commands[12];
+    uint64_t blocks = 0;
+    int count;
+    while ((count = FAT32_ReadRun(&f, buf, run)) > 0) blocks += (uint32_t)count;
+    if (count == -2) return -2;
+
+    uint64_t bytes = host_sd_bytes() - bytes0;
+    double secs = (host_cycles() - cycles0) / CPU_HZ;
+    printf("%2lu per read: %llu blocks, %lu commands (CMD17 %lu, CMD18 %lu, CMD12 %lu), "
+           "%llu SPI bytes, %.1f overhead bytes per block, %.3f s, %.0f KB/s\n",
+           (unsigned long)run, (unsigned long long)blocks, (unsigned long)(sd_commands() - cmds0),
+           (unsigned long)(s->commands[17] - cmd17), (unsigned long)(s->commands[18] - cmd18),
+           (unsigned long)(s->commands[12] - cmd12), (unsigned long long)bytes,
+           blocks ? (double)(bytes - blocks * SECTOR_SIZE) / blocks : 0.0, secs,
+           secs > 0 ? blocks * SECTOR_SIZE / 1024.0 / secs : 0.0);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    HostConfig cfg = { 0, 0, 250, 0, 0, 0 };
+    const char* image = 0;
+    const char* file = "MV.WAV";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-latency") == 0 && i + 1 < argc) cfg.sd_latency_us = (uint32_t)atoi(argv[++i]);
+        else if (!image) image = argv[i];
+        else file = argv[i];
+    }
+    char name[16] = { 0 };
+    const char* dot = strrchr(file, '.');
+    if (!image || !dot || dot - file >= (long)sizeof(name)) {
+        fprintf(stderr, "usage: sdbench [-latency us] sd.img [NAME.EXT]\n");
+        return 2;
+    }
+    memcpy(name, file, dot - file);
+    if (sd_emu_open(image) != 0) {
+        fprintf(stderr, "sdbench: cannot open %s\n", image);
+        return 1;
+    }
+
+    host_start(&cfg);
+    AudioFile f;
+    if (SD_Init() != 0 || FAT32_Init() != 0) {
+        fprintf(stderr, "sdbench: card or file system did not start\n");
+        return 1;
+    }
+    SD_EnableDMA(1);
+    if (FAT32_FindFile(name, dot + 1, &f) != 0) {
+        fprintf(stderr, "sdbench: %s not found on %s\n", file, image);
+        return 1;
+    }
+    printf("%s: %lu bytes, bus clock %lu kHz, card latency %lu us\n", file, (unsigned long)f.size,
+           (unsigned long)(SD_BusClock() / 1000), (unsigned long)cfg.sd_latency_us);
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        if (read_file(f.startCluster, f.size, runs[i]) != 0) {
+            printf("%2lu per read: card error\n", (unsigned long)runs[i]);
+            failed = 1;
+        }
+    }
+    sd_emu_close();
+    return failed;
+}
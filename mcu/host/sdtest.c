@@ -0,0 +1,283 @@
+// sdtest.c
+// Drives the SD driver's DMA read path against a scripted card: a good run, a block
+// that fails its CRC and is read again, one that keeps failing, a DMA error and a
+// data token that never comes in the middle of a CMD18 run. Each read must end with
+// the right status, SD_Busy() clear, the card deselected, the SPI bus free with
+// queued messages sent, done() called once, and no SPI byte clocked from inside the
+// DMA interrupt. Build again with -DSD_CRC_RETRIES=0 to check a driver that never
+// re-reads.
+//
+// Build (Linux, from mcu/host):
+//     gcc -O2 -funsigned-char -DHOST_BUILD -I. -I../lib -I../src -o sdtest sdtest.c
+//         ../lib/STM32L432KC_SD.c ../lib/STM32L432KC_CRC.c ../lib/STM32L432KC_SPIBUS.c
+// Usage:
+//     ./sdtest
+
+#include "STM32L432KC_SD.h"
+#include "STM32L432KC_SPIBUS.h"
+#include "STM32L432KC_HAL.h"
+#include "STM32L432KC_CRC.h"
+#include <stdio.h>
+#include <string.h>
+
+#define RUN      4     // Blocks per multi-block read, as STREAM_RUN_SECTORS
+#define FIRST    100   // Sector the reads start at
+#define NONE     0xFFFFFFFFu
+#define QUEUE    2048  // Card output waiting to be clocked out
+
+SPI_TypeDef host_spi1;
+DWT_Type host_dwt;
+uint32_t SystemCoreClock = 80000000u;
+
+// --- Scripted card ---
+
+typedef struct {
+    uint32_t bad_sector;    // Sent with a flipped bit...
+    int      bad_times;     // ...this many times
+    uint32_t silent_sector; // Never gets a data token
+    int      dma_fail_at;   // DMA transfer (1-based) that ends in error, 0 for none
+} Script;
+
+static Script   script;
+static uint8_t  q[QUEUE];
+static int      q_head, q_len;
+static uint8_t  cmd[6];
+static int      cmd_len;
+static int      multi;          // Streaming a CMD18 run
+static uint32_t next_sector;
+static int      stalled;        // Run reached the silent sector
+static uint32_t cmd_count[64];
+static uint32_t cmd_arg[64];    // Argument of the last of each command
+
+static int      sd_cs, fpga_cs;
+static uint32_t fpga_bytes;
+static int      in_isr;
+static uint32_t isr_bytes;      // Clocked while the DMA interrupt ran
+
+// DMA: the data is taken at once, the interrupt fires on the next hal_idle
+static void   (*dma_done)(int err);
+static int      dma_err;
+static int      dma_count;
+
+static void push(uint8_t b) {
+    if (q_len < QUEUE) q[(q_head + q_len++) % QUEUE] = b;
+}
+
+static uint8_t pattern(uint32_t sector, int i) {
+    return (uint8_t)(sector * 31 + i * 7 + (i >> 8));
+}
+
+static void push_block(uint32_t sector) {
+    if (sector == script.silent_sector) {
+        stalled = 1;
+        return;
+    }
+    uint8_t data[SECTOR_SIZE];
+    for (int i = 0; i < SECTOR_SIZE; i++) data[i] = pattern(sector, i);
+    uint16_t crc = crc16(data, SECTOR_SIZE);
+    if (sector == script.bad_sector && script.bad_times > 0) {
+        script.bad_times--;
+        data[17] ^= 0x10;
+    }
+    push(0xFF);
+    push(0xFE);
+    for (int i = 0; i < SECTOR_SIZE; i++) push(data[i]);
+    push((uint8_t)(crc >> 8));
+    push((uint8_t)crc);
+}
+
+static void card_command(void) {
+    uint8_t index = cmd[0] & 0x3F;
+    uint32_t arg = ((uint32_t)cmd[1] << 24) | ((uint32_t)cmd[2] << 16) | ((uint32_t)cmd[3] << 8) | cmd[4];
+    cmd_count[index]++;
+    cmd_arg[index] = arg;
+    if (index == 12) {
+        q_len = 0;
+        multi = stalled = 0;
+        push(0xFF); // Stuff byte
+        push(0x00);
+        for (int i = 0; i < 4; i++) push(0x00); // Busy
+        return;
+    }
+    push(0xFF);
+    push(0x00);
+    if (index == 17) push_block(arg);
+    if (index == 18) {
+        multi = 1;
+        stalled = 0;
+        next_sector = arg + 1;
+        push_block(arg);
+    }
+}
+
+static uint8_t card_xfer(uint8_t mosi) {
+    if (q_len == 0 && multi && !stalled) push_block(next_sector++);
+    uint8_t miso = 0xFF;
+    if (q_len > 0) {
+        miso = q[q_head];
+        q_head = (q_head + 1) % QUEUE;
+        q_len--;
+    }
+    if (cmd_len > 0 || (mosi & 0xC0) == 0x40) {
+        cmd[cmd_len++] = mosi;
+        if (cmd_len == 6) {
+            cmd_len = 0;
+            card_command();
+        }
+    }
+    return miso;
+}
+
+// --- HAL for the driver ---
+
+void hal_chip_select(int device, int active) {
+    if (device == HAL_DEV_SD) {
+        sd_cs = active;
+        if (!active) cmd_len = 0;
+    } else {
+        fpga_cs = active;
+    }
+}
+
+void hal_idle(void) {
+    void (*done)(int err) = dma_done;
+    if (!done) return;
+    dma_done = 0;
+    in_isr = 1;
+    done(dma_err);
+    in_isr = 0;
+}
+
+void pinMode(int gpio_pin, int function) { (void)gpio_pin; (void)function; }
+
+char spiSendReceive(char send) {
+    if (in_isr) isr_bytes++;
+    if (fpga_cs) {
+        fpga_bytes++;
+        return 0;
+    }
+    return sd_cs ? (char)card_xfer((uint8_t)send) : (char)0xFF;
+}
+
+void initSPIDMA(void) {}
+
+void spiDMAReceive(uint8_t* rx, uint16_t len, void (*done)(int err)) {
+    if (in_isr) isr_bytes += len;
+    for (uint16_t i = 0; i < len; i++) rx[i] = card_xfer(0xFF);
+    dma_err = (++dma_count == script.dma_fail_at);
+    dma_done = done;
+}
+
+// --- Cases ---
+
+static int done_calls, done_status;
+
+static void read_done(int status) {
+    done_calls++;
+    done_status = status;
+}
+
+static int failures = 0;
+
+static void check(const char* name, int ok, const char* what) {
+    if (!ok) {
+        printf("%s: FAILED: %s\n", name, what);
+        failures++;
+    }
+}
+
+// Reads count sectors from FIRST with the script in place, the way the player does:
+// start the read, then poll from the main loop until it is over
+static void run(const char* name, const Script* s, uint32_t count, int want_status,
+                uint32_t want_cmd17, uint32_t want_cmd18) {
+    static uint8_t buf[RUN * SECTOR_SIZE];
+    script = *s;
+    q_len = cmd_len = multi = stalled = 0;
+    memset(cmd_count, 0, sizeof(cmd_count));
+    dma_count = 0;
+    isr_bytes = 0;
+    fpga_bytes = 0;
+    done_calls = 0;
+    done_status = 1;
+    memset(buf, 0, sizeof(buf));
+    uint32_t crc_errors = SD_CRCErrors();
+    int failed_before = failures;
+
+    int res = SD_ReadSectorsAsync(FIRST, buf, count, read_done);
+    check(name, res == 0, "read did not start");
+    check(name, SD_Busy(), "SD_Busy() clear while the read is running");
+
+    // A note queued while the card holds the bus
+    static const uint8_t note[2] = { 0x01, 0x00 };
+    spiBusSend(HAL_DEV_FPGA, 0, note, sizeof(note));
+    check(name, spiBusQueueDepth() == 1, "message not queued behind the read");
+
+    int polls = 0;
+    while (SD_Poll() && polls++ < 100) hal_idle();
+
+    check(name, done_calls == 1, "done() not called exactly once");
+    check(name, done_status == want_status, "wrong status");
+    check(name, !SD_Busy(), "SD_Busy() still set");
+    check(name, !sd_cs, "card still selected");
+    check(name, spiBusOwner() == SPIBUS_FREE, "bus not released");
+    check(name, spiBusQueueDepth() == 0 && fpga_bytes == sizeof(note), "queued message not sent");
+    check(name, isr_bytes == 0, "SPI bytes clocked inside the DMA interrupt");
+    check(name, cmd_count[17] == want_cmd17 && cmd_count[18] == want_cmd18, "unexpected read commands");
+    check(name, cmd_count[18] == 0 || cmd_count[12] == cmd_count[18], "CMD18 run not stopped");
+    if (want_status == 0) {
+        int same = 1;
+        for (uint32_t b = 0; b < count; b++) {
+            for (int i = 0; i < SECTOR_SIZE; i++) same &= (buf[b * SECTOR_SIZE + i] == pattern(FIRST + b, i));
+        }
+        check(name, same, "data differs");
+    }
+    if (s->bad_times > 0) check(name, SD_CRCErrors() > crc_errors, "CRC error not counted");
+
+    printf("%s: %s (status %d, CMD17 %lu, CMD18 %lu, CMD12 %lu)\n", name,
+           failures == failed_before ? "ok" : "FAILED", done_status, (unsigned long)cmd_count[17],
+           (unsigned long)cmd_count[18], (unsigned long)cmd_count[12]);
+}
+
+int main(void) {
+    crc16_init(); // As SD_Init does
+    SD_EnableDMA(1);
+    spiBusSetSpeed(HAL_DEV_SD, SD_BR_SAFE);
+    const Script clean = { NONE, 0, NONE, 0 };
+    Script s;
+
+    run("single block", &clean, 1, 0, 1, 0);
+    run("multi-block run", &clean, RUN, 0, 0, 1);
+
+    // One bad block: re-read from it, or give up at once with no retries
+    s = clean;
+    s.bad_sector = FIRST + 2;
+    s.bad_times = 1;
+    if (SD_CRC_RETRIES > 0) {
+        run("CRC error, re-read", &s, RUN, 0, 0, 2);
+        check("CRC error, re-read", cmd_arg[18] == FIRST + 2, "re-read did not start at the bad block");
+    } else {
+        run("CRC error, no retries", &s, RUN, -4, 0, 1);
+    }
+
+    // A block that stays bad through every re-read
+    s = clean;
+    s.bad_sector = FIRST + 3;
+    s.bad_times = 1000;
+    run("CRC error, retries used up", &s, RUN, -4, (uint32_t)SD_CRC_RETRIES, 1);
+
+    s = clean;
+    s.bad_sector = FIRST;
+    s.bad_times = 1000;
+    run("CRC error, single block", &s, 1, -4, 1u + SD_CRC_RETRIES, 0);
+
+    s = clean;
+    s.dma_fail_at = 2;
+    run("DMA error", &s, RUN, -3, 0, 1);
+
+    s = clean;
+    s.silent_sector = FIRST + 2;
+    run("token timeout mid-run", &s, RUN, -2, 0, 1);
+
+    printf("%s\n", failures ? "FAILED" : "All SD DMA cases passed.");
+    return failures != 0;
+}
@@ -0,0 +1,100 @@
+// stm32l432xx.h (host)
+// Stand-in for the CMSIS device header in the host build. Peripheral registers
+// are plain structs in RAM, so firmware that writes them directly compiles and
+// runs; the few registers the simulation reads (SPI1->CR1 baud rate) are
+// interpreted by hal_host.c. Only the fields and bits the firmware uses are here.
+
+#ifndef HOST_STM32L432XX_H
+#define HOST_STM32L432XX_H
+
+#include <stdint.h>
+
+#define __IO volatile
+
+typedef struct {
+    __IO uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR, AFR[2], BRR;
+} GPIO_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR, ICSCR, CFGR, PLLCFGR, AHB1ENR, AHB2ENR, APB1ENR1, APB2ENR;
+} RCC_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1, CR2, SR, DR;
+} SPI_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR, SWTRIGR, DHR12R1, DHR12L1, DHR8R1, DHR12R2, DHR12L2, DHR8R2,
+                  DHR12RD, DHR12LD, DHR8RD, DOR1, DOR2, SR, MCR;
+} DAC_TypeDef;
+
+typedef struct {
+    __IO uint32_t CCR, CNDTR, CPAR, CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct {
+    __IO uint32_t ISR, IFCR;
+} DMA_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CNT, PSC, ARR;
+} TIM_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1, CR2, CR3, BRR, RQR, ISR, ICR, RDR, TDR;
+} USART_TypeDef;
+
+typedef struct {
+    __IO uint32_t CTRL, CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern GPIO_TypeDef host_gpioa, host_gpiob;
+extern RCC_TypeDef host_rcc;
+extern SPI_TypeDef host_spi1;
+extern DAC_TypeDef host_dac1;
+extern DMA_TypeDef host_dma1, host_dma2;
+extern DMA_Channel_TypeDef host_dma1_ch[7];
+extern TIM_TypeDef host_tim6;
+extern USART_TypeDef host_usart1, host_usart2;
+extern DWT_Type host_dwt;
+extern CoreDebug_Type host_coredebug;
+extern uint32_t SystemCoreClock;
+
+#define GPIOA     (&host_gpioa)
+#define GPIOB     (&host_gpiob)
+#define RCC       (&host_rcc)
+#define SPI1      (&host_spi1)
+#define DAC1      (&host_dac1)
+#define DMA1      (&host_dma1)
+#define DMA2      (&host_dma2)
+#define TIM6      (&host_tim6)
+#define USART1    (&host_usart1)
+#define USART2    (&host_usart2)
+#define DWT       (&host_dwt)
+#define CoreDebug (&host_coredebug)
+
+// Interrupts are simulated inside hal_idle and SPI waits, never between two
+// statements, so masking them has nothing to do
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline void __disable_irq(void) {}
+
+#define _VAL2FLD(field, value) (((uint32_t)(value) << field##_Pos) & field##_Msk)
+#define _FLD2VAL(field, value) (((uint32_t)(value) & field##_Msk) >> field##_Pos)
+
+#define RCC_AHB2ENR_GPIOAEN (1U << 0)
+#define RCC_AHB2ENR_GPIOBEN (1U << 1)
+
+#define SPI_CR1_BR_Pos 3U
+#define SPI_CR1_BR_Msk (7U << SPI_CR1_BR_Pos)
+#define SPI_CR1_BR     SPI_CR1_BR_Msk
+#define SPI_CR1_SPE    (1U << 6)
+
+#define DWT_CTRL_CYCCNTENA_Msk      (1U << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk  (1U << 24)
+
+#endif
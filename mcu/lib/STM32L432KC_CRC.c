@@ -0,0 +1,32 @@
+// STM32L432KC_CRC.c
+// Slice-by-4 CRC-16/XMODEM
+
+#include "STM32L432KC_CRC.h"
+
+// table[k][x]: CRC of byte x followed by k zero bytes
+static uint16_t table[4][256];
+
+void crc16_init(void) {
+    for (int x = 0; x < 256; x++) {
+        uint16_t crc = (uint16_t)(x << 8);
+        for (int bit = 0; bit < 8; bit++) crc = (uint16_t)((crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1);
+        table[0][x] = crc;
+    }
+    for (int k = 1; k < 4; k++) {
+        for (int x = 0; x < 256; x++) {
+            uint16_t prev = table[k - 1][x];
+            table[k][x] = (uint16_t)((prev << 8) ^ table[0][prev >> 8]);
+        }
+    }
+}
+
+uint16_t crc16_update(uint16_t crc, const uint8_t* data, uint32_t len) {
+    // Four bytes at a time: the CRC folds into the first two, and each byte's
+    // contribution is looked up already shifted past the bytes that follow it
+    for (; len >= 4; len -= 4, data += 4) {
+        uint32_t t = crc ^ ((uint32_t)data[0] << 8 | data[1]);
+        crc = table[3][t >> 8] ^ table[2][t & 0xFF] ^ table[1][data[2]] ^ table[0][data[3]];
+    }
+    for (; len > 0; len--, data++) crc = (uint16_t)((crc << 8) ^ table[0][(crc >> 8) ^ *data]);
+    return crc;
+}
@@ -2,47 +2,160 @@
 #include "STM32L432KC_DAC.h"
 #include "STM32L432KC_RCC.h"
 #include "STM32L432KC_GPIO.h"
+#include "STM32L432KC_DMA.h"
 
-void Audio_DAC_Init(void) {
+// Ping-pong stream state
+static uint16_t *stream_buf = 0;
+static uint16_t stream_half = 0;        // Values per half: frames times channels
+static uint8_t stream_stereo = 0;
+static volatile uint8_t half_free[2];   // Set by the DMA ISR once a half has played
+static uint8_t fill_half = 0;           // Next half the main loop refills
+static volatile uint32_t underruns = 0;
+static void (*on_half)(void) = 0;       // Told about each half the ISR frees
+
+void Audio_DAC_Init(int stereo) {
     // 1. Enable DAC Clock
     RCC->APB1ENR1 |= RCC_APB1ENR1_DAC1EN;
 
-    // 2. Configure GPIO PA5 as Analog (DAC1_OUT2)
+    // 2. Configure GPIO PA5 as Analog (DAC1_OUT2), and PA4 (DAC1_OUT1) for stereo
     RCC->AHB2ENR |= RCC_AHB2ENR_GPIOAEN;
     pinMode(PA5, GPIO_ANALOG);
+    if (stereo) pinMode(PA4, GPIO_ANALOG);
 
     // 3. Configure DAC Mode: Normal Mode with Output Buffer
-    // Bits 18:16 for Channel 2 in DAC_MCR
+    // Bits 18:16 for Channel 2 in DAC_MCR, 2:0 for Channel 1
     // 000: Connected to external pin with Buffer enabled (Default, but let's be explicit)
     DAC1->MCR &= ~(DAC_MCR_MODE2); 
+    if (stereo) DAC1->MCR &= ~(DAC_MCR_MODE1);
 
-    // 4. Enable DAC Channel 2
+    // 4. Enable DAC Channel 2 (and 1)
     DAC1->CR |= DAC_CR_EN2; 
+    if (stereo) DAC1->CR |= DAC_CR_EN1;
     
     // Wait for stabilization (tWAKEUP ~15us)
     volatile int i;
     for(i=0; i<1000; i++); 
 }
 
-void Audio_Timer_Init(uint32_t sampleRate) {
-    // 1. Enable TIM6 Clock
+void Audio_Stream_Start(uint16_t *buf, uint16_t samples, uint32_t sampleRate, int stereo) {
+    if (sampleRate == 0) sampleRate = 16000;
+    stream_buf = buf;
+    stream_stereo = stereo ? 1 : 0;
+    stream_half = (samples / 2) << stream_stereo;
+    half_free[0] = 0;
+    half_free[1] = 0;
+    fill_half = 0;
+    underruns = 0;
+
+    if (!stream_stereo) {
+        // 1. DMA1 Channel 4 (DAC_CH2 request): memory -> DHR12R2, circular,
+        //    halfword reads zero-extended to word writes, interrupts at half and full
+        initDMA(DMA1);
+        dmaSetRequest(DMA1, 4, DMA1_CH4_DAC_CH2);
+        DMA1_Channel4->CCR = 0;
+        dmaClearFlags(DMA1, 4);
+        DMA1_Channel4->CPAR  = (uint32_t) &DAC1->DHR12R2;
+        DMA1_Channel4->CMAR  = (uint32_t) buf;
+        DMA1_Channel4->CNDTR = samples;
+        DMA1_Channel4->CCR   = DMA_CCR_DIR | DMA_CCR_CIRC | DMA_CCR_MINC
+                             | _VAL2FLD(DMA_CCR_MSIZE, 0b01) | _VAL2FLD(DMA_CCR_PSIZE, 0b10)
+                             | DMA_CCR_HTIE | DMA_CCR_TCIE | _VAL2FLD(DMA_CCR_PL, 0b11);
+        NVIC_SetPriority(DMA1_Channel4_IRQn, 0);
+        NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+        DMA1_Channel4->CCR |= DMA_CCR_EN;
+
+        // 2. DAC Channel 2: convert on TIM6 TRGO (TSEL2 = 000), request the next sample by DMA
+        DAC1->CR &= ~DAC_CR_EN2;
+        DAC1->CR = (DAC1->CR & ~DAC_CR_TSEL2) | DAC_CR_TEN2 | DAC_CR_DMAEN2;
+        DAC1->CR |= DAC_CR_EN2;
+    } else {
+        // 1. DMA2 Channel 4 (DAC_CH1 request; DMA1 Channel 3 is SPI1 TX): memory -> DHR12RD,
+        //    circular, one word per frame, interrupts at half and full
+        initDMA(DMA2);
+        dmaSetRequest(DMA2, 4, DMA2_CH4_DAC_CH1);
+        DMA2_Channel4->CCR = 0;
+        dmaClearFlags(DMA2, 4);
+        DMA2_Channel4->CPAR  = (uint32_t) &DAC1->DHR12RD;
+        DMA2_Channel4->CMAR  = (uint32_t) buf;
+        DMA2_Channel4->CNDTR = samples;
+        DMA2_Channel4->CCR   = DMA_CCR_DIR | DMA_CCR_CIRC | DMA_CCR_MINC
+                             | _VAL2FLD(DMA_CCR_MSIZE, 0b10) | _VAL2FLD(DMA_CCR_PSIZE, 0b10)
+                             | DMA_CCR_HTIE | DMA_CCR_TCIE | _VAL2FLD(DMA_CCR_PL, 0b11);
+        NVIC_SetPriority(DMA2_Channel4_IRQn, 0);
+        NVIC_EnableIRQ(DMA2_Channel4_IRQn);
+        DMA2_Channel4->CCR |= DMA_CCR_EN;
+
+        // 2. Both channels convert on TIM6 TRGO (TSEL = 000). Only Channel 1 requests DMA:
+        //    the dual register loads both holding registers from one write.
+        DAC1->CR &= ~(DAC_CR_EN1 | DAC_CR_EN2);
+        DAC1->CR = (DAC1->CR & ~(DAC_CR_TSEL1 | DAC_CR_TSEL2 | DAC_CR_DMAEN2))
+                 | DAC_CR_TEN1 | DAC_CR_TEN2 | DAC_CR_DMAEN1;
+        DAC1->CR |= DAC_CR_EN1 | DAC_CR_EN2;
+    }
+
+    // 3. TIM6: update event on TRGO at the sample rate, no CPU interrupt
     RCC->APB1ENR1 |= RCC_APB1ENR1_TIM6EN;
+    TIM6->CR1  = 0;
+    TIM6->DIER = 0;
+    TIM6->PSC  = 0;
+    TIM6->ARR  = (SystemCoreClock / sampleRate) - 1;
+    TIM6->CR2  = (TIM6->CR2 & ~TIM_CR2_MMS) | _VAL2FLD(TIM_CR2_MMS, 0b010);
+    TIM6->EGR  = TIM_EGR_UG;
+    TIM6->SR   = 0;
+    TIM6->CR1 |= TIM_CR1_CEN;
+}
 
-    // 2. Configure Period
-    // F_timer = 80 MHz
-    // ARR = (80,000,000 / sampleRate) - 1
-    uint32_t arrValue = (SystemCoreClock / sampleRate) - 1;
+void Audio_Stream_Stop(void) {
+    TIM6->CR1 &= ~TIM_CR1_CEN;
+    if (!stream_stereo) {
+        DMA1_Channel4->CCR &= ~DMA_CCR_EN;
+        NVIC_DisableIRQ(DMA1_Channel4_IRQn);
+        DAC1->CR &= ~(DAC_CR_DMAEN2 | DAC_CR_TEN2);
+        DAC1->DHR12R2 = DAC_MIDSCALE;
+    } else {
+        DMA2_Channel4->CCR &= ~DMA_CCR_EN;
+        NVIC_DisableIRQ(DMA2_Channel4_IRQn);
+        DAC1->CR &= ~(DAC_CR_DMAEN1 | DAC_CR_TEN1 | DAC_CR_TEN2);
+        DAC1->DHR12RD = DAC_MIDSCALE | (DAC_MIDSCALE << 16);
+    }
+}
 
-    TIM6->PSC = 0;
-    TIM6->ARR = arrValue;
+uint16_t *Audio_Stream_FreeHalf(void) {
+    return half_free[fill_half] ? stream_buf + (fill_half * stream_half) : 0;
+}
 
-    // 3. Enable Update Interrupt
-    TIM6->DIER |= TIM_DIER_UIE;
+void Audio_Stream_Commit(void) {
+    half_free[fill_half] = 0;
+    fill_half ^= 1;
+}
 
-    // 4. Enable Interrupt in NVIC
-    NVIC_EnableIRQ(TIM6_DAC_IRQn);
-    NVIC_SetPriority(TIM6_DAC_IRQn, 0); // High priority
+void Audio_Stream_OnHalf(void (*fn)(void)) {
+    on_half = fn;
+}
 
-    // 5. Enable Timer
-    TIM6->CR1 |= TIM_CR1_CEN;
-}
\ No newline at end of file
+uint32_t Audio_Stream_Underruns(void) {
+    return underruns;
+}
+
+// HT: first half played, DMA moves on to the second. TC: the reverse.
+static void stream_irq(DMA_TypeDef *DMAx, int channel) {
+    uint32_t flags = dmaGetFlags(DMAx, channel);
+    dmaClearFlags(DMAx, channel);
+
+    int played;
+    if (flags & DMA_FLAG_HT)      played = 0;
+    else if (flags & DMA_FLAG_TC) played = 1;
+    else return;
+
+    half_free[played] = 1;
+    if (half_free[played ^ 1]) underruns++; // Now playing a half nobody refilled
+    if (on_half) on_half();
+}
+
+void DMA1_Channel4_IRQHandler(void) {
+    stream_irq(DMA1, 4);
+}
+
+void DMA2_Channel4_IRQHandler(void) {
+    stream_irq(DMA2, 4);
+}
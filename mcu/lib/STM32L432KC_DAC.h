@@ -4,20 +4,37 @@
 #ifndef STM32L4_DAC_H
 #define STM32L4_DAC_H
 
+#include <stdint.h>
 #include "stm32l432xx.h"
 
-// Initialize DAC1 on Channel 2 (PA5)
-void Audio_DAC_Init(void);
+// Initialize DAC1 on Channel 2 (PA5), and with stereo set on Channel 1 (PA4) as well
+void Audio_DAC_Init(int stereo);
 
-// Start Timer 6 interrupts at a specific frequency (Hz)
-void Audio_Timer_Init(uint32_t sampleRate);
+#define DAC_MIDSCALE 0x800 // 12-bit silence
 
-// Write a 12-bit value to the DAC
-// Inlined for speed in ISR
-static inline void DAC_Write(uint16_t value) {
-    // Write to 12-bit right-aligned data holding register for Channel 2
-    // Channel 2 corresponds to pin PA5
-    DAC1->DHR12R2 = value;
-}
+// Ping-pong playback: TIM6 TRGO triggers the DAC, and circular DMA feeds it from buf
+// (samples frames of 12-bit right-aligned values, split in two halves). The main loop
+// refills whichever half the DMA has just finished with, so SD reads never delay an
+// individual sample.
+//
+// Mono drives Channel 2 from DMA1 Channel 4. Stereo frames are left (Channel 1) then
+// right (Channel 2), so each one is a word in the layout of DHR12RD: DMA2 Channel 4
+// writes that register once per trigger and both channels convert together. Either
+// way the CPU never touches a single sample.
+void Audio_Stream_Start(uint16_t *buf, uint16_t samples, uint32_t sampleRate, int stereo);
+void Audio_Stream_Stop(void);
+
+// Returns the half that is due for a refill (samples / 2 frames), or 0 while both
+// are still queued.
+// Call Audio_Stream_Commit once it has been filled.
+uint16_t *Audio_Stream_FreeHalf(void);
+void Audio_Stream_Commit(void);
+
+// Sets a function the DMA interrupt calls each time a half has played and is due
+// for a refill (0: none). It runs at the DAC's interrupt priority.
+void Audio_Stream_OnHalf(void (*fn)(void));
+
+// Number of times the DMA started playing a half that had not been refilled
+uint32_t Audio_Stream_Underruns(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+// STM32L432KC_DMA.c
+// Source code for DMA functions
+
+#include "STM32L432KC_DMA.h"
+
+void initDMA(DMA_TypeDef * DMAx) {
+    if (DMAx == DMA1) RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
+    else              RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+}
+
+void dmaSetRequest(DMA_TypeDef * DMAx, int channel, int request) {
+    DMA_Request_TypeDef * CSELR = (DMAx == DMA1) ? DMA1_CSELR : DMA2_CSELR;
+    uint32_t shift = (uint32_t)(channel - 1) * 4U;
+    CSELR->CSELR = (CSELR->CSELR & ~(0xFU << shift)) | ((uint32_t)request << shift);
+}
+
+uint32_t dmaGetFlags(DMA_TypeDef * DMAx, int channel) {
+    return (DMAx->ISR >> ((channel - 1) * 4)) & 0xFU;
+}
+
+void dmaClearFlags(DMA_TypeDef * DMAx, int channel) {
+    DMAx->IFCR = (0xFU << ((channel - 1) * 4));
+}
@@ -0,0 +1,46 @@
+// STM32L432KC_DMA.h
+// Header for DMA functions
+
+#ifndef STM32L4_DMA_H
+#define STM32L4_DMA_H
+
+#include <stdint.h>
+#include <stm32l432xx.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+// Per-channel flag bits as they appear (shifted by 4*(ch-1)) in DMAx->ISR/IFCR
+#define DMA_FLAG_GI 0x1 // Global interrupt
+#define DMA_FLAG_TC 0x2 // Transfer complete
+#define DMA_FLAG_HT 0x4 // Half transfer
+#define DMA_FLAG_TE 0x8 // Transfer error
+
+// Request IDs for DMAx_CSELR (RM0394 Tables 41 and 42)
+#define DMA1_CH2_SPI1_RX 1
+#define DMA1_CH3_SPI1_TX 1
+#define DMA1_CH4_DAC_CH2 5
+#define DMA2_CH4_DAC_CH1 3
+
+///////////////////////////////////////////////////////////////////////////////
+// Function prototypes
+///////////////////////////////////////////////////////////////////////////////
+
+/* Turns on the clock for a DMA controller.
+ *    -- DMAx: DMA1 or DMA2 */
+void initDMA(DMA_TypeDef * DMAx);
+
+/* Routes a peripheral request to a DMA channel.
+ *    -- DMAx: DMA1 or DMA2
+ *    -- channel: 1-7
+ *    -- request: 4-bit request ID from the CSELR mapping table */
+void dmaSetRequest(DMA_TypeDef * DMAx, int channel, int request);
+
+/* Returns the DMA_FLAG_* bits currently set for a channel. */
+uint32_t dmaGetFlags(DMA_TypeDef * DMAx, int channel);
+
+/* Clears every flag of a channel. */
+void dmaClearFlags(DMA_TypeDef * DMAx, int channel);
+
+#endif
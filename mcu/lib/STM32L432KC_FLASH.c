@@ -2,8 +2,67 @@
 // Source code for FLASH functions
 
 #include "STM32L432KC_FLASH.h"
+#include <string.h>
+
+#define FLASH_KEY1 0x45670123U
+#define FLASH_KEY2 0xCDEF89ABU
+#define FLASH_SR_ERRORS (FLASH_SR_OPERR | FLASH_SR_PROGERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR \
+                       | FLASH_SR_SIZERR | FLASH_SR_PGSERR | FLASH_SR_MISERR | FLASH_SR_FASTERR)
 
 void configureFlash() {
   FLASH->ACR |= FLASH_ACR_LATENCY_4WS;
   FLASH->ACR |= FLASH_ACR_PRFTEN;
-}
\ No newline at end of file
+}
+
+const uint8_t * flashPage(int page) {
+    return (const uint8_t *) (FLASH_BASE + (uint32_t) page * FLASH_PAGE_BYTES);
+}
+
+// Unlocks the control register and clears flags left by an earlier operation (RM0394 3.3.5)
+static void flashBegin(void) {
+    while (FLASH->SR & FLASH_SR_BSY);
+    if (FLASH->CR & FLASH_CR_LOCK) {
+        FLASH->KEYR = FLASH_KEY1;
+        FLASH->KEYR = FLASH_KEY2;
+    }
+    FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+}
+
+static int flashEnd(void) {
+    while (FLASH->SR & FLASH_SR_BSY);
+    int res = (FLASH->SR & FLASH_SR_ERRORS) ? -1 : 0;
+    FLASH->CR &= ~(FLASH_CR_PER | FLASH_CR_PG);
+    FLASH->CR |= FLASH_CR_LOCK;
+
+    // Drop data cache lines that may still hold the old contents
+    FLASH->ACR &= ~FLASH_ACR_DCEN;
+    FLASH->ACR |= FLASH_ACR_DCRST;
+    FLASH->ACR &= ~FLASH_ACR_DCRST;
+    FLASH->ACR |= FLASH_ACR_DCEN;
+    return res;
+}
+
+int flashErasePage(int page) {
+    flashBegin();
+    FLASH->CR = (FLASH->CR & ~FLASH_CR_PNB) | FLASH_CR_PER | _VAL2FLD(FLASH_CR_PNB, page);
+    FLASH->CR |= FLASH_CR_STRT;
+    return flashEnd();
+}
+
+int flashProgram(int page, uint32_t offset, const void * data, uint32_t len) {
+    volatile uint32_t * dst = (volatile uint32_t *) (flashPage(page) + offset);
+    const uint8_t * src = (const uint8_t *) data;
+
+    flashBegin();
+    FLASH->CR |= FLASH_CR_PG;
+    for (uint32_t i = 0; i < len; i += 8) {
+        uint32_t w[2];
+        memcpy(w, src + i, 8); // data need not be aligned
+        dst[0] = w[0];
+        dst[1] = w[1]; // The second word starts the programming
+        dst += 2;
+        while (FLASH->SR & FLASH_SR_BSY);
+        if (FLASH->SR & FLASH_SR_ERRORS) break;
+    }
+    return flashEnd();
+}
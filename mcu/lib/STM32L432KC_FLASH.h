@@ -7,10 +7,30 @@
 #include <stdint.h>
 #include <stm32l432xx.h>
 
+///////////////////////////////////////////////////////////////////////////////
+// Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+#define FLASH_PAGE_BYTES 2048
+#define FLASH_PAGES      128 // 256 KB
+
 ///////////////////////////////////////////////////////////////////////////////
 // Function prototypes
 ///////////////////////////////////////////////////////////////////////////////
 
 void configureFlash();
 
-#endif
\ No newline at end of file
+/* Returns the address of a page, which reads like ordinary memory. */
+const uint8_t * flashPage(int page);
+
+/* Erases a page to all 0xFF. The CPU stalls on instruction fetches for the ~22 ms
+ * this takes, so never call it while audio is streaming.
+ *    -- return: 0, or -1 if the controller reported an error */
+int flashErasePage(int page);
+
+/* Programs an erased part of a page, 8 bytes (one double word) at a time.
+ *    -- offset, len: multiples of 8
+ *    -- return: 0, or -1 if the controller reported an error */
+int flashProgram(int page, uint32_t offset, const void * data, uint32_t len);
+
+#endif
@@ -0,0 +1,30 @@
+// STM32L432KC_HAL.h
+// Hooks where a host build (mcu/host) needs to see what the hardware would:
+// SPI chip selects and busy-wait loops. On the target they are a GPIO write
+// and nothing at all.
+
+#ifndef STM32L4_HAL_H
+#define STM32L4_HAL_H
+
+#include <stdint.h>
+#include <stm32l432xx.h>
+
+#define HAL_DEV_SD   0 // Chip select on PA11
+#define HAL_DEV_FPGA 1 // Chip select on PB0
+
+#ifdef HOST_BUILD
+void hal_chip_select(int device, int active);
+void hal_idle(void);
+#else
+// Drives an SPI chip select (active low)
+static inline void hal_chip_select(int device, int active) {
+    GPIO_TypeDef* port = (device == HAL_DEV_SD) ? GPIOA : GPIOB;
+    uint32_t pin = (device == HAL_DEV_SD) ? 11 : 0;
+    port->BSRR = 1U << (pin + (active ? 16 : 0));
+}
+
+// Called on every pass of a busy-wait; the host build advances simulated time here
+static inline void hal_idle(void) {}
+#endif
+
+#endif
@@ -0,0 +1,85 @@
+// STM32L432KC_PROF.c
+// DWT scope counters and their telemetry frames
+
+#include "STM32L432KC_PROF.h"
+
+#if PROF_ENABLE
+#include "STM32L432KC_USART.h"
+#include <string.h>
+
+#define FRAME_HEADER 8
+#define FRAME_SCOPE  (16 + 2 * PROF_BUCKETS)
+#define FRAME_SIZE   (FRAME_HEADER + PROF_NUM_SCOPES * FRAME_SCOPE + 1)
+
+static ProfScope scopes[PROF_NUM_SCOPES];
+static uint32_t period_start = 0;
+static uint8_t  frame[FRAME_SIZE];
+
+static void reset_scopes(void) {
+    memset(scopes, 0, sizeof(scopes));
+    for (int i = 0; i < PROF_NUM_SCOPES; i++) scopes[i].min = 0xFFFFFFFF;
+}
+
+void prof_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    reset_scopes();
+    period_start = DWT->CYCCNT;
+}
+
+void prof_record(int scope, uint32_t cycles) {
+    ProfScope* s = &scopes[scope];
+    s->count++;
+    s->total += cycles;
+    if (cycles < s->min) s->min = cycles;
+    if (cycles > s->max) s->max = cycles;
+
+    int k = 31 - __builtin_clz(cycles | 1) - PROF_BUCKET_SHIFT;
+    if (k < 0) k = 0;
+    if (k >= PROF_BUCKETS) k = PROF_BUCKETS - 1;
+    if (s->hist[k] != 0xFFFF) s->hist[k]++;
+}
+
+static uint8_t* put_u32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+    return p + 4;
+}
+
+// Copies the counters into a frame and clears them for the next period
+static void send_frame(uint32_t period) {
+    uint8_t* p = frame;
+    *p++ = 0xA5;
+    *p++ = 0x5A;
+    *p++ = PROF_VERSION;
+    *p++ = PROF_NUM_SCOPES;
+    p = put_u32(p, period);
+    for (int i = 0; i < PROF_NUM_SCOPES; i++) {
+        const ProfScope* s = &scopes[i];
+        p = put_u32(p, s->count);
+        p = put_u32(p, s->count ? s->min : 0);
+        p = put_u32(p, s->max);
+        p = put_u32(p, s->total);
+        for (int k = 0; k < PROF_BUCKETS; k++) {
+            *p++ = (uint8_t)s->hist[k];
+            *p++ = (uint8_t)(s->hist[k] >> 8);
+        }
+    }
+    uint8_t sum = 0;
+    for (uint8_t* q = frame + 2; q < p; q++) sum += *q;
+    *p = sum;
+
+    reset_scopes();
+    usartWrite((const char*)frame, FRAME_SIZE); // Dropped whole if the console is backed up
+}
+
+void prof_poll(void) {
+    uint32_t now = DWT->CYCCNT;
+    if (now - period_start >= PROF_PERIOD_CYCLES) {
+        send_frame(now - period_start);
+        period_start = now;
+    }
+}
+#endif
@@ -0,0 +1,73 @@
+// STM32L432KC_PROF.h
+// Hot-path profiler on the DWT cycle counter. Each named scope keeps a count, min,
+// max, total and log2 histogram of its durations in fixed RAM slots; once per
+// period the counters go out on the USART2 console (initUSARTDMA) as one binary
+// frame, mixed in with printf output (tools/profview.py picks them out), and start again.
+//
+// Build with PROF_ENABLE=1 to turn it on. Otherwise every macro expands to nothing
+// and STM32L432KC_PROF.c compiles to an empty unit.
+//
+// Frame, little-endian:
+//    0xA5 0x5A, version, scope count, period in cycles (u32)
+//    per scope: count, min, max, total cycles (u32 each), PROF_BUCKETS x u16 histogram
+//    checksum: low byte of the sum of every byte after the sync pair
+
+#ifndef STM32L4_PROF_H
+#define STM32L4_PROF_H
+
+#include <stdint.h>
+#include <stm32l432xx.h>
+
+#ifndef PROF_ENABLE
+#define PROF_ENABLE 0
+#endif
+
+#define PROF_VERSION        1
+#define PROF_BUCKETS        16       // Bucket k: 2^(k+5) to 2^(k+6) cycles, ends open
+#define PROF_BUCKET_SHIFT   5
+#define PROF_PERIOD_CYCLES  80000000 // One frame a second at 80 MHz
+
+// Scopes, in frame order
+enum {
+    PROF_SD_READ,   // Blocking SD_ReadSectors
+    PROF_FAT_NEXT,  // FAT32_NextCluster
+    PROF_BEAT,      // process_beat, target under 10000 cycles per block
+    PROF_FPGA_SEND, // Note handed to the SPI arbiter, sent there if the bus is free
+    PROF_DAC_FILL,  // Decoding one DAC half
+    PROF_MIX,       // Mixing one-shot sounds into a DAC half
+    PROF_OVERSAMPLE, // Interpolating and dithering a DAC half
+    PROF_SD_START,  // Starting an async SD run: command and wait for the first data token
+    PROF_SD_POLL,   // SD_Poll handling a block: CRC check, then the next block or the end of the run
+    PROF_NUM_SCOPES
+};
+
+#if PROF_ENABLE
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+    uint16_t hist[PROF_BUCKETS];
+} ProfScope;
+
+// Starts the cycle counter. Frames need the console from initUSARTDMA.
+void prof_init(void);
+
+// Adds one duration to a scope
+void prof_record(int scope, uint32_t cycles);
+
+// Call from the main loop: queues a frame on the console once the period is up
+void prof_poll(void);
+
+#define PROF_START(scope) uint32_t prof_t0_##scope = DWT->CYCCNT
+#define PROF_STOP(scope)  prof_record(scope, DWT->CYCCNT - prof_t0_##scope)
+#define PROF_INIT()       prof_init()
+#define PROF_POLL()       prof_poll()
+#else
+#define PROF_START(scope)
+#define PROF_STOP(scope)
+#define PROF_INIT()
+#define PROF_POLL()
+#endif
+
+#endif
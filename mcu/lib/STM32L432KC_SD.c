@@ -3,13 +3,20 @@
 
 #include "STM32L432KC_SD.h"
 #include "STM32L432KC_RCC.h"
+#include "STM32L432KC_HAL.h"
+#include "STM32L432KC_PROF.h"
+#include "STM32L432KC_CRC.h"
+#include "STM32L432KC_SPIBUS.h"
 #include <string.h>
 #include <stdio.h>
 
 // --- Commands ---
 #define CMD0    (0x40+0)    // GO_IDLE_STATE
 #define CMD8    (0x40+8)    // SEND_IF_COND
+#define CMD12   (0x40+12)   // STOP_TRANSMISSION
 #define CMD17   (0x40+17)   // READ_SINGLE_BLOCK
+#define CMD18   (0x40+18)   // READ_MULTIPLE_BLOCK
+#define CMD24   (0x40+24)   // WRITE_BLOCK
 #define CMD55   (0x40+55)   // APP_CMD
 #define ACMD41  (0x40+41)   // SD_SEND_OP_COND
 
@@ -21,9 +28,15 @@
 #define OFF_BPB_NUM_FATS       0x10
 #define OFF_BPB_FAT_SZ_32      0x24
 #define OFF_BPB_ROOT_CLUS      0x2C
+#define OFF_BPB_FS_INFO        0x30
+#define OFF_BS_VOL_ID          0x43
+#define OFF_FSI_FREE_COUNT     488
+#define OFF_FSI_NXT_FREE       492
 
-#define CS_ENABLE()  (GPIOA->BSRR = (1 << (SPI_CE + 16))) 
-#define CS_DISABLE() (GPIOA->BSRR = (1 << SPI_CE))        
+#define FAT32_EOC 0x0FFFFFF8 // Cluster numbers from here on end a chain
+
+#define CS_ENABLE()  hal_chip_select(HAL_DEV_SD, 1)
+#define CS_DISABLE() hal_chip_select(HAL_DEV_SD, 0)
 
 // Globals
 static uint32_t g_lba_begin = 0;
@@ -31,14 +44,61 @@ static uint32_t g_fat_start_lba = 0;
 static uint32_t g_data_start_lba = 0;
 static uint8_t  g_sec_per_clus = 0;
 static uint32_t g_root_cluster = 0;
+static uint32_t g_fsinfo_lba = 0;
+static uint32_t g_volume_id = 0;
+
+// DMA read state
+static int sd_use_dma = 0;
+static volatile int sd_busy = 0;
+static volatile int sd_status = 0;
+static void (*sd_done)(int status) = 0;
+static uint8_t* sd_dst = 0;             // Next block of the current run
+static volatile uint32_t sd_blocks_left = 0;
+static int sd_multi = 0;                // Current run uses CMD18
+static uint32_t sd_sector = 0;          // Card sector of the block at sd_dst
+static int sd_retries = 0;              // CRC retries left in the current run
+static volatile int sd_block_in = 0;    // DMA interrupt reported a block for SD_Poll
+static volatile int sd_dma_err = 0;     // And whether the transfer failed
+static void (*sd_notify)(void) = 0;     // Told from the interrupt that SD_Poll has work
+
+// Bus clock and data integrity
+static int sd_br = SD_BR_SAFE;
+static uint32_t sd_crc_errors = 0;
+
+// Metadata sector cache
+typedef struct {
+    uint32_t lba;
+    uint32_t used;  // Access stamp; the smallest is evicted first
+    uint8_t  valid;
+    uint8_t  data[SECTOR_SIZE];
+} CacheLine;
+
+static CacheLine cache[SD_CACHE_SECTORS];
+static uint32_t cache_clock = 0;
+static uint32_t cache_hits = 0;
+static uint32_t cache_misses = 0;
 
 // --- Low Level Helpers ---
 
-// Change SPI Speed (Divisor: 0=2, 1=4, ... 7=256)
+// Change SPI Speed (Divisor: 0=2, 1=4, ... 7=256). The arbiter switches it in
+// whenever the card has the bus.
 static void SD_SetSpeed(int br) {
-    SPI1->CR1 &= ~SPI_CR1_SPE; // Disable
-    SPI1->CR1 = (SPI1->CR1 & ~SPI_CR1_BR) | _VAL2FLD(SPI_CR1_BR, br);
-    SPI1->CR1 |= SPI_CR1_SPE;  // Enable
+    spiBusSetSpeed(HAL_DEV_SD, br);
+}
+
+// One step slower after a corrupted block
+static void SD_SlowDown(void) {
+    if (sd_br < 7) sd_br++;
+    SD_SetSpeed(sd_br);
+}
+
+// Reads the CRC that follows a block and checks the block against it
+static int SD_CheckCRC(const uint8_t* block) {
+    uint16_t crc = (uint16_t)((uint8_t)spiSendReceive(0xFF) << 8);
+    crc |= (uint8_t)spiSendReceive(0xFF);
+    if (crc == crc16(block, SECTOR_SIZE)) return 0;
+    sd_crc_errors++;
+    return -4;
 }
 
 static uint8_t SD_Command(uint8_t cmd, uint32_t arg, uint8_t crc) {
@@ -63,39 +123,333 @@ static uint8_t SD_Command(uint8_t cmd, uint32_t arg, uint8_t crc) {
     return res;
 }
 
-int SD_ReadSector(uint32_t sector, uint8_t* buff) {
+// Waits for the 0xFE start token that precedes every data block
+static int SD_WaitToken(void) {
+    int timeout = 20000;
+    while (spiSendReceive(0xFF) != 0xFE && timeout-- > 0);
+    return (timeout <= 0) ? -2 : 0;
+}
+
+// Ends a CMD18 run. The card is still streaming when CMD12 goes out, so this skips
+// SD_Command's ready wait, drops the stuff byte and waits out the R1b busy period.
+static void SD_StopTransmission(void) {
+    spiSendReceive(CMD12);
+    spiSendReceive(0);
+    spiSendReceive(0);
+    spiSendReceive(0);
+    spiSendReceive(0);
+    spiSendReceive(0xFF);
+    spiSendReceive(0xFF); // Stuff byte
+
+    for (int i = 0; i < 100; i++) {
+        if ((spiSendReceive(0xFF) & 0x80) == 0) break;
+    }
+    int timeout = 20000;
+    while (spiSendReceive(0xFF) != 0xFF && timeout-- > 0);
+}
+
+// Sends CMD17/CMD18 and waits for the first data token. Leaves CS asserted on success.
+static int SD_BeginRead(uint8_t cmd, uint32_t sector) {
     CS_ENABLE();
-    if (SD_Command(CMD17, sector, 0xFF) != 0x00) {
+    if (SD_Command(cmd, sector, 0xFF) != 0x00) {
         CS_DISABLE();
         return -1; 
     }
-
-    // Wait for data token (0xFE)
-    int timeout = 20000;
-    while (spiSendReceive(0xFF) != 0xFE && timeout-- > 0);
-    if (timeout <= 0) {
+    if (SD_WaitToken() != 0) {
+        if (cmd == CMD18) SD_StopTransmission();
         CS_DISABLE();
         return -2;
     }
+    return 0;
+}
 
-    // Read Data
-    for (int i = 0; i < 512; i++) buff[i] = spiSendReceive(0xFF);
-    
-    // Read CRC (discard)
-    spiSendReceive(0xFF); 
+// Polled read with up to retries re-reads, one clock step slower each, of a block
+// that fails its CRC. The re-read picks up from the failed block. The bus is held
+// for one run at a time.
+static int SD_ReadPolled(uint32_t sector, uint8_t* buff, uint32_t count, int retries) {
+    while (count > 0) {
+        int multi = (count > 1);
+        spiBusLock(HAL_DEV_SD);
+        int res = SD_BeginRead(multi ? CMD18 : CMD17, sector);
+        if (res != 0) {
+            spiBusRelease();
+            return res;
+        }
+
+        uint32_t blk = 0;
+        for (; blk < count; blk++) {
+            if (blk > 0 && SD_WaitToken() != 0) {
+                res = -2;
+                break;
+            }
+
+            // Read Data
+            for (int i = 0; i < 512; i++) buff[i] = spiSendReceive(0xFF);
+            if (SD_CheckCRC(buff) != 0) {
+                res = -4;
+                break;
+            }
+            buff += SECTOR_SIZE;
+        }
+
+        if (multi) SD_StopTransmission();
+        CS_DISABLE();
+        spiBusRelease();
+        if (res != -4 || retries-- == 0) return res;
+        SD_SlowDown();
+        sector += blk;
+        count -= blk;
+    }
+    return 0;
+}
+
+int SD_ReadSectorsPolled(uint32_t sector, uint8_t* buff, uint32_t count) {
+    return SD_ReadPolled(sector, buff, count, SD_CRC_RETRIES);
+}
+
+int SD_ReadSectorPolled(uint32_t sector, uint8_t* buff) {
+    return SD_ReadSectorsPolled(sector, buff, 1);
+}
+
+// DMA interrupt: a 512-byte block is in. Everything that waits on the card is left
+// to SD_Poll in the main loop, so the interrupt itself takes a few cycles.
+static void SD_DMAComplete(int err) {
+    sd_dma_err = err;
+    sd_block_in = 1;
+    if (sd_notify) sd_notify();
+}
+
+// Checks the block the DMA interrupt reported. The next block of a CMD18 run is
+// chained from here, after polling for its data token; a block that fails its CRC
+// is read again, one clock step slower. The last block ends the run: CMD12 and its
+// busy wait, then the card and bus are released, which sends queued messages.
+static int SD_PollBlock(void) {
+    sd_block_in = 0;
+    int res = sd_dma_err ? -3 : SD_CheckCRC(sd_dst);
+    int selected = 1;
+
+    if (res == -4 && sd_retries > 0) {
+        sd_retries--;
+        if (sd_multi) SD_StopTransmission();
+        CS_DISABLE();
+        SD_SlowDown();
+        sd_multi = (sd_blocks_left > 1);
+        res = SD_BeginRead(sd_multi ? CMD18 : CMD17, sd_sector);
+        if (res == 0) {
+            spiDMAReceive(sd_dst, SECTOR_SIZE, SD_DMAComplete);
+            return 1;
+        }
+        selected = 0; // SD_BeginRead let go of the card
+    } else if (res == 0 && --sd_blocks_left > 0) {
+        sd_dst += SECTOR_SIZE;
+        sd_sector++;
+        if (SD_WaitToken() == 0) {
+            spiDMAReceive(sd_dst, SECTOR_SIZE, SD_DMAComplete);
+            return 1;
+        }
+        res = -2;
+    }
+
+    if (selected) {
+        if (sd_multi) SD_StopTransmission();
+        CS_DISABLE();
+    }
+    spiBusRelease(); // Messages queued during the run go out now
+
+    sd_status = res;
+    sd_busy = 0;
+    if (sd_done) sd_done(sd_status);
+    return 0;
+}
+
+int SD_Poll(void) {
+    if (!sd_block_in) return sd_busy;
+    PROF_START(PROF_SD_POLL);
+    int busy = SD_PollBlock();
+    PROF_STOP(PROF_SD_POLL);
+    return busy;
+}
+
+void SD_OnBlock(void (*fn)(void)) {
+    sd_notify = fn;
+}
+
+int SD_ReadSectorsAsync(uint32_t sector, uint8_t* buff, uint32_t count, void (*done)(int status)) {
+    if (!sd_use_dma || count == 0) {
+        int res = SD_ReadSectorsPolled(sector, buff, count);
+        if (done) done(res);
+        return res;
+    }
+
+    while (SD_Poll()) hal_idle(); // One transfer at a time
+    PROF_START(PROF_SD_START);
+    spiBusLock(HAL_DEV_SD);
+    sd_multi = (count > 1);
+    int res = SD_BeginRead(sd_multi ? CMD18 : CMD17, sector);
+    PROF_STOP(PROF_SD_START);
+    if (res != 0) {
+        spiBusRelease();
+        return res;
+    }
+
+    sd_dst = buff;
+    sd_sector = sector;
+    sd_retries = SD_CRC_RETRIES;
+    sd_blocks_left = count;
+    sd_done = done;
+    sd_busy = 1;
+    spiDMAReceive(buff, SECTOR_SIZE, SD_DMAComplete);
+    return 0;
+}
+
+int SD_ReadSectorAsync(uint32_t sector, uint8_t* buff, void (*done)(int status)) {
+    return SD_ReadSectorsAsync(sector, buff, 1, done);
+}
+
+int SD_ReadSectors(uint32_t sector, uint8_t* buff, uint32_t count) {
+    PROF_START(PROF_SD_READ);
+    int res;
+    if (!sd_use_dma) {
+        res = SD_ReadSectorsPolled(sector, buff, count);
+    } else {
+        res = SD_ReadSectorsAsync(sector, buff, count, 0);
+        if (res == 0) {
+            while (SD_Poll()) hal_idle();
+            res = sd_status;
+        }
+    }
+    PROF_STOP(PROF_SD_READ);
+    return res;
+}
+
+int SD_ReadSector(uint32_t sector, uint8_t* buff) {
+    return SD_ReadSectors(sector, buff, 1);
+}
+
+int SD_WriteSector(uint32_t sector, const uint8_t* buff) {
+    while (SD_Poll()) hal_idle();
+    spiBusLock(HAL_DEV_SD);
+    CS_ENABLE();
+    if (SD_Command(CMD24, sector, 0xFF) != 0x00) {
+        CS_DISABLE();
+        spiBusRelease();
+        return -1;
+    }
+    spiSendReceive(0xFF); // Gap before the data token
+    spiSendReceive(0xFE);
+    for (int i = 0; i < SECTOR_SIZE; i++) spiSendReceive(buff[i]);
+    spiSendReceive(0xFF); // CRC (not checked in SPI mode)
     spiSendReceive(0xFF);
 
+    uint8_t resp = spiSendReceive(0xFF) & 0x1F; // 0x05: data accepted
+
+    // The card holds MISO low while it programs the block
+    int timeout = 200000;
+    while (spiSendReceive(0xFF) == 0x00 && timeout-- > 0);
     CS_DISABLE();
-    return 0;
+    spiBusRelease();
+    int res = (resp != 0x05) ? -3 : (timeout <= 0) ? -2 : 0;
+
+    // Write-through: keep a cached copy in step with the card
+    for (int i = 0; i < SD_CACHE_SECTORS; i++) {
+        if (!cache[i].valid || cache[i].lba != sector) continue;
+        if (res == 0) memcpy(cache[i].data, buff, SECTOR_SIZE);
+        else cache[i].valid = 0; // The card may hold either version now
+    }
+    return res;
+}
+
+const uint8_t* SD_ReadSectorCached(uint32_t sector) {
+    CacheLine* victim = &cache[0];
+    for (int i = 0; i < SD_CACHE_SECTORS; i++) {
+        CacheLine* line = &cache[i];
+        if (line->valid && line->lba == sector) {
+            line->used = ++cache_clock;
+            cache_hits++;
+            return line->data;
+        }
+        // Empty lines first, then the least recently used
+        if (victim->valid && (!line->valid || line->used < victim->used)) victim = line;
+    }
+
+    cache_misses++;
+    victim->valid = 0;
+    if (SD_ReadSector(sector, victim->data) != 0) return 0;
+    victim->lba = sector;
+    victim->used = ++cache_clock;
+    victim->valid = 1;
+    return victim->data;
+}
+
+void SD_CacheInvalidate(void) {
+    for (int i = 0; i < SD_CACHE_SECTORS; i++) cache[i].valid = 0;
+}
+
+void SD_CacheStats(uint32_t* hits, uint32_t* misses) {
+    *hits = cache_hits;
+    *misses = cache_misses;
+}
+
+int SD_Busy(void) {
+    return sd_busy;
+}
+
+uint32_t SD_BusClock(void) {
+    return SystemCoreClock >> (sd_br + 1);
+}
+
+uint32_t SD_CRCErrors(void) {
+    return sd_crc_errors;
+}
+
+// 1 if SD_CAL_BLOCKS blocks from the start of the card read back with good CRCs at br
+static int SD_CheckSpeed(int br) {
+    uint8_t block[SECTOR_SIZE];
+    SD_SetSpeed(br);
+    for (uint32_t sector = 0; sector < SD_CAL_BLOCKS; sector++) {
+        if (SD_ReadPolled(sector, block, 1, 0) != 0) return 0;
+    }
+    return 1;
+}
+
+// Starts at the divisor a previous boot settled on if it still passes. Otherwise
+// steps the clock up from SD_BR_SAFE for as long as the check passes, and stays at
+// the fastest rate that did. Failures here only pick the rate; they are not
+// counted as errors.
+static void SD_Calibrate(int saved) {
+    int best = SD_BR_SAFE;
+    if (saved >= SD_BR_FASTEST && saved <= SD_BR_SAFE && SD_CheckSpeed(saved)) {
+        best = saved;
+    } else {
+        for (int br = SD_BR_SAFE; br >= SD_BR_FASTEST && SD_CheckSpeed(br); br--) best = br;
+    }
+    sd_br = best;
+    SD_SetSpeed(sd_br);
+    sd_crc_errors = 0;
+}
+
+void SD_EnableDMA(int enable) {
+    static int dma_ready = 0;
+    while (SD_Poll()) hal_idle();
+    if (enable && !dma_ready) {
+        initSPIDMA();
+        dma_ready = 1;
+    }
+    sd_use_dma = enable;
 }
 
 int SD_Init() {
+    return SD_InitAt(0);
+}
+
+int SD_InitAt(uint32_t clock) {
     pinMode(SPI_CE, GPIO_OUTPUT); 
     CS_DISABLE();
 
     // 1. Set very slow speed for initialization (< 400kHz)
     // System Clock = 80MHz. Div 256 => ~312kHz
     SD_SetSpeed(0b111); 
+    spiBusLock(HAL_DEV_SD);
 
     // 2. Power-up delay (80 clocks)
     for (int i = 0; i < 12; i++) spiSendReceive(0xFF);
@@ -104,6 +458,7 @@ int SD_Init() {
     CS_ENABLE();
     if (SD_Command(CMD0, 0, 0x95) != 0x01) {
         CS_DISABLE();
+        spiBusRelease();
         return -1;
     }
     CS_DISABLE();
@@ -124,22 +479,27 @@ int SD_Init() {
         res = SD_Command(ACMD41, 0x40000000, 0xFF); 
         CS_DISABLE();
     } while (res != 0x00 && retries-- > 0);
+    spiBusRelease();
 
     if (retries <= 0) return -2;
 
-    // 6. Switch to High Speed
-    // Div 4 => 20MHz (Safe for most SPI modules and wiring)
-    SD_SetSpeed(0b001); 
+    // 6. Switch to the fastest clock the wiring carries cleanly
+    int saved = -1;
+    for (int br = 0; br <= 7; br++) {
+        if ((SystemCoreClock >> (br + 1)) == clock) saved = br;
+    }
+    crc16_init();
+    SD_Calibrate(saved);
 
     return 0;
 }
 
 // --- FAT32 Implementation ---
 
-static uint32_t get_u32(uint8_t* b, int offset) {
+static uint32_t get_u32(const uint8_t* b, int offset) {
     return b[offset] | (b[offset+1] << 8) | (b[offset+2] << 16) | (b[offset+3] << 24);
 }
-static uint16_t get_u16(uint8_t* b, int offset) {
+static uint16_t get_u16(const uint8_t* b, int offset) {
     return b[offset] | (b[offset+1] << 8);
 }
 
@@ -148,16 +508,17 @@ uint32_t ClusterToLBA(uint32_t cluster) {
 }
 
 int FAT32_Init(void) {
-    uint8_t buffer[SECTOR_SIZE];
-    
-    if(SD_ReadSector(0, buffer) != 0) return -1;
+    SD_CacheInvalidate();
+    const uint8_t* buffer = SD_ReadSectorCached(0);
+    if (!buffer) return -1;
     
     // Simple check for MBR vs Volume Boot Record
     // If byte 0 is 0xEB or 0xE9, it might be a VBR directly (no partition table)
     // Otherwise, assume MBR partition table at offset 0x1C6
     if (buffer[0] != 0xEB && buffer[0] != 0xE9) {
         g_lba_begin = get_u32(buffer, OFF_PART1_LBA_START);
-        SD_ReadSector(g_lba_begin, buffer);
+        buffer = SD_ReadSectorCached(g_lba_begin);
+        if (!buffer) return -2;
     } else {
         g_lba_begin = 0;
     }
@@ -167,6 +528,8 @@ int FAT32_Init(void) {
     uint8_t  num_fats = buffer[OFF_BPB_NUM_FATS];
     uint32_t fat_size = get_u32(buffer, OFF_BPB_FAT_SZ_32);
     g_root_cluster    = get_u32(buffer, OFF_BPB_ROOT_CLUS);
+    g_fsinfo_lba      = g_lba_begin + get_u16(buffer, OFF_BPB_FS_INFO);
+    g_volume_id       = get_u32(buffer, OFF_BS_VOL_ID);
 
     g_fat_start_lba  = g_lba_begin + rsvd_sec;
     g_data_start_lba = g_fat_start_lba + (num_fats * fat_size);
@@ -174,7 +537,37 @@ int FAT32_Init(void) {
     return 0;
 }
 
-static int match_filename(uint8_t* entry, const char* name, const char* ext) {
+int FAT32_InitFrom(const FAT32_Geometry* geometry) {
+    SD_CacheInvalidate();
+    const uint8_t* buffer = SD_ReadSectorCached(geometry->lbaBegin);
+    if (!buffer) return -2;
+    if ((buffer[0] != 0xEB && buffer[0] != 0xE9) || get_u32(buffer, OFF_BS_VOL_ID) != geometry->volumeId ||
+        buffer[OFF_BPB_SEC_PER_CLUS] != geometry->sectorsPerCluster) {
+        return FAT32_Init();
+    }
+
+    g_lba_begin      = geometry->lbaBegin;
+    g_fat_start_lba  = geometry->fatStartLba;
+    g_data_start_lba = geometry->dataStartLba;
+    g_sec_per_clus   = geometry->sectorsPerCluster;
+    g_root_cluster   = geometry->rootCluster;
+    g_fsinfo_lba     = geometry->fsInfoLba;
+    g_volume_id      = geometry->volumeId;
+    return 1;
+}
+
+void FAT32_GetGeometry(FAT32_Geometry* geometry) {
+    memset(geometry, 0, sizeof(*geometry));
+    geometry->volumeId          = g_volume_id;
+    geometry->lbaBegin          = g_lba_begin;
+    geometry->fatStartLba       = g_fat_start_lba;
+    geometry->dataStartLba      = g_data_start_lba;
+    geometry->rootCluster       = g_root_cluster;
+    geometry->fsInfoLba         = g_fsinfo_lba;
+    geometry->sectorsPerCluster = g_sec_per_clus;
+}
+
+static int match_filename(const uint8_t* entry, const char* name, const char* ext) {
     for(int i=0; i<8; i++) {
         char c = (i < strlen(name)) ? name[i] : ' ';
         if(entry[i] != c) return 0;
@@ -186,62 +579,381 @@ static int match_filename(uint8_t* entry, const char* name, const char* ext) {
     return 1;
 }
 
-int FAT32_FindFile(const char* name, const char* ext, AudioFile* fileInfo) {
-    uint8_t buffer[SECTOR_SIZE];
-    SD_ReadSector(ClusterToLBA(g_root_cluster), buffer);
-    
-    for (int i = 0; i < 512; i += 32) {
-        if (buffer[i] == 0x00) break; 
-        if (buffer[i] == 0xE5) continue; 
+// Returns the FAT entry (next cluster) for a cluster, or end-of-chain on a read failure
+static uint32_t FAT32_NextCluster(uint32_t cluster) {
+    PROF_START(PROF_FAT_NEXT);
+    uint32_t fatOffset = cluster * 4;
+    const uint8_t* fatBuffer = SD_ReadSectorCached(g_fat_start_lba + (fatOffset / SECTOR_SIZE));
+    uint32_t next = 0x0FFFFFFF;
+    if (fatBuffer) next = get_u32(fatBuffer, fatOffset % SECTOR_SIZE) & 0x0FFFFFFF;
+    PROF_STOP(PROF_FAT_NEXT);
+    return next;
+}
+
+// Walks the cluster chain once and coalesces it into the file's extent map.
+// Consecutive FAT entries share a sector, so a contiguous file costs one FAT
+// read per 128 clusters. If the table fills up, the lazy chain position is left
+// at the last mapped cluster and FAT32_PlanRun continues from there.
+static void FAT32_BuildExtents(AudioFile* file) {
+    const uint8_t* fatBuffer = 0;
+    uint32_t fatLoaded = 0xFFFFFFFF;
+    uint32_t totalSectors = (file->size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint32_t spc = file->sectorsPerCluster;
+    uint32_t clusters = (totalSectors + spc - 1) / spc;
+    uint32_t cluster = file->startCluster;
+
+    file->numExtents = 0;
+    file->mappedSectors = 0;
+    file->extentsComplete = 1;
+    if (clusters == 0 || cluster < 2) return;
+
+    for (uint32_t n = 0; n < clusters; n++) {
+        uint32_t lba = ClusterToLBA(cluster);
+        FAT32_Extent* last = file->numExtents ? &file->extents[file->numExtents - 1] : 0;
+
+        if (last && last->lba + last->sectors == lba) {
+            last->sectors += spc;
+        } else if (file->numExtents < FAT32_MAX_EXTENTS) {
+            file->extents[file->numExtents].lba = lba;
+            file->extents[file->numExtents].sectors = spc;
+            file->numExtents++;
+        } else {
+            file->extentsComplete = 0; // Table full: rest of the chain is read lazily
+            return;
+        }
+        file->mappedSectors += spc;
+        file->currentCluster = cluster;
+        file->sectorInCluster = spc;
+
+        if (n + 1 == clusters) return;
 
-        if (match_filename(&buffer[i], name, ext)) {
-            uint32_t clusHigh = get_u16(buffer, i + 20);
-            uint32_t clusLow  = get_u16(buffer, i + 26);
-            
-            fileInfo->startCluster = (clusHigh << 16) | clusLow;
-            fileInfo->currentCluster = fileInfo->startCluster;
-            fileInfo->size = get_u32(buffer, i + 28);
-            fileInfo->sectorsPerCluster = g_sec_per_clus;
-            fileInfo->sectorInCluster = 0;
-            fileInfo->sectorsRead = 0;
-            
-            return 0; 
+        uint32_t fatOffset = cluster * 4;
+        uint32_t fatSector = g_fat_start_lba + (fatOffset / SECTOR_SIZE);
+        if (fatSector != fatLoaded) {
+            fatBuffer = SD_ReadSectorCached(fatSector);
+            if (!fatBuffer) {
+                file->extentsComplete = 0; // Retry lazily during playback
+                return;
+            }
+            fatLoaded = fatSector;
         }
+        cluster = get_u32(fatBuffer, fatOffset % SECTOR_SIZE) & 0x0FFFFFFF;
+        if (cluster < 2 || cluster >= 0x0FFFFFF8) return; // Chain shorter than the file
     }
-    return -1; 
 }
 
-int FAT32_ReadNextSector(AudioFile* file, uint8_t* buffer) {
-    if (file->sectorsRead * SECTOR_SIZE >= file->size) return -1;
+int FAT32_OpenFile(uint32_t startCluster, uint32_t size, AudioFile* fileInfo) {
+    fileInfo->startCluster = startCluster;
+    fileInfo->currentCluster = startCluster;
+    fileInfo->size = size;
+    fileInfo->sectorsPerCluster = g_sec_per_clus;
+    fileInfo->sectorInCluster = 0;
+    fileInfo->sectorsRead = 0;
+    fileInfo->fatStartLba = g_fat_start_lba;
+    fileInfo->dataStartLba = g_data_start_lba;
+
+    FAT32_BuildExtents(fileInfo);
+    return 0;
+}
 
-    uint32_t lba = ClusterToLBA(file->currentCluster) + file->sectorInCluster;
-    if (SD_ReadSector(lba, buffer) != 0) return -2;
+int FAT32_OpenMapped(uint32_t startCluster, uint32_t size, const FAT32_Extent* extents,
+                     uint8_t numExtents, uint8_t extentsComplete, AudioFile* fileInfo) {
+    if (numExtents > FAT32_MAX_EXTENTS) return -1;
+    fileInfo->startCluster = startCluster;
+    fileInfo->size = size;
+    fileInfo->sectorsPerCluster = g_sec_per_clus;
+    fileInfo->sectorsRead = 0;
+    fileInfo->fatStartLba = g_fat_start_lba;
+    fileInfo->dataStartLba = g_data_start_lba;
+
+    memcpy(fileInfo->extents, extents, numExtents * sizeof(FAT32_Extent));
+    fileInfo->numExtents = numExtents;
+    fileInfo->extentsComplete = extentsComplete;
+    fileInfo->mappedSectors = 0;
+    for (int i = 0; i < numExtents; i++) fileInfo->mappedSectors += extents[i].sectors;
+
+    // Lazy chain position at the last mapped cluster, as FAT32_BuildExtents leaves it
+    fileInfo->currentCluster = startCluster;
+    fileInfo->sectorInCluster = 0;
+    if (numExtents > 0) {
+        const FAT32_Extent* last = &extents[numExtents - 1];
+        fileInfo->currentCluster = (last->lba + last->sectors - g_sec_per_clus - g_data_start_lba) / g_sec_per_clus + 2;
+        fileInfo->sectorInCluster = g_sec_per_clus;
+    }
+    return 0;
+}
 
-    file->sectorsRead++;
-    file->sectorInCluster++;
+int FAT32_FindFile(const char* name, const char* ext, AudioFile* fileInfo) {
+    uint32_t cluster = g_root_cluster;
+
+    while (cluster >= 2 && cluster < FAT32_EOC) {
+        uint32_t lba = ClusterToLBA(cluster);
+        for (int sec = 0; sec < g_sec_per_clus; sec++) {
+            const uint8_t* buffer = SD_ReadSectorCached(lba + sec);
+            if (!buffer) return -2;
+
+            for (int i = 0; i < 512; i += 32) {
+                if (buffer[i] == 0x00) return -1;      // End of directory
+                if (buffer[i] == 0xE5) continue;       // Deleted
+                if (buffer[i + 11] == 0x0F) continue;  // Long file name entry
+                if (buffer[i + 11] & 0x08) continue;   // Volume label
+
+                if (match_filename(&buffer[i], name, ext)) {
+                    uint32_t clusHigh = get_u16(buffer, i + 20);
+                    uint32_t clusLow  = get_u16(buffer, i + 26);
+                    return FAT32_OpenFile((clusHigh << 16) | clusLow, get_u32(buffer, i + 28), fileInfo);
+                }
+            }
+        }
+        cluster = FAT32_NextCluster(cluster);
+    }
+    return -1;
+}
 
-    // Cluster Boundary Check
-    if (file->sectorInCluster >= file->sectorsPerCluster) {
-        // Read FAT to find next cluster
-        uint32_t fatOffset = file->currentCluster * 4;
-        uint32_t fatSector = g_fat_start_lba + (fatOffset / SECTOR_SIZE);
-        uint32_t entOffset = fatOffset % SECTOR_SIZE;
+// --- Directory walk ---
+
+// Checksum of an 8.3 name, repeated in each of its long name entries
+static uint8_t lfn_checksum(const uint8_t* entry) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + entry[i]);
+    return sum;
+}
+
+// Character offsets of the 13 UCS-2 characters in a long name entry
+static const uint8_t lfn_offsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+// Long name entries come last part first; each carries its place in the name.
+// Characters outside ASCII are replaced with '_'.
+static void lfn_add(const uint8_t* entry, char* lfn, uint8_t* sum, int* valid) {
+    uint8_t seq = entry[0];
+    if (seq & 0x40) {
+        memset(lfn, 0, FAT32_NAME_LEN);
+        *sum = entry[13];
+        *valid = 1;
+    } else if (!*valid || entry[13] != *sum) {
+        *valid = 0;
+        return;
+    }
+    int pos = ((seq & 0x1F) - 1) * 13;
+    for (int k = 0; k < 13; k++, pos++) {
+        uint16_t ch = (uint16_t)(entry[lfn_offsets[k]] | (entry[lfn_offsets[k] + 1] << 8));
+        if (ch == 0x0000 || ch == 0xFFFF) break;
+        if (pos >= 0 && pos < FAT32_NAME_LEN - 1) lfn[pos] = (ch < 0x80) ? (char)ch : '_';
+    }
+}
+
+// NAME.EXT from the padded 8.3 fields, honouring the lower-case flags Windows sets
+static void short_name(const uint8_t* entry, char* out) {
+    int n = 0;
+    for (int i = 0; i < 8 && entry[i] != ' '; i++) {
+        char c = (i == 0 && entry[0] == 0x05) ? (char)0xE5 : (char)entry[i];
+        if ((entry[12] & 0x08) && c >= 'A' && c <= 'Z') c += 32;
+        out[n++] = c;
+    }
+    if (entry[8] != ' ') {
+        out[n++] = '.';
+        for (int i = 8; i < 11 && entry[i] != ' '; i++) {
+            char c = (char)entry[i];
+            if ((entry[12] & 0x10) && c >= 'A' && c <= 'Z') c += 32;
+            out[n++] = c;
+        }
+    }
+    out[n] = 0;
+}
 
-        // WARNING: We reuse the data buffer for FAT table read. 
-        // This destroys 'buffer' content if we aren't careful, 
-        // but here 'buffer' was already filled with data we *just* returned?
-        // Actually, the caller expects 'buffer' to contain the file data.
-        // We CANNOT overwrite 'buffer' here. We need a temp buffer.
-        uint8_t fatBuffer[512]; 
-        SD_ReadSector(fatSector, fatBuffer);
+int FAT32_Walk(FAT32_WalkFn fn, void* ctx) {
+    // Position in each open directory. Sectors come from the cache, so coming back
+    // up from a subdirectory usually finds the parent's sector still there.
+    struct {
+        uint32_t cluster;
+        uint8_t  sector;
+        uint8_t  entry;
+    } stack[FAT32_MAX_DEPTH + 1];
+    FAT32_DirEntry e;
+    char lfn[FAT32_NAME_LEN];
+    uint8_t lfn_sum = 0;
+    int lfn_valid = 0;
+    int depth = 0;
+
+    stack[0].cluster = g_root_cluster;
+    stack[0].sector = 0;
+    stack[0].entry = 0;
+
+    while (depth >= 0) {
+        if (stack[depth].sector >= g_sec_per_clus) {
+            uint32_t next = FAT32_NextCluster(stack[depth].cluster);
+            if (next < 2 || next >= FAT32_EOC) {
+                depth--;
+                continue;
+            }
+            stack[depth].cluster = next;
+            stack[depth].sector = 0;
+        }
+        // Fetched for every entry: fn may read the card in between
+        uint32_t lba = ClusterToLBA(stack[depth].cluster) + stack[depth].sector;
+        uint16_t offset = (uint16_t)(stack[depth].entry * 32);
+        const uint8_t* buffer = SD_ReadSectorCached(lba);
+        if (!buffer) return -2;
+        const uint8_t* ent = &buffer[offset];
+        if (++stack[depth].entry == SECTOR_SIZE / 32) {
+            stack[depth].entry = 0;
+            stack[depth].sector++;
+        }
 
-        uint32_t nextCluster = get_u32(fatBuffer, entOffset) & 0x0FFFFFFF;
-        
-        if (nextCluster >= 0x0FFFFFF8) return -1; // EOF
-        
-        file->currentCluster = nextCluster;
-        file->sectorInCluster = 0;
+        if (ent[0] == 0x00) { // End of directory
+            depth--;
+            lfn_valid = 0;
+            continue;
+        }
+        if (ent[0] == 0xE5) { // Deleted
+            lfn_valid = 0;
+            continue;
+        }
+        if (ent[11] == 0x0F) {
+            lfn_add(ent, lfn, &lfn_sum, &lfn_valid);
+            continue;
+        }
+        if (ent[11] & 0x08) { // Volume label
+            lfn_valid = 0;
+            continue;
+        }
+        if (ent[0] == '.') { // "." and ".."
+            lfn_valid = 0;
+            continue;
+        }
+
+        if (lfn_valid && lfn_sum == lfn_checksum(ent) && lfn[0] != 0) memcpy(e.name, lfn, FAT32_NAME_LEN);
+        else short_name(ent, e.name);
+        lfn_valid = 0;
+        e.attr = ent[11];
+        e.depth = (uint8_t)depth;
+        e.startCluster = ((uint32_t)get_u16(ent, 20) << 16) | get_u16(ent, 26);
+        e.size = get_u32(ent, 28);
+        e.entryLba = lba;
+        e.entryOffset = offset;
+        if (fn(&e, ctx)) return 1;
+
+        if ((e.attr & FAT32_ATTR_DIR) && depth < FAT32_MAX_DEPTH && e.startCluster >= 2) {
+            depth++;
+            stack[depth].cluster = e.startCluster;
+            stack[depth].sector = 0;
+            stack[depth].entry = 0;
+        }
     }
+    return 0;
+}
+
+// FNV-1a, one byte at a time
+static uint32_t fnv_add(uint32_t h, const uint8_t* p, uint32_t n) {
+    while (n--) {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Adds the first cluster of a directory, up to its end marker, to the hash
+static int hash_dir(uint32_t* h, uint32_t cluster) {
+    uint32_t lba = ClusterToLBA(cluster);
+    for (int sec = 0; sec < g_sec_per_clus; sec++) {
+        const uint8_t* buffer = SD_ReadSectorCached(lba + sec);
+        if (!buffer) return -2;
+        int i = 0;
+        while (i < SECTOR_SIZE && buffer[i] != 0x00) i += 32;
+        *h = fnv_add(*h, buffer, (uint32_t)i);
+        if (i < SECTOR_SIZE) break;
+    }
+    return 0;
+}
+
+int FAT32_VolumeSignature(const uint32_t* dirs, uint32_t numDirs, uint32_t* sig) {
+    uint32_t h = 2166136261u;
+    h = fnv_add(h, (const uint8_t*)&g_volume_id, 4);
+
+    const uint8_t* buffer = SD_ReadSectorCached(g_fsinfo_lba);
+    if (!buffer) return -2;
+    h = fnv_add(h, &buffer[OFF_FSI_FREE_COUNT], 8); // Free count and next-free hint
 
+    if (hash_dir(&h, g_root_cluster) != 0) return -2;
+    for (uint32_t i = 0; i < numDirs; i++) {
+        if (dirs[i] < 2 || dirs[i] >= FAT32_EOC) return -1;
+        h = fnv_add(h, (const uint8_t*)&dirs[i], 4);
+        if (hash_dir(&h, dirs[i]) != 0) return -2;
+    }
+    *sig = h;
     return 0;
-}
\ No newline at end of file
+}
+
+int FAT32_CheckEntry(uint32_t entryLba, uint16_t entryOffset, uint32_t startCluster, uint32_t size) {
+    if (entryOffset > SECTOR_SIZE - 32 || (entryOffset & 31)) return 1;
+    const uint8_t* buffer = SD_ReadSectorCached(entryLba);
+    if (!buffer) return -2;
+    const uint8_t* ent = &buffer[entryOffset];
+    if (ent[0] == 0x00 || ent[0] == 0xE5 || ent[11] == 0x0F || (ent[11] & (FAT32_ATTR_DIR | 0x08))) return 1;
+    uint32_t cluster = ((uint32_t)get_u16(ent, 20) << 16) | get_u16(ent, 26);
+    return (cluster == startCluster && get_u32(ent, 28) == size) ? 0 : 1;
+}
+
+int FAT32_SectorToLBA(const AudioFile* file, uint32_t fileSector, uint32_t* lba) {
+    uint32_t base = 0;
+    for (int i = 0; i < file->numExtents; i++) {
+        const FAT32_Extent* ext = &file->extents[i];
+        if (fileSector < base + ext->sectors) {
+            *lba = ext->lba + (fileSector - base);
+            return (int)(ext->sectors - (fileSector - base));
+        }
+        base += ext->sectors;
+    }
+    return -1;
+}
+
+// Claims up to nsect contiguous sectors from the file position and advances it.
+// Inside the extent map this is pure arithmetic; past it (fragmented files only)
+// the chain is followed one cluster at a time. Returns the sector count (first LBA
+// in *lba) or -1 at end of file.
+static int FAT32_PlanRun(AudioFile* file, uint32_t nsect, uint32_t* lba) {
+    uint32_t total = (file->size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (file->sectorsRead >= total) return -1;
+    if (nsect > total - file->sectorsRead) nsect = total - file->sectorsRead;
+
+    int avail = FAT32_SectorToLBA(file, file->sectorsRead, lba);
+    if (avail < 0) {
+        if (file->extentsComplete) return -1; // Chain ended before file size
+
+        // Past the extent map: follow the chain lazily
+        if (file->sectorInCluster >= file->sectorsPerCluster) {
+            uint32_t nextCluster = FAT32_NextCluster(file->currentCluster);
+            if (nextCluster < 2 || nextCluster >= 0x0FFFFFF8) return -1; // EOF
+            file->currentCluster = nextCluster;
+            file->sectorInCluster = 0;
+        }
+        *lba = ClusterToLBA(file->currentCluster) + file->sectorInCluster;
+        avail = (int)(file->sectorsPerCluster - file->sectorInCluster);
+    }
+
+    uint32_t count = ((uint32_t)avail < nsect) ? (uint32_t)avail : nsect;
+    if (file->sectorsRead >= file->mappedSectors) file->sectorInCluster += count;
+    file->sectorsRead += count;
+    return (int)count;
+}
+
+int FAT32_ReadRun(AudioFile* file, uint8_t* buffer, uint32_t nsect) {
+    uint32_t lba;
+    int count = FAT32_PlanRun(file, nsect, &lba);
+    if (count < 0) return -1;
+    if (SD_ReadSectors(lba, buffer, (uint32_t)count) != 0) return -2;
+    return count;
+}
+
+int FAT32_ReadRunAsync(AudioFile* file, uint8_t* buffer, uint32_t nsect) {
+    uint32_t lba;
+    int count = FAT32_PlanRun(file, nsect, &lba);
+    if (count < 0) return -1;
+    if (SD_ReadSectorsAsync(lba, buffer, (uint32_t)count, 0) != 0) return -2;
+    return count;
+}
+
+int FAT32_ReadNextSector(AudioFile* file, uint8_t* buffer) {
+    int count = FAT32_ReadRun(file, buffer, 1);
+    return (count < 0) ? count : 0;
+}
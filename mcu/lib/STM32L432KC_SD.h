@@ -11,23 +11,175 @@
 // FAT32 Definitions
 #define SECTOR_SIZE 512
 
+// Extent map size. Files with more fragments than this fall back to reading the FAT
+// lazily once playback runs past the last mapped extent.
+#define FAT32_MAX_EXTENTS 16
+
+// Bus clock, as SPI1 divisors (0: /2 ... 7: /256 of 80 MHz). At start-up the clock is
+// stepped up from SD_BR_SAFE (5 MHz) towards SD_BR_FASTEST (20 MHz; cards are
+// specified to 25 MHz in SPI mode) while test reads keep passing their CRC check.
+#define SD_BR_SAFE     3
+#define SD_BR_FASTEST  1
+#define SD_CAL_BLOCKS  16 // Blocks read back at each calibration step
+#ifndef SD_CRC_RETRIES
+#define SD_CRC_RETRIES 3  // Re-reads of a corrupted block, each one clock step slower
+#endif
+
+// Sectors kept by the metadata cache (FAT, directories, boot sectors), 1 or more.
+// Audio and file data reads bypass it.
+#define SD_CACHE_SECTORS 6
+
+#define FAT32_NAME_LEN  64 // Long names are cut to this, terminator included
+#define FAT32_MAX_DEPTH 8  // Subdirectory levels the walker descends
+#define FAT32_ATTR_DIR  0x10
+
+// A stretch of a file that sits in consecutive sectors on the card
+typedef struct {
+    uint32_t lba;       // First sector of the stretch
+    uint32_t sectors;   // Length in sectors
+} FAT32_Extent;
+
 // File structure to keep track of playback
 typedef struct {
     uint32_t startCluster;
-    uint32_t currentCluster;
+    uint32_t currentCluster;   // Lazy chain position past the extent map
     uint32_t size;
-    uint32_t sectorsRead;
-    uint32_t sectorInCluster;
+    uint32_t sectorsRead;      // File position in sectors
+    uint32_t sectorInCluster;  // Lazy chain position past the extent map
     uint8_t  sectorsPerCluster;
     uint32_t fatStartLba;
     uint32_t dataStartLba;
+
+    // Cluster chain coalesced into contiguous runs when the file is opened
+    FAT32_Extent extents[FAT32_MAX_EXTENTS];
+    uint8_t  numExtents;
+    uint8_t  extentsComplete;  // 1 if the table covers the whole chain
+    uint32_t mappedSectors;    // File sectors covered by the table
 } AudioFile;
 
+// Where the file system sits on the card, as FAT32_Init found it
+typedef struct {
+    uint32_t volumeId;         // Serial number from the volume boot sector
+    uint32_t lbaBegin;         // Volume boot sector
+    uint32_t fatStartLba;
+    uint32_t dataStartLba;
+    uint32_t rootCluster;
+    uint32_t fsInfoLba;
+    uint8_t  sectorsPerCluster;
+    uint8_t  pad[3];
+} FAT32_Geometry;
+
+// One file or directory as FAT32_Walk reports it
+typedef struct {
+    char     name[FAT32_NAME_LEN]; // Long name if the entry has one, else NAME.EXT
+    uint8_t  attr;
+    uint8_t  depth;                // 0 for the root directory
+    uint32_t startCluster;
+    uint32_t size;
+    uint32_t entryLba;             // Sector holding its short entry
+    uint16_t entryOffset;          // Byte offset of that entry in the sector
+} FAT32_DirEntry;
+
+// Called for every entry. Returning nonzero stops the walk.
+typedef int (*FAT32_WalkFn)(const FAT32_DirEntry* entry, void* ctx);
+
 // Function Prototypes
+// Every read checks the CRC16 of each block. A read that still fails after
+// SD_CRC_RETRIES re-reads returns -4.
 int SD_Init(void);
-int SD_ReadSector(uint32_t sector, uint8_t* buff);
+// Same, but first tries the bus clock (Hz, from SD_BusClock) an earlier boot ended
+// up at: if it passes the calibration reads, the slower steps are skipped
+int SD_InitAt(uint32_t clock);
+void SD_EnableDMA(int enable);
+int SD_ReadSector(uint32_t sector, uint8_t* buff);        // Blocking; uses DMA when enabled
+int SD_ReadSectorPolled(uint32_t sector, uint8_t* buff);  // Byte-by-byte fallback
+
+// Starts a sector read and returns once the data token has arrived; the 512 data bytes
+// then move by DMA. The DMA interrupt only flags each block that comes in; SD_Poll, from
+// the main loop, checks it and chains the next, and once the last is in, SD_Busy()
+// clears and done(status) runs from there. Falls back to a blocking polled read when
+// DMA is off.
+int SD_ReadSectorAsync(uint32_t sector, uint8_t* buff, void (*done)(int status));
+int SD_Busy(void);
+
+// Does the work waiting since the last DMA interrupt. This can block for as long as
+// the card takes to send a data token or to finish the CMD12 busy period. Returns 1
+// while a read is still going. Main loop only.
+int SD_Poll(void);
+
+// Sets a function the DMA interrupt calls when SD_Poll has work, e.g. to post a task
+void SD_OnBlock(void (*fn)(void));
+
+// Current bus clock in Hz, and blocks that failed their CRC since start-up
+uint32_t SD_BusClock(void);
+uint32_t SD_CRCErrors(void);
+
+// Reads count consecutive sectors in one CMD18/CMD12 transaction (CMD17 when count is 1)
+int SD_ReadSectors(uint32_t sector, uint8_t* buff, uint32_t count);
+int SD_ReadSectorsPolled(uint32_t sector, uint8_t* buff, uint32_t count);
+int SD_ReadSectorsAsync(uint32_t sector, uint8_t* buff, uint32_t count, void (*done)(int status));
+
+// Writes one sector with CMD24 and waits for the card to finish programming it.
+// A cached copy of the sector is updated too.
+int SD_WriteSector(uint32_t sector, const uint8_t* buff);
+
+// Reads a sector through the LRU metadata cache. Returns a pointer to the cached
+// copy, valid until the next cached read, or 0 on a card error.
+const uint8_t* SD_ReadSectorCached(uint32_t sector);
+
+// Drops every cached sector (the card was changed or written behind the cache)
+void SD_CacheInvalidate(void);
+
+// Cached reads served from RAM and from the card since start-up
+void SD_CacheStats(uint32_t* hits, uint32_t* misses);
+
 int FAT32_Init(void);
+
+// Mounts with geometry saved from an earlier FAT32_GetGeometry. Only the volume boot
+// sector is read, to check its serial number; on a mismatch this falls back to
+// FAT32_Init. Returns 1 if the saved geometry was used, else what FAT32_Init returned.
+int FAT32_InitFrom(const FAT32_Geometry* geometry);
+void FAT32_GetGeometry(FAT32_Geometry* geometry);
 int FAT32_FindFile(const char* name, const char* ext, AudioFile* fileInfo);
+uint32_t ClusterToLBA(uint32_t cluster);
+
+// Opens a file from its directory entry fields, e.g. ones kept in an index
+int FAT32_OpenFile(uint32_t startCluster, uint32_t size, AudioFile* fileInfo);
+
+// Same, with an extent map saved from an earlier open instead of walking the FAT
+int FAT32_OpenMapped(uint32_t startCluster, uint32_t size, const FAT32_Extent* extents,
+                     uint8_t numExtents, uint8_t extentsComplete, AudioFile* fileInfo);
+
+// Visits every entry of the root directory and its subdirectories, depth first,
+// following each directory's cluster chain. Returns 0 when done, 1 if fn stopped
+// the walk, -2 on a card error.
+int FAT32_Walk(FAT32_WalkFn fn, void* ctx);
+
+// Re-reads a short entry where FAT32_Walk found it. Returns 0 if it is still a file
+// with this first cluster and size, 1 if not, -2 on a card error.
+int FAT32_CheckEntry(uint32_t entryLba, uint16_t entryOffset, uint32_t startCluster, uint32_t size);
+
+// Cheap fingerprint of the volume: serial number, FSInfo free-space fields and the
+// first cluster of the root directory and of each directory in dirs, up to the end
+// marker. It catches most changes without walking the tree, but not all: an entry
+// past a directory's first cluster, or in a directory not listed, can change
+// without it, as can a file rewritten in place at the same size when the writer
+// leaves FSInfo alone. Check an entry with FAT32_CheckEntry before relying on it.
+// Returns 0, -1 if a listed cluster is out of range, -2 on a card error.
+int FAT32_VolumeSignature(const uint32_t* dirs, uint32_t numDirs, uint32_t* sig);
 int FAT32_ReadNextSector(AudioFile* file, uint8_t* buffer);
 
+// Maps a sector index within the file to its LBA using only the extent map.
+// Returns how many sectors from there are contiguous, or -1 if it is not mapped.
+int FAT32_SectorToLBA(const AudioFile* file, uint32_t fileSector, uint32_t* lba);
+
+// Reads up to nsect sectors from the file position in a single multi-block transaction,
+// stopping early at end of file or where the cluster chain is not contiguous.
+// Returns the number of sectors read, -1 at end of file, -2 on a card error.
+int FAT32_ReadRun(AudioFile* file, uint8_t* buffer, uint32_t nsect);
+
+// Same as FAT32_ReadRun, but returns as soon as the transfer is started;
+// the data is in once SD_Poll() returns 0.
+int FAT32_ReadRunAsync(AudioFile* file, uint8_t* buffer, uint32_t nsect);
+
 #endif
\ No newline at end of file
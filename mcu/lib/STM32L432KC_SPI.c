@@ -5,6 +5,12 @@
 #include "STM32L432KC_SPI.h"
 #include "STM32L432KC_GPIO.h"
 #include "STM32L432KC_RCC.h"
+#include "STM32L432KC_DMA.h"
+
+// DMA transfer state
+static volatile int spi_dma_busy = 0;
+static void (*spi_dma_done)(int err) = 0;
+static const uint8_t spi_dma_fill = 0xFF;
 
 /* Enables the SPI peripheral and intializes its clock speed (baud rate), polarity, and phase.
  *    -- br: (0b000 - 0b111). The SPI clk will be the master clock / 2^(BR+1).
@@ -53,4 +59,66 @@ char spiSendReceive(char send) {
     while(!(SPI1->SR & SPI_SR_RXNE)); // Wait until data has been received
     char rec = (volatile char) SPI1->DR;
     return rec; // Return received character
-}
\ No newline at end of file
+}
+
+/* Routes SPI1 RX/TX to DMA1 channels 2/3 so blocks can be read without polling. */
+void initSPIDMA(void) {
+    initDMA(DMA1);
+    dmaSetRequest(DMA1, 2, DMA1_CH2_SPI1_RX);
+    dmaSetRequest(DMA1, 3, DMA1_CH3_SPI1_TX);
+
+    // Channel 2 (RX): peripheral -> memory, byte wide, memory increment.
+    // RX gets the higher priority so the RX FIFO can never overrun.
+    DMA1_Channel2->CCR  = DMA_CCR_MINC | DMA_CCR_TCIE | DMA_CCR_TEIE | _VAL2FLD(DMA_CCR_PL, 0b10);
+    DMA1_Channel2->CPAR = (uint32_t) &SPI1->DR;
+
+    // Channel 3 (TX): memory -> peripheral, fixed source so every byte sent is 0xFF
+    DMA1_Channel3->CCR  = DMA_CCR_DIR | _VAL2FLD(DMA_CCR_PL, 0b01);
+    DMA1_Channel3->CPAR = (uint32_t) &SPI1->DR;
+    DMA1_Channel3->CMAR = (uint32_t) &spi_dma_fill;
+
+    NVIC_SetPriority(DMA1_Channel2_IRQn, 1);
+    NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+}
+
+/* Receives a block over SPI1 by DMA while clocking out 0xFF fill bytes.
+ *    -- rx: destination buffer (len bytes)
+ *    -- len: number of bytes to transfer
+ *    -- done: optional callback run from the DMA interrupt (err = 1 on transfer error) */
+void spiDMAReceive(uint8_t * rx, uint16_t len, void (*done)(int err)) {
+    spi_dma_done = done;
+    spi_dma_busy = 1;
+
+    // Drop anything a polled transfer left behind in the RX FIFO
+    while (SPI1->SR & SPI_SR_RXNE) (void) *(volatile uint8_t *) (&SPI1->DR);
+
+    dmaClearFlags(DMA1, 2);
+    dmaClearFlags(DMA1, 3);
+    DMA1_Channel2->CMAR  = (uint32_t) rx;
+    DMA1_Channel2->CNDTR = len;
+    DMA1_Channel3->CNDTR = len;
+
+    // Enable order from RM0394 40.4.9: RX DMA, then the channels, then TX DMA
+    SPI1->CR2 |= SPI_CR2_RXDMAEN;
+    DMA1_Channel2->CCR |= DMA_CCR_EN;
+    DMA1_Channel3->CCR |= DMA_CCR_EN;
+    SPI1->CR2 |= SPI_CR2_TXDMAEN;
+}
+
+int spiDMABusy(void) {
+    return spi_dma_busy;
+}
+
+// RX completes last, so its TC marks the end of the whole transfer
+void DMA1_Channel2_IRQHandler(void) {
+    uint32_t flags = dmaGetFlags(DMA1, 2);
+    dmaClearFlags(DMA1, 2);
+    if ((flags & (DMA_FLAG_TC | DMA_FLAG_TE)) == 0) return;
+
+    DMA1_Channel2->CCR &= ~DMA_CCR_EN;
+    DMA1_Channel3->CCR &= ~DMA_CCR_EN;
+    SPI1->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+
+    spi_dma_busy = 0;
+    if (spi_dma_done) spi_dma_done((flags & DMA_FLAG_TE) ? 1 : 0);
+}
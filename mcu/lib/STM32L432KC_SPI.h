@@ -30,4 +30,17 @@ void initSPI(int br, int cpol, int cpha);
  *    -- return: the character received over SPI */
 char spiSendReceive(char send);
 
+/* Routes SPI1 RX/TX to DMA1 channels 2/3 so blocks can be read without polling. */
+void initSPIDMA(void);
+
+/* Receives a block over SPI1 by DMA while clocking out 0xFF fill bytes.
+ * Returns immediately; spiDMABusy() drops to 0 when the last byte has arrived.
+ *    -- rx: destination buffer (len bytes)
+ *    -- len: number of bytes to transfer
+ *    -- done: optional callback run from the DMA interrupt (err = 1 on transfer error) */
+void spiDMAReceive(uint8_t * rx, uint16_t len, void (*done)(int err));
+
+/* Returns 1 while a transfer started by spiDMAReceive is in flight. */
+int spiDMABusy(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,161 @@
+// STM32L432KC_SPIBUS.c
+// SPI1 arbiter: bus locks and the message queue
+
+#include "STM32L432KC_SPIBUS.h"
+#include "STM32L432KC_SPI.h"
+#include <string.h>
+
+typedef struct {
+    uint32_t queued_at;  // DWT cycle count at spiBusSend
+    uint32_t seq;        // Order within a priority
+    SpiBusDone done;
+    void *   ctx;
+    uint8_t  used;
+    uint8_t  device;
+    uint8_t  priority;
+    uint8_t  len;
+    uint8_t  data[SPIBUS_MSG_BYTES]; // Sent, then overwritten with what came back
+} SpiBusMsg;
+
+static volatile int owner = SPIBUS_FREE;
+static uint8_t dev_br[SPIBUS_DEVICES] = {7, 7}; // Until told otherwise: slowest
+static int bus_br = -1;                         // Divisor now in SPI1->CR1
+
+static SpiBusMsg queue[SPIBUS_QUEUE];
+static volatile uint32_t depth = 0;
+static uint32_t next_seq = 0;
+static SpiBusStats stats;
+
+// Switches in a device's divisor. Only while nothing is being clocked.
+static void bus_grant(int device) {
+    owner = device;
+    if (bus_br != dev_br[device]) {
+        bus_br = dev_br[device];
+        SPI1->CR1 &= ~SPI_CR1_SPE;
+        SPI1->CR1 = (SPI1->CR1 & ~SPI_CR1_BR) | _VAL2FLD(SPI_CR1_BR, bus_br);
+        SPI1->CR1 |= SPI_CR1_SPE;
+    }
+}
+
+// Takes the most urgent queued message into msg. Returns 0 if there is none.
+static int bus_pop(SpiBusMsg * msg) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    int best = -1;
+    for (int i = 0; i < SPIBUS_QUEUE; i++) {
+        if (!queue[i].used) continue;
+        if (best < 0 || queue[i].priority < queue[best].priority ||
+            (queue[i].priority == queue[best].priority && (int32_t)(queue[i].seq - queue[best].seq) < 0)) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        *msg = queue[best];
+        queue[best].used = 0;
+        depth--;
+    }
+    __set_PRIMASK(primask);
+    return best >= 0;
+}
+
+// Sends queued messages until there are none, then frees the bus. The caller
+// holds it, so nothing else is clocking.
+static void bus_drain(void) {
+    SpiBusMsg msg;
+    for (;;) {
+        while (bus_pop(&msg)) {
+            bus_grant(msg.device);
+            uint32_t waited = DWT->CYCCNT - msg.queued_at;
+            if (waited > stats.worst_latency) stats.worst_latency = waited;
+            hal_chip_select(msg.device, 1);
+            for (int i = 0; i < msg.len; i++) msg.data[i] = (uint8_t)spiSendReceive(msg.data[i]);
+            hal_chip_select(msg.device, 0);
+            stats.sent++;
+            if (msg.done) msg.done(msg.ctx, msg.data, msg.len);
+        }
+
+        // A message queued from an interrupt since the last pop found the bus held
+        // and was left for us
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        int empty = (depth == 0);
+        if (empty) owner = SPIBUS_FREE;
+        __set_PRIMASK(primask);
+        if (empty) return;
+    }
+}
+
+void spiBusSetSpeed(int device, int br) {
+    dev_br[device] = (uint8_t)br;
+    if (owner == device) bus_grant(device);
+}
+
+void spiBusLock(int device) {
+    for (;;) {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        int got = (owner == SPIBUS_FREE && depth == 0);
+        if (got) owner = device;
+        __set_PRIMASK(primask);
+        if (got) break;
+        hal_idle();
+    }
+    bus_grant(device);
+}
+
+void spiBusRelease(void) {
+    bus_drain();
+}
+
+int spiBusSend(int device, uint8_t priority, const uint8_t * data, int len) {
+    return spiBusTransfer(device, priority, data, len, 0, 0);
+}
+
+int spiBusTransfer(int device, uint8_t priority, const uint8_t * data, int len, SpiBusDone done, void * ctx) {
+    if (len <= 0 || len > SPIBUS_MSG_BYTES) return -1;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    int slot = -1;
+    for (int i = 0; i < SPIBUS_QUEUE; i++) {
+        if (!queue[i].used) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        stats.dropped++;
+        __set_PRIMASK(primask);
+        return -1;
+    }
+    SpiBusMsg * msg = &queue[slot];
+    msg->queued_at = DWT->CYCCNT;
+    msg->seq = next_seq++;
+    msg->device = (uint8_t)device;
+    msg->priority = priority;
+    msg->len = (uint8_t)len;
+    msg->done = done;
+    msg->ctx = ctx;
+    memcpy(msg->data, data, len);
+    msg->used = 1;
+    if (++depth > stats.max_depth) stats.max_depth = depth;
+
+    // Free bus: send it now, from here
+    int idle = (owner == SPIBUS_FREE);
+    if (idle) owner = device;
+    __set_PRIMASK(primask);
+    if (idle) bus_drain();
+    return 0;
+}
+
+int spiBusOwner(void) {
+    return owner;
+}
+
+uint32_t spiBusQueueDepth(void) {
+    return depth;
+}
+
+void spiBusStats(SpiBusStats * out) {
+    *out = stats;
+}
@@ -0,0 +1,71 @@
+// STM32L432KC_SPIBUS.h
+// Arbiter for SPI1, which the SD card (CS PA11) and the FPGA (CS PB0) share.
+//
+// The SD driver locks the bus for each command or multi-block run and releases it
+// when the card is deselected, from SD_Poll in the main loop for DMA runs. Short messages
+// for other devices are queued with a priority instead of waiting. They go out as
+// soon as the bus is free: at once if nobody holds it, otherwise right after the
+// SD run in flight, before the next SD lock is granted. A message therefore waits
+// for one SD run (4 blocks, ~1 ms at 20 MHz) and for the main loop to get to SD_Poll.
+//
+// Each device keeps its own clock divisor, which is switched in when it gets the bus.
+
+#ifndef STM32L4_SPIBUS_H
+#define STM32L4_SPIBUS_H
+
+#include <stdint.h>
+#include <stm32l432xx.h>
+#include "STM32L432KC_HAL.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+#define SPIBUS_DEVICES   2  // Indexed by HAL_DEV_SD, HAL_DEV_FPGA
+#define SPIBUS_QUEUE     16 // Messages waiting for the bus
+#define SPIBUS_MSG_BYTES 12 // Longest queued message
+#define SPIBUS_FREE      -1 // spiBusOwner when nobody holds the bus
+
+// Told what came back during a message, from wherever it was sent: spiBusSend, or
+// SD_Poll as the SD driver gives the bus back. rx is only valid during the call.
+typedef void (*SpiBusDone)(void * ctx, const uint8_t * rx, int len);
+
+typedef struct {
+    uint32_t sent;          // Queued messages sent
+    uint32_t dropped;       // Messages refused because the queue was full
+    uint32_t max_depth;     // Most messages ever waiting at once
+    uint32_t worst_latency; // Longest wait from spiBusSend to chip select, in CPU cycles
+} SpiBusStats;
+
+///////////////////////////////////////////////////////////////////////////////
+// Function prototypes
+///////////////////////////////////////////////////////////////////////////////
+
+/* Sets the SPI1 divisor (0b000 - 0b111, as initSPI) a device is driven at. Applied
+ * now if the device holds the bus, else the next time it gets it. */
+void spiBusSetSpeed(int device, int br);
+
+/* Waits until the bus is free and no message is queued, then gives it to device.
+ * Main loop only. CS stays with the caller. */
+void spiBusLock(int device);
+
+/* Gives the bus back and sends any queued messages. Safe from interrupts. */
+void spiBusRelease(void);
+
+/* Queues a message: chip select, len bytes, deselect. Messages go out lowest
+ * priority number first, in order within a priority.
+ *    -- return: 0, or -1 if the queue is full or len is over SPIBUS_MSG_BYTES */
+int spiBusSend(int device, uint8_t priority, const uint8_t * data, int len);
+
+/* spiBusSend that also keeps the bytes received, for done (may be 0). */
+int spiBusTransfer(int device, uint8_t priority, const uint8_t * data, int len, SpiBusDone done, void * ctx);
+
+/* Returns the device holding the bus, or SPIBUS_FREE. */
+int spiBusOwner(void);
+
+/* Returns the number of messages waiting. */
+uint32_t spiBusQueueDepth(void);
+
+void spiBusStats(SpiBusStats * stats);
+
+#endif
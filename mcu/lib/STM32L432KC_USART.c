@@ -5,6 +5,26 @@
 #include "STM32L432KC_USART.h"
 #include "STM32L432KC_GPIO.h"
 #include "STM32L432KC_RCC.h"
+#include "STM32L432KC_DMA.h"
+
+// Console state (initUSARTDMA). Ring positions are free-running byte counts,
+// masked when indexing.
+static USART_TypeDef * console = 0;
+
+static uint8_t tx_ring[USART_TX_RING];
+static volatile uint32_t tx_reserve = 0; // Claimed by writers
+static volatile uint32_t tx_commit = 0;  // Copied in and ready to send
+static volatile uint32_t tx_tail = 0;    // Sent
+static volatile uint32_t tx_writers = 0; // Writes in progress, nested by interrupts
+static volatile uint32_t tx_dma_len = 0; // Bytes in the running transfer, 0 when idle
+static volatile uint32_t tx_dropped = 0;
+
+static uint8_t rx_ring[USART_RX_RING];
+static volatile uint32_t rx_head = 0;    // Received
+static uint32_t rx_tail = 0;             // Consumed
+static uint32_t rx_dma_pos = 0;          // Ring index DMA had reached at the last update
+static volatile int rx_event = 0;        // New bytes since the last usartReadLine scan
+static uint32_t rx_overruns = 0;
 
 USART_TypeDef * id2Port(int USART_ID) {
     USART_TypeDef * USART;
@@ -76,6 +96,12 @@ void sendChar(USART_TypeDef * USART, char data){
     while(!(USART->ISR & USART_ISR_TC));
 }
 
+int trySendChar(USART_TypeDef * USART, char data){
+    if(!(USART->ISR & USART_ISR_TXE)) return 0;
+    USART->TDR = data;
+    return 1;
+}
+
 void sendString(USART_TypeDef * USART, char * charArray){
 
     uint32_t i = 0;
@@ -92,10 +118,194 @@ char readChar(USART_TypeDef * USART) {
 }
 
 void readString(USART_TypeDef * USART, char* charArray){
+    // The console reads from its ring: the next full line, or "" if none has arrived
+    if (USART == console) {
+        if (usartReadLine(charArray, USART_RX_RING) < 0) charArray[0] = 0;
+        return;
+    }
     int i = 0;
     do{
         charArray[i] = readChar(USART);
         i++;
     }
     while(USART->ISR & USART_ISR_RXNE);
-}
\ No newline at end of file
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DMA console
+///////////////////////////////////////////////////////////////////////////////
+
+USART_TypeDef * initUSARTDMA(int USART_ID, int baud_rate) {
+    if (USART_ID != USART2_ID) return 0;
+    USART_TypeDef * USART = initUSART(USART_ID, baud_rate);
+
+    initDMA(DMA1);
+    dmaSetRequest(DMA1, 6, DMA1_CH6_USART2_RX);
+    dmaSetRequest(DMA1, 7, DMA1_CH7_USART2_TX);
+
+    // Channel 6 (RX): RDR -> rx_ring, circular. HT and TC update the head at least
+    // twice per lap, so a lap can never pass unnoticed.
+    DMA1_Channel6->CCR   = 0;
+    dmaClearFlags(DMA1, 6);
+    DMA1_Channel6->CPAR  = (uint32_t) &USART->RDR;
+    DMA1_Channel6->CMAR  = (uint32_t) rx_ring;
+    DMA1_Channel6->CNDTR = USART_RX_RING;
+    DMA1_Channel6->CCR   = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE;
+
+    // Channel 7 (TX): one contiguous piece of tx_ring -> TDR per transfer
+    DMA1_Channel7->CCR   = 0;
+    dmaClearFlags(DMA1, 7);
+    DMA1_Channel7->CPAR  = (uint32_t) &USART->TDR;
+    DMA1_Channel7->CCR   = DMA_CCR_DIR | DMA_CCR_MINC | DMA_CCR_TCIE | DMA_CCR_TEIE;
+
+    // OVRDIS can only change while the USART is off. With it set, a late DMA read
+    // loses a byte instead of stopping reception until ORE is cleared.
+    USART->CR1 &= ~USART_CR1_UE;
+    USART->CR3 |= USART_CR3_OVRDIS | USART_CR3_DMAR | USART_CR3_DMAT;
+    USART->CR1 |= USART_CR1_UE;
+    USART->ICR  = USART_ICR_IDLECF;
+    USART->CR1 |= USART_CR1_IDLEIE;
+    DMA1_Channel6->CCR |= DMA_CCR_EN;
+
+    // Below the DAC and SD transfers
+    NVIC_SetPriority(DMA1_Channel6_IRQn, 3);
+    NVIC_SetPriority(DMA1_Channel7_IRQn, 3);
+    NVIC_SetPriority(USART2_IRQn, 3);
+    NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+    NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+    NVIC_EnableIRQ(USART2_IRQn);
+
+    console = USART;
+    return USART;
+}
+
+// Sends the next contiguous piece of committed bytes if the channel is idle.
+// Runs with interrupts masked.
+static void tx_kick(void) {
+    if (tx_dma_len != 0 || tx_commit == tx_tail) return;
+    uint32_t start = tx_tail & (USART_TX_RING - 1);
+    uint32_t len = tx_commit - tx_tail;
+    if (len > USART_TX_RING - start) len = USART_TX_RING - start;
+    tx_dma_len = len;
+    DMA1_Channel7->CCR  &= ~DMA_CCR_EN;
+    DMA1_Channel7->CMAR  = (uint32_t) &tx_ring[start];
+    DMA1_Channel7->CNDTR = len;
+    DMA1_Channel7->CCR  |= DMA_CCR_EN;
+}
+
+// Ends a write. The last writer out (an interrupted main loop write finishes after
+// the interrupt's) publishes everything claimed so far, so bytes are only sent once
+// every write before them is complete.
+static void tx_release(int dropped) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (dropped) tx_dropped++;
+    if (--tx_writers == 0) {
+        tx_commit = tx_reserve;
+        tx_kick();
+    }
+    __set_PRIMASK(primask);
+}
+
+int usartWrite(const char * data, int len) {
+    if (console == 0 || len <= 0) return 0;
+
+    // An interrupt that writes here runs its whole write before this one resumes,
+    // so the count is back where it was by then
+    tx_writers++;
+
+    // Claim len bytes. Taking an interrupt clears the exclusive monitor, so an
+    // interrupt that claims space in between makes the store fail and the claim retry.
+    uint32_t start;
+    do {
+        start = __LDREXW(&tx_reserve);
+        if (start + (uint32_t)len - tx_tail > USART_TX_RING) {
+            __CLREX();
+            tx_release(1);
+            return 0;
+        }
+    } while (__STREXW(start + (uint32_t)len, &tx_reserve));
+
+    for (int i = 0; i < len; i++) tx_ring[(start + (uint32_t)i) & (USART_TX_RING - 1)] = (uint8_t)data[i];
+    tx_release(0);
+    return len;
+}
+
+uint32_t usartDropped(void) {
+    return tx_dropped;
+}
+
+// printf lands here (newlib). Output that does not fit is dropped, but reported as
+// written so printf never retries.
+int _write(int file, char * ptr, int len) {
+    (void) file;
+    usartWrite(ptr, len);
+    return len;
+}
+
+// Brings rx_head up to where DMA has written. Runs from the RX interrupts, or with
+// them masked.
+static void rx_update(void) {
+    uint32_t pos = (USART_RX_RING - DMA1_Channel6->CNDTR) & (USART_RX_RING - 1);
+    rx_head += (pos - rx_dma_pos) & (USART_RX_RING - 1);
+    rx_dma_pos = pos;
+    rx_event = 1;
+}
+
+int usartReadLine(char * line, int size) {
+    if (!rx_event) return -1; // Nothing new since the last look
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    rx_update();
+    rx_event = 0;
+    uint32_t head = rx_head;
+    __set_PRIMASK(primask);
+
+    if (head - rx_tail > USART_RX_RING) {
+        rx_overruns += head - rx_tail - USART_RX_RING;
+        rx_tail = head - USART_RX_RING;
+    }
+    for (uint32_t i = rx_tail; i != head; i++) {
+        uint8_t c = rx_ring[i & (USART_RX_RING - 1)];
+        if (c != '\r' && c != '\n') continue;
+        int n = 0;
+        for (uint32_t j = rx_tail; j != i && n < size - 1; j++) line[n++] = (char) rx_ring[j & (USART_RX_RING - 1)];
+        line[n] = 0;
+        rx_tail = i + 1;
+        rx_event = 1; // More lines may be waiting
+        return n;
+    }
+    return -1;
+}
+
+uint32_t usartOverruns(void) {
+    return rx_overruns;
+}
+
+void DMA1_Channel6_IRQHandler(void) {
+    dmaClearFlags(DMA1, 6);
+    rx_update();
+}
+
+// Idle line: a burst of input has ended
+void USART2_IRQHandler(void) {
+    if (USART2->ISR & USART_ISR_IDLE) {
+        USART2->ICR = USART_ICR_IDLECF;
+        rx_update();
+    }
+}
+
+void DMA1_Channel7_IRQHandler(void) {
+    uint32_t flags = dmaGetFlags(DMA1, 7);
+    dmaClearFlags(DMA1, 7);
+    if ((flags & (DMA_FLAG_TC | DMA_FLAG_TE)) == 0) return;
+
+    // A writer in a higher-priority interrupt may be kicking the channel too
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    tx_tail += tx_dma_len;
+    tx_dma_len = 0;
+    tx_kick();
+    __set_PRIMASK(primask);
+}
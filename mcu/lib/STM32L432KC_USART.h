@@ -11,6 +11,14 @@
 #define USART1_ID   1
 #define USART2_ID   2
 
+// Console rings for initUSARTDMA (powers of two)
+#define USART_TX_RING 1024
+#define USART_RX_RING 256
+
+// Request IDs for DMAx_CSELR (RM0394 Table 41)
+#define DMA1_CH6_USART2_RX 2
+#define DMA1_CH7_USART2_TX 2
+
 ///////////////////////////////////////////////////////////////////////////////
 // Function prototypes
 ///////////////////////////////////////////////////////////////////////////////
@@ -18,8 +26,33 @@
 USART_TypeDef * id2Port(int USART_ID);
 USART_TypeDef * initUSART(int USART_ID, int baud_rate);
 void sendChar(USART_TypeDef * USART, char data);
+int trySendChar(USART_TypeDef * USART, char data); // Returns 0 without sending if TX is full
 char readChar(USART_TypeDef * USART);
 void sendString(USART_TypeDef * USART, char * charArray);
 void readString(USART_TypeDef * USART, char * charArray);
 
+/* Sets up USART2 as a console that never blocks its callers. Output goes through a
+ * ring drained by DMA1 channel 7; input lands in a circular ring filled by DMA1
+ * channel 6, and an idle line marks the end of each burst. printf is retargeted to
+ * the output ring. USART1 is not supported: its DMA channels clash with the DAC.
+ *    -- return: the port, or 0 for an unsupported USART_ID */
+USART_TypeDef * initUSARTDMA(int USART_ID, int baud_rate);
+
+/* Queues len bytes for the console. Safe from the main loop and from interrupts,
+ * never waits, and never interleaves two writers' bytes. A write that does not fit
+ * is dropped whole and counted.
+ *    -- return: len, or 0 if the bytes were dropped */
+int usartWrite(const char * data, int len);
+
+/* Returns the number of writes dropped because the output ring was full. */
+uint32_t usartDropped(void);
+
+/* Copies the next complete input line (without its CR/LF) into line and consumes it.
+ * Longer lines are cut to size - 1 characters.
+ *    -- return: the line length, or -1 when no full line has arrived yet */
+int usartReadLine(char * line, int size);
+
+/* Returns the number of input bytes lost because the input ring was not read in time. */
+uint32_t usartOverruns(void);
+
 #endif
\ No newline at end of file
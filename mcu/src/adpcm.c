@@ -0,0 +1,86 @@
+// adpcm.c
+// Table-driven IMA ADPCM decoder, bit-exact with the IMA reference algorithm
+
+#include "adpcm.h"
+
+static const int16_t step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// One code to one sample. The difference is built from shifted steps, as in the
+// reference, rather than (2n+1)*step/8, which rounds differently.
+static inline int32_t expand(int32_t* pred, int32_t* index, uint32_t code) {
+    int32_t step = step_table[*index];
+    int32_t diff = step >> 3;
+    if (code & 4) diff += step;
+    if (code & 2) diff += step >> 1;
+    if (code & 1) diff += step >> 2;
+    int32_t p = (code & 8) ? *pred - diff : *pred + diff;
+    if (p > 32767) p = 32767;
+    if (p < -32768) p = -32768;
+    *pred = p;
+
+    int32_t i = *index + index_table[code];
+    if (i < 0) i = 0;
+    if (i > 88) i = 88;
+    *index = i;
+    return p;
+}
+
+int16_t adpcm_block_header(AdpcmChannel* c, const uint8_t* hdr) {
+    c->predictor = (int16_t)(hdr[0] | (hdr[1] << 8));
+    c->index = (hdr[2] > 88) ? 88 : hdr[2];
+    return c->predictor;
+}
+
+void adpcm_decode_bytes(AdpcmChannel* c, const uint8_t* in, uint32_t n, int16_t* out) {
+    // Work on locals so the state stays in registers across the block
+    int32_t pred = c->predictor;
+    int32_t index = c->index;
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t b = in[k];
+        *out++ = (int16_t)expand(&pred, &index, b & 0x0F);
+        *out++ = (int16_t)expand(&pred, &index, b >> 4);
+    }
+    c->predictor = (int16_t)pred;
+    c->index = (uint8_t)index;
+}
+
+uint32_t adpcm_decode_block(const uint8_t* block, uint32_t block_bytes, uint16_t channels, int16_t* out) {
+    AdpcmChannel ch[2];
+    uint32_t hdr = 4u * channels;
+    if (channels < 1 || channels > 2 || block_bytes < hdr) return 0;
+
+    for (uint16_t c = 0; c < channels; c++) out[c] = adpcm_block_header(&ch[c], block + 4 * c);
+    uint32_t samples = 1;
+    const uint8_t* p = block + hdr;
+    uint32_t left = block_bytes - hdr;
+
+    if (channels == 1) {
+        adpcm_decode_bytes(&ch[0], p, left, out + 1);
+        return 1 + 2 * left;
+    }
+
+    // Stereo: 4 bytes (8 samples) of left, then 4 of right
+    int16_t tmp[8];
+    while (left >= 8) {
+        for (uint16_t c = 0; c < 2; c++) {
+            adpcm_decode_bytes(&ch[c], p + 4 * c, 4, tmp);
+            for (int k = 0; k < 8; k++) out[2 * (samples + k) + c] = tmp[k];
+        }
+        samples += 8;
+        p += 8;
+        left -= 8;
+    }
+    return samples;
+}
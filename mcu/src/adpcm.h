@@ -0,0 +1,27 @@
+// adpcm.h
+// IMA/DVI ADPCM (WAV format 0x11) decoder. Each block starts with a 4-byte header
+// per channel (first sample, step index); 4-bit codes follow, low nibble first,
+// interleaved per channel in 4-byte groups.
+
+#ifndef ADPCM_H
+#define ADPCM_H
+
+#include <stdint.h>
+
+#define WAV_FORMAT_IMA_ADPCM 0x0011
+
+typedef struct {
+    int16_t predictor;
+    uint8_t index;     // Into the step table, 0..88
+} AdpcmChannel;
+
+// Loads a channel's block header. Returns the sample it carries.
+int16_t adpcm_block_header(AdpcmChannel* c, const uint8_t* hdr);
+
+// Expands n bytes of one channel's codes into 2n samples
+void adpcm_decode_bytes(AdpcmChannel* c, const uint8_t* in, uint32_t n, int16_t* out);
+
+// Decodes a whole block into interleaved samples. Returns samples per channel.
+uint32_t adpcm_decode_block(const uint8_t* block, uint32_t block_bytes, uint16_t channels, int16_t* out);
+
+#endif
@@ -0,0 +1,55 @@
+// chart.c
+// Streams .CHT beatmaps through the FAT32 layer one sector at a time
+
+#include "chart.h"
+#include <string.h>
+
+static uint32_t get_u32(const uint8_t* b, uint32_t o) {
+    return (uint32_t)b[o] | ((uint32_t)b[o + 1] << 8) | ((uint32_t)b[o + 2] << 16) | ((uint32_t)b[o + 3] << 24);
+}
+
+// Loads the next sector of the chart into buf
+static int chart_fill(ChartReader* c) {
+    int count = FAT32_ReadRun(&c->file, c->buf, 1);
+    if (count == -1) return 0;
+    if (count < 0) return -2;
+    c->len = SECTOR_SIZE;
+    c->idx = 0;
+    return 1;
+}
+
+int chart_open(ChartReader* c, const char* name) {
+    int res = FAT32_FindFile(name, CHART_EXT, &c->file);
+    if (res != 0) return res;
+    if (c->file.size < CHART_HEADER_SIZE) return -3;
+
+    res = chart_fill(c);
+    if (res <= 0) return (res == 0) ? -3 : res;
+    if (memcmp(c->buf, CHART_MAGIC, 4) != 0) return -3;
+
+    c->sample_rate = get_u32(c->buf, 4);
+    c->notes_left  = get_u32(c->buf, 8);
+    c->bpm_x100    = get_u32(c->buf, 12);
+    c->idx = CHART_HEADER_SIZE;
+
+    // Never trust the count past the end of the file
+    uint32_t fits = (c->file.size - CHART_HEADER_SIZE) / CHART_RECORD_SIZE;
+    if (c->notes_left > fits) c->notes_left = fits;
+    return 0;
+}
+
+int chart_next(ChartReader* c, uint32_t* sample, uint8_t* lanes) {
+    if (c->notes_left == 0) return 0;
+    if (c->idx >= c->len) {
+        int res = chart_fill(c);
+        if (res <= 0) {
+            c->notes_left = 0;
+            return res;
+        }
+    }
+    *sample = get_u32(c->buf, c->idx);
+    *lanes  = c->buf[c->idx + 4];
+    c->idx += CHART_RECORD_SIZE;
+    c->notes_left--;
+    return 1;
+}
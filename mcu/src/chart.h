@@ -0,0 +1,42 @@
+// chart.h
+// Precompiled beatmap (.CHT) written by tools/chartgen and played back from the card.
+//
+// Layout, little-endian:
+//    header  (16 bytes): "CHT1", sample rate, note count, tempo in BPM * 100
+//    records ( 8 bytes): sample index (u32), lane mask (u8), 3 pad bytes
+// Records are in sample order. Both sizes divide the sector size, so no record
+// is ever split across sectors.
+
+#ifndef CHART_H
+#define CHART_H
+
+#include <stdint.h>
+
+#define CHART_EXT         "CHT"
+#define CHART_MAGIC       "CHT1"
+#define CHART_HEADER_SIZE 16
+#define CHART_RECORD_SIZE 8
+
+#ifndef CHART_HOST_ONLY
+#include "STM32L432KC_SD.h"
+
+typedef struct {
+    AudioFile file;
+    uint8_t   buf[SECTOR_SIZE];
+    uint16_t  idx;          // Read index into buf
+    uint16_t  len;          // Valid bytes in buf
+    uint32_t  notes_left;
+    uint32_t  sample_rate;
+    uint32_t  bpm_x100;
+} ChartReader;
+
+// Opens <name>.CHT from the root directory and checks its header.
+// Returns 0 on success, -1 if there is no chart, -2 on a card error, -3 if it is not a chart.
+int chart_open(ChartReader* c, const char* name);
+
+// Reads the next note. Returns 1 with the note filled in, 0 after the last note,
+// -2 on a card error.
+int chart_next(ChartReader* c, uint32_t* sample, uint8_t* lanes);
+#endif
+
+#endif
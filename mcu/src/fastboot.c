@@ -0,0 +1,115 @@
+// fastboot.c
+// Boot metadata page in internal flash
+
+#include "fastboot.h"
+#include <stddef.h>
+#include <string.h>
+
+_Static_assert(sizeof(FastbootPage) % 8 == 0, "the page is programmed in double words");
+_Static_assert(sizeof(FastbootPage) <= FLASH_PAGE_BYTES, "FASTBOOT_SONGS too large for one page");
+
+// FNV-1a over the page up to its checksum
+static uint32_t page_checksum(const FastbootPage* p) {
+    const uint8_t* b = (const uint8_t*)p;
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < offsetof(FastbootPage, checksum); i++) {
+        h ^= b[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int fastboot_mount(Fastboot* fb) {
+    memcpy(&fb->page, flashPage(FASTBOOT_PAGE), sizeof(fb->page));
+    fb->valid = fb->page.magic == FASTBOOT_MAGIC && fb->page.version == FASTBOOT_VERSION &&
+                fb->page.num_songs <= FASTBOOT_SONGS && fb->page.checksum == page_checksum(&fb->page);
+    fb->mounted = 0;
+    fb->dirty = 0;
+
+    int res = fb->valid ? SD_InitAt(fb->page.sd_clock) : SD_Init();
+    if (res != 0) return res;
+
+    if (fb->valid) {
+        res = FAT32_InitFrom(&fb->page.geometry);
+        if (res < 0) return res;
+        fb->mounted = (res == 1);
+    } else {
+        res = FAT32_Init();
+        if (res != 0) return res;
+    }
+
+    if (!fb->mounted) {
+        // New card or no record: start over with this card's geometry
+        memset(&fb->page, 0, sizeof(fb->page));
+        fb->page.magic = FASTBOOT_MAGIC;
+        fb->page.version = FASTBOOT_VERSION;
+        FAT32_GetGeometry(&fb->page.geometry);
+        fb->dirty = 1;
+    }
+    return 0;
+}
+
+void fastboot_check(Fastboot* fb, uint32_t signature) {
+    if (fb->page.signature == signature) return;
+    fb->page.signature = signature;
+    fb->page.num_songs = 0;
+    fb->dirty = 1;
+}
+
+// Drops saved song i, keeping the order of the rest
+static void drop_song(FastbootPage* p, uint32_t i) {
+    memmove(&p->songs[i], &p->songs[i + 1], (p->num_songs - i - 1) * sizeof(FastbootSong));
+    p->num_songs--;
+}
+
+int fastboot_open(Fastboot* fb, const SongEntry* song, AudioFile* file) {
+    FastbootPage* p = &fb->page;
+    for (uint32_t i = 0; i < p->num_songs; i++) {
+        const FastbootSong* s = &p->songs[i];
+        if (s->name_hash != song->name_hash || s->start_cluster != song->start_cluster || s->size != song->size) continue;
+
+        // The signature can miss a change, so the entry the map was made from is read
+        // again: a song rewritten elsewhere or resized has to be mapped afresh
+        int res = FAT32_CheckEntry(s->entry_lba, s->entry_offset, s->start_cluster, s->size);
+        if (res < 0) return -2;
+        if (res == 0 &&
+            FAT32_OpenMapped(s->start_cluster, s->size, s->extents, s->num_extents, s->extents_complete, file) == 0) {
+            return 1;
+        }
+        drop_song(p, i);
+        fb->dirty = 1;
+        break;
+    }
+
+    FAT32_OpenFile(song->start_cluster, song->size, file);
+
+    // Most recent first; the oldest falls off the end
+    uint32_t keep = (p->num_songs < FASTBOOT_SONGS) ? p->num_songs : FASTBOOT_SONGS - 1;
+    memmove(&p->songs[1], &p->songs[0], keep * sizeof(FastbootSong));
+    FastbootSong* s = &p->songs[0];
+    memset(s, 0, sizeof(*s));
+    s->name_hash = song->name_hash;
+    s->start_cluster = song->start_cluster;
+    s->size = song->size;
+    s->entry_lba = song->entry_lba;
+    s->entry_offset = song->entry_offset;
+    s->num_extents = file->numExtents;
+    s->extents_complete = file->extentsComplete;
+    memcpy(s->extents, file->extents, file->numExtents * sizeof(FAT32_Extent));
+    p->num_songs = keep + 1;
+    fb->dirty = 1;
+    return 0;
+}
+
+int fastboot_save(Fastboot* fb) {
+    if (fb->page.sd_clock != SD_BusClock()) {
+        fb->page.sd_clock = SD_BusClock();
+        fb->dirty = 1;
+    }
+    if (!fb->dirty) return 0;
+    fb->page.checksum = page_checksum(&fb->page);
+    if (flashErasePage(FASTBOOT_PAGE) != 0) return -1;
+    if (flashProgram(FASTBOOT_PAGE, 0, &fb->page, sizeof(fb->page)) != 0) return -1;
+    fb->dirty = 0;
+    return 0;
+}
@@ -0,0 +1,72 @@
+// fastboot.h
+// Boot metadata kept in the last page of internal flash: the SD bus clock, the
+// FAT32 geometry of the card and the extent maps of the songs played most recently. When the card's
+// serial number and volume signature still match, the mount and the FAT walk
+// for those songs are skipped, and the card is tried at the saved clock before the
+// clock steps are read through. A saved map is only used after the song's directory
+// entry has been read again and still has the saved first cluster and size.
+//
+// The page is rewritten only when a song not in it is played or the card changed,
+// and always before playback starts: erasing stalls the CPU for ~22 ms.
+
+#ifndef FASTBOOT_H
+#define FASTBOOT_H
+
+#include <stdint.h>
+#include "STM32L432KC_SD.h"
+#include "STM32L432KC_FLASH.h"
+#include "song_index.h"
+
+#define FASTBOOT_MAGIC   0x54534246 // "FBST"
+#define FASTBOOT_VERSION 2
+#define FASTBOOT_SONGS   8                 // Extent maps kept, most recently played first
+#define FASTBOOT_PAGE    (FLASH_PAGES - 1) // Clear of the program at the start of flash
+
+typedef struct {
+    uint32_t     name_hash;     // song_name_hash of the file
+    uint32_t     start_cluster;
+    uint32_t     size;
+    uint32_t     entry_lba;     // Where its directory entry was when it was mapped
+    uint16_t     entry_offset;
+    uint8_t      num_extents;
+    uint8_t      extents_complete;
+    FAT32_Extent extents[FAT32_MAX_EXTENTS];
+} FastbootSong;
+
+// Page layout; a multiple of 8 bytes so it programs in whole double words
+typedef struct {
+    uint32_t       magic;
+    uint32_t       version;
+    uint32_t       signature; // FAT32_VolumeSignature when the songs were mapped
+    uint32_t       num_songs;
+    uint32_t       sd_clock;  // SD_BusClock when the page was saved
+    FAT32_Geometry geometry;
+    FastbootSong   songs[FASTBOOT_SONGS];
+    uint32_t       reserved2;
+    uint32_t       checksum;  // FNV-1a of everything above
+} FastbootPage;
+
+typedef struct {
+    FastbootPage page;       // RAM copy
+    uint8_t      valid;      // page held a good record at boot
+    uint8_t      mounted;    // Its geometry matched the card
+    uint8_t      dirty;      // Changed since it was read
+} Fastboot;
+
+// Reads the page, then starts the card at its bus clock and mounts it with its
+// geometry if it is valid, or with SD_Init and FAT32_Init if not. Returns 0, or
+// negative as those do.
+int fastboot_mount(Fastboot* fb);
+
+// Drops the saved extent maps if the volume signature has changed since they were made
+void fastboot_check(Fastboot* fb, uint32_t signature);
+
+// Opens a song from its saved extent map, or by walking the FAT if it has none, or
+// its directory entry no longer matches, and remembering the result. Returns 1 if
+// the saved map was used, 0 after a FAT walk, -2 on a card error.
+int fastboot_open(Fastboot* fb, const SongEntry* song, AudioFile* file);
+
+// Writes the page if anything changed. Returns 0, or -1 on a flash error.
+int fastboot_save(Fastboot* fb);
+
+#endif
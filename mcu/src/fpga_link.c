@@ -0,0 +1,72 @@
+// fpga_link.c
+// Note and status frames to and from the FPGA
+
+#include "fpga_link.h"
+#include "STM32L432KC_SPIBUS.h"
+#include <string.h>
+
+static uint32_t get_be32(const uint8_t* b) {
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+// SpiBusDone: runs where the arbiter sent the frame, SD_Poll included
+static void frame_done(void* ctx, const uint8_t* rx, int len) {
+    FpgaLink* link = (FpgaLink*)ctx;
+    link->answered++;
+    if (len != FPGA_FRAME_BYTES || rx[0] != FPGA_FRAME_SYNC) {
+        link->bad_frames++;
+        link->more = 0;
+        return;
+    }
+    link->frames++;
+    if (rx[1] & 0x80) link->lost++;
+    link->more = (rx[1] & 0x0F) != 0;
+    link->score = (uint16_t)((rx[2] << 8) | rx[3]);
+
+    int count = (rx[1] >> 4) & 0x07;
+    if (count > FPGA_FRAME_EVENTS) count = FPGA_FRAME_EVENTS;
+    for (int i = 0; i < count; i++) {
+        uint32_t ev = get_be32(&rx[4 + 4 * i]);
+        uint8_t next = (link->ring_head + 1) & (FPGA_HIT_RING - 1);
+        if (next == link->ring_tail) {
+            link->lost++;
+            continue;
+        }
+        FpgaHit* hit = &link->ring[link->ring_head];
+        hit->lane = (uint8_t)(ev >> 30);
+        hit->judgment = (uint8_t)((ev >> 28) & 0x03);
+        hit->time_us = ev & 0x0FFFFFFF;
+        link->ring_head = next;
+        link->hits++;
+    }
+}
+
+void fpga_link_init(FpgaLink* link, uint8_t priority) {
+    memset(link, 0, sizeof(*link));
+    link->priority = priority;
+}
+
+int fpga_link_send(FpgaLink* link, uint8_t lanes) {
+    uint8_t frame[FPGA_FRAME_BYTES] = {0};
+    frame[0] = lanes & 0x0F;
+    link->queued++; // Before the transfer: a free bus sends and parses it right here
+    if (spiBusTransfer(HAL_DEV_FPGA, link->priority, frame, FPGA_FRAME_BYTES, frame_done, link) != 0) {
+        link->queued--;
+        return -1;
+    }
+    link->idle_calls = 0;
+    return 0;
+}
+
+int fpga_link_service(FpgaLink* link) {
+    if (link->queued != link->answered) return 0; // Its answer will say whether more is waiting
+    if (!link->more && ++link->idle_calls < FPGA_POLL_EVERY) return 0;
+    return fpga_link_send(link, 0);
+}
+
+int fpga_link_next_hit(FpgaLink* link, FpgaHit* hit) {
+    if (link->ring_tail == link->ring_head) return 0;
+    *hit = link->ring[link->ring_tail];
+    link->ring_tail = (link->ring_tail + 1) & (FPGA_HIT_RING - 1);
+    return 1;
+}
@@ -0,0 +1,61 @@
+// fpga_link.h
+// Full-duplex link to the FPGA (fpga/src/beat_receiver.sv). Every transaction is
+// one frame: the MCU sends a note byte (lane mask, 0 for none) and zeros, and the
+// FPGA answers with its status in the same clocks:
+//    byte 0     FPGA_FRAME_SYNC
+//    byte 1     overflow (bit 7), events in this frame (bits 6:4), events still queued (bits 3:0)
+//    bytes 2-3  score, big-endian
+//    bytes 4-11 two hit events, big-endian: lane (bits 31:30), judgment (29:28), FPGA time in us (27:0)
+//
+// Notes carry the poll. fpga_link_service adds a poll-only frame when the FPGA
+// said it has more queued, or when nothing has gone out for a while. Frames are
+// queued on the SPI arbiter and parsed when they come back, possibly from inside
+// SD_Poll; hits then wait in a ring for the main loop.
+
+#ifndef FPGA_LINK_H
+#define FPGA_LINK_H
+
+#include <stdint.h>
+
+#define FPGA_FRAME_BYTES  12
+#define FPGA_FRAME_SYNC   0xA5
+#define FPGA_FRAME_EVENTS 2
+#define FPGA_HIT_RING     32 // Hits waiting for fpga_link_next_hit (power of two)
+#define FPGA_POLL_EVERY   3  // fpga_link_service calls without a frame before a poll
+
+enum { FPGA_PERFECT = 1, FPGA_OKAY = 2, FPGA_MISS = 3 };
+
+typedef struct {
+    uint8_t  lane;     // 0-3
+    uint8_t  judgment; // FPGA_PERFECT, FPGA_OKAY or FPGA_MISS
+    uint32_t time_us;  // FPGA clock, wraps every 2^28 us
+} FpgaHit;
+
+typedef struct {
+    uint8_t  priority;          // spiBusTransfer priority of every frame
+    FpgaHit  ring[FPGA_HIT_RING];
+    volatile uint8_t ring_head; // Written where frames are parsed
+    uint8_t  ring_tail;         // Read by the main loop
+    uint8_t  queued;            // Frames handed to the arbiter (main loop only)
+    volatile uint8_t answered;  // Frames back (parser only); queued - answered are in flight
+    volatile uint8_t more;      // The last frame left events queued on the FPGA
+    uint8_t  idle_calls;        // fpga_link_service calls since the last frame
+    volatile uint16_t score;    // Running score from the FPGA
+    uint32_t frames;            // Frames back with a good sync byte
+    uint32_t bad_frames;        // Frames without one: FPGA missing or not configured
+    uint32_t hits;              // Hits received
+    uint32_t lost;              // Frames reporting a full FPGA queue, plus hits the ring refused
+} FpgaLink;
+
+void fpga_link_init(FpgaLink* link, uint8_t priority);
+
+// Queues a frame carrying a note. Returns 0, or -1 if the bus queue is full.
+int fpga_link_send(FpgaLink* link, uint8_t lanes);
+
+// Call regularly (once per DAC refill): sends a poll-only frame when one is due
+int fpga_link_service(FpgaLink* link);
+
+// Takes the oldest hit received. Returns 1 if there was one.
+int fpga_link_next_hit(FpgaLink* link, FpgaHit* hit);
+
+#endif
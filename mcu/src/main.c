@@ -1,270 +1,430 @@
 #include "STM32L432KC.h"
+#include "STM32L432KC_SD.h"
+#include "STM32L432KC_DAC.h"
+#include "STM32L432KC_HAL.h"
+#include "STM32L432KC_SPIBUS.h"
+#include "STM32L432KC_PROF.h"
+#include "onset.h"
+#include "tempo.h"
+#include "chart.h"
+#include "sm_chart.h"
+#include "wav_decode.h"
+#include "song_index.h"
+#include "fastboot.h"
+#include "sched.h"
+#include "fpga_link.h"
+#include "mixer.h"
+#include "stretch.h"
+#include "oversample.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <stdlib.h> // for abs()
 
-#define SECTOR_SIZE 512
 #define TARGET_NAME "MV"
 #define TARGET_EXT  "WAV"
-
-// --- BPB Offsets ---
-#define OFF_BPB_BYTES_PER_SEC  0x0B
-#define OFF_BPB_SEC_PER_CLUS   0x0D
-#define OFF_BPB_RSVD_SEC_CNT   0x0E
-#define OFF_BPB_NUM_FATS       0x10
-#define OFF_BPB_FAT_SZ_32      0x24
-#define OFF_BPB_ROOT_CLUS      0x2C
-#define OFF_PART1_LBA_START    0x1C6
-
-#define CS_FPGA_ENABLE()  (GPIOB->BSRR = (1 << (0 + 16))) // PB0 Low
-#define CS_FPGA_DISABLE() (GPIOB->BSRR = (1 << 0))        // PB0 High
-
-// --- SD Commands ---
-#define CMD0    (0x40+0)    // GO_IDLE_STATE
-#define CMD8    (0x40+8)    // SEND_IF_COND
-#define CMD17   (0x40+17)   // READ_SINGLE_BLOCK
-#define CMD55   (0x40+55)   // APP_CMD
-#define CMD58   (0x40+58)   // READ_OCR
-#define ACMD41  (0x40+41)   // SD_SEND_OP_COND
-
-// --- SPI chip-select (PA11) ---
-#define CS_ENABLE()  (GPIOA->BSRR = (1 << (SPI_CE + 16))) 
-#define CS_DISABLE() (GPIOA->BSRR = (1 << SPI_CE))   
-
-// Global sector buffer
-static uint8_t buffer[SECTOR_SIZE];
-
-// FAT32 globals
-static uint32_t g_lba_begin      = 0;
-static uint32_t g_fat_start_lba  = 0;
-static uint32_t g_data_start_lba = 0;
-static uint32_t g_root_cluster   = 0;
-static uint8_t  g_sec_per_clus   = 0;
-
-#define CLUSTER_LBA(c) (g_data_start_lba + ((uint32_t)((c) - 2U) * g_sec_per_clus))
-
-// --- Circular Buffer Config ---
-#define DELAY_SECONDS 2
-#define BUFFER_SIZE   (16000 * DELAY_SECONDS) 
-
-// Global audio buffer
-static uint8_t audio_delay_buffer[BUFFER_SIZE]; 
-static uint32_t buffer_head = 0; // Write index (Future/SD)
-static uint32_t buffer_tail = 0; // Read index  (Present/DAC)
+#define TARGET_DIFFICULTY "" // StepMania chart to play, "" for the first dance-single one
+
+// Song sample rate. Songs are decoded and resampled to it, and every sample index
+// (playback, beats, charts) counts samples at this rate. The DAC runs at
+// OVERSAMPLE_FACTOR times it, fed by the output stage.
+#define AUDIO_OUT_RATE 16000
+
+// Build with AUDIO_STEREO=1 to play both channels of stereo songs: left on PA4 (DAC1
+// channel 1), right on PA5. Mono songs then play on both. Otherwise songs are mixed
+// down to PA5 alone.
+#ifndef AUDIO_STEREO
+#define AUDIO_STEREO 0
+#endif
+#define OUT_CHANNELS (AUDIO_STEREO ? 2 : 1)
+
+// Practice mode: the song plays at this percentage of its tempo, at the same pitch,
+// through the time-stretcher (STRETCH_MIN_PCT to 100). The console can change it.
+#define PRACTICE_SPEED_PCT 100
+
+#define CONSOLE_BAUD 115200 // USART2, the ST-LINK virtual COM port
+
+#define CS_FPGA_DISABLE() hal_chip_select(HAL_DEV_FPGA, 0) // PB0 High
+
+// The FPGA's receiver shifts on SCK and hands each byte to its 24 MHz fabric
+// clock through a synchroniser, so it gets a slower clock than the card: 5 MHz
+#define FPGA_SPI_BR   3
+#define FPGA_PRIO_NOTE 1 // Arbiter priority of FPGA frames
+
+// Audio data is streamed in multi-block runs: one run is played while DMA fills the other
+#define STREAM_RUN_SECTORS 4
+static uint8_t  stream_buf[2][STREAM_RUN_SECTORS * SECTOR_SIZE];
+static uint32_t stream_len[2]; // Valid bytes in each stream_buf
+static uint8_t  stream_cur = 0; // stream_buf being played
+static AudioFile song;
+static SongIndex library; // Every playable song on the card
+static Fastboot boot;      // Mount and extent metadata kept in flash
+static uint32_t boot_ms;   // Time from main() to the first sample
+static uint32_t open_ms;   // And to the song being open: the part fastboot shortens
+static WavDecoder play_dec;
+static uint32_t bytes_left_in_file = 0;
+static uint32_t sd_buffer_idx = 0; // Read index into stream_buf[stream_cur]
+static uint32_t play_pos = 0;      // Song position of the next sample for the DAC
+static uint32_t out_pos = 0;       // Samples handed to the DAC so far
+static int      stream_refill_due = 0; // The spare run is free and not yet requested
+
+// DAC ping-pong buffer: DMA plays one half while the main loop fills the other.
+// DAC_BUF_SAMPLES counts frames at the song rate; the output stage turns each into
+// OVERSAMPLE_FACTOR DAC frames. In stereo a frame holds a left and a right value.
+#define DAC_BUF_SAMPLES 512
+#define PCM_HALF_VALUES (DAC_BUF_SAMPLES / 2 * OUT_CHANNELS)
+#define DAC_HALF_VALUES (PCM_HALF_VALUES * OVERSAMPLE_FACTOR)
+static uint16_t dac_buf[2 * DAC_HALF_VALUES];
+static int16_t  pcm_block[PCM_HALF_VALUES]; // Decoded frames for one half
+static Oversampler dac_out;                 // pcm_block to DAC values
+
+// Decode cost, from the DWT cycle counter
+static uint32_t decode_cycles  = 0;
+static uint32_t decode_samples = 0;
+
+// Below 100% the song goes through the stretcher, which stays in the path for the rest
+// of the song so that the samples it holds are not skipped. Song positions (beats,
+// notes, play_pos) then run slower than out_pos.
+static Stretch  stretch;
+static uint32_t speed_pct = PRACTICE_SPEED_PCT;
+static int      stretching = 0;
+
+// --- Lookahead Config ---
+// Beat detection reads the song through a second cursor that runs ahead of playback,
+// so only beat events (not audio) are held for the lookahead window.
+#define NOTE_TRAVEL_SECONDS 2  // Time a note takes to fall to the hit line
+#define LOOKAHEAD_SECONDS   4  // Analysis lead over playback (>= NOTE_TRAVEL_SECONDS)
+
+static AudioFile ana_file;     // Analysis cursor: own position, same extent map
+static WavDecoder ana_dec;
+static uint8_t   ana_buf[STREAM_RUN_SECTORS * SECTOR_SIZE];
+static uint32_t  ana_len  = 0;
+static uint32_t  ana_idx  = 0;
+static uint32_t  ana_left = 0; // Bytes of the data chunk not yet decoded
+static uint32_t  ana_pos  = 0; // Sample index of the next sample to analyse
+static uint32_t  travel_samples    = 0;
+static uint32_t  lookahead_samples = 0;
+
+// Detected beats waiting for their note to be sent
+#define BEAT_QUEUE_LEN 64
+typedef struct {
+    uint32_t sample; // Sample index where the beat is heard
+    uint8_t  lanes;
+} BeatEvent;
+static BeatEvent beat_queue[BEAT_QUEUE_LEN];
+static uint8_t   beat_q_head = 0; // Next free slot
+static uint8_t   beat_q_tail = 0; // Oldest event
+static uint32_t  beats_dropped = 0;
+
+// Notes out to the FPGA, and the player's hits and score back
+static FpgaLink fpga;
+static uint32_t judged[4]; // Hits per judgment, indexed by FPGA_PERFECT...FPGA_MISS
+
+// One-shot sounds mixed over the song, loaded from the root of the card at song start:
+// an assist tick as each note reaches the hit line, and a sound for every hit
+#define ASSIST_NAME "ASSIST"
+#define HIT_NAME    "HIT"
+#define SOUND_LEVEL_Q15 16384 // Sounds are mixed at half scale, under the song
+enum { SOUND_ASSIST, SOUND_HIT };
+static Mixer mix;
+
+// Note source, picked per song: a precompiled <TARGET_NAME>.CHT, else a StepMania
+// <TARGET_NAME>.SM/.SSC, else live beat detection
+enum { NOTES_ANALYSIS, NOTES_CHART, NOTES_STEPMANIA };
+static int         note_source = NOTES_ANALYSIS;
+static ChartReader chart;
+static AudioFile   sm_file;
+static SmParser    sm;
+static int      chart_pending = 0; // chart_note holds a note not yet queued
+static uint32_t chart_note_sample;
+static uint8_t  chart_note_lanes;
 
 // --- BEAT DETECTION SETTINGS ---
-// SENSITIVITY
-// Signal must be 120% louder than average to trigger.
-#define SENSITIVITY 1.2f 
+// Onsets come from the spectral-flux detector in onset.c, one ONSET_FRAME block at a time.
+// tempo.c follows the beat and snaps notes onto a 1/TEMPO_SNAP_DIV-beat grid.
 
-// MIN_VOLUME
-#define MIN_VOLUME 15     
+// COOLDOWN before the tempo locks: 6000 samples @ 16kHz = 375ms.
+// Once locked, notes are at least ~3/4 of a grid step apart.
+#define BEAT_COOLDOWN_SAMPLES 6000
 
 const uint8_t LANE_MASKS[4] = {0x01, 0x02, 0x04, 0x08};
 
 // State variables for beat detection
-static float avg_energy = 20.0f; // Start with a reasonable guess
-static int beat_cooldown = 0;
+static OnsetDetector onset;
+static TempoTracker  tempo;
+static int16_t  onset_frame[ONSET_FRAME]; // Signed 16-bit samples for the current block
+static uint16_t onset_fill = 0;
+static int32_t  beat_cooldown = 0;
+static uint32_t last_note_sample = 0; // Grid point of the last queued note
+static int      have_note = 0;
+
+// Main loop tasks, in priority order. Audio refills a DAC half when the DMA interrupt
+// frees one; the others are posted by what they depend on.
+static Scheduler sched;
+static int task_audio;   // Refill the free DAC half
+static int task_sd;      // Chain the blocks of a DMA read, then queue the next run into the spare buffer
+static int task_fpga;    // Send notes that are due
+static int task_console; // Commands and profiler frames
+static int task_notes;   // A DAC half of analysis, or chart notes up to the lookahead
+static volatile int playing = 0;
+
+#define CONSOLE_DEADLINE_MS 100
 
 // =====================================================================
-// HELPER: Beat Detection & FPGA Trigger
+// HELPER: Beat Detection
 // =====================================================================
-void process_beat(uint8_t sample) {
-    // 1. Calculate Amplitude (0 to 128)
-    int16_t amplitude = (int16_t)sample - 128;
-    if (amplitude < 0) amplitude = -amplitude;
-
-    // 2. Dynamic Threshold Logic
-    float threshold = avg_energy * SENSITIVITY;
-
-    if (amplitude > threshold && amplitude > MIN_VOLUME) {
-        
-        if (beat_cooldown == 0) {
-            // BEAT DETECTED!
-            uint8_t packet = 0;
-            int p_idx = sample % 4; 
-            
-            // Basic beat
-            packet |= LANE_MASKS[p_idx];
-            
-            // REMOVED: Double beat logic.
-            // This prevents spawning 2 tiles at once, making it easier to play.
-            /* if (amplitude > (threshold * 1.5f)) {
-                 packet |= LANE_MASKS[(p_idx + 1) % 4];
-            }
-            */
-
-            // Send to FPGA
-            CS_FPGA_ENABLE(); 
-            spiSendReceive(packet);
-            CS_FPGA_DISABLE();
-
-            // COOLDOWN INCREASED: 4000 samples @ 16kHz = 250ms.
-            // This caps the speed at ~4 beats per second (easier).
-            beat_cooldown = 6000; 
-        }
+static void detect_beat(const int16_t* frame, uint32_t sample_index) {
+    uint8_t bands = onset_process(&onset, frame);
+    uint32_t onset_time = sample_index + ONSET_FRAME / 8; // Attacks show up early in the block
+    tempo_update(&tempo, onset.strength, bands != 0, onset_time);
+
+    if (beat_cooldown > 0) beat_cooldown -= ONSET_FRAME;
+    if (bands == 0 || beat_cooldown > 0) return;
+
+    // Two onsets snapping to the same grid point make one note, and the queue stays in order
+    uint32_t note_sample = tempo_snap(&tempo, onset_time);
+    if (have_note && (int32_t)(note_sample - last_note_sample) <= 0) return;
+
+    // BEAT DETECTED!
+    // Only the band with the clearest onset gets a tile, so bass hits land in
+    // the left lane and hats in the right one. Never more than one tile at once,
+    // making it easier to play.
+    uint8_t packet = LANE_MASKS[onset.strongest];
+
+    // Queue it; the note goes out NOTE_TRAVEL_SECONDS before the beat plays
+    uint8_t next = (beat_q_head + 1) % BEAT_QUEUE_LEN;
+    if (next != beat_q_tail) {
+        beat_queue[beat_q_head].sample = note_sample;
+        beat_queue[beat_q_head].lanes  = packet;
+        beat_q_head = next;
+        last_note_sample = note_sample;
+        have_note = 1;
+    } else {
+        beats_dropped++;
     }
 
-    // 3. Update Running Average (Leaky Integrator)
-    avg_energy = (avg_energy * 0.999f) + ((float)amplitude * 0.001f);
+    uint32_t grid = tempo_grid_samples(&tempo);
+    beat_cooldown = grid ? (int32_t)(grid - grid / 4) : BEAT_COOLDOWN_SAMPLES;
+}
 
-    // 4. Handle Cooldown
-    if (beat_cooldown > 0) {
-        beat_cooldown--;
-    }
+void process_beat(const int16_t* frame, uint32_t sample_index) {
+    PROF_START(PROF_BEAT);
+    detect_beat(frame, sample_index);
+    PROF_STOP(PROF_BEAT);
 }
 
 // =====================================================================
-// SD + SPI 
+// HELPER: FPGA Trigger
 // =====================================================================
 
-uint8_t SD_Command(uint8_t cmd, uint32_t arg, uint8_t crc) {
-    uint8_t retry = 0xFF;
-    while (spiSendReceive(0xFF) != 0xFF && retry-- > 0);
-
-    spiSendReceive(cmd);
-    spiSendReceive((uint8_t)(arg >> 24));
-    spiSendReceive((uint8_t)(arg >> 16));
-    spiSendReceive((uint8_t)(arg >> 8));
-    spiSendReceive((uint8_t)arg);
-    spiSendReceive(crc);
-
-    uint8_t res = 0;
-    for (int i = 0; i < 100; i++) {
-        res = spiSendReceive(0xFF);
-        if ((res & 0x80) == 0) break;
-    }
-    return res;
+// Output sample index at which a song position will be heard
+static uint32_t song_to_out(uint32_t sample) {
+    int32_t ahead = (int32_t)(sample - play_pos);
+    return out_pos + (uint32_t)(ahead * 100 / (int32_t)speed_pct);
 }
 
-int SD_ReadSector(uint32_t sector, uint8_t* buff) {
-    CS_ENABLE();
-    if (SD_Command(CMD17, sector, 0xFF) != 0x00) {
-        CS_DISABLE();
-        return -1;
-    }
-    int timeout = 10000;
-    while (spiSendReceive(0xFF) != 0xFE && timeout-- > 0);
-    if (timeout <= 0) {
-        CS_DISABLE();
-        return -2;
+// Sends every queued note whose beat is now within NOTE_TRAVEL_SECONDS of playback.
+// Notes fall in real time, so when practising that is less of the song.
+// The bus arbiter sends it at once, or right after the SD run holding the bus.
+static void release_beats(void) {
+    uint32_t travel = travel_samples * speed_pct / 100;
+    while (beat_q_tail != beat_q_head && beat_queue[beat_q_tail].sample <= play_pos + travel) {
+        PROF_START(PROF_FPGA_SEND);
+        int res = fpga_link_send(&fpga, beat_queue[beat_q_tail].lanes);
+        PROF_STOP(PROF_FPGA_SEND);
+        if (res != 0) return; // Bus queue full; the next DAC refill tries again
+        mixer_trigger(&mix, SOUND_ASSIST, song_to_out(beat_queue[beat_q_tail].sample));
+        beat_q_tail = (beat_q_tail + 1) % BEAT_QUEUE_LEN;
     }
-    for (int i = 0; i < SECTOR_SIZE; i++) {
-        buff[i] = spiSendReceive(0xFF);
-    }
-    spiSendReceive(0xFF);
-    spiSendReceive(0xFF);
-    CS_DISABLE();
-    return 0;
 }
 
-int SD_Init(void) {
-    RCC->AHB2ENR |= RCC_AHB2ENR_GPIOAEN;
-    pinMode(SPI_CE, GPIO_OUTPUT);
-    CS_DISABLE();
-    for (int i = 0; i < 10; i++) spiSendReceive(0xFF);
-    CS_ENABLE();
-    uint8_t r0 = SD_Command(CMD0, 0, 0x95);
-    CS_DISABLE();
-    if (r0 != 0x01) return -1;
-
-    CS_ENABLE();
-    SD_Command(CMD8, 0x1AA, 0x87);
-    spiSendReceive(0xFF); spiSendReceive(0xFF); spiSendReceive(0xFF); spiSendReceive(0xFF);
-    CS_DISABLE();
-
-    int retries = 1000;
-    uint8_t res;
-    do {
-        CS_ENABLE();
-        SD_Command(CMD55, 0, 0xFF);
-        res = SD_Command(ACMD41, 0x40000000, 0xFF);
-        CS_DISABLE();
-    } while (res != 0x00 && retries-- > 0);
-
-    if (retries <= 0 || res != 0x00) return -2;
-    return 0;
+static void print_bus_stats(void) {
+    SpiBusStats bus;
+    spiBusStats(&bus);
+    printf("SPI bus: %lu messages, %lu waiting, at most %lu, worst wait %lu us, %lu dropped.\n",
+           (unsigned long)bus.sent, (unsigned long)spiBusQueueDepth(), (unsigned long)bus.max_depth,
+           (unsigned long)(bus.worst_latency / (SystemCoreClock / 1000000)), (unsigned long)bus.dropped);
+}
+
+static void print_player_stats(void) {
+    printf("Player: %lu perfect, %lu okay, %lu missed, score %u.\n", (unsigned long)judged[FPGA_PERFECT],
+           (unsigned long)judged[FPGA_OKAY], (unsigned long)judged[FPGA_MISS], (unsigned)fpga.score);
+    printf("FPGA link: %lu frames, %lu without sync, %lu hits lost.\n", (unsigned long)fpga.frames,
+           (unsigned long)fpga.bad_frames, (unsigned long)fpga.lost);
+}
+
+static void print_output_stats(void) {
+    uint32_t half = DAC_BUF_SAMPLES / 2;
+    mixer_report(&mix, half, SystemCoreClock / AUDIO_OUT_RATE * half);
+    if (stretching) stretch_report(&stretch, SystemCoreClock / AUDIO_OUT_RATE * half);
+    oversample_report(&dac_out, SystemCoreClock / AUDIO_OUT_RATE * half);
 }
 
 // =====================================================================
-// FAT32 helpers
+// SD streaming
 // =====================================================================
 
-uint32_t get_u32(const uint8_t* b, int offset) {
-    return (uint32_t)b[offset] | ((uint32_t)b[offset+1] << 8) | ((uint32_t)b[offset+2] << 16) | ((uint32_t)b[offset+3] << 24);
+// Kicks off the DMA read of the next run of the song into the spare buffer
+static void stream_prefetch(void) {
+    uint8_t next = stream_cur ^ 1;
+    stream_refill_due = 0;
+    int count = FAT32_ReadRunAsync(&song, stream_buf[next], STREAM_RUN_SECTORS);
+    stream_len[next] = (count > 0) ? (uint32_t)count * SECTOR_SIZE : 0;
 }
 
-uint16_t get_u16(const uint8_t* b, int offset) {
-    return (uint16_t)b[offset] | ((uint16_t)b[offset+1] << 8);
+// Switches to the prefetched run and has the SD task queue the one after it.
+// Returns -1 at end of file.
+static int stream_next_run(void) {
+    if (stream_refill_due) stream_prefetch(); // Both runs used up before the SD task got a turn
+    while (SD_Poll()) hal_idle();
+    if (stream_len[stream_cur ^ 1] == 0) return -1;
+    stream_cur ^= 1;
+    stream_refill_due = 1;
+    sched_post(&sched, task_sd);
+    return 0;
 }
 
-int match_filename(const uint8_t* entry, const char* name, const char* ext) {
-    for (int i = 0; i < 8; i++) {
-        char c = (i < (int)strlen(name)) ? name[i] : ' ';
-        if (entry[i] != (uint8_t)c) return 0;
-    }
-    for (int i = 0; i < 3; i++) {
-        char c = (i < (int)strlen(ext)) ? ext[i] : ' ';
-        if (entry[8+i] != (uint8_t)c) return 0;
+// Decodes up to max output samples from the playback cursor.
+// Returns fewer only at the end of the data chunk.
+static uint32_t play_decode(int16_t* out, uint32_t max) {
+    uint32_t n = 0;
+    while (n < max && bytes_left_in_file > 0) {
+        if (sd_buffer_idx >= stream_len[stream_cur]) {
+            sd_buffer_idx = 0;
+            if (stream_next_run() != 0) {
+                bytes_left_in_file = 0;
+                break;
+            }
+        }
+        uint32_t avail = stream_len[stream_cur] - sd_buffer_idx;
+        if (avail > bytes_left_in_file) avail = bytes_left_in_file;
+        uint32_t used;
+        n += wav_decode(&play_dec, &stream_buf[stream_cur][sd_buffer_idx], avail, &used, out + n * OUT_CHANNELS, max - n);
+        sd_buffer_idx += used;
+        bytes_left_in_file -= used;
     }
-    return 1;
+    return n;
 }
 
-uint32_t fat32_next_cluster(uint32_t cluster) {
-    uint32_t fat_offset = cluster * 4U;
-    uint32_t sector     = g_fat_start_lba + (fat_offset / SECTOR_SIZE);
-    uint32_t offset     = fat_offset % SECTOR_SIZE;
-    if (SD_ReadSector(sector, buffer) != 0) return 0x0FFFFFFF;
-    return get_u32(buffer, offset) & 0x0FFFFFFF;
-}
-
-int fat32_mount(void) {
-    if (SD_ReadSector(0, buffer) != 0) return -1;
-    g_lba_begin = get_u32(buffer, OFF_PART1_LBA_START);
-    if (g_lba_begin == 0) return -2;
-    if (SD_ReadSector(g_lba_begin, buffer) != 0) return -3;
-    g_sec_per_clus = buffer[OFF_BPB_SEC_PER_CLUS];
-    uint16_t rsvd_sec = get_u16(buffer, OFF_BPB_RSVD_SEC_CNT);
-    uint8_t  num_fats = buffer[OFF_BPB_NUM_FATS];
-    uint32_t fat_sz   = get_u32(buffer, OFF_BPB_FAT_SZ_32);
-    g_root_cluster    = get_u32(buffer, OFF_BPB_ROOT_CLUS);
-    g_fat_start_lba  = g_lba_begin + rsvd_sec;
-    g_data_start_lba = g_fat_start_lba + ((uint32_t)num_fats * fat_sz);
-    return 0;
+// play_decode with its cost counted; also the stretcher's source
+static uint32_t song_source(void* ctx, int16_t* out, uint32_t max) {
+    (void)ctx;
+    uint32_t start = DWT->CYCCNT;
+    uint32_t n = play_decode(out, max);
+    decode_cycles += DWT->CYCCNT - start;
+    decode_samples += n;
+    return n;
 }
 
-int fat32_find_root_file(const char* name, const char* ext, uint32_t* first_cluster, uint32_t* file_size) {
-    uint32_t cluster_start_lba = CLUSTER_LBA(g_root_cluster);
-    for (int sec_offset = 0; sec_offset < g_sec_per_clus; sec_offset++) {
-        uint32_t current_lba = cluster_start_lba + sec_offset;
-        if (SD_ReadSector(current_lba, buffer) != 0) return -1;
-        for (int i = 0; i < SECTOR_SIZE; i += 32) {
-            uint8_t first = buffer[i];
-            if (first == 0x00) return -2;
-            if (first == 0xE5) continue;
-            uint8_t attr = buffer[i+11];
-            if (attr == 0x0F) continue;
-            if (attr & 0x08) continue;
-            if (match_filename(&buffer[i], name, ext)) {
-                uint32_t clus_hi = get_u16(buffer, i + 20);
-                uint32_t clus_lo = get_u16(buffer, i + 26);
-                *first_cluster   = (clus_hi << 16) | clus_lo;
-                *file_size       = get_u32(buffer, i + 28);
-                return 0;
+// Same as play_decode for the analysis cursor, which reads with blocking runs
+static uint32_t ana_decode(int16_t* out, uint32_t max) {
+    uint32_t n = 0;
+    while (n < max && ana_left > 0) {
+        if (ana_idx >= ana_len) {
+            int count = FAT32_ReadRun(&ana_file, ana_buf, STREAM_RUN_SECTORS);
+            if (count <= 0) {
+                ana_left = 0;
+                break;
             }
+            ana_len = (uint32_t)count * SECTOR_SIZE;
+            ana_idx = 0;
         }
+        uint32_t avail = ana_len - ana_idx;
+        if (avail > ana_left) avail = ana_left;
+        uint32_t used;
+        n += wav_decode(&ana_dec, &ana_buf[ana_idx], avail, &used, out + n, max - n);
+        ana_idx += used;
+        ana_left -= used;
+    }
+    return n;
+}
+
+// Runs beat detection until the analysis cursor is lookahead_samples ahead of playback,
+// at most max_samples at a time so the DAC refill is never held up for long
+static void run_analysis(uint32_t max_samples) {
+    while (max_samples > 0 && ana_pos < play_pos + lookahead_samples) {
+        uint32_t want = ONSET_FRAME - onset_fill;
+        if (want > max_samples) want = max_samples;
+        uint32_t got = ana_decode(&onset_frame[onset_fill], want);
+        if (got == 0) return;
+        onset_fill += got;
+        ana_pos += got;
+        max_samples -= got;
+        if (onset_fill == ONSET_FRAME) {
+            process_beat(onset_frame, ana_pos - ONSET_FRAME);
+            onset_fill = 0;
+        }
+    }
+}
+
+// SmReadFn over a FAT32 file: one sector per call, trimmed to the file size
+static int sm_read_sector(void* ctx, uint8_t* buf) {
+    AudioFile* file = (AudioFile*)ctx;
+    uint32_t pos = file->sectorsRead * SECTOR_SIZE;
+    if (pos >= file->size) return 0;
+    int count = FAT32_ReadRun(file, buf, 1);
+    if (count == -1) return 0;
+    if (count < 0) return -1;
+    uint32_t left = file->size - pos;
+    return (int)(left < SECTOR_SIZE ? left : SECTOR_SIZE);
+}
+
+// Next note from the chart or StepMania file; 1 if there is one
+static int next_chart_note(uint32_t* sample, uint8_t* lanes) {
+    if (note_source == NOTES_CHART) return chart_next(&chart, sample, lanes);
+    SmNote note;
+    int res = sm_next(&sm, &note);
+    if (res == -1) {
+        printf("No dance-single chart in the StepMania file.\n");
+        note_source = NOTES_ANALYSIS;
     }
-    return -2;
+    if (res != 1) return 0;
+    *sample = note.sample;
+    *lanes  = note.lanes;
+    return 1;
+}
+
+// Moves chart notes into the beat queue until it is full or lookahead_samples ahead of playback
+static void feed_chart(void) {
+    for (;;) {
+        if (!chart_pending) {
+            if (next_chart_note(&chart_note_sample, &chart_note_lanes) != 1) return;
+            chart_pending = 1;
+        }
+        if (chart_note_sample > play_pos + lookahead_samples) return;
+
+        uint8_t next = (beat_q_head + 1) % BEAT_QUEUE_LEN;
+        if (next == beat_q_tail) return; // Full; release_beats will make room
+        beat_queue[beat_q_head].sample = chart_note_sample;
+        beat_queue[beat_q_head].lanes  = chart_note_lanes;
+        beat_q_head = next;
+        chart_pending = 0;
+    }
+}
+
+// Keeps the note source ahead of playback
+static void run_notes(uint32_t max_samples) {
+    if (note_source != NOTES_ANALYSIS) feed_chart();
+    if (note_source == NOTES_ANALYSIS) run_analysis(max_samples); // Also after a chart fell through
 }
 
 // =====================================================================
 // WAV header parse 
 // =====================================================================
 
+uint32_t get_u32(const uint8_t* b, int offset) {
+    return (uint32_t)b[offset] | ((uint32_t)b[offset+1] << 8) | ((uint32_t)b[offset+2] << 16) | ((uint32_t)b[offset+3] << 24);
+}
+
+uint16_t get_u16(const uint8_t* b, int offset) {
+    return (uint16_t)b[offset] | ((uint16_t)b[offset+1] << 8);
+}
+
 typedef struct {
+    uint16_t audio_format;
     uint32_t sample_rate;
     uint16_t bits_per_sample;
     uint16_t num_channels;
+    uint16_t block_align;
     uint32_t data_offset;
     uint32_t data_size;
 } WavInfo;
@@ -281,8 +441,10 @@ int parse_wav_header(const uint8_t* sec0, uint32_t file_size, WavInfo* w) {
         uint32_t size = get_u32(ch, 4);
         uint32_t data_off = offset + 8;
         if (id == 0x20746D66) { // "fmt "
+            w->audio_format = get_u16(sec0, data_off);
             w->num_channels = get_u16(sec0, data_off + 2);
             w->sample_rate = get_u32(sec0, data_off + 4);
+            w->block_align = get_u16(sec0, data_off + 12);
             w->bits_per_sample = get_u16(sec0, data_off + 14);
             have_fmt = 1;
         } else if (id == 0x61746164) { // "data"
@@ -302,33 +464,173 @@ int parse_wav_header(const uint8_t* sec0, uint32_t file_size, WavInfo* w) {
     return 0;
 }
 
+// Decodes <name>.WAV from the root of the card into a mixer sound, at the DAC rate
+// and SOUND_LEVEL_Q15. Sounds longer than MIXER_SOUND_MAX are cut. Runs before
+// playback, so it borrows the analysis buffer and decoder. Returns 0, or -1 if the
+// file is missing or unplayable, which leaves the sound empty.
+static int load_sound(const char* name, MixerSound* s) {
+    AudioFile f;
+    WavInfo w;
+    s->len = 0;
+    if (FAT32_FindFile(name, "WAV", &f) != 0) return -1;
+    int got = sm_read_sector(&f, ana_buf);
+    if (got <= 0 || parse_wav_header(ana_buf, f.size, &w) != 0) return -1;
+    if (wav_decoder_init(&ana_dec, w.audio_format, w.num_channels, w.bits_per_sample, w.block_align,
+                         w.sample_rate, AUDIO_OUT_RATE) != 0) return -1;
+
+    uint32_t idx = w.data_offset;
+    uint32_t left = w.data_size;
+    while (left > 0 && s->len < MIXER_SOUND_MAX) {
+        if (idx >= (uint32_t)got) {
+            idx -= (uint32_t)got;
+            got = sm_read_sector(&f, ana_buf);
+            if (got <= 0) break;
+            continue;
+        }
+        uint32_t avail = (uint32_t)got - idx;
+        if (avail > left) avail = left;
+        uint32_t used;
+        s->len += wav_decode(&ana_dec, ana_buf + idx, avail, &used, &s->data[s->len], MIXER_SOUND_MAX - s->len);
+        idx += used;
+        left -= used;
+    }
+    for (uint32_t i = 0; i < s->len; i++) s->data[i] = (int16_t)((s->data[i] * SOUND_LEVEL_Q15) >> 15);
+    printf("Sound %s: %u ms.\n", name, (unsigned)(s->len / (AUDIO_OUT_RATE / 1000)));
+    return 0;
+}
+
 // =====================================================================
 // DAC & Timer
 // =====================================================================
 
-void initDAC(void) {
-    RCC->APB1ENR1 |= RCC_APB1ENR1_DAC1EN;
-    RCC->AHB2ENR  |= RCC_AHB2ENR_GPIOAEN;
-    GPIOA->MODER &= ~(0b11U << (5 * 2));
-    GPIOA->MODER |=  (0b11U << (5 * 2));
-    DAC1->CR &= ~DAC_CR_TEN2;
-    DAC1->CR |= DAC_CR_EN2;
+// Fills one DAC half from the playback cursor, padding with silence past the end
+// of the file. Returns 0 once the song has ended and the last sound has rung out.
+static int fill_dac_half(uint16_t* half) {
+    if (speed_pct != 100 && !stretching) {
+        stretch_init(&stretch, song_source, 0, OUT_CHANNELS, play_pos, speed_pct);
+        stretching = 1;
+    }
+    uint32_t n;
+    PROF_START(PROF_DAC_FILL);
+    if (stretching) {
+        n = stretch_process(&stretch, pcm_block);
+        play_pos = stretch.pos;
+    } else {
+        n = song_source(0, pcm_block, DAC_BUF_SAMPLES / 2);
+        play_pos += DAC_BUF_SAMPLES / 2;
+    }
+    PROF_STOP(PROF_DAC_FILL);
+
+    // Sounds ring on past the end of the song, over silence
+    for (uint32_t i = n * OUT_CHANNELS; i < PCM_HALF_VALUES; i++) pcm_block[i] = 0;
+    PROF_START(PROF_MIX);
+    mixer_mix(&mix, pcm_block, DAC_BUF_SAMPLES / 2, out_pos);
+    PROF_STOP(PROF_MIX);
+
+    PROF_START(PROF_OVERSAMPLE);
+    oversample_process(&dac_out, pcm_block, DAC_BUF_SAMPLES / 2, half);
+    PROF_STOP(PROF_OVERSAMPLE);
+    out_pos += DAC_BUF_SAMPLES / 2;
+    return n == DAC_BUF_SAMPLES / 2 || mixer_busy(&mix);
+}
+
+// Runs a command typed on the console, if a full line has arrived.
+// Returns 1 when playback should stop.
+static int console_command(void) {
+    char line[32];
+    if (usartReadLine(line, sizeof(line)) <= 0) return 0;
+    if (strcmp(line, "stop") == 0) return 1;
+    if (strcmp(line, "stats") == 0) {
+        printf("At %lu ms: %lu underruns, %lu beats dropped, %lu log writes dropped.\n",
+               (unsigned long)(play_pos / (AUDIO_OUT_RATE / 1000)), (unsigned long)Audio_Stream_Underruns(),
+               (unsigned long)beats_dropped, (unsigned long)usartDropped());
+        printf("First sample came %lu ms after reset.\n", (unsigned long)boot_ms);
+        sched_report(&sched);
+        print_bus_stats();
+        print_player_stats();
+        print_output_stats();
+    } else if (strncmp(line, "speed ", 6) == 0) {
+        uint32_t pct = (uint32_t)strtoul(line + 6, 0, 10);
+        if (pct < STRETCH_MIN_PCT) pct = STRETCH_MIN_PCT;
+        if (pct > 100) pct = 100;
+        speed_pct = pct;
+        if (stretching) stretch_set_speed(&stretch, speed_pct);
+        printf("Speed %lu%%.\n", (unsigned long)speed_pct);
+    } else {
+        printf("Commands: stats, stop, speed <%d-100>\n", STRETCH_MIN_PCT);
+    }
+    return 0;
+}
+
+// =====================================================================
+// Tasks
+// =====================================================================
+
+static int audio_task(void* ctx) {
+    (void)ctx;
+    uint16_t* half = Audio_Stream_FreeHalf();
+    if (half == 0) return 0;
+    if (!fill_dac_half(half)) playing = 0;
+    Audio_Stream_Commit();
+    // Playback moved on: notes may be due, and the analysis has room to run ahead
+    sched_post(&sched, task_fpga);
+    sched_post(&sched, task_notes);
+    sched_post(&sched, task_console);
+    return Audio_Stream_FreeHalf() != 0; // Both halves were free: fill the other too
+}
+
+static int sd_task(void* ctx) {
+    (void)ctx;
+    if (SD_Poll()) return 0; // Posted again by the next block
+    if (stream_refill_due) stream_prefetch();
+    return 0;
+}
+
+static int fpga_task(void* ctx) {
+    (void)ctx;
+    release_beats();
+    fpga_link_service(&fpga);
+    FpgaHit hit;
+    while (fpga_link_next_hit(&fpga, &hit)) {
+        judged[hit.judgment]++;
+        // The next block to be filled is the earliest the sound can start
+        if (hit.judgment != FPGA_MISS) mixer_trigger(&mix, SOUND_HIT, out_pos);
+    }
+    return 0;
+}
+
+static int notes_task(void* ctx) {
+    (void)ctx;
+    run_notes(DAC_BUF_SAMPLES / 2);
+    return note_source == NOTES_ANALYSIS && ana_left > 0 && ana_pos < play_pos + lookahead_samples;
+}
+
+static int console_task(void* ctx) {
+    (void)ctx;
+    if (console_command()) playing = 0;
+    PROF_POLL();
+    return 0;
+}
+
+// DAC interrupt: a half has played
+static void audio_half_free(void) {
+    sched_post(&sched, task_audio);
 }
 
-void initAudioTimer(uint32_t sample_rate) {
-    if (sample_rate == 0) sample_rate = 16000;
-    RCC->APB1ENR1 |= RCC_APB1ENR1_TIM6EN;
-    TIM6->CR1 = 0;
-    TIM6->PSC = 0;
-    TIM6->ARR = (80000000U / sample_rate) - 1U;
-    TIM6->EGR = TIM_EGR_UG;
-    TIM6->SR  = 0;
-    TIM6->CR1 |= TIM_CR1_CEN;
+// SD DMA interrupt: a block is in, for SD_Poll to check
+static void sd_block_in(void) {
+    sched_post(&sched, task_sd);
 }
 
-static inline void audio_wait_tick(void) {
-    while ((TIM6->SR & TIM_SR_UIF) == 0) {}
-    TIM6->SR &= ~TIM_SR_UIF;
+static void sched_setup(void) {
+    uint32_t cycles_per_sample = SystemCoreClock / AUDIO_OUT_RATE;
+    sched_init(&sched);
+    task_audio   = sched_add(&sched, "audio", audio_task, 0, 0, cycles_per_sample * (DAC_BUF_SAMPLES / 2));
+    task_sd      = sched_add(&sched, "sd", sd_task, 0, 1, cycles_per_sample * (DAC_BUF_SAMPLES / 2));
+    task_fpga    = sched_add(&sched, "fpga", fpga_task, 0, 2, cycles_per_sample * (DAC_BUF_SAMPLES / 2));
+    task_console = sched_add(&sched, "console", console_task, 0, 3, SystemCoreClock / 1000 * CONSOLE_DEADLINE_MS);
+    // Background: the lookahead leaves it seconds of slack, so it gets whatever time is left
+    task_notes   = sched_add(&sched, "notes", notes_task, 0, 4, cycles_per_sample * ONSET_FRAME);
 }
 
 // =====================================================================
@@ -336,89 +638,145 @@ static inline void audio_wait_tick(void) {
 // =====================================================================
 
 int play_wav(void) {
-    uint32_t file_clus = 0;
-    uint32_t file_size = 0;
-    if (fat32_find_root_file(TARGET_NAME, TARGET_EXT, &file_clus, &file_size) != 0) {
+    const SongEntry* entry = song_index_find(&library, TARGET_NAME "." TARGET_EXT);
+    if (entry && song_index_check(entry) != 0) {
+        // Changed since it was indexed, without the signature noticing
+        printf("Song changed on the card, rebuilding the library.\n");
+        if (song_index_rebuild(&library) != 0) return -1;
+        fastboot_check(&boot, library.signature);
+        entry = song_index_find(&library, TARGET_NAME "." TARGET_EXT);
+    }
+    if (!entry) {
         printf("File not found.\n"); return -1;
     }
-
-    uint32_t cluster = file_clus;
-    uint32_t sector_in_cluster = 0;
-    SD_ReadSector(CLUSTER_LBA(cluster), buffer); 
+    int mapped = fastboot_open(&boot, entry, &song);
+    if (mapped < 0) return -1;
+    if (boot_ms == 0) open_ms = DWT->CYCCNT / (SystemCoreClock / 1000);
+    note_source = (chart_open(&chart, TARGET_NAME) == 0) ? NOTES_CHART : NOTES_ANALYSIS;
+    chart_pending = 0;
+    memset(judged, 0, sizeof(judged));
+    mixer_init(&mix, OUT_CHANNELS);
+    oversample_init(&dac_out, OUT_CHANNELS, OVERSAMPLE_SHAPING);
+    load_sound(ASSIST_NAME, &mix.sounds[SOUND_ASSIST]);
+    load_sound(HIT_NAME, &mix.sounds[SOUND_HIT]);
+    sched_setup();
+
+    stream_cur = 0;
+    int count = FAT32_ReadRun(&song, stream_buf[0], STREAM_RUN_SECTORS);
+    if (count <= 0) return -1;
+    stream_len[0] = (uint32_t)count * SECTOR_SIZE;
     WavInfo w;
-    if (parse_wav_header(buffer, file_size, &w) != 0) return -1;
-    
-    uint32_t bytes_left_in_file = w.data_size;
-    uint32_t sd_buffer_idx = w.data_offset; 
-    
-    printf("Buffering %d seconds...\n", DELAY_SECONDS);
-    
-    // --- 3. PRIME BUFFER ---
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        if (bytes_left_in_file == 0) break;
-        if (sd_buffer_idx >= SECTOR_SIZE) {
-            sd_buffer_idx = 0;
-            sector_in_cluster++;
-            if (sector_in_cluster >= g_sec_per_clus) {
-                cluster = fat32_next_cluster(cluster);
-                if (cluster >= 0x0FFFFFF8) break; 
-                sector_in_cluster = 0;
-            }
-            SD_ReadSector(CLUSTER_LBA(cluster) + sector_in_cluster, buffer);
-        }
-        uint8_t sample = buffer[sd_buffer_idx++];
-        bytes_left_in_file--;
-        
-        // Use the new helper function
-        process_beat(sample);
-
-        audio_delay_buffer[i] = sample;
+    if (parse_wav_header(stream_buf[0], song.size, &w) != 0) return -1;
+    if (wav_decoder_init(&play_dec, w.audio_format, w.num_channels, w.bits_per_sample, w.block_align,
+                         w.sample_rate, AUDIO_OUT_RATE) != 0 ||
+        wav_decoder_init(&ana_dec, w.audio_format, w.num_channels, w.bits_per_sample, w.block_align,
+                         w.sample_rate, AUDIO_OUT_RATE) != 0) {
+        printf("Unsupported WAV: format 0x%04x, %u channels, %u bits.\n",
+               w.audio_format, w.num_channels, w.bits_per_sample);
+        return -1;
+    }
+    if (AUDIO_STEREO) wav_decoder_stereo(&play_dec);
+
+    // The analysis cursor starts from the same first run as playback
+    ana_file = song;
+    memcpy(ana_buf, stream_buf[0], stream_len[0]);
+    ana_len  = stream_len[0];
+    ana_idx  = w.data_offset;
+    ana_left = w.data_size;
+    ana_pos  = 0;
+
+    stream_prefetch();
+    bytes_left_in_file = w.data_size;
+    sd_buffer_idx = w.data_offset; 
+    play_pos = 0;
+    out_pos = 0;
+    stretching = 0;
+
+    uint32_t rate = AUDIO_OUT_RATE;
+    decode_cycles = decode_samples = 0;
+    travel_samples    = rate * NOTE_TRAVEL_SECONDS;
+    lookahead_samples = rate * LOOKAHEAD_SECONDS;
+    beat_q_head = beat_q_tail = 0;
+    onset_init(&onset, rate);
+    tempo_init(&tempo, rate, ONSET_FRAME);
+    onset_fill = 0;
+    beat_cooldown = 0;
+    have_note = 0;
+
+    if (note_source == NOTES_CHART && chart.sample_rate != rate) {
+        printf("Chart is for %lu Hz, ignoring it.\n", (unsigned long)chart.sample_rate);
+        note_source = NOTES_ANALYSIS;
+    }
+    if (note_source == NOTES_ANALYSIS &&
+        (FAT32_FindFile(TARGET_NAME, "SM", &sm_file) == 0 || FAT32_FindFile(TARGET_NAME, "SSC", &sm_file) == 0)) {
+        sm_init(&sm, sm_read_sector, &sm_file, TARGET_DIFFICULTY, rate);
+        note_source = NOTES_STEPMANIA;
+    }
+    if (note_source == NOTES_CHART) {
+        printf("Playing chart: %lu notes at %lu BPM.\n",
+               (unsigned long)chart.notes_left, (unsigned long)(chart.bpm_x100 / 100));
+    } else if (note_source == NOTES_STEPMANIA) {
+        printf("Playing StepMania chart.\n");
+    } else {
+        printf("Analysing %d seconds ahead...\n", LOOKAHEAD_SECONDS);
     }
     
-    buffer_head = 0; 
-    buffer_tail = 0; 
+    // --- 3. PRIME LOOKAHEAD ---
+    // Only notes within the travel time are due at the first sample; the rest of the
+    // lookahead fills while playing
+    run_notes(travel_samples);
+    release_beats();
+
+    // Flash is written now: erasing stalls the CPU, which would starve the DAC later
+    if (fastboot_save(&boot) != 0) printf("Could not save boot metadata.\n");
 
     // --- 4. START PLAYBACK ---
     printf("Starting Playback.\n");
-    initDAC();
-    initAudioTimer(w.sample_rate);
-
-    while (bytes_left_in_file > 0) {
-        if (sd_buffer_idx >= SECTOR_SIZE) {
-            sd_buffer_idx = 0;
-            sector_in_cluster++;
-            if (sector_in_cluster >= g_sec_per_clus) {
-                cluster = fat32_next_cluster(cluster);
-                if (cluster >= 0x0FFFFFF8) break;
-                sector_in_cluster = 0;
-            }
-            SD_ReadSector(CLUSTER_LBA(cluster) + sector_in_cluster, buffer);
-        }
-        uint8_t new_sample = buffer[sd_buffer_idx++];
-        bytes_left_in_file--;
-
-        // Use the same helper function here
-        process_beat(new_sample);
-
-        uint8_t audio_out = audio_delay_buffer[buffer_tail];
-        audio_delay_buffer[buffer_tail] = new_sample;
-        buffer_tail++;
-        if (buffer_tail >= BUFFER_SIZE) buffer_tail = 0;
-
-        audio_wait_tick();
-        DAC1->DHR8R2 = audio_out; 
+    Audio_DAC_Init(AUDIO_STEREO);
+    playing = fill_dac_half(&dac_buf[0]);
+    if (playing) playing = fill_dac_half(&dac_buf[DAC_HALF_VALUES]);
+    Audio_Stream_OnHalf(audio_half_free);
+    Audio_Stream_Start(dac_buf, DAC_BUF_SAMPLES * OVERSAMPLE_FACTOR, AUDIO_OUT_RATE * OVERSAMPLE_FACTOR, AUDIO_STEREO);
+    if (boot_ms == 0) {
+        boot_ms = DWT->CYCCNT / (SystemCoreClock / 1000);
+        printf("Time to first sample: %lu ms, song open at %lu ms (%s mount, %s extent map).\n",
+               (unsigned long)boot_ms, (unsigned long)open_ms,
+               boot.mounted ? "saved" : "full", mapped ? "saved" : "new");
     }
 
-    // --- 5. DRAIN BUFFER ---
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        uint8_t audio_out = audio_delay_buffer[buffer_tail];
-        buffer_tail++;
-        if (buffer_tail >= BUFFER_SIZE) buffer_tail = 0;
-        audio_wait_tick();
-        DAC1->DHR8R2 = audio_out;
+    sched_post(&sched, task_notes); // Fill the rest of the lookahead
+    SD_OnBlock(sd_block_in);
+    while (playing) {
+        if (!sched_run(&sched)) hal_idle();
     }
+    SD_OnBlock(0);
+    Audio_Stream_OnHalf(0);
+
+    // --- 5. DRAIN ---
+    // Queue silence until both halves holding the tail of the song have played
+    for (int i = 0; i < 2; i++) {
+        uint16_t* half;
+        while ((half = Audio_Stream_FreeHalf()) == 0) hal_idle();
+        for (int j = 0; j < DAC_HALF_VALUES; j++) half[j] = DAC_MIDSCALE;
+        Audio_Stream_Commit();
+    }
+    Audio_Stream_Stop();
 
-    DAC1->DHR8R2 = 0x80;
+    printf("Playback done, %lu underruns, %lu beats dropped, %lu BPM.\n",
+           (unsigned long)Audio_Stream_Underruns(), (unsigned long)beats_dropped,
+           (unsigned long)(note_source == NOTES_CHART ? chart.bpm_x100 / 100 : tempo_bpm(&tempo, rate)));
+    if (decode_samples > 0) {
+        printf("Decode: %lu cycles per output sample.\n", (unsigned long)(decode_cycles / decode_samples));
+    }
+    uint32_t hits, misses;
+    SD_CacheStats(&hits, &misses);
+    printf("Sector cache: %lu hits, %lu misses.\n", (unsigned long)hits, (unsigned long)misses);
+    printf("SD: %lu CRC errors, bus at %lu kHz.\n", (unsigned long)SD_CRCErrors(),
+           (unsigned long)(SD_BusClock() / 1000));
+    sched_report(&sched);
+    print_bus_stats();
+    print_player_stats();
+    print_output_stats();
     return 0;
 }
 
@@ -431,14 +789,28 @@ int main(void) {
     GPIOB->MODER |=  (1U << 0); 
     CS_FPGA_DISABLE();          
 
+    // Cycle counter for timing the decode stage and the boot
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    initUSARTDMA(USART2_ID, CONSOLE_BAUD); // printf from here on never blocks
+    PROF_INIT();
+
     initSPI(7, 0, 0);
-    if (SD_Init() != 0) return -1;
-    SPI1->CR1 &= ~SPI_CR1_SPE;
-    SPI1->CR1 = (SPI1->CR1 & ~SPI_CR1_BR) | (3 << 3); 
-    SPI1->CR1 |= SPI_CR1_SPE;
-    if (fat32_mount() != 0) return -1;
+    spiBusSetSpeed(HAL_DEV_FPGA, FPGA_SPI_BR);
+    fpga_link_init(&fpga, FPGA_PRIO_NOTE);
+    if (fastboot_mount(&boot) != 0) return -1;
+    printf("SD bus at %lu kHz.\n", (unsigned long)(SD_BusClock() / 1000));
+    SD_EnableDMA(1);
+
+    if (song_index_load(&library) != 0) return -1;
+    fastboot_check(&boot, library.signature);
+    printf("Library: %u songs (%s%s).\n", library.count,
+           library.from_cache ? "from " SONG_INDEX_NAME "." SONG_INDEX_EXT : "scanned",
+           library.saved ? ", saved" : "");
+    if (library.skipped) printf("%u songs did not fit in the index.\n", library.skipped);
 
     play_wav();
 
-    while (1) {}
+    while (1) hal_idle();
 }
\ No newline at end of file
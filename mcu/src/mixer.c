@@ -0,0 +1,173 @@
+// mixer.c
+// One-shot sound mixer for the DAC path
+
+#include "mixer.h"
+#include "stm32l432xx.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#define MIXER_USE_DSP 1
+#endif
+
+static inline int16_t sat16(int32_t x) {
+#ifdef MIXER_USE_DSP
+    return (int16_t)__SSAT(x, 16);
+#else
+    if (x > 32767) return 32767;
+    if (x < -32768) return -32768;
+    return (int16_t)x;
+#endif
+}
+
+// out[i] += in[i], saturating
+static void mix_add(int16_t* out, const int16_t* in, uint32_t n) {
+#ifdef MIXER_USE_DSP
+    // One sample first if out is not word-aligned, then QADD16 on pairs. Sound data
+    // can start on any halfword, and the M4 loads it unaligned.
+    if (n > 0 && ((uintptr_t)out & 2)) {
+        *out = sat16(*out + *in);
+        out++; in++; n--;
+    }
+    uint32_t* o = (uint32_t*)out;
+    for (; n >= 4; n -= 4) {
+        uint32_t a, b;
+        memcpy(&a, in, 4);
+        memcpy(&b, in + 2, 4);
+        o[0] = __QADD16(o[0], a);
+        o[1] = __QADD16(o[1], b);
+        o += 2; in += 4;
+    }
+    out = (int16_t*)o;
+#endif
+    for (; n > 0; n--) {
+        *out = sat16(*out + *in);
+        out++; in++;
+    }
+}
+
+// out[2i] and out[2i + 1] += in[i], saturating
+static void mix_add_stereo(int16_t* out, const int16_t* in, uint32_t n) {
+#ifdef MIXER_USE_DSP
+    // The sample copied to both halves of a word, then one QADD16 per frame
+    for (; n > 0; n--) {
+        uint32_t o, s = (uint16_t)*in++;
+        memcpy(&o, out, 4);
+        o = __QADD16(o, s | (s << 16));
+        memcpy(out, &o, 4);
+        out += 2;
+    }
+#else
+    for (; n > 0; n--) {
+        out[0] = sat16(out[0] + *in);
+        out[1] = sat16(out[1] + *in);
+        out += 2; in++;
+    }
+#endif
+}
+
+// Mixes up to n frames of a voice into out; frees it at the end of its sound.
+// Returns the frames mixed.
+static uint32_t voice_mix(MixerVoice* v, int16_t* out, uint32_t n, int channels) {
+    uint32_t left = v->sound->len - v->pos;
+    if (n > left) n = left;
+    if (channels == 2) mix_add_stereo(out, &v->sound->data[v->pos], n);
+    else mix_add(out, &v->sound->data[v->pos], n);
+    v->pos += n;
+    if (v->pos >= v->sound->len) v->sound = 0;
+    return n;
+}
+
+// A free voice, or else the one furthest into its sound
+static MixerVoice* voice_alloc(Mixer* m) {
+    MixerVoice* oldest = &m->voices[0];
+    for (int i = 0; i < MIXER_VOICES; i++) {
+        MixerVoice* v = &m->voices[i];
+        if (!v->sound) return v;
+        if (v->pos > oldest->pos) oldest = v;
+    }
+    m->stolen++;
+    return oldest;
+}
+
+void mixer_init(Mixer* m, int channels) {
+    memset(m->voices, 0, sizeof(m->voices));
+    m->channels = (channels == 2) ? 2 : 1;
+    m->num_events = 0;
+    m->max_active = 0;
+    m->triggered = m->stolen = m->dropped = 0;
+    m->blocks = m->voice_samples = m->cycles = m->worst_cycles = 0;
+}
+
+int mixer_trigger(Mixer* m, uint8_t sound, uint32_t sample) {
+    if (sound >= MIXER_SOUNDS || m->sounds[sound].len == 0) return -1;
+    if (m->num_events >= MIXER_EVENTS) {
+        m->dropped++;
+        return -1;
+    }
+    m->events[m->num_events].sample = sample;
+    m->events[m->num_events].sound = sound;
+    m->num_events++;
+    m->triggered++;
+    return 0;
+}
+
+int mixer_mix(Mixer* m, int16_t* block, uint32_t n, uint32_t block_start) {
+    uint32_t start = DWT->CYCCNT;
+    uint32_t mixed = 0;
+    uint32_t used = 0; // Bit per voice mixed into this block
+
+    // Voices already sounding continue from the top of the block
+    for (int i = 0; i < MIXER_VOICES; i++) {
+        if (!m->voices[i].sound) continue;
+        mixed += voice_mix(&m->voices[i], block, n, m->channels);
+        used |= 1u << i;
+    }
+
+    // Triggers due in this block start at their offset; late ones at the top
+    for (int i = 0; i < m->num_events;) {
+        MixerEvent* e = &m->events[i];
+        int32_t ahead = (int32_t)(e->sample - block_start);
+        if (ahead >= (int32_t)n) {
+            i++;
+            continue;
+        }
+        uint32_t offset = ahead > 0 ? (uint32_t)ahead : 0;
+        MixerVoice* v = voice_alloc(m);
+        v->sound = &m->sounds[e->sound];
+        v->pos = 0;
+        mixed += voice_mix(v, block + offset * m->channels, n - offset, m->channels);
+        used |= 1u << (v - m->voices);
+        *e = m->events[--m->num_events];
+    }
+
+    if (used == 0) return 0;
+    int active = 0;
+    for (; used; used &= used - 1) active++;
+    uint32_t took = DWT->CYCCNT - start;
+    m->blocks++;
+    m->voice_samples += mixed;
+    m->cycles += took;
+    if (took > m->worst_cycles) m->worst_cycles = took;
+    if (active > m->max_active) m->max_active = (uint8_t)active;
+    return active;
+}
+
+int mixer_busy(const Mixer* m) {
+    if (m->num_events > 0) return 1;
+    for (int i = 0; i < MIXER_VOICES; i++) {
+        if (m->voices[i].sound) return 1;
+    }
+    return 0;
+}
+
+void mixer_report(const Mixer* m, uint32_t block_samples, uint32_t block_cycles) {
+    printf("Mixer: %lu sounds, %lu cut short, %lu dropped, up to %u at once.\n",
+           (unsigned long)m->triggered, (unsigned long)m->stolen, (unsigned long)m->dropped, m->max_active);
+    if (m->voice_samples == 0 || m->cycles == 0) return;
+    // Cost of one voice over a whole block, from the average per mixed sample
+    uint32_t per_voice = (uint32_t)((uint64_t)m->cycles * block_samples / m->voice_samples);
+    printf("Mixing: %lu cycles per voice per block, worst block %lu of %lu cycles, time for %lu voices.\n",
+           (unsigned long)per_voice, (unsigned long)m->worst_cycles, (unsigned long)block_cycles,
+           (unsigned long)(per_voice ? block_cycles / per_voice : 0));
+}
@@ -0,0 +1,71 @@
+// mixer.h
+// Fixed-point mixer for one-shot sounds on top of the song. Sounds are decoded into
+// RAM before playback; a trigger names a sound and the sample index it starts at,
+// which may be seconds ahead. mixer_mix adds every voice sounding in a DAC block to
+// the decoded song with saturating 16-bit adds, two samples per instruction on the M4.
+// Sounds are mono; in stereo blocks they go to both channels, one frame per instruction.
+//
+// Triggers and mixing both run in the main loop. The cycles spent mixing are counted
+// per block, so mixer_report can tell how many voices fit in the refill budget.
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <stdint.h>
+
+#define MIXER_VOICES    4    // Sounds playing at once; a new one takes over the oldest
+#define MIXER_SOUNDS    2
+#define MIXER_SOUND_MAX 2048 // Samples per sound: 128 ms at 16 kHz
+#define MIXER_EVENTS    32   // Triggers waiting for their start sample
+
+typedef struct {
+    int16_t  data[MIXER_SOUND_MAX]; // At the DAC rate and final level
+    uint16_t len;                   // 0 when not loaded; triggers are then ignored
+} MixerSound;
+
+typedef struct {
+    const MixerSound* sound; // 0 when free
+    uint16_t pos;            // Next sample of the sound
+} MixerVoice;
+
+typedef struct {
+    uint32_t sample; // Sample index the sound starts at
+    uint8_t  sound;
+} MixerEvent;
+
+typedef struct {
+    MixerSound sounds[MIXER_SOUNDS];
+    MixerVoice voices[MIXER_VOICES];
+    MixerEvent events[MIXER_EVENTS];
+    uint8_t  channels;      // Of the blocks mixed into: 1, or 2 for left, right frames
+    uint8_t  num_events;
+    uint8_t  max_active;    // Most voices mixed into one block
+    uint32_t triggered;
+    uint32_t stolen;        // Voices cut short by a newer sound
+    uint32_t dropped;       // Triggers refused by a full event list
+    uint32_t blocks;        // Blocks with at least one voice
+    uint32_t voice_samples; // Frames mixed, summed over voices
+    uint32_t cycles;        // Spent mixing those blocks
+    uint32_t worst_cycles;  // Longest single block
+} Mixer;
+
+// Clears the voices, pending triggers and counters, for blocks of 1 or 2 channels.
+// Loaded sounds are kept.
+void mixer_init(Mixer* m, int channels);
+
+// Starts sound at sample index `sample`, or at the next block if that has passed.
+// Returns 0, or -1 if the sound is not loaded or the event list is full.
+int mixer_trigger(Mixer* m, uint8_t sound, uint32_t sample);
+
+// Adds the voices sounding in the n frames of block, whose first frame has index block_start.
+// Returns the number of voices mixed.
+int mixer_mix(Mixer* m, int16_t* block, uint32_t n, uint32_t block_start);
+
+// Nonzero while a voice is sounding or a trigger is waiting
+int mixer_busy(const Mixer* m);
+
+// Prints the counters and the mixing cost, against block_cycles of budget per
+// block of block_samples frames.
+void mixer_report(const Mixer* m, uint32_t block_samples, uint32_t block_cycles);
+
+#endif
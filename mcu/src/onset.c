@@ -0,0 +1,231 @@
+// onset.c
+// Block-based spectral-flux onset detector
+
+#include "onset.h"
+#include <math.h>
+#include <stdlib.h>
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include <stm32l432xx.h> // CMSIS SIMD intrinsics
+#define ONSET_USE_DSP 1
+#endif
+
+#define FFT_N    (ONSET_SPEC_SIZE / 2) // Complex FFT size behind the real FFT
+#define FFT_LOG2 (ONSET_FRAME_LOG2 - ONSET_DECIM_LOG2 - 1)
+#define MID_BAND     2 // Upper-mid and hats: second differences, not FFT bins
+#define TOP_BAND     3
+#define MID_HALVINGS 2 // The upper-mid band's second differences run at 1/4 of the rate
+
+// Complex Q15 values are packed as (re | im << 16), the layout the M4 SIMD ops expect
+#define CPLX(re, im) ((int32_t)((uint32_t)(uint16_t)(re) | ((uint32_t)(uint16_t)(im) << 16)))
+#define RE(z)        ((int16_t)((uint32_t)(z) & 0xFFFF))
+#define IM(z)        ((int16_t)((uint32_t)(z) >> 16))
+
+// Band edges in Hz: kick, snare/low-mid, upper-mid, hats. The lower two are summed
+// from FFT bins. The upper two use second differences, which peak at 2 kHz and 8 kHz
+// at the player's 16 kHz and only roughly follow these edges.
+static const uint16_t band_edges_hz[ONSET_BANDS + 1] = {40, 150, 500, 2500, 8000};
+
+// Right shift from summed second differences to about the summed bin magnitudes of
+// the band, so a sine reads much the same level in any band
+static const uint8_t curve_shift[ONSET_BANDS] = {0, 0, 9, 9};
+
+static int32_t  twiddle[FFT_N];              // exp(-j*2*pi*k/ONSET_SPEC_SIZE), k < FFT_N
+static int16_t  window[ONSET_SPEC_SIZE / 2]; // First half of a Hann window
+static uint16_t bitrev[FFT_N];
+static int32_t  fft_buf[FFT_N];
+static int32_t  dec_buf[ONSET_FRAME / 2]; // Pair sums on the way down to the FFT's rate
+static int      tables_ready = 0;
+
+// --- Fixed-point helpers ---
+
+#ifdef ONSET_USE_DSP
+// (a * w) >> 15 on packed Q15 complex values, two MACs per instruction
+static inline int32_t cmul_q15(int32_t a, int32_t w) {
+    int32_t re = (int32_t)__SMUSD((uint32_t)a, (uint32_t)w) >> 15;
+    int32_t im = (int32_t)__SMUADX((uint32_t)a, (uint32_t)w) >> 15;
+    return (int32_t)__PKHBT((uint32_t)re, (uint32_t)im, 16);
+}
+#define HADD16(a, b) ((int32_t)__SHADD16((uint32_t)(a), (uint32_t)(b)))
+#define HSUB16(a, b) ((int32_t)__SHSUB16((uint32_t)(a), (uint32_t)(b)))
+#else
+static inline int32_t cmul_q15(int32_t a, int32_t w) {
+    int32_t re = ((int32_t)RE(a) * RE(w) - (int32_t)IM(a) * IM(w)) >> 15;
+    int32_t im = ((int32_t)RE(a) * IM(w) + (int32_t)IM(a) * RE(w)) >> 15;
+    return CPLX(re, im);
+}
+static inline int32_t HADD16(int32_t a, int32_t b) {
+    return CPLX((RE(a) + RE(b)) >> 1, (IM(a) + IM(b)) >> 1);
+}
+static inline int32_t HSUB16(int32_t a, int32_t b) {
+    return CPLX((RE(a) - RE(b)) >> 1, (IM(a) - IM(b)) >> 1);
+}
+#endif
+
+// log2(x) in Q8, linear between powers of two
+static int32_t log2_q8(uint32_t x) {
+    if (x == 0) return 0;
+    int msb = 31 - __builtin_clz(x);
+    uint32_t frac = (msb >= 8) ? (x >> (msb - 8)) : (x << (8 - msb));
+    return (msb << 8) | (int32_t)(frac & 0xFF);
+}
+
+// --- FFT ---
+
+// In-place radix-2 DIT FFT on bit-reversed input. Every stage halves its output,
+// so the result is scaled by 1/FFT_N and can never overflow. The first butterfly of
+// each group has a twiddle of 1 and skips the multiply.
+static void fft_q15(int32_t* x) {
+    for (int len = 2; len <= FFT_N; len <<= 1) {
+        int half = len >> 1;
+        int step = ONSET_SPEC_SIZE / len;
+        for (int i = 0; i < FFT_N; i += len) {
+            int32_t a = x[i];
+            int32_t t = x[i + half];
+            x[i]        = HADD16(a, t);
+            x[i + half] = HSUB16(a, t);
+            for (int k = 1; k < half; k++) {
+                a = x[i + k];
+                t = cmul_q15(x[i + k + half], twiddle[k * step]);
+                x[i + k]        = HADD16(a, t);
+                x[i + k + half] = HSUB16(a, t);
+            }
+        }
+    }
+}
+
+// Magnitude of real-FFT bin k (0 < k < FFT_N), untangled from the half-size complex FFT
+// of the even/odd packed frame
+static uint32_t bin_magnitude(const int32_t* z, int k) {
+    int32_t a = z[k];
+    int32_t b = z[FFT_N - k];
+    int32_t fe_r = (RE(a) + RE(b)) >> 1;  // (Z[k] + conj(Z[N-k])) / 2
+    int32_t fe_i = (IM(a) - IM(b)) >> 1;
+    int32_t fo_r = (IM(a) + IM(b)) >> 1;  // (Z[k] - conj(Z[N-k])) / 2j
+    int32_t fo_i = (RE(b) - RE(a)) >> 1;
+    int32_t w = twiddle[k];
+    int32_t xr = fe_r + ((fo_r * RE(w) - fo_i * IM(w)) >> 15);
+    int32_t xi = fe_i + ((fo_r * IM(w) + fo_i * RE(w)) >> 15);
+
+    // |x| ~= max + 3/8 min
+    uint32_t ax = (uint32_t)(xr < 0 ? -xr : xr);
+    uint32_t ay = (uint32_t)(xi < 0 ? -xi : xi);
+    return (ax > ay) ? ax + ((ay * 3) >> 3) : ay + ((ax * 3) >> 3);
+}
+
+static void build_tables(void) {
+    const float pi = 3.14159265f;
+    for (int k = 0; k < FFT_N; k++) {
+        float a = 2.0f * pi * (float)k / (float)ONSET_SPEC_SIZE;
+        twiddle[k] = CPLX((int16_t)(32767.0f * cosf(a)), (int16_t)(-32767.0f * sinf(a)));
+    }
+    for (int n = 0; n < ONSET_SPEC_SIZE / 2; n++) {
+        float a = 2.0f * pi * (float)n / (float)(ONSET_SPEC_SIZE - 1);
+        window[n] = (int16_t)(32767.0f * (0.5f - 0.5f * cosf(a)));
+    }
+    for (int n = 0; n < FFT_N; n++) {
+        uint16_t r = 0;
+        for (int b = 0; b < FFT_LOG2; b++) {
+            if (n & (1 << b)) r |= (uint16_t)(1 << (FFT_LOG2 - 1 - b));
+        }
+        bitrev[n] = r;
+    }
+    tables_ready = 1;
+}
+
+// --- Detector ---
+
+void onset_init(OnsetDetector* d, uint32_t sample_rate) {
+    if (!tables_ready) build_tables();
+    if (sample_rate == 0) sample_rate = 16000;
+
+    for (int b = 0; b < ONSET_BANDS; b++) {
+        // Bin width is sample_rate / ONSET_FRAME, as the decimated FFT is as much shorter.
+        // Levels are per bin of the whole band, also for the bands the FFT leaves out.
+        uint32_t lo = (band_edges_hz[b] * ONSET_FRAME) / sample_rate;
+        uint32_t hi = (band_edges_hz[b + 1] * ONSET_FRAME) / sample_rate;
+        if (lo < 1) lo = 1;
+        if (hi <= lo) hi = lo + 1;
+        d->log_width[b] = log2_q8(hi - lo);
+        if (b >= MID_BAND || lo >= FFT_N) lo = hi = 0;
+        if (hi > FFT_N) hi = FFT_N;
+        d->band_lo[b]    = (uint16_t)lo;
+        d->band_hi[b]    = (uint16_t)hi;
+        d->prev_level[b] = 0;
+        d->mean_acc[b]   = 0;
+        d->dev_acc[b]    = 0;
+        d->hold[b]       = 1; // First frame has no previous level to diff against
+    }
+    d->strength = 0;
+    d->strongest = 0;
+}
+
+uint8_t onset_process(OnsetDetector* d, const int16_t* frame) {
+    // 1. Sum sample pairs ONSET_DECIM_LOG2 times to bring the frame down to the FFT's
+    //    rate. The bands above the FFT are measured by second differences, which fall
+    //    12 dB an octave below half their rate: the hats at the full rate, on every
+    //    other sample, and the upper-mid band at 1/4 of it.
+    uint32_t curve[ONSET_BANDS] = {0};
+    int32_t* spec = dec_buf;
+    for (int n = 0; n < ONSET_FRAME / 2 - 1; n++) {
+        const int16_t* x = frame + 2 * n;
+        curve[TOP_BAND] += (uint32_t)abs(x[0] - 2 * x[1] + x[2]);
+    }
+    for (int n = 0; n < ONSET_FRAME / 2; n++) spec[n] = frame[2 * n] + frame[2 * n + 1];
+    for (int h = 2, len = ONSET_FRAME / 4; h <= ONSET_DECIM_LOG2; h++, len >>= 1) {
+        for (int n = 0; n < len; n++) spec[n] = spec[2 * n] + spec[2 * n + 1];
+        if (h != MID_HALVINGS) continue;
+        for (int n = 0; n < len - 2; n++) {
+            curve[MID_BAND] += (uint32_t)abs(spec[n] - 2 * spec[n + 1] + spec[n + 2]);
+        }
+    }
+
+    // 2. Window, halve (headroom for the complex stages) and pack even/odd samples of
+    //    the decimated frame as one complex sequence, stored in bit-reversed order for
+    //    the FFT, then take the spectrum of the lower bands
+    for (int n = 0; n < FFT_N; n++) {
+        int i0 = 2 * n;
+        int i1 = 2 * n + 1;
+        int32_t w0 = window[(i0 < ONSET_SPEC_SIZE / 2) ? i0 : ONSET_SPEC_SIZE - 1 - i0];
+        int32_t w1 = window[(i1 < ONSET_SPEC_SIZE / 2) ? i1 : ONSET_SPEC_SIZE - 1 - i1];
+        fft_buf[bitrev[n]] = CPLX(((spec[i0] >> ONSET_DECIM_LOG2) * w0) >> 16,
+                                  ((spec[i1] >> ONSET_DECIM_LOG2) * w1) >> 16);
+    }
+    fft_q15(fft_buf);
+
+    // 3. Per-band level, flux and adaptive threshold
+    uint8_t mask = 0;
+    int32_t best = 0;
+    d->strength = 0;
+    for (int b = 0; b < ONSET_BANDS; b++) {
+        uint32_t sum = curve[b] >> curve_shift[b];
+        for (int k = d->band_lo[b]; k < d->band_hi[b]; k++) sum += bin_magnitude(fft_buf, k);
+
+        int32_t level = log2_q8(sum + 1) - d->log_width[b];
+        int32_t flux  = level - d->prev_level[b];
+        if (flux < 0) flux = 0;
+        d->prev_level[b] = level;
+        d->strength += flux;
+
+        int32_t mean = d->mean_acc[b] >> ONSET_EMA_SHIFT;
+        int32_t dev  = d->dev_acc[b] >> ONSET_EMA_SHIFT;
+        int32_t threshold = mean + ((dev * ONSET_K_Q4) >> 4) + ONSET_FLOOR;
+
+        if (d->hold[b] > 0) {
+            d->hold[b]--;
+        } else if (flux > threshold && level > ONSET_MIN_LEVEL) {
+            mask |= (uint8_t)(1 << b);
+            d->hold[b] = ONSET_HOLD_FRAMES;
+            if (flux - threshold > best) {
+                best = flux - threshold;
+                d->strongest = b;
+            }
+        }
+
+        // Running statistics include this frame only after the decision
+        int32_t diff = flux - mean;
+        d->mean_acc[b] += diff;
+        d->dev_acc[b]  += ((diff < 0) ? -diff : diff) - dev;
+    }
+    return mask;
+}
@@ -0,0 +1,44 @@
+// onset.h
+// Block-based spectral-flux onset detector. Each frame is split into one frequency
+// band per lane: the two lower bands from a fixed-point real FFT of the frame brought
+// down to 1/8 of its rate, the two upper ones from second differences. A band fires
+// when the rise in its level clears an adaptive threshold.
+
+#ifndef ONSET_H
+#define ONSET_H
+
+#include <stdint.h>
+
+#define ONSET_FRAME_LOG2 9
+#define ONSET_FRAME      (1 << ONSET_FRAME_LOG2) // Samples per frame (hop = frame)
+#define ONSET_BANDS      4                       // Band i drives lane i
+#define ONSET_DECIM_LOG2 3                       // The FFT runs at 1/8 of the sample rate
+#define ONSET_SPEC_SIZE  (ONSET_FRAME >> ONSET_DECIM_LOG2) // Real FFT length
+
+// --- Threshold tuning (flux and levels are log2 units in Q8: 256 = 6 dB) ---
+#define ONSET_EMA_SHIFT   5   // Flux mean/deviation average over ~2^5 frames
+#define ONSET_K_Q4        24  // Threshold = mean + 1.5 * deviation + floor
+#define ONSET_FLOOR       96  // Smallest flux that can count as an onset
+#define ONSET_MIN_LEVEL   (3 * 256) // Band must be at least this loud to fire
+#define ONSET_HOLD_FRAMES 4   // Frames a band stays quiet after firing
+
+typedef struct {
+    uint16_t band_lo[ONSET_BANDS];    // First FFT bin of each band (the upper two have none)
+    uint16_t band_hi[ONSET_BANDS];    // One past the last bin
+    int32_t  log_width[ONSET_BANDS];  // log2 of the band width, to level per bin
+    int32_t  prev_level[ONSET_BANDS]; // Band level of the previous frame
+    int32_t  mean_acc[ONSET_BANDS];   // Flux mean, scaled by 2^ONSET_EMA_SHIFT
+    int32_t  dev_acc[ONSET_BANDS];    // Flux mean absolute deviation, same scale
+    uint8_t  hold[ONSET_BANDS];       // Frames until the band may fire again
+    int32_t  strength;                // Summed flux of the last frame
+    int      strongest;               // Band with the widest margin in the last onset
+} OnsetDetector;
+
+// Builds the FFT tables and band edges for a sample rate
+void onset_init(OnsetDetector* d, uint32_t sample_rate);
+
+// Analyses one frame of ONSET_FRAME signed Q15 samples.
+// Returns a lane mask with a bit set for every band that had an onset.
+uint8_t onset_process(OnsetDetector* d, const int16_t* frame);
+
+#endif
@@ -0,0 +1,49 @@
+// oversample.h
+// DAC output stage: raises decoded audio from the song rate to 4 times it, then
+// quantises it to the DAC's 12 bits. Two half-band interpolators each double the
+// rate; half their taps are zero and one phase is a plain copy, so only the other
+// phase is filtered, two MACs per instruction on the M4. The first does the real
+// work, cutting images above 8.8 kHz; the second only has to clear 24 kHz.
+//
+// The 12-bit step is dithered, and the error noise-shaped to high frequencies, so
+// most of it lands above the audio band that oversampling opened up. Cycles spent
+// per block are kept for oversample_report.
+
+#ifndef OVERSAMPLE_H
+#define OVERSAMPLE_H
+
+#include <stdint.h>
+
+#define OVERSAMPLE_FACTOR  4
+#define OVERSAMPLE_CHUNK   32  // Input frames filtered at a time, sizing the work buffers
+#define OVERSAMPLE_TAPS1   48  // Filtered phase of the first half-band
+#define OVERSAMPLE_TAPS2   8   // And of the second
+#define OVERSAMPLE_SHAPING 2   // Noise-shaping order used by the player
+#define OVERSAMPLE_MAX_CHANNELS 2
+
+typedef struct {
+    uint8_t  channels;  // Interleaved values per frame
+    uint8_t  shaping;   // Error feedback order: 0 (dither only), 1 or 2
+    // Per channel: filter history, then the chunk being filtered
+    int16_t  x1[OVERSAMPLE_MAX_CHANNELS][OVERSAMPLE_TAPS1 + OVERSAMPLE_CHUNK];
+    int16_t  x2[OVERSAMPLE_MAX_CHANNELS][OVERSAMPLE_TAPS2 + 2 * OVERSAMPLE_CHUNK];
+    int32_t  err[OVERSAMPLE_MAX_CHANNELS][2]; // Last two quantisation errors
+    int32_t  draw[OVERSAMPLE_MAX_CHANNELS];   // Last dither draw
+    uint32_t seed;
+    uint32_t clipped;   // Output values held at the ends of the DAC range
+    uint32_t blocks;
+    uint32_t cycles;    // Spent in oversample_process
+    uint32_t worst_cycles;
+} Oversampler;
+
+// Sets a stage up for frames of 1 or 2 channels, with silence in its history
+void oversample_init(Oversampler* o, int channels, int shaping);
+
+// Turns n frames of 16-bit audio into n * OVERSAMPLE_FACTOR
+// frames of offset-binary 12-bit DAC values. Output lags input by 26 song samples.
+void oversample_process(Oversampler* o, const int16_t* in, uint32_t n, uint16_t* out);
+
+// Prints the cost per block, against block_cycles of budget per block
+void oversample_report(const Oversampler* o, uint32_t block_cycles);
+
+#endif
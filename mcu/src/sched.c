@@ -0,0 +1,70 @@
+// sched.c
+// Cooperative task scheduler
+
+#include "sched.h"
+#include "stm32l432xx.h"
+#include <stdio.h>
+#include <string.h>
+
+void sched_init(Scheduler* s) {
+    memset(s, 0, sizeof(*s));
+}
+
+int sched_add(Scheduler* s, const char* name, SchedFn fn, void* ctx, uint8_t priority, uint32_t deadline) {
+    if (s->count >= SCHED_MAX_TASKS) return -1;
+    SchedTask* t = &s->tasks[s->count];
+    memset(t, 0, sizeof(*t));
+    t->name = name;
+    t->fn = fn;
+    t->ctx = ctx;
+    t->priority = priority;
+    t->deadline = deadline;
+    return s->count++;
+}
+
+void sched_post(Scheduler* s, int id) {
+    SchedTask* t = &s->tasks[id];
+    if (t->pending) return;
+    // The main loop only clears pending, so an interrupt landing between these two
+    // stores finds it still clear and writes the same values
+    t->posted_at = DWT->CYCCNT;
+    t->pending = 1;
+}
+
+int sched_run(Scheduler* s) {
+    SchedTask* best = 0;
+    uint32_t now = DWT->CYCCNT;
+    int32_t best_left = 0;
+    for (int i = 0; i < s->count; i++) {
+        SchedTask* t = &s->tasks[i];
+        if (!t->pending) continue;
+        int32_t left = (int32_t)(t->posted_at + t->deadline - now);
+        if (!best || t->priority < best->priority || (t->priority == best->priority && left < best_left)) {
+            best = t;
+            best_left = left;
+        }
+    }
+    if (!best) return 0;
+
+    // Cleared before the run, so a post that arrives while it runs is not lost
+    uint32_t posted_at = best->posted_at;
+    best->pending = 0;
+    int more = best->fn(best->ctx);
+
+    uint32_t took = DWT->CYCCNT - posted_at;
+    best->runs++;
+    if (took > best->worst) best->worst = took;
+    if (took > best->deadline) best->overruns++;
+    if (more) sched_post(s, (int)(best - s->tasks));
+    return 1;
+}
+
+void sched_report(const Scheduler* s) {
+    uint32_t per_us = SystemCoreClock / 1000000;
+    for (int i = 0; i < s->count; i++) {
+        const SchedTask* t = &s->tasks[i];
+        printf("Task %s: %lu runs, worst %lu us of %lu, %lu overruns.\n", t->name, (unsigned long)t->runs,
+               (unsigned long)(t->worst / per_us), (unsigned long)(t->deadline / per_us),
+               (unsigned long)t->overruns);
+    }
+}
@@ -0,0 +1,55 @@
+// sched.h
+// Run-to-completion task scheduler for the main loop. Events post tasks: the DAC
+// interrupt freeing a buffer half, a stream buffer running empty, a DAC refill that
+// moved playback on. sched_run then runs the most urgent pending task to completion,
+// lowest priority number first and earliest deadline among equals.
+//
+// Each post starts the task's deadline. A task that completes later than that after
+// its post counts an overrun, and the longest post-to-completion time is kept.
+// Time is the DWT cycle counter, so deadlines must stay under half its wrap (~26 s).
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+#define SCHED_MAX_TASKS 8
+
+// Does one bounded piece of work. Returns 1 if there is more to do, which posts the
+// task again, or 0 to wait for the next post.
+typedef int (*SchedFn)(void* ctx);
+
+typedef struct {
+    const char* name;
+    SchedFn  fn;
+    void*    ctx;
+    uint8_t  priority;           // 0 runs first
+    uint32_t deadline;           // Cycles allowed from post to completion
+    volatile uint8_t  pending;
+    volatile uint32_t posted_at; // Cycle count of the post being served
+    uint32_t runs;
+    uint32_t overruns;
+    uint32_t worst;              // Longest post-to-completion time, in cycles
+} SchedTask;
+
+typedef struct {
+    SchedTask tasks[SCHED_MAX_TASKS];
+    uint8_t   count;
+} Scheduler;
+
+void sched_init(Scheduler* s);
+
+// Returns the task's id for sched_post, or -1 if SCHED_MAX_TASKS are in use
+int sched_add(Scheduler* s, const char* name, SchedFn fn, void* ctx, uint8_t priority, uint32_t deadline);
+
+// Makes a task pending. Safe from interrupts. Posting a task that is already
+// pending does nothing: the one run serves both posts, against the first deadline.
+void sched_post(Scheduler* s, int id);
+
+// Runs the most urgent pending task. Returns 0 if none was pending.
+int sched_run(Scheduler* s);
+
+// Prints runs, worst time and overruns of every task
+void sched_report(const Scheduler* s);
+
+#endif
@@ -0,0 +1,354 @@
+// sm_chart.c
+// Streaming StepMania chart parser
+
+#include "sm_chart.h"
+#include <string.h>
+
+enum {
+    ST_TOP,       // Between tags
+    ST_TAG,       // Reading a tag name up to ':'
+    ST_SKIP,      // Value of a tag we do not use, up to ';'
+    ST_NUMBER,    // #OFFSET
+    ST_PAIRS,     // #BPMS / #STOPS: beat=value,beat=value;
+    ST_STRING,    // .ssc #STEPSTYPE / #DIFFICULTY
+    ST_SM_FIELDS, // .sm #NOTES header: type:author:difficulty:meter:radar:
+    ST_NOTES      // Note rows
+};
+
+// --- Small helpers (no libc number parsing on the MCU) ---
+
+static float parse_float(const char* s) {
+    float sign = 1.0f, value = 0.0f, scale = 0.0f;
+    if (*s == '-') {
+        sign = -1.0f;
+        s++;
+    } else if (*s == '+') {
+        s++;
+    }
+    for (; *s; s++) {
+        if (*s == '.') {
+            scale = 1.0f;
+        } else if (*s >= '0' && *s <= '9') {
+            value = value * 10.0f + (float)(*s - '0');
+            if (scale != 0.0f) scale *= 10.0f;
+        } else {
+            break;
+        }
+    }
+    return sign * ((scale != 0.0f) ? value / scale : value);
+}
+
+static int equals_nocase(const char* a, const char* b) {
+    for (; *a && *b; a++, b++) {
+        char x = (*a >= 'a' && *a <= 'z') ? (char)(*a - 32) : *a;
+        char y = (*b >= 'a' && *b <= 'z') ? (char)(*b - 32) : *b;
+        if (x != y) return 0;
+    }
+    return *a == *b;
+}
+
+static int is_space(uint8_t c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Keeps the token free of surrounding whitespace; inner spaces survive for strings
+static void token_add(SmParser* p, uint8_t c) {
+    if (is_space(c) && p->token_len == 0) return;
+    if (p->token_len < SM_TOKEN_LEN - 1) p->token[p->token_len++] = (char)c;
+}
+
+static const char* token_end(SmParser* p) {
+    while (p->token_len > 0 && is_space((uint8_t)p->token[p->token_len - 1])) p->token_len--;
+    p->token[p->token_len] = 0;
+    p->token_len = 0;
+    return p->token;
+}
+
+static void copy_str(char* dst, const char* src, uint32_t size) {
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = 0;
+}
+
+// --- Timing ---
+
+static void timing_add(SmParser* p, float value) {
+    int stops = equals_nocase(p->tag, "STOPS");
+    SmTiming* table = stops ? p->stops : p->bpms;
+    uint8_t* count = stops ? &p->num_stops : &p->num_bpms;
+    uint8_t max = stops ? SM_MAX_STOPS : SM_MAX_BPMS;
+
+    if (!stops && value <= 0.0f) {
+        p->dropped++; // Warps (negative BPMs) are not supported
+        return;
+    }
+    if (*count >= max) {
+        p->dropped++;
+        return;
+    }
+    table[*count].beat = p->pair_beat;
+    table[*count].value = value;
+    (*count)++;
+}
+
+// Converts a beat to seconds from the start of the audio. Notes come in beat order,
+// so the BPM and stop tables are walked forward instead of summed from the start.
+static float beat_to_seconds(SmParser* p, float beat) {
+    while (p->bpm_idx + 1 < p->num_bpms && p->bpms[p->bpm_idx + 1].beat <= beat) {
+        const SmTiming* seg = &p->bpms[p->bpm_idx];
+        p->seg_time += (p->bpms[p->bpm_idx + 1].beat - seg->beat) * 60.0f / seg->value;
+        p->bpm_idx++;
+    }
+    // A stop on a note's own beat happens after the note
+    while (p->stop_idx < p->num_stops && p->stops[p->stop_idx].beat < beat) {
+        p->stop_time += p->stops[p->stop_idx].value;
+        p->stop_idx++;
+    }
+    const SmTiming* seg = &p->bpms[p->bpm_idx];
+    return -p->offset + p->seg_time + (beat - seg->beat) * 60.0f / seg->value + p->stop_time;
+}
+
+// --- Chart selection ---
+
+static int chart_wanted(const SmParser* p) {
+    if (p->selected || !equals_nocase(p->steps_type, "dance-single")) return 0;
+    return p->difficulty[0] == 0 || equals_nocase(p->difficulty, p->chart_difficulty);
+}
+
+static void select_chart(SmParser* p) {
+    p->selected = 1;
+    if (p->num_bpms == 0) {
+        p->bpms[0].beat = 0.0f;
+        p->bpms[0].value = 120.0f;
+        p->num_bpms = 1;
+    }
+    p->bpm_idx = 0;
+    p->seg_time = 0.0f;
+    p->stop_idx = 0;
+    p->stop_time = 0.0f;
+    p->measure = 0;
+    p->num_rows = 0;
+    p->row_cols = 0;
+    p->row_mask = 0;
+}
+
+// --- Tokenizer ---
+
+static void tag_done(SmParser* p) {
+    copy_str(p->tag, token_end(p), sizeof(p->tag));
+
+    if (equals_nocase(p->tag, "OFFSET")) {
+        p->state = ST_NUMBER;
+    } else if (equals_nocase(p->tag, "BPMS") || equals_nocase(p->tag, "STOPS")) {
+        // The last table before the chosen chart wins (.ssc charts may carry their own)
+        if (!p->selected) {
+            if (equals_nocase(p->tag, "BPMS")) p->num_bpms = 0;
+            else p->num_stops = 0;
+        }
+        p->state = p->selected ? ST_SKIP : ST_PAIRS;
+    } else if (equals_nocase(p->tag, "NOTEDATA")) {
+        p->steps_type[0] = 0; // .ssc: a new chart starts
+        p->chart_difficulty[0] = 0;
+        p->state = ST_SKIP;
+    } else if (equals_nocase(p->tag, "STEPSTYPE") || equals_nocase(p->tag, "DIFFICULTY")) {
+        p->state = ST_STRING;
+    } else if (equals_nocase(p->tag, "NOTES")) {
+        if (p->steps_type[0] != 0) {
+            // .ssc: type and difficulty came as tags, the value is the note data
+            if (chart_wanted(p)) {
+                select_chart(p);
+                p->state = ST_NOTES;
+            } else {
+                p->state = ST_SKIP;
+            }
+        } else {
+            p->field = 0;
+            p->state = ST_SM_FIELDS;
+        }
+    } else {
+        p->state = ST_SKIP;
+    }
+}
+
+// Feeds one character of the note data. Returns 1 when a measure is complete.
+static int notes_char(SmParser* p, uint8_t c) {
+    if (c == ',' || c == ';' || is_space(c)) {
+        if (p->row_cols > 0) {
+            if (p->num_rows < SM_MEASURE_ROWS) p->rows[p->num_rows++] = p->row_mask;
+            p->row_cols = 0;
+            p->row_mask = 0;
+        }
+        if (c == ',' || c == ';') {
+            p->last_measure = (c == ';');
+            p->emit = 0;
+            p->measure_ready = 1;
+            return 1;
+        }
+        return 0;
+    }
+    // Taps, hold heads and roll heads are notes; tails, mines, lifts and fakes are not
+    if (p->row_cols < SM_LANES && (c == '1' || c == '2' || c == '4')) p->row_mask |= (uint8_t)(1 << p->row_cols);
+    p->row_cols++;
+    return 0;
+}
+
+static void char_in(SmParser* p, uint8_t c) {
+    switch (p->state) {
+    case ST_TOP:
+        if (c == '#') {
+            p->token_len = 0;
+            p->state = ST_TAG;
+        }
+        break;
+    case ST_TAG:
+        if (c == ':') tag_done(p);
+        else if (c == ';') p->state = ST_TOP;
+        else token_add(p, c);
+        break;
+    case ST_SKIP:
+        if (c == ';') p->state = ST_TOP;
+        break;
+    case ST_NUMBER:
+        if (c == ';') {
+            if (!p->selected) p->offset = parse_float(token_end(p));
+            else token_end(p);
+            p->state = ST_TOP;
+        } else {
+            token_add(p, c);
+        }
+        break;
+    case ST_PAIRS:
+        if (c == '=') {
+            p->pair_beat = parse_float(token_end(p));
+        } else if (c == ',' || c == ';') {
+            const char* t = token_end(p);
+            if (*t) timing_add(p, parse_float(t));
+            if (c == ';') p->state = ST_TOP;
+        } else {
+            token_add(p, c);
+        }
+        break;
+    case ST_STRING:
+        if (c == ';') {
+            if (equals_nocase(p->tag, "STEPSTYPE")) copy_str(p->steps_type, token_end(p), sizeof(p->steps_type));
+            else copy_str(p->chart_difficulty, token_end(p), sizeof(p->chart_difficulty));
+            p->state = ST_TOP;
+        } else {
+            token_add(p, c);
+        }
+        break;
+    case ST_SM_FIELDS:
+        if (c == ':') {
+            const char* t = token_end(p);
+            if (p->field == 0) copy_str(p->steps_type, t, sizeof(p->steps_type));
+            if (p->field == 2) copy_str(p->chart_difficulty, t, sizeof(p->chart_difficulty));
+            if (++p->field == 5) {
+                if (chart_wanted(p)) {
+                    select_chart(p);
+                    p->state = ST_NOTES;
+                } else {
+                    p->state = ST_SKIP;
+                }
+                p->steps_type[0] = 0;
+            }
+        } else if (c == ';') {
+            p->state = ST_TOP; // Malformed
+            p->steps_type[0] = 0;
+        } else {
+            token_add(p, c);
+        }
+        break;
+    }
+}
+
+// Feeds one character to whichever state is active. Returns 1 when a measure is complete.
+static int feed(SmParser* p, uint8_t c) {
+    if (p->state == ST_NOTES) {
+        if (!notes_char(p, c)) return 0;
+        if (p->last_measure) p->state = ST_TOP;
+        return 1;
+    }
+    char_in(p, c);
+    return 0;
+}
+
+// Runs the tokenizer until a measure of the chosen chart is complete.
+// Returns 1 for a measure, 0 at end of file, -2 on a read error.
+static int parse_measure(SmParser* p) {
+    for (;;) {
+        if (p->idx >= p->len) {
+            if (p->eof) return 0;
+            int n = p->read(p->ctx, p->buf);
+            if (n < 0) return -2;
+            if (n == 0) {
+                p->eof = 1;
+                // A chart cut off without its ';' still ends its last measure
+                if (p->state == ST_NOTES) {
+                    notes_char(p, ';');
+                    return 1;
+                }
+                return 0;
+            }
+            p->len = (uint16_t)n;
+            p->idx = 0;
+        }
+        uint8_t c = p->buf[p->idx++];
+
+        // "//" comments run to the end of the line. A '/' is held back until the
+        // next character shows whether it starts one, which may be in the next sector.
+        if (p->in_comment) {
+            if (c != '\n') continue;
+            p->in_comment = 0;
+        } else if (p->slash) {
+            p->slash = 0;
+            if (c == '/') {
+                p->in_comment = 1;
+                continue;
+            }
+            feed(p, '/'); // Never completes a measure
+        } else if (c == '/') {
+            p->slash = 1;
+            continue;
+        }
+        if (feed(p, c)) return 1;
+    }
+}
+
+// --- Public API ---
+
+void sm_init(SmParser* p, SmReadFn read, void* ctx, const char* difficulty, uint32_t sample_rate) {
+    memset(p, 0, sizeof(*p));
+    p->read = read;
+    p->ctx = ctx;
+    p->state = ST_TOP;
+    p->sample_rate = sample_rate;
+    if (difficulty) copy_str(p->difficulty, difficulty, sizeof(p->difficulty));
+}
+
+int sm_next(SmParser* p, SmNote* note) {
+    for (;;) {
+        if (p->measure_ready) {
+            while (p->emit < p->num_rows) {
+                uint16_t r = p->emit++;
+                if (p->rows[r] == 0) continue;
+                float beat = (float)p->measure * 4.0f + 4.0f * (float)r / (float)p->num_rows;
+                float t = beat_to_seconds(p, beat);
+                if (t < 0.0f) continue; // Before the audio starts
+                note->sample = (uint32_t)(t * (float)p->sample_rate + 0.5f);
+                note->lanes = p->rows[r];
+                return 1;
+            }
+            p->measure_ready = 0;
+            p->num_rows = 0;
+            p->measure++;
+            if (p->last_measure) p->done = 1;
+        }
+        if (p->done) return 0;
+
+        int res = parse_measure(p);
+        if (res < 0) return -2;
+        if (res == 0) {
+            p->done = 1;
+            return p->selected ? 0 : -1;
+        }
+    }
+}
@@ -0,0 +1,92 @@
+// sm_chart.h
+// Streaming parser for StepMania .sm/.ssc charts. Reads the file one sector at a time
+// through a callback and turns the 4-panel note rows of one chart into time-ordered
+// lane events. Memory is fixed whatever the size of the file.
+
+#ifndef SM_CHART_H
+#define SM_CHART_H
+
+#include <stdint.h>
+
+#define SM_BUF_SIZE     512 // One sector
+#define SM_MAX_BPMS     32  // Timing table sizes; extra entries are dropped
+#define SM_MAX_STOPS    32
+#define SM_MEASURE_ROWS 192 // Finest subdivision StepMania writes
+#define SM_LANES        4
+#define SM_TOKEN_LEN    32
+
+// Fills buf with up to SM_BUF_SIZE bytes of the file.
+// Returns the byte count, 0 at end of file, negative on a read error.
+typedef int (*SmReadFn)(void* ctx, uint8_t* buf);
+
+typedef struct {
+    float beat;
+    float value; // BPM, or stop length in seconds
+} SmTiming;
+
+typedef struct {
+    uint32_t sample; // Sample index where the note is hit
+    uint8_t  lanes;
+} SmNote;
+
+typedef struct {
+    // Input
+    SmReadFn read;
+    void*    ctx;
+    uint8_t  buf[SM_BUF_SIZE];
+    uint16_t idx;
+    uint16_t len;
+    int      eof;
+
+    // Tokenizer
+    uint8_t  state;
+    uint8_t  field;                   // Colon-separated field inside #NOTES
+    char     tag[16];
+    char     token[SM_TOKEN_LEN];
+    uint8_t  token_len;
+    float    pair_beat;               // Beat half of a "beat=value" pair being read
+    uint8_t  slash;                   // Held-back '/' that may start a comment
+    uint8_t  in_comment;
+
+    // Timing
+    float    offset;                  // #OFFSET, seconds
+    SmTiming bpms[SM_MAX_BPMS];
+    uint8_t  num_bpms;
+    SmTiming stops[SM_MAX_STOPS];
+    uint8_t  num_stops;
+    uint8_t  dropped;                 // Timing entries that did not fit
+
+    // Chart selection
+    char     difficulty[16];          // Wanted difficulty, "" for the first dance-single chart
+    char     steps_type[16];          // Of the chart being read
+    char     chart_difficulty[16];
+    int      selected;                // A chart has been chosen and is being read
+    int      done;
+
+    // Current measure
+    uint8_t  rows[SM_MEASURE_ROWS];   // Lane mask per row
+    uint16_t num_rows;
+    uint8_t  row_mask;
+    uint8_t  row_cols;
+    uint32_t measure;
+    uint16_t emit;                    // Next row to hand out once the measure is complete
+    int      measure_ready;
+    int      last_measure;            // Chart ended with this measure
+
+    // Beat to time, walked forward as notes are handed out
+    uint32_t sample_rate;
+    uint8_t  bpm_idx;
+    float    seg_time;                // Seconds at bpms[bpm_idx].beat
+    uint8_t  stop_idx;
+    float    stop_time;               // Seconds of stops before the current note
+} SmParser;
+
+// Starts parsing. difficulty picks the chart (e.g. "Easy"); 0 or "" takes the first
+// dance-single chart in the file.
+void sm_init(SmParser* p, SmReadFn read, void* ctx, const char* difficulty, uint32_t sample_rate);
+
+// Returns 1 with the next note, 0 once the chart is finished, -1 if no chart matched,
+// -2 on a read error.
+int sm_next(SmParser* p, SmNote* note);
+
+#endif
@@ -0,0 +1,197 @@
+// song_index.c
+// Song library: directory walk, WAV format check and the SONGS.IDX cache
+
+#include "song_index.h"
+#include "wav_decode.h"
+#include "STM32L432KC_SD.h"
+#include <string.h>
+
+static uint8_t sector[SECTOR_SIZE];
+
+static uint32_t get_u32(const uint8_t* b, uint32_t o) {
+    return (uint32_t)b[o] | ((uint32_t)b[o + 1] << 8) | ((uint32_t)b[o + 2] << 16) | ((uint32_t)b[o + 3] << 24);
+}
+
+static uint16_t get_u16(const uint8_t* b, uint32_t o) {
+    return (uint16_t)(b[o] | (b[o + 1] << 8));
+}
+
+static void put_u32(uint8_t* b, uint32_t o, uint32_t v) {
+    b[o] = (uint8_t)v;
+    b[o + 1] = (uint8_t)(v >> 8);
+    b[o + 2] = (uint8_t)(v >> 16);
+    b[o + 3] = (uint8_t)(v >> 24);
+}
+
+uint32_t song_name_hash(const char* name) {
+    uint32_t h = 2166136261u;
+    for (; *name; name++) {
+        char c = (*name >= 'a' && *name <= 'z') ? (char)(*name - 32) : *name;
+        h ^= (uint8_t)c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int has_wav_ext(const char* name) {
+    uint32_t n = strlen(name);
+    if (n < 4) return 0;
+    const char* e = name + n - 4;
+    return e[0] == '.' && (e[1] | 32) == 'w' && (e[2] | 32) == 'a' && (e[3] | 32) == 'v';
+}
+
+// Format tag from the fmt chunk in the first sector of a WAV file, or 0
+static uint16_t wav_format(uint32_t start_cluster) {
+    if (SD_ReadSector(ClusterToLBA(start_cluster), sector) != 0) return 0;
+    if (memcmp(sector, "RIFF", 4) != 0 || memcmp(sector + 8, "WAVE", 4) != 0) return 0;
+    for (uint32_t off = 12; off + 10 <= SECTOR_SIZE;) {
+        uint32_t size = get_u32(sector, off + 4);
+        if (memcmp(sector + off, "fmt ", 4) == 0) return get_u16(sector, off + 8);
+        if (size >= SECTOR_SIZE) break;
+        off += 8 + size + (size & 1);
+    }
+    return 0;
+}
+
+// --- Rebuild ---
+
+static int add_song(const FAT32_DirEntry* e, void* ctx) {
+    SongIndex* idx = (SongIndex*)ctx;
+    if (e->attr & FAT32_ATTR_DIR) {
+        // Directories the walk descends into go into the signature
+        if (e->depth >= FAT32_MAX_DEPTH || e->startCluster < 2) return 0;
+        if (idx->num_dirs < SONG_INDEX_DIRS) idx->dirs[idx->num_dirs++] = e->startCluster;
+        else idx->dirs_skipped++;
+        return 0;
+    }
+    if (e->size < 44 || e->startCluster < 2) return 0;
+    if (!has_wav_ext(e->name)) return 0;
+
+    uint16_t format = wav_format(e->startCluster);
+    if (format != WAV_FORMAT_PCM && format != WAV_FORMAT_EXTENSIBLE && format != WAV_FORMAT_IMA_ADPCM) return 0;
+    if (idx->count >= SONG_INDEX_MAX) {
+        idx->skipped++;
+        return 0;
+    }
+    SongEntry* s = &idx->songs[idx->count++];
+    s->name_hash = song_name_hash(e->name);
+    s->start_cluster = e->startCluster;
+    s->size = e->size;
+    s->format = format;
+    s->entry_offset = e->entryOffset;
+    s->entry_lba = e->entryLba;
+    return 0;
+}
+
+// Writes the index over the contents of SONGS.IDX. Returns 0 if it was saved.
+// If some directories did not fit, a later boot could not tell whether the index
+// is stale, so only the header is written, without its magic.
+static int save(const SongIndex* idx, AudioFile* f) {
+    int complete = (idx->dirs_skipped == 0);
+    uint32_t count = complete ? idx->count : 0;
+    uint32_t bytes = SONG_INDEX_HEADER_SIZE + SONG_INDEX_DIRS_SIZE + count * SONG_INDEX_ENTRY_SIZE;
+    if (f->size < bytes) return -1;
+
+    uint32_t sectors = (bytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint32_t next = 0; // Next song to write
+    for (uint32_t s = 0; s < sectors; s++) {
+        uint32_t lba;
+        if (FAT32_SectorToLBA(f, s, &lba) < 0) return -1;
+
+        memset(sector, 0, SECTOR_SIZE);
+        uint32_t o = 0;
+        if (s == 0) {
+            if (complete) memcpy(sector, SONG_INDEX_MAGIC, 4);
+            put_u32(sector, 4, idx->signature);
+            put_u32(sector, 8, count);
+            put_u32(sector, 12, SONG_INDEX_ENTRY_SIZE);
+            put_u32(sector, 16, idx->num_dirs);
+            for (uint32_t d = 0; d < idx->num_dirs; d++) put_u32(sector, SONG_INDEX_HEADER_SIZE + 4 * d, idx->dirs[d]);
+            o = SONG_INDEX_HEADER_SIZE + SONG_INDEX_DIRS_SIZE;
+        }
+        for (; o < SECTOR_SIZE && next < count; o += SONG_INDEX_ENTRY_SIZE, next++) {
+            const SongEntry* e = &idx->songs[next];
+            put_u32(sector, o, e->name_hash);
+            put_u32(sector, o + 4, e->start_cluster);
+            put_u32(sector, o + 8, e->size);
+            put_u32(sector, o + 12, e->format | ((uint32_t)e->entry_offset << 16));
+            put_u32(sector, o + 16, e->entry_lba);
+        }
+        if (SD_WriteSector(lba, sector) != 0) return -2;
+    }
+    return complete ? 0 : -1;
+}
+
+// --- Cache ---
+
+// Reads SONGS.IDX back. Returns 0 if it holds an index whose signature still
+// matches the volume, -1 if not, -2 on a card error.
+static int load_cache(SongIndex* idx, AudioFile* f) {
+    if (FAT32_ReadRun(f, sector, 1) != 1) return -1;
+    if (memcmp(sector, SONG_INDEX_MAGIC, 4) != 0 || get_u32(sector, 12) != SONG_INDEX_ENTRY_SIZE) return -1;
+    uint32_t count = get_u32(sector, 8);
+    uint32_t num_dirs = get_u32(sector, 16);
+    if (count > SONG_INDEX_MAX || num_dirs > SONG_INDEX_DIRS) return -1;
+    if (SONG_INDEX_HEADER_SIZE + SONG_INDEX_DIRS_SIZE + count * SONG_INDEX_ENTRY_SIZE > f->size) return -1;
+
+    // The signature covers the directories the index was built from
+    uint32_t saved = get_u32(sector, 4);
+    for (uint32_t d = 0; d < num_dirs; d++) idx->dirs[d] = get_u32(sector, SONG_INDEX_HEADER_SIZE + 4 * d);
+    idx->num_dirs = (uint16_t)num_dirs;
+    int res = FAT32_VolumeSignature(idx->dirs, num_dirs, &idx->signature);
+    if (res == -2) return -2;
+    if (res != 0 || idx->signature != saved) return -1;
+
+    uint32_t o = SONG_INDEX_HEADER_SIZE + SONG_INDEX_DIRS_SIZE;
+    for (uint32_t n = 0; n < count; n++, o += SONG_INDEX_ENTRY_SIZE) {
+        if (o == SECTOR_SIZE) {
+            if (FAT32_ReadRun(f, sector, 1) != 1) return -1;
+            o = 0;
+        }
+        SongEntry* e = &idx->songs[n];
+        e->name_hash = get_u32(sector, o);
+        e->start_cluster = get_u32(sector, o + 4);
+        e->size = get_u32(sector, o + 8);
+        e->format = get_u16(sector, o + 12);
+        e->entry_offset = get_u16(sector, o + 14);
+        e->entry_lba = get_u32(sector, o + 16);
+    }
+    idx->count = (uint16_t)count;
+    return 0;
+}
+
+int song_index_load(SongIndex* idx) {
+    memset(idx, 0, sizeof(*idx));
+    AudioFile cache;
+    if (FAT32_FindFile(SONG_INDEX_NAME, SONG_INDEX_EXT, &cache) == 0) {
+        int res = load_cache(idx, &cache);
+        if (res == -2) return -2;
+        if (res == 0) {
+            idx->from_cache = 1;
+            return 0;
+        }
+    }
+    return song_index_rebuild(idx);
+}
+
+int song_index_rebuild(SongIndex* idx) {
+    memset(idx, 0, sizeof(*idx));
+    if (FAT32_Walk(add_song, idx) < 0) return -2;
+    if (FAT32_VolumeSignature(idx->dirs, idx->num_dirs, &idx->signature) != 0) return -2;
+
+    AudioFile cache;
+    if (FAT32_FindFile(SONG_INDEX_NAME, SONG_INDEX_EXT, &cache) == 0) idx->saved = (save(idx, &cache) == 0);
+    return 0;
+}
+
+int song_index_check(const SongEntry* e) {
+    return FAT32_CheckEntry(e->entry_lba, e->entry_offset, e->start_cluster, e->size);
+}
+
+const SongEntry* song_index_find(const SongIndex* idx, const char* name) {
+    uint32_t h = song_name_hash(name);
+    for (uint16_t i = 0; i < idx->count; i++) {
+        if (idx->songs[i].name_hash == h) return &idx->songs[i];
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+// song_index.h
+// In-RAM index of the playable songs on the card, built by walking every directory
+// and kept in SONGS.IDX so later boots can skip the walk.
+//
+// SONGS.IDX layout, little-endian:
+//    header      (32 bytes): "SIDX", volume signature, song count, entry size,
+//                            directory count, 12 reserved bytes
+//    directories (128 bytes): first cluster of each subdirectory walked
+//    entries     (32 bytes): name hash, first cluster, size, WAV format tag,
+//                            offset and sector of the directory entry, 12 reserved bytes
+// The firmware does not allocate clusters, so the file must already exist and be
+// big enough (160 + 32 * SONG_INDEX_MAX bytes); it is rewritten in place.
+
+#ifndef SONG_INDEX_H
+#define SONG_INDEX_H
+
+#include <stdint.h>
+
+#define SONG_INDEX_MAX   256
+#define SONG_INDEX_NAME  "SONGS"
+#define SONG_INDEX_EXT   "IDX"
+#define SONG_INDEX_MAGIC "SIDX"
+#define SONG_INDEX_DIRS  32 // Subdirectories the signature covers; cards with more are walked every boot
+#define SONG_INDEX_HEADER_SIZE 32
+#define SONG_INDEX_DIRS_SIZE   (SONG_INDEX_DIRS * 4)
+#define SONG_INDEX_ENTRY_SIZE  32
+
+typedef struct {
+    uint32_t name_hash;     // song_name_hash of the file name
+    uint32_t start_cluster;
+    uint32_t size;
+    uint16_t format;        // WAV format tag
+    uint16_t entry_offset;  // Where its directory entry was, for song_index_check
+    uint32_t entry_lba;
+} SongEntry;
+
+typedef struct {
+    SongEntry songs[SONG_INDEX_MAX];
+    uint16_t  count;
+    uint16_t  skipped;      // Playable songs that did not fit
+    uint32_t  dirs[SONG_INDEX_DIRS]; // First cluster of each subdirectory walked
+    uint16_t  num_dirs;
+    uint16_t  dirs_skipped; // Subdirectories that did not fit; the index is then not saved
+    uint32_t  signature;    // FAT32_VolumeSignature over dirs when the index was built
+    uint8_t   from_cache;   // 1 if read back from SONGS.IDX
+    uint8_t   saved;        // 1 if a rebuilt index was written to SONGS.IDX
+} SongIndex;
+
+// Case-insensitive FNV-1a hash of a file name such as "MV.WAV" or "My Song.wav"
+uint32_t song_name_hash(const char* name);
+
+// Loads the index from SONGS.IDX if the volume signature still matches, otherwise
+// walks the card, rebuilds it and tries to save it. Returns 0, or -2 on a card error.
+int song_index_load(SongIndex* idx);
+
+// Walks the card and rebuilds the index, as song_index_load does when the signature
+// has changed. Returns 0, or -2 on a card error.
+int song_index_rebuild(SongIndex* idx);
+
+// Re-reads the directory entry a song was indexed from. Returns 0 if it still has the
+// indexed first cluster and size, 1 if the song has changed or moved (rebuild the
+// index), -2 on a card error.
+int song_index_check(const SongEntry* e);
+
+// Looks a song up by file name. Returns 0 if it is not on the card.
+const SongEntry* song_index_find(const SongIndex* idx, const char* name);
+
+#endif
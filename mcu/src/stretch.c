@@ -0,0 +1,176 @@
+// stretch.c
+// WSOLA time-stretcher for practice mode
+
+#include "stretch.h"
+#include "stm32l432xx.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#define STRETCH_USE_DSP 1
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Rising half of a periodic Hann window of STRETCH_FRAME, Q15. The falling half is
+// 32768 minus it, so overlapped frames sum to exactly one.
+static int16_t rise[STRETCH_HOP];
+static int     tables_ready = 0;
+
+static void init_tables(void) {
+    for (int i = 0; i < STRETCH_HOP; i++) {
+        float s = sinf((float)M_PI * (float)i / (float)STRETCH_FRAME);
+        rise[i] = (int16_t)lrintf(32768.0f * s * s);
+    }
+    tables_ready = 1;
+}
+
+// Sum of a[i] * b[i], i < n (a multiple of 4). b may start on any halfword.
+static int64_t dot(const int16_t* a, const int16_t* b, uint32_t n) {
+#ifdef STRETCH_USE_DSP
+    uint64_t acc = 0;
+    for (uint32_t i = 0; i < n; i += 4) {
+        uint32_t a0, a1, b0, b1;
+        memcpy(&a0, a + i, 4);
+        memcpy(&a1, a + i + 2, 4);
+        memcpy(&b0, b + i, 4);
+        memcpy(&b1, b + i + 2, 4);
+        acc = __SMLALD(a0, b0, acc);
+        acc = __SMLALD(a1, b1, acc);
+    }
+    return (int64_t)acc;
+#else
+    int64_t acc = 0;
+    for (uint32_t i = 0; i < n; i++) acc += (int32_t)a[i] * b[i];
+    return acc;
+#endif
+}
+
+// Drops input before position lo and tops in[] up from the source. Returns the
+// cycles spent in the source.
+static uint32_t refill(Stretch* s, uint32_t lo) {
+    uint32_t ch = s->channels;
+    uint32_t drop = lo - s->in_start;
+    if (drop > STRETCH_BUF) drop = STRETCH_BUF;
+    if (drop > 0) {
+        memmove(s->in, s->in + drop * ch, (STRETCH_BUF - drop) * ch * sizeof(int16_t));
+        memset(s->in + (STRETCH_BUF - drop) * ch, 0, drop * ch * sizeof(int16_t));
+        s->in_start += drop;
+        s->in_len = s->in_len > drop ? s->in_len - drop : 0;
+    }
+    uint32_t start = DWT->CYCCNT;
+    while (s->in_len < STRETCH_BUF && s->end == UINT32_MAX) {
+        uint32_t got = s->src(s->ctx, s->in + s->in_len * ch, STRETCH_BUF - s->in_len);
+        if (got == 0) s->end = s->in_start + s->in_len;
+        s->in_len += got;
+    }
+    return DWT->CYCCNT - start;
+}
+
+// Frame offset into in[] of the candidate in [k0, k1] that best continues the tail:
+// the largest corr * |corr| / energy, which ranks like the normalised correlation.
+// Stereo sums run over both channels.
+static uint32_t best_match(const Stretch* s, uint32_t k0, uint32_t k1, uint32_t nominal) {
+    uint32_t ch = s->channels;
+    uint32_t len = STRETCH_HOP * ch;
+    const int16_t* in = s->in;
+    int64_t energy = 0;
+    for (uint32_t i = 0; i < len; i++) energy += (int32_t)in[k0 * ch + i] * in[k0 * ch + i];
+
+    uint32_t best = nominal;
+    int64_t best_score = INT64_MIN;
+    for (uint32_t k = k0; k <= k1; k++) {
+        if (k > k0) {
+            for (uint32_t c = 0; c < ch; c++) {
+                int32_t add = in[(k + STRETCH_HOP - 1) * ch + c];
+                int32_t drop = in[(k - 1) * ch + c];
+                energy += add * add - drop * drop;
+            }
+        }
+        // Halving corr and quartering energy keeps the score; do so until corr^2 fits 62 bits
+        int64_t c = dot(s->tail, in + k * ch, len);
+        int64_t e = energy;
+        while (c >= ((int64_t)1 << 31) || c <= -((int64_t)1 << 31)) {
+            c >>= 1;
+            e >>= 2;
+        }
+        int64_t score = c * (c < 0 ? -c : c) / (e + 1);
+        // Ties go to the nominal position, then to the earlier frame
+        if (score > best_score || (score == best_score && k == nominal)) {
+            best_score = score;
+            best = k;
+        }
+    }
+    return best;
+}
+
+void stretch_init(Stretch* s, StretchSource src, void* ctx, int channels, uint32_t start, uint32_t speed_pct) {
+    if (!tables_ready) init_tables();
+    memset(s, 0, sizeof(*s));
+    s->src = src;
+    s->ctx = ctx;
+    s->channels = (channels == 2) ? 2 : 1;
+    s->pos = start;
+    s->in_start = start;
+    s->end = UINT32_MAX;
+    stretch_set_speed(s, speed_pct);
+}
+
+void stretch_set_speed(Stretch* s, uint32_t speed_pct) {
+    if (speed_pct < STRETCH_MIN_PCT) speed_pct = STRETCH_MIN_PCT;
+    if (speed_pct > STRETCH_MAX_PCT) speed_pct = STRETCH_MAX_PCT;
+    s->hop_q16 = speed_pct * ((uint32_t)STRETCH_HOP << 16) / 100;
+}
+
+uint32_t stretch_process(Stretch* s, int16_t* out) {
+    uint32_t start = DWT->CYCCNT;
+    uint32_t ch = s->channels;
+    uint32_t lo = s->pos > s->in_start + STRETCH_SEEK ? s->pos - STRETCH_SEEK : s->in_start;
+    uint32_t source_cycles = refill(s, lo);
+    if (s->pos >= s->end) {
+        memset(out, 0, STRETCH_HOP * ch * sizeof(int16_t));
+        return 0;
+    }
+
+    uint32_t nominal = s->pos - s->in_start;
+    if (!s->started) {
+        // Nothing to overlap yet: the first frame continues itself, so it is taken as is
+        memcpy(s->tail, s->in + nominal * ch, STRETCH_HOP * ch * sizeof(int16_t));
+        s->started = 1;
+    }
+    uint32_t k = best_match(s, lo - s->in_start, nominal + STRETCH_SEEK, nominal);
+
+    const int16_t* frame = s->in + k * ch;
+    for (uint32_t i = 0; i < STRETCH_HOP * ch; i++) {
+        int32_t w = rise[ch == 2 ? i >> 1 : i];
+        out[i] = (int16_t)((s->tail[i] * (32768 - w) + frame[i] * w) >> 15);
+    }
+    memcpy(s->tail, frame + STRETCH_HOP * ch, STRETCH_HOP * ch * sizeof(int16_t));
+
+    // Output frames that still map onto the input
+    uint32_t n = STRETCH_HOP;
+    if (s->end != UINT32_MAX) {
+        uint64_t left = ((uint64_t)(s->end - s->pos) << 16) * STRETCH_HOP / s->hop_q16;
+        if (left < n) n = (uint32_t)left;
+    }
+
+    uint32_t frac = s->pos_frac + s->hop_q16;
+    s->pos += frac >> 16;
+    s->pos_frac = (uint16_t)frac;
+
+    uint32_t took = DWT->CYCCNT - start - source_cycles;
+    s->blocks++;
+    s->cycles += took;
+    if (took > s->worst_cycles) s->worst_cycles = took;
+    return n;
+}
+
+void stretch_report(const Stretch* s, uint32_t block_cycles) {
+    if (s->blocks == 0) return;
+    printf("Stretch at %lu%%: %lu cycles per block, worst %lu of %lu.\n",
+           (unsigned long)((s->hop_q16 * 100 + (STRETCH_HOP << 15)) / ((uint32_t)STRETCH_HOP << 16)),
+           (unsigned long)(s->cycles / s->blocks), (unsigned long)s->worst_cycles, (unsigned long)block_cycles);
+}
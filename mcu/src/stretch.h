@@ -0,0 +1,63 @@
+// stretch.h
+// WSOLA time-stretcher: plays a song slower without lowering its pitch. Each call
+// makes one hop of output by overlap-adding a Hann frame of the input onto the tail
+// of the last one. The frame's nominal position moves through the song by the speed
+// times the hop; it is then moved by up to STRETCH_SEEK samples to wherever it best
+// matches the tail, so waveforms join in phase instead of smearing.
+//
+// Fixed point throughout: Q15 windows, and a normalised cross-correlation on 64-bit
+// sums (two MACs per instruction on the M4). Input is pulled from a source callback
+// as needed. Stereo frames are matched on both channels at once and moved together,
+// so the image does not wander. Cycles spent per hop, not counting the source, are
+// kept for stretch_report.
+
+#ifndef STRETCH_H
+#define STRETCH_H
+
+#include <stdint.h>
+
+#define STRETCH_HOP     256                 // Output samples per call: one DAC half
+#define STRETCH_FRAME   (2 * STRETCH_HOP)   // Frames overlap by half
+#define STRETCH_SEEK    64                  // Largest move from the nominal position: 4 ms at 16 kHz
+#define STRETCH_BUF     (STRETCH_FRAME + 2 * STRETCH_SEEK)
+#define STRETCH_MIN_PCT 50
+#define STRETCH_MAX_PCT 100
+#define STRETCH_MAX_CHANNELS 2
+
+// Writes up to max input frames to out. Returns the number written, 0 at the end.
+typedef uint32_t (*StretchSource)(void* ctx, int16_t* out, uint32_t max);
+
+typedef struct {
+    StretchSource src;
+    void*    ctx;
+    uint8_t  channels;           // Interleaved values per frame
+    uint32_t hop_q16;            // Input samples per output hop, Q16
+    uint32_t pos;                // Nominal input position of the next frame
+    uint16_t pos_frac;           // Its fraction, Q16
+    uint32_t in_start;           // Input position of in[0]
+    uint32_t in_len;             // Frames of in[] from the source; zeros after them
+    uint32_t end;                // Input length once the source ran dry, else UINT32_MAX
+    int16_t  in[STRETCH_BUF * STRETCH_MAX_CHANNELS];
+    int16_t  tail[STRETCH_HOP * STRETCH_MAX_CHANNELS]; // Second half of the last frame
+    uint8_t  started;            // tail holds a frame
+    uint32_t blocks;
+    uint32_t cycles;             // Spent in stretch_process, less the source
+    uint32_t worst_cycles;
+} Stretch;
+
+// Sets a stretcher up to read frames of 1 or 2 channels from src, whose next frame
+// has input position start
+void stretch_init(Stretch* s, StretchSource src, void* ctx, int channels, uint32_t start, uint32_t speed_pct);
+
+// Playback speed in percent, clamped to STRETCH_MIN_PCT..STRETCH_MAX_PCT. Takes effect
+// from the next hop.
+void stretch_set_speed(Stretch* s, uint32_t speed_pct);
+
+// Writes STRETCH_HOP frames to out. Returns how many of them come from the input:
+// STRETCH_HOP until the source runs out, then fewer, then 0.
+uint32_t stretch_process(Stretch* s, int16_t* out);
+
+// Prints the speed and the cost per hop, against block_cycles of budget per hop
+void stretch_report(const Stretch* s, uint32_t block_cycles);
+
+#endif
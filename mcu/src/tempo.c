@@ -0,0 +1,195 @@
+// tempo.c
+// Tempo tracker with a phase-locked beat grid
+
+#include "tempo.h"
+#include <string.h>
+#include <math.h>
+
+#define ENV_MASK (TEMPO_ENV_LEN - 1)
+
+// Comb score for a lag: the lag itself plus its first multiple, so the fundamental
+// beats the double-tempo peak, weighted toward TEMPO_PRIOR_BPM so bar-length
+// repeats do not win over the beat
+static int64_t lag_score(const TempoTracker* t, int lag) {
+    int64_t score = (int64_t)t->acf[lag] + (t->acf[2 * lag] >> 1);
+    return (score * t->prior[lag]) >> 8;
+}
+
+// Signed distance from a sample to the nearest beat of the grid
+static int32_t grid_error(const TempoTracker* t, uint32_t sample) {
+    int32_t period = (int32_t)(t->period_q8 >> 8);
+    int32_t err = (int32_t)(sample - t->beat_pos) % period;
+    if (err > period / 2) err -= period;
+    else if (err < -period / 2) err += period;
+    return err;
+}
+
+// Moves beat_pos forward to the last grid beat at or before sample
+static void advance_grid(TempoTracker* t, uint32_t sample) {
+    for (;;) {
+        uint32_t acc = t->beat_frac + t->period_q8;
+        uint32_t next = t->beat_pos + (acc >> 8);
+        if ((int32_t)(next - sample) > 0) break;
+        t->beat_pos  = next;
+        t->beat_frac = acc & 0xFF;
+    }
+}
+
+static void shift_grid(TempoTracker* t, int32_t samples) {
+    t->beat_pos = (uint32_t)((int32_t)t->beat_pos + samples);
+}
+
+// Picks the autocorrelation peak in the tempo range and refines it to a fraction of a frame
+static void estimate_period(TempoTracker* t) {
+    int best = 0;
+    int64_t best_score = 0;
+    for (int lag = t->lag_min; lag <= t->lag_max; lag++) {
+        int64_t score = lag_score(t, lag);
+        if (score > best_score) {
+            best_score = score;
+            best = lag;
+        }
+    }
+    if (best == 0) return; // Nothing periodic yet
+
+    // Parabolic interpolation through the neighbours, in Q8 frames
+    int64_t a = lag_score(t, best - 1);
+    int64_t c = lag_score(t, best + 1);
+    int64_t den = a - 2 * best_score + c;
+    int32_t delta = (den < 0) ? (int32_t)(((a - c) * 128) / den) : 0;
+    if (delta > 128) delta = 128;
+    if (delta < -128) delta = -128;
+    uint32_t lag_q8 = (uint32_t)(best * 256 + delta);
+
+    // Follow small drifts smoothly; a jump has to show up twice in a row
+    uint32_t tol = lag_q8 / 16;
+    if (t->lag_q8 == 0) {
+        t->lag_q8 = lag_q8;
+    } else if (lag_q8 + tol >= t->lag_q8 && lag_q8 <= t->lag_q8 + tol) {
+        t->lag_q8 = (3 * t->lag_q8 + lag_q8) / 4;
+        t->candidate_q8 = 0;
+    } else if (lag_q8 + tol >= t->candidate_q8 && lag_q8 <= t->candidate_q8 + tol) {
+        t->lag_q8 = lag_q8;
+        t->candidate_q8 = 0;
+    } else {
+        t->candidate_q8 = lag_q8;
+    }
+    t->period_q8 = t->lag_q8 * t->frame_samples;
+}
+
+// Finds the beat offset whose comb over the last few periods collects the most
+// strength. Returns the sample index of the newest beat it implies.
+static uint32_t estimate_phase(const TempoTracker* t, uint32_t sample) {
+    uint32_t lag = (t->lag_q8 + 128) >> 8;
+    uint32_t best_phase = 0;
+    int32_t best_sum = INT32_MIN;
+    for (uint32_t phase = 0; phase < lag; phase++) {
+        int32_t sum = 0;
+        for (uint32_t k = 0; k < TEMPO_COMB_BEATS; k++) {
+            uint32_t back = phase + ((k * t->lag_q8 + 128) >> 8); // 0 = newest entry
+            if (back >= TEMPO_ENV_LEN) break;
+            sum += t->env[(t->env_head - 1 - back) & ENV_MASK];
+        }
+        if (sum > best_sum) {
+            best_sum = sum;
+            best_phase = phase;
+        }
+    }
+    return sample - (best_phase + 1) * t->frame_samples; // Newest entry is a frame old
+}
+
+void tempo_init(TempoTracker* t, uint32_t sample_rate, uint32_t frame_samples) {
+    memset(t, 0, sizeof(*t));
+    if (sample_rate == 0) sample_rate = 16000;
+    t->frame_samples = frame_samples;
+
+    // lag = 60 * rate / (bpm * frame_samples), leaving room for lag_score(lag_max + 1)
+    uint32_t lo = (60 * sample_rate) / (TEMPO_MAX_BPM * frame_samples);
+    uint32_t hi = (60 * sample_rate + TEMPO_MIN_BPM * frame_samples - 1) / (TEMPO_MIN_BPM * frame_samples);
+    if (lo < 2) lo = 2;
+    if (hi > (TEMPO_MAX_LAG - 2) / 2) hi = (TEMPO_MAX_LAG - 2) / 2;
+    if (lo > hi) lo = hi;
+    t->lag_min = (uint16_t)lo;
+    t->lag_max = (uint16_t)hi;
+
+    // Log-normal preference around TEMPO_PRIOR_BPM, one octave wide
+    float frames_per_min = 60.0f * (float)sample_rate / (float)frame_samples;
+    for (uint32_t lag = 1; lag < TEMPO_MAX_LAG / 2; lag++) {
+        float octaves = log2f(frames_per_min / ((float)lag * TEMPO_PRIOR_BPM));
+        t->prior[lag] = (uint8_t)(255.0f * expf(-0.5f * octaves * octaves));
+    }
+}
+
+void tempo_update(TempoTracker* t, int32_t strength, int onset, uint32_t sample) {
+    // 1. Envelope: [1 2 1] smoothed so autocorrelation peaks stay round between
+    //    whole-frame lags, which makes the newest entry one frame old. Mean-removed
+    //    and scaled so the correlation sums stay in 32 bits.
+    int32_t smooth = (t->raw[1] + 2 * t->raw[0] + strength) >> 2;
+    t->raw[1] = t->raw[0];
+    t->raw[0] = strength;
+    int32_t mean = t->env_mean >> TEMPO_ACF_SHIFT;
+    t->env_mean += smooth - mean;
+    int32_t e = (smooth - mean) >> 2;
+    if (e > 2047) e = 2047;
+    if (e < -2047) e = -2047;
+    t->env[t->env_head] = (int16_t)e;
+
+    // 2. Leaky autocorrelation over every lag the period search can touch
+    int max_lag = 2 * (t->lag_max + 1);
+    for (int lag = 0; lag <= max_lag; lag++) {
+        int32_t past = t->env[(t->env_head - lag) & ENV_MASK];
+        t->acf[lag] += e * past - (t->acf[lag] >> TEMPO_ACF_SHIFT);
+    }
+    t->env_head = (t->env_head + 1) & ENV_MASK;
+    t->frames++;
+
+    // 3. Period and phase estimates every few frames once there is enough history
+    if (t->frames >= TEMPO_WARMUP_FRAMES && (t->frames % TEMPO_ESTIMATE_FRAMES) == 0) {
+        estimate_period(t);
+        if (t->period_q8 != 0) {
+            uint32_t beat = estimate_phase(t, sample);
+            if (!t->locked) {
+                t->beat_pos = beat;
+                t->beat_frac = 0;
+                t->locked = 1;
+            } else {
+                int32_t err = grid_error(t, beat);
+                int32_t period = (int32_t)(t->period_q8 >> 8);
+                if (err > -period / 4 && err < period / 4) shift_grid(t, err / 2);
+                else shift_grid(t, err); // Lost the phase; re-anchor
+            }
+        }
+    }
+    if (!t->locked) return;
+    advance_grid(t, sample);
+
+    // 4. Onsets close to a beat nudge the grid between estimates
+    if (onset) {
+        int32_t err = grid_error(t, sample);
+        int32_t period = (int32_t)(t->period_q8 >> 8);
+        if (err * 6 > -period && err * 6 < period) {
+            // Second-order loop: a steady error means the period is off, so trim it too
+            shift_grid(t, err >> TEMPO_PLL_SHIFT);
+            t->lag_q8 += ((err * 256) / (int32_t)t->frame_samples) >> TEMPO_FREQ_SHIFT;
+            t->period_q8 = t->lag_q8 * t->frame_samples;
+        }
+    }
+}
+
+uint32_t tempo_snap(const TempoTracker* t, uint32_t sample) {
+    if (!t->locked) return sample;
+    int64_t grid_q8 = t->period_q8 / TEMPO_SNAP_DIV;
+    int64_t d = ((int64_t)(int32_t)(sample - t->beat_pos) << 8) - t->beat_frac;
+    int64_t n = (d >= 0) ? (d + grid_q8 / 2) / grid_q8 : -((-d + grid_q8 / 2) / grid_q8);
+    return t->beat_pos + (uint32_t)(int32_t)((n * grid_q8 + t->beat_frac + 128) >> 8);
+}
+
+uint32_t tempo_grid_samples(const TempoTracker* t) {
+    if (!t->locked) return 0;
+    return (t->period_q8 / TEMPO_SNAP_DIV) >> 8;
+}
+
+uint32_t tempo_bpm(const TempoTracker* t, uint32_t sample_rate) {
+    if (!t->locked) return 0;
+    return (uint32_t)(((uint64_t)60 * sample_rate * 256 + t->period_q8 / 2) / t->period_q8);
+}
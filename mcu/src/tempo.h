@@ -0,0 +1,62 @@
+// tempo.h
+// Tempo tracker. Autocorrelates the onset-strength envelope to estimate the beat
+// period, phase-locks a beat grid to detected onsets, and snaps note times to
+// subdivisions of that grid.
+
+#ifndef TEMPO_H
+#define TEMPO_H
+
+#include <stdint.h>
+
+#define TEMPO_ENV_LEN   256 // Envelope history in frames (power of two)
+#define TEMPO_MAX_LAG   127 // Longest autocorrelation lag kept, in frames
+#define TEMPO_MIN_BPM   70
+#define TEMPO_MAX_BPM   180
+#define TEMPO_SNAP_DIV  2   // Grid points per beat: 1 = quarter notes, 2 = eighths
+#define TEMPO_PRIOR_BPM 120 // Preferred tempo when half/double tempo score alike
+
+// --- Tracker tuning ---
+#define TEMPO_ACF_SHIFT       7  // Autocorrelation memory, ~2^7 frames
+#define TEMPO_ESTIMATE_FRAMES 16 // Frames between period estimates
+#define TEMPO_WARMUP_FRAMES   96 // Frames of envelope before the grid is trusted
+#define TEMPO_PLL_SHIFT       2  // Phase correction = error / 2^shift per onset
+#define TEMPO_FREQ_SHIFT      4  // Period correction = error / 2^shift per onset
+#define TEMPO_COMB_BEATS      4  // Past beats summed when estimating the phase
+
+typedef struct {
+    int16_t  env[TEMPO_ENV_LEN];      // Smoothed, mean-removed onset strength per frame
+    int32_t  acf[TEMPO_MAX_LAG + 1];  // Leaky autocorrelation of env
+    uint16_t env_head;                // Slot for the next frame
+    uint32_t frames;                  // Frames seen so far
+    int32_t  env_mean;                // Strength mean, scaled by 2^TEMPO_ACF_SHIFT
+    int32_t  raw[2];                  // Last two strengths, for the smoothing filter
+    uint32_t frame_samples;           // Samples per envelope frame
+    uint16_t lag_min;                 // Period search range in frames
+    uint16_t lag_max;
+    uint8_t  prior[TEMPO_MAX_LAG / 2]; // Q8 weight of each lag around TEMPO_PRIOR_BPM
+    uint32_t lag_q8;                  // Beat period in frames, Q8
+    uint32_t candidate_q8;            // Lag waiting for a second agreeing estimate
+    uint32_t period_q8;               // Beat period in samples, Q8
+    uint32_t beat_pos;                // Sample index of the latest grid beat
+    uint32_t beat_frac;               // Q8 fraction of beat_pos
+    int      locked;                  // Grid has a period and phase
+} TempoTracker;
+
+// Sizes the period search for a sample rate and envelope frame length
+void tempo_init(TempoTracker* t, uint32_t sample_rate, uint32_t frame_samples);
+
+// Feeds one frame of onset strength.
+//    -- onset: nonzero if the detector fired on this frame
+//    -- sample: sample index of the frame (where an onset in it is placed)
+void tempo_update(TempoTracker* t, int32_t strength, int onset, uint32_t sample);
+
+// Moves a sample index to the nearest grid point (unchanged until locked)
+uint32_t tempo_snap(const TempoTracker* t, uint32_t sample);
+
+// Samples between grid points, or 0 until locked
+uint32_t tempo_grid_samples(const TempoTracker* t);
+
+// Current tempo in beats per minute, or 0 until locked
+uint32_t tempo_bpm(const TempoTracker* t, uint32_t sample_rate);
+
+#endif
@@ -0,0 +1,233 @@
+// wav_decode.c
+// PCM/ADPCM decode, downmix and polyphase resampling
+
+#include "wav_decode.h"
+#include <math.h>
+#include <string.h>
+
+// Windowed-sinc table for the current rate pair, one row of taps per phase (Q15)
+static int16_t  coef[WAV_PHASES][WAV_TAPS];
+static uint32_t coef_in_rate = 0;
+static uint32_t coef_out_rate = 0;
+
+// Low-pass at 0.45 * the lower of the two rates, Hann-windowed, each phase
+// normalised to unity gain at DC
+static void build_coef(uint32_t in_rate, uint32_t out_rate) {
+    const float pi = 3.14159265f;
+    float fc = 0.45f * (float)((in_rate < out_rate) ? in_rate : out_rate) / (float)in_rate;
+    for (int p = 0; p < WAV_PHASES; p++) {
+        float frac = (float)p / WAV_PHASES;
+        float h[WAV_TAPS];
+        float sum = 0.0f;
+        for (int k = 0; k < WAV_TAPS; k++) {
+            float x = (float)k - (WAV_TAPS / 2 - 1) - frac; // Distance from the output point
+            float sinc = (x == 0.0f) ? 1.0f : sinf(2.0f * pi * fc * x) / (2.0f * pi * fc * x);
+            float w = 0.5f + 0.5f * cosf(pi * x / (WAV_TAPS / 2));
+            h[k] = sinc * w;
+            sum += h[k];
+        }
+        for (int k = 0; k < WAV_TAPS; k++) coef[p][k] = (int16_t)lrintf(32767.0f * h[k] / sum);
+    }
+    coef_in_rate = in_rate;
+    coef_out_rate = out_rate;
+}
+
+int wav_decoder_init(WavDecoder* d, uint16_t format, uint16_t channels, uint16_t bits,
+                     uint16_t block_align, uint32_t in_rate, uint32_t out_rate) {
+    if ((channels != 1 && channels != 2) || in_rate == 0 || out_rate == 0) return -1;
+    if (format == WAV_FORMAT_EXTENSIBLE) format = WAV_FORMAT_PCM;
+    if (format == WAV_FORMAT_PCM) {
+        if (bits != 8 && bits != 16) return -1;
+    } else if (format == WAV_FORMAT_IMA_ADPCM) {
+        // Whole 4-byte groups per channel after the header
+        if (bits != 4 || block_align <= 4 * channels || (block_align - 4 * channels) % (4 * channels) != 0) return -1;
+    } else {
+        return -1;
+    }
+    memset(d, 0, sizeof(*d));
+    d->format = format;
+    d->channels = channels;
+    d->bits = bits;
+    d->frame_bytes = (uint16_t)(channels * (bits / 8));
+    d->block_align = block_align;
+    d->out_channels = 1;
+    d->chunk_channels = 1;
+    d->resample = (in_rate != out_rate);
+    d->step_q16 = (uint32_t)(((uint64_t)in_rate << 16) / out_rate);
+    if (d->resample && (coef_in_rate != in_rate || coef_out_rate != out_rate)) build_coef(in_rate, out_rate);
+    return 0;
+}
+
+void wav_decoder_stereo(WavDecoder* d) {
+    d->out_channels = 2;
+    d->chunk_channels = (uint8_t)d->channels;
+}
+
+// Sample c of an input frame as signed 16-bit
+static int16_t frame_sample(const WavDecoder* d, const uint8_t* f, int c) {
+    if (d->bits == 8) return (int16_t)(((int32_t)f[c] - 128) << 8);
+    return (int16_t)(f[2 * c] | (f[2 * c + 1] << 8));
+}
+
+// One input frame to a signed 16-bit mono sample
+static int16_t frame_to_mono(const WavDecoder* d, const uint8_t* f) {
+    if (d->bits == 8) {
+        int32_t s = (int32_t)f[0] - 128;
+        if (d->channels == 2) s = (s + (int32_t)f[1] - 128) >> 1;
+        return (int16_t)(s << 8);
+    }
+    int32_t s = (int16_t)(f[0] | (f[1] << 8));
+    if (d->channels == 2) s = (s + (int16_t)(f[2] | (f[3] << 8))) >> 1;
+    return (int16_t)s;
+}
+
+// Takes the next whole frame from the carry and/or the input. Returns its bytes, or 0
+// if the input ran out.
+static const uint8_t* next_frame(WavDecoder* d, const uint8_t* in, uint32_t in_bytes, uint32_t* i) {
+    if (d->carry_len == 0 && *i + d->frame_bytes <= in_bytes) {
+        const uint8_t* f = in + *i;
+        *i += d->frame_bytes;
+        return f;
+    }
+    while (d->carry_len < d->frame_bytes) {
+        if (*i >= in_bytes) return 0;
+        d->carry[d->carry_len++] = in[(*i)++];
+    }
+    d->carry_len = 0;
+    return d->carry;
+}
+
+static void fill_pcm(WavDecoder* d, const uint8_t* in, uint32_t in_bytes, uint32_t* i) {
+    const uint8_t* f;
+    if (d->chunk_channels == 2) {
+        while (d->chunk_len + 2 <= WAV_CHUNK && (f = next_frame(d, in, in_bytes, i)) != 0) {
+            d->chunk[d->chunk_len++] = frame_sample(d, f, 0);
+            d->chunk[d->chunk_len++] = frame_sample(d, f, 1);
+        }
+        return;
+    }
+    while (d->chunk_len < WAV_CHUNK && (f = next_frame(d, in, in_bytes, i)) != 0) {
+        d->chunk[d->chunk_len++] = frame_to_mono(d, f);
+    }
+}
+
+// Decodes ADPCM into the chunk. Mono data runs straight from the input buffer a
+// stretch at a time; stereo goes a byte at a time so the two channels can be mixed
+// or interleaved.
+static void fill_adpcm(WavDecoder* d, const uint8_t* in, uint32_t in_bytes, uint32_t* i) {
+    uint32_t header_bytes = 4u * d->channels;
+    while (d->chunk_len + 16 <= WAV_CHUNK && *i < in_bytes) {
+        if (d->block_pos < header_bytes) {
+            d->header[d->block_pos++] = in[(*i)++];
+            if (d->block_pos == header_bytes) {
+                int32_t s = adpcm_block_header(&d->adpcm[0], d->header);
+                if (d->chunk_channels == 2) {
+                    d->chunk[d->chunk_len++] = (int16_t)s;
+                    d->chunk[d->chunk_len++] = adpcm_block_header(&d->adpcm[1], d->header + 4);
+                } else {
+                    if (d->channels == 2) s = (s + adpcm_block_header(&d->adpcm[1], d->header + 4)) >> 1;
+                    d->chunk[d->chunk_len++] = (int16_t)s;
+                }
+            }
+        } else if (d->channels == 1) {
+            uint32_t n = (WAV_CHUNK - d->chunk_len) / 2;
+            if (n > in_bytes - *i) n = in_bytes - *i;
+            if (n > (uint32_t)(d->block_align - d->block_pos)) n = d->block_align - d->block_pos;
+            adpcm_decode_bytes(&d->adpcm[0], in + *i, n, &d->chunk[d->chunk_len]);
+            d->chunk_len += n * 2;
+            d->block_pos += n;
+            *i += n;
+        } else {
+            // 4 bytes (8 samples) of left, then 4 of right
+            uint32_t g = (d->block_pos - header_bytes) & 7;
+            if (g < 4) {
+                adpcm_decode_bytes(&d->adpcm[0], in + *i, 1, &d->group[2 * g]);
+            } else {
+                int16_t r[2];
+                adpcm_decode_bytes(&d->adpcm[1], in + *i, 1, r);
+                const int16_t* l = &d->group[2 * (g - 4)];
+                if (d->chunk_channels == 2) {
+                    d->chunk[d->chunk_len++] = l[0];
+                    d->chunk[d->chunk_len++] = r[0];
+                    d->chunk[d->chunk_len++] = l[1];
+                    d->chunk[d->chunk_len++] = r[1];
+                } else {
+                    d->chunk[d->chunk_len++] = (int16_t)((l[0] + r[0]) >> 1);
+                    d->chunk[d->chunk_len++] = (int16_t)((l[1] + r[1]) >> 1);
+                }
+            }
+            d->block_pos++;
+            (*i)++;
+        }
+        if (d->block_pos >= d->block_align) d->block_pos = 0;
+    }
+}
+
+// Dot product of the newest WAV_TAPS inputs with the phase nearest the output position
+static int16_t fir(const WavDecoder* d, const int16_t* hist) {
+    const int16_t* x = &hist[d->hist_pos];
+    const int16_t* h = coef[(d->pos_q16 >> (16 - WAV_PHASES_LOG2)) & (WAV_PHASES - 1)];
+    int32_t acc = 0;
+    for (int k = 0; k < WAV_TAPS; k++) acc += (int32_t)x[k] * h[k];
+    acc = (acc + (1 << 14)) >> 15;
+    if (acc > 32767) acc = 32767;
+    if (acc < -32768) acc = -32768;
+    return (int16_t)acc;
+}
+
+uint32_t wav_decode(WavDecoder* d, const uint8_t* in, uint32_t in_bytes, uint32_t* used,
+                    int16_t* out, uint32_t max_out) {
+    uint32_t i = 0;
+    uint32_t n = 0;
+
+    for (;;) {
+        // Resample (or copy) what is already decoded
+        while (d->chunk_idx < d->chunk_len) {
+            if (!d->resample) {
+                if (n == max_out) goto done;
+                if (d->out_channels == 1) {
+                    out[n++] = d->chunk[d->chunk_idx++];
+                    continue;
+                }
+                int16_t l = d->chunk[d->chunk_idx++];
+                out[2 * n] = l;
+                out[2 * n + 1] = (d->chunk_channels == 2) ? d->chunk[d->chunk_idx++] : l;
+                n++;
+                continue;
+            }
+            // Every output that lies before the newest input can be computed now
+            while (d->pos_q16 < 0x10000) {
+                if (n == max_out) goto done;
+                if (d->out_channels == 1) {
+                    out[n++] = fir(d, d->hist);
+                } else {
+                    int16_t l = fir(d, d->hist);
+                    out[2 * n] = l;
+                    out[2 * n + 1] = (d->chunk_channels == 2) ? fir(d, d->hist_r) : l;
+                    n++;
+                }
+                d->pos_q16 += d->step_q16;
+            }
+            int16_t s = d->chunk[d->chunk_idx++];
+            d->hist[d->hist_pos] = s;
+            d->hist[d->hist_pos + WAV_TAPS] = s;
+            if (d->chunk_channels == 2) {
+                s = d->chunk[d->chunk_idx++];
+                d->hist_r[d->hist_pos] = s;
+                d->hist_r[d->hist_pos + WAV_TAPS] = s;
+            }
+            d->hist_pos = (uint8_t)((d->hist_pos + 1) % WAV_TAPS);
+            d->pos_q16 -= 0x10000;
+        }
+
+        // Then decode the next chunk of input
+        d->chunk_len = 0;
+        d->chunk_idx = 0;
+        if (d->format == WAV_FORMAT_IMA_ADPCM) fill_adpcm(d, in, in_bytes, &i);
+        else fill_pcm(d, in, in_bytes, &i);
+        if (d->chunk_len == 0) break;
+    }
+done:
+    *used = i;
+    return n;
+}
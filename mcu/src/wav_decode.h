@@ -0,0 +1,68 @@
+// wav_decode.h
+// Block decoder from WAV sample data to signed 16-bit mono at the DAC rate:
+// 8/16-bit PCM or IMA ADPCM, mono or stereo (mixed down), resampled by a fixed-point
+// polyphase FIR. Input is decoded a chunk at a time, then the chunk is resampled.
+// A decoder can instead write interleaved stereo frames (wav_decoder_stereo).
+
+#ifndef WAV_DECODE_H
+#define WAV_DECODE_H
+
+#include <stdint.h>
+#include "adpcm.h"
+
+#define WAV_FORMAT_PCM        0x0001
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE // PCM when the sample format is 8/16-bit
+
+#define WAV_TAPS        16 // FIR taps per phase
+#define WAV_PHASES_LOG2 6
+#define WAV_PHASES      (1 << WAV_PHASES_LOG2) // Fractional positions between input samples
+#define WAV_CHUNK       64 // Input-rate samples decoded per pass
+
+typedef struct {
+    uint16_t format;                // WAV_FORMAT_PCM or WAV_FORMAT_IMA_ADPCM
+    uint16_t channels;
+    uint16_t bits;
+    uint16_t frame_bytes;           // Bytes per input frame (all channels)
+    uint8_t  carry[4];              // Input frame split across two calls
+    uint8_t  carry_len;
+
+    // IMA ADPCM: blocks are decoded as they stream past, so no block buffer is needed
+    uint16_t block_align;           // Bytes per block (all channels)
+    uint16_t block_pos;             // Bytes of the current block consumed
+    AdpcmChannel adpcm[2];
+    uint8_t  header[8];             // Block header bytes gathered so far
+    int16_t  group[8];              // Left samples of a stereo group waiting for the right
+
+    // Decoded input-rate samples on their way to the resampler
+    int16_t  chunk[WAV_CHUNK];
+    uint8_t  chunk_len;
+    uint8_t  chunk_idx;
+    uint8_t  out_channels;          // 1, or 2 after wav_decoder_stereo
+    uint8_t  chunk_channels;        // 2 when stereo input stays stereo: chunk holds L, R pairs
+
+    uint8_t  resample;              // 0 when the rates match
+    uint32_t step_q16;              // Input samples per output sample, Q16
+    uint32_t pos_q16;               // Next output position past the oldest tap, Q16
+    int16_t  hist[2 * WAV_TAPS];    // Input history, stored twice so any window is contiguous
+    int16_t  hist_r[2 * WAV_TAPS];  // Same for the right channel when chunk_channels is 2
+    uint8_t  hist_pos;
+} WavDecoder;
+
+// Sets a decoder up for one stream, from the fields of its fmt chunk. block_align is
+// only used for ADPCM. Returns 0, or -1 for a format it cannot decode.
+// Decoders that share rates share one coefficient table.
+int wav_decoder_init(WavDecoder* d, uint16_t format, uint16_t channels, uint16_t bits,
+                     uint16_t block_align, uint32_t in_rate, uint32_t out_rate);
+
+// Makes the decoder write left, right frames: stereo input keeps its channels and
+// mono input is copied to both. Call after wav_decoder_init.
+void wav_decoder_stereo(WavDecoder* d);
+
+// Decodes from in[0..in_bytes) into out[0..max_out) frames. Stops when either runs out;
+// partial input frames and ADPCM blocks are carried over to the next call.
+//    -- used: set to the input bytes consumed
+//    -- return: output frames written (samples, for a mono decoder)
+uint32_t wav_decode(WavDecoder* d, const uint8_t* in, uint32_t in_bytes, uint32_t* used,
+                    int16_t* out, uint32_t max_out);
+
+#endif
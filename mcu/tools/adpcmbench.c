@@ -0,0 +1,297 @@
+// adpcmbench.c
+// Checks the firmware's IMA ADPCM decoder against a plain per-sample reference
+// decode and reports its speed. Without a file, a synthetic signal is encoded in
+// mono and stereo; with one, the blocks of an IMA ADPCM WAV are used.
+//
+// Build (Linux):  gcc -O2 -I../src -o adpcmbench adpcmbench.c ../src/adpcm.c ../src/wav_decode.c -lm
+// Usage:          ./adpcmbench [SONG.WAV]
+
+#include "adpcm.h"
+#include "wav_decode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define TEST_SECONDS 10
+#define TEST_RATE    22050
+#define REPEATS      20 // Decodes of the whole stream when timing
+
+// --- Reference decoder: the IMA algorithm written out one sample at a time ---
+
+static const int ref_steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+static const int ref_index_adjust[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+// Code for sample n (n >= 1) of channel c
+static int ref_code(const uint8_t* block, int channels, int c, int n) {
+    int k = n - 1;
+    int byte = 4 * channels + (k / 8) * 4 * channels + 4 * c + (k % 8) / 2;
+    return (k & 1) ? block[byte] >> 4 : block[byte] & 0x0F;
+}
+
+static int ref_decode_block(const uint8_t* block, int bytes, int channels, int16_t* out) {
+    int samples = (bytes - 4 * channels) * 2 / channels + 1;
+    for (int c = 0; c < channels; c++) {
+        int pred = (int16_t)(block[4 * c] | (block[4 * c + 1] << 8));
+        int index = block[4 * c + 2];
+        if (index > 88) index = 88;
+        out[c] = (int16_t)pred;
+        for (int n = 1; n < samples; n++) {
+            int code = ref_code(block, channels, c, n);
+            int step = ref_steps[index];
+            int diff = step >> 3;
+            if (code & 4) diff += step;
+            if (code & 2) diff += step >> 1;
+            if (code & 1) diff += step >> 2;
+            pred += (code & 8) ? -diff : diff;
+            if (pred > 32767) pred = 32767;
+            if (pred < -32768) pred = -32768;
+            index += ref_index_adjust[code & 7];
+            if (index < 0) index = 0;
+            if (index > 88) index = 88;
+            out[n * channels + c] = (int16_t)pred;
+        }
+    }
+    return samples;
+}
+
+// --- Encoder for the synthetic test ---
+
+typedef struct {
+    int pred;
+    int index;
+} EncState;
+
+static int encode_sample(EncState* e, int x) {
+    int step = ref_steps[e->index];
+    int d = x - e->pred;
+    int code = 0;
+    if (d < 0) {
+        code = 8;
+        d = -d;
+    }
+    int diff = step >> 3;
+    if (d >= step) { code |= 4; d -= step; diff += step; }
+    if (d >= step >> 1) { code |= 2; d -= step >> 1; diff += step >> 1; }
+    if (d >= step >> 2) { code |= 1; diff += step >> 2; }
+    e->pred += (code & 8) ? -diff : diff;
+    if (e->pred > 32767) e->pred = 32767;
+    if (e->pred < -32768) e->pred = -32768;
+    e->index += ref_index_adjust[code & 7];
+    if (e->index < 0) e->index = 0;
+    if (e->index > 88) e->index = 88;
+    return code;
+}
+
+// Encodes interleaved PCM into blocks of block_align bytes. Returns the stream size.
+static long encode(const int16_t* pcm, long frames, int channels, int block_align, uint8_t* out) {
+    int per_block = (block_align - 4 * channels) * 2 / channels + 1;
+    EncState e[2] = { { 0, 0 }, { 0, 0 } };
+    long size = 0;
+    for (long f = 0; f + per_block <= frames; f += per_block) {
+        uint8_t* b = out + size;
+        memset(b, 0, block_align);
+        for (int c = 0; c < channels; c++) {
+            e[c].pred = pcm[f * channels + c];
+            b[4 * c] = (uint8_t)e[c].pred;
+            b[4 * c + 1] = (uint8_t)(e[c].pred >> 8);
+            b[4 * c + 2] = (uint8_t)e[c].index;
+            for (int n = 1; n < per_block; n++) {
+                int k = n - 1;
+                int byte = 4 * channels + (k / 8) * 4 * channels + 4 * c + (k % 8) / 2;
+                int code = encode_sample(&e[c], pcm[(f + n) * channels + c]);
+                b[byte] |= (uint8_t)((k & 1) ? code << 4 : code);
+            }
+        }
+        size += block_align;
+    }
+    return size;
+}
+
+// Tones, a sweep, noise bursts and silence, so the step index covers its range
+static void synth(int16_t* pcm, long frames, int channels) {
+    uint32_t seed = 1;
+    for (long i = 0; i < frames; i++) {
+        double t = (double)i / TEST_RATE;
+        double s = 0.3 * sin(2 * M_PI * 220 * t) + 0.2 * sin(2 * M_PI * (100 + 400 * t) * t);
+        seed = seed * 1664525u + 1013904223u;
+        if ((i / 4000) % 3 == 0) s += 0.4 * ((int32_t)seed / 2147483648.0);
+        if ((i / 30000) % 4 == 3) s *= 0.01;
+        for (int c = 0; c < channels; c++) {
+            double v = (c == 0) ? s : 0.8 * s + 0.1 * cos(2 * M_PI * 3000 * t);
+            pcm[i * channels + c] = (int16_t)lrint(32767.0 * (v > 1 ? 1 : v < -1 ? -1 : v));
+        }
+    }
+}
+
+// --- Checks ---
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t ticks(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int run(const char* name, const uint8_t* data, long size, int channels, int block_align, uint32_t rate) {
+    long blocks = size / block_align;
+    int per_block = (block_align - 4 * channels) * 2 / channels + 1;
+    long samples = blocks * per_block; // Per channel
+    int16_t* ref = malloc(sizeof(int16_t) * samples * channels);
+    int16_t* dut = malloc(sizeof(int16_t) * samples * channels);
+    int16_t* mono = malloc(sizeof(int16_t) * (samples + WAV_CHUNK));
+    int failed = 0;
+
+    for (long b = 0; b < blocks; b++) {
+        ref_decode_block(data + b * block_align, block_align, channels, ref + b * per_block * channels);
+    }
+
+    // Block decoder
+    for (long b = 0; b < blocks; b++) {
+        uint32_t n = adpcm_decode_block(data + b * block_align, block_align, channels, dut + b * per_block * channels);
+        if ((int)n != per_block) {
+            printf("%s: block %ld gave %u samples, expected %d\n", name, b, n, per_block);
+            failed = 1;
+            break;
+        }
+    }
+    long mismatch = 0;
+    for (long i = 0; i < samples * channels; i++) mismatch += (ref[i] != dut[i]);
+    if (mismatch) failed = 1;
+    printf("%s: %ld blocks of %d bytes, %d ch: block decode %s (%ld mismatches)\n",
+           name, blocks, block_align, channels, mismatch ? "DIFFERS" : "bit-exact", mismatch);
+
+    // Streaming decoder, fed in uneven pieces the way sector runs arrive
+    WavDecoder d;
+    if (wav_decoder_init(&d, WAV_FORMAT_IMA_ADPCM, channels, 4, block_align, rate, rate) != 0) {
+        printf("%s: wav_decoder_init rejected the stream\n", name);
+        failed = 1;
+    } else {
+        long pos = 0, n = 0, piece = 1;
+        while (pos < blocks * block_align) {
+            long len = piece % 2011 + 1;
+            if (len > blocks * block_align - pos) len = blocks * block_align - pos;
+            uint32_t used = 0;
+            n += wav_decode(&d, data + pos, len, &used, mono + n, samples - n);
+            pos += used;
+            piece = piece * 7 + 3;
+        }
+        long stream_mismatch = (n != samples);
+        for (long i = 0; i < n && i < samples; i++) {
+            int32_t want = ref[i * channels];
+            if (channels == 2) want = (want + ref[i * channels + 1]) >> 1;
+            stream_mismatch += (mono[i] != want);
+        }
+        if (stream_mismatch) failed = 1;
+        printf("%s: streaming decode %s (%ld of %ld samples, %ld mismatches)\n",
+               name, stream_mismatch ? "DIFFERS" : "bit-exact", n, samples, stream_mismatch);
+    }
+
+    // Speed of the block decoder
+    double t0 = now();
+    uint64_t c0 = ticks();
+    for (int r = 0; r < REPEATS; r++) {
+        for (long b = 0; b < blocks; b++) {
+            adpcm_decode_block(data + b * block_align, block_align, channels, dut + b * per_block * channels);
+        }
+    }
+    uint64_t c1 = ticks();
+    double secs = now() - t0;
+    double total = (double)samples * channels * REPEATS;
+    printf("%s: %.2f ns per sample", name, 1e9 * secs / total);
+    if (c1 > c0) printf(", %.1f TSC cycles per sample", (double)(c1 - c0) / total);
+    printf(", %.0fx real time\n", (double)samples * REPEATS / rate / secs);
+
+    free(ref);
+    free(dut);
+    free(mono);
+    return failed;
+}
+
+static uint32_t get_u32(const uint8_t* b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint16_t get_u16(const uint8_t* b) {
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static int run_file(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "adpcmbench: cannot open %s\n", path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* file = malloc(size);
+    if (fread(file, 1, size, f) != (size_t)size) size = 0;
+    fclose(f);
+
+    if (size < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "adpcmbench: %s is not a WAV file\n", path);
+        return 1;
+    }
+    uint16_t format = 0, channels = 0, block_align = 0;
+    uint32_t rate = 0;
+    const uint8_t* data = 0;
+    long data_size = 0;
+    for (long off = 12; off + 8 <= size;) {
+        uint32_t id_size = get_u32(file + off + 4);
+        if (memcmp(file + off, "fmt ", 4) == 0) {
+            format = get_u16(file + off + 8);
+            channels = get_u16(file + off + 10);
+            rate = get_u32(file + off + 12);
+            block_align = get_u16(file + off + 20);
+        } else if (memcmp(file + off, "data", 4) == 0) {
+            data = file + off + 8;
+            data_size = (off + 8 + (long)id_size <= size) ? (long)id_size : size - off - 8;
+        }
+        off += 8 + id_size + (id_size & 1);
+    }
+    if (format != WAV_FORMAT_IMA_ADPCM || !data || (channels != 1 && channels != 2)) {
+        fprintf(stderr, "adpcmbench: %s is not a mono/stereo IMA ADPCM WAV\n", path);
+        return 1;
+    }
+    int res = run(path, data, data_size, channels, block_align, rate);
+    free(file);
+    return res;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) return run_file(argv[1]);
+
+    long frames = (long)TEST_SECONDS * TEST_RATE;
+    int failed = 0;
+    for (int channels = 1; channels <= 2; channels++) {
+        int block_align = 512 * channels;
+        int16_t* pcm = malloc(sizeof(int16_t) * frames * channels);
+        uint8_t* adpcm = malloc(frames * channels);
+        synth(pcm, frames, channels);
+        long size = encode(pcm, frames, channels, block_align, adpcm);
+        failed |= run(channels == 1 ? "mono" : "stereo", adpcm, size, channels, block_align, TEST_RATE);
+        free(pcm);
+        free(adpcm);
+    }
+    return failed;
+}
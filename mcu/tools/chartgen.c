@@ -0,0 +1,337 @@
+// chartgen.c
+// Offline beatmap compiler. Reads a song WAV, analyses the whole file and writes
+// a .CHT chart next to it, which the firmware plays instead of detecting beats live.
+//
+// Build (Linux):  gcc -O2 -I../src -o chartgen chartgen.c ../src/onset.c ../src/wav_decode.c ../src/adpcm.c -lm
+// Usage:          ./chartgen MV.WAV [-o OUT.CHT] [-div 1|2] [-rate HZ]
+//
+// Note times are written in samples at the firmware's DAC rate (-rate, default 16000),
+// whatever the rate of the WAV.
+//
+// Uses the same onset detector as the firmware, but with knowledge of the whole song:
+// thresholds look at frames on both sides, tempo and phase are fitted over the full
+// length, and when two onsets compete for one grid point the stronger one wins.
+
+#define CHART_HOST_ONLY
+#include "chart.h"
+#include "onset.h"
+#include "tempo.h"
+#include "wav_decode.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PICK_WINDOW  8    // Frames each side for the local flux statistics
+#define PICK_K       1.5  // Threshold = mean + K * deviation + ONSET_FLOOR
+#define ONSET_OFFSET (ONSET_FRAME / 8) // Where in its frame an onset is placed
+
+typedef struct {
+    uint32_t sample_rate;
+    uint32_t samples;
+    int16_t* pcm; // Mono, signed Q15
+} Song;
+
+typedef struct {
+    uint32_t sample;
+    uint8_t  lanes;
+    double   margin;
+} Note;
+
+// --- WAV loading ---
+
+static uint32_t get_u32(const uint8_t* b) {
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint16_t get_u16(const uint8_t* b) {
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static void put_u32(uint8_t* b, uint32_t v) {
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+    b[2] = (uint8_t)(v >> 16);
+    b[3] = (uint8_t)(v >> 24);
+}
+
+// Loads any WAV the firmware plays (8/16-bit PCM or IMA ADPCM, mono or stereo)
+// through its own decoder, mixed down to mono at the file's rate
+static int load_wav(const char* path, Song* song) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* file = malloc((size_t)size);
+    if (!file || fread(file, 1, (size_t)size, f) != (size_t)size) {
+        fclose(f);
+        free(file);
+        return -1;
+    }
+    fclose(f);
+
+    if (size < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+        free(file);
+        return -2;
+    }
+
+    uint16_t format = 0, channels = 0, bits = 0, block_align = 0;
+    const uint8_t* data = 0;
+    uint32_t data_size = 0;
+    long offset = 12;
+    while (offset + 8 <= size) {
+        uint32_t chunk = get_u32(file + offset + 4);
+        const uint8_t* body = file + offset + 8;
+        if (chunk > (uint32_t)(size - offset - 8)) chunk = (uint32_t)(size - offset - 8);
+        if (memcmp(file + offset, "fmt ", 4) == 0 && chunk >= 16) {
+            format = get_u16(body);
+            channels = get_u16(body + 2);
+            song->sample_rate = get_u32(body + 4);
+            block_align = get_u16(body + 12);
+            bits = get_u16(body + 14);
+        } else if (memcmp(file + offset, "data", 4) == 0) {
+            data = body;
+            data_size = chunk;
+        }
+        offset += 8 + chunk + (chunk & 1);
+    }
+    WavDecoder dec;
+    if (!data || wav_decoder_init(&dec, format, channels, bits, block_align,
+                                  song->sample_rate, song->sample_rate) != 0) {
+        free(file);
+        return -3;
+    }
+
+    // Same rate in and out, so the decoder only converts and mixes down
+    uint32_t cap = 0;
+    song->samples = 0;
+    song->pcm = 0;
+    while (data_size > 0) {
+        if (cap - song->samples < 4096) {
+            cap += 1 << 20;
+            song->pcm = realloc(song->pcm, cap * sizeof(int16_t));
+        }
+        uint32_t used;
+        uint32_t n = wav_decode(&dec, data, data_size, &used, song->pcm + song->samples, cap - song->samples);
+        song->samples += n;
+        data += used;
+        data_size -= used;
+        if (n == 0 && used == 0) break;
+    }
+    free(file);
+    return 0;
+}
+
+// --- Tempo ---
+
+// Onset strength at a fractional frame position, linearly interpolated
+static double env_at(const double* env, uint32_t frames, double pos) {
+    if (pos < 0 || pos >= frames - 1) return 0;
+    uint32_t i = (uint32_t)pos;
+    double frac = pos - i;
+    return env[i] * (1 - frac) + env[i + 1] * frac;
+}
+
+// Fits one beat period and phase (both in frames) to the whole song. The period comes
+// from the autocorrelation, weighted like the firmware tracker, then period and phase
+// are refined together by maximising a comb over every beat in the song.
+static double fit_tempo(const double* env, uint32_t frames, uint32_t sample_rate, double* phase) {
+    double frames_per_min = 60.0 * sample_rate / ONSET_FRAME;
+    int lo = (int)floor(frames_per_min / TEMPO_MAX_BPM);
+    int hi = (int)ceil(frames_per_min / TEMPO_MIN_BPM);
+    if (lo < 2) lo = 2;
+    if ((uint32_t)(2 * hi + 2) >= frames) return 0;
+
+    double* acf = calloc((size_t)(2 * hi + 3), sizeof(double));
+    for (int lag = 0; lag <= 2 * hi + 2; lag++) {
+        for (uint32_t i = (uint32_t)lag; i < frames; i++) acf[lag] += env[i] * env[i - lag];
+    }
+
+    int best = 0;
+    double best_score = 0;
+    for (int lag = lo; lag <= hi; lag++) {
+        double octaves = log2(frames_per_min / (lag * TEMPO_PRIOR_BPM));
+        double score = (acf[lag] + acf[2 * lag] / 2) * exp(-0.5 * octaves * octaves);
+        if (score > best_score) {
+            best_score = score;
+            best = lag;
+        }
+    }
+    free(acf);
+    if (best == 0) return 0;
+
+    double best_period = best, best_phase = 0, best_comb = -1e300;
+    for (double period = best - 1.0; period <= best + 1.0; period += 0.005) {
+        for (double ph = 0; ph < period; ph += 0.125) {
+            double comb = 0;
+            for (double pos = ph; pos < frames; pos += period) comb += env_at(env, frames, pos);
+            comb /= floor((frames - ph) / period) + 1;
+            if (comb > best_comb) {
+                best_comb = comb;
+                best_period = period;
+                best_phase = ph;
+            }
+        }
+    }
+    *phase = best_phase;
+    return best_period;
+}
+
+// --- Onset picking ---
+
+// Picks onsets per band against thresholds from frames on both sides.
+// Returns the band with the widest margin over its threshold, or -1.
+static int pick_frame(double* const flux[ONSET_BANDS], int32_t* const level[ONSET_BANDS],
+                      uint32_t frames, uint32_t f, double* margin) {
+    int lane = -1;
+    *margin = 0;
+    uint32_t lo = (f > PICK_WINDOW) ? f - PICK_WINDOW : 0;
+    uint32_t hi = (f + PICK_WINDOW < frames) ? f + PICK_WINDOW : frames - 1;
+
+    for (int b = 0; b < ONSET_BANDS; b++) {
+        const double* x = flux[b];
+        if (level[b][f] <= ONSET_MIN_LEVEL) continue;
+        if ((f > 0 && x[f - 1] > x[f]) || (f + 1 < frames && x[f + 1] >= x[f])) continue;
+
+        double mean = 0, dev = 0;
+        for (uint32_t i = lo; i <= hi; i++) mean += x[i];
+        mean /= hi - lo + 1;
+        for (uint32_t i = lo; i <= hi; i++) dev += fabs(x[i] - mean);
+        dev /= hi - lo + 1;
+
+        double over = x[f] - (mean + PICK_K * dev + ONSET_FLOOR);
+        if (over > *margin) {
+            *margin = over;
+            lane = b;
+        }
+    }
+    return lane;
+}
+
+// --- Main ---
+
+static void usage(void) {
+    fprintf(stderr, "usage: chartgen SONG.WAV [-o OUT.CHT] [-div 1|2] [-rate HZ]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* in = 0;
+    const char* out = 0;
+    int div = TEMPO_SNAP_DIV;
+    uint32_t out_rate = 16000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out = argv[++i];
+        else if (strcmp(argv[i], "-div") == 0 && i + 1 < argc) div = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc) out_rate = (uint32_t)atoi(argv[++i]);
+        else if (argv[i][0] == '-' || in) usage();
+        else in = argv[i];
+    }
+    if (!in || div < 1 || out_rate == 0) usage();
+
+    // SONG.WAV -> SONG.CHT, keeping the case of the extension
+    char out_buf[1024];
+    if (!out) {
+        snprintf(out_buf, sizeof(out_buf), "%s", in);
+        char* dot = strrchr(out_buf, '.');
+        if (!dot || strlen(dot) != 4) {
+            fprintf(stderr, "chartgen: give an output name with -o\n");
+            return 1;
+        }
+        int lower = (dot[1] >= 'a' && dot[1] <= 'z');
+        strcpy(dot + 1, lower ? "cht" : CHART_EXT);
+        out = out_buf;
+    }
+
+    Song song = {0};
+    int res = load_wav(in, &song);
+    if (res != 0) {
+        fprintf(stderr, "chartgen: %s: %s\n", in,
+                res == -1 ? "cannot read file" : res == -2 ? "not a WAV file"
+                : "unsupported format (the player takes 8/16-bit PCM or IMA ADPCM, mono or stereo)");
+        return 1;
+    }
+
+    // 1. Onset detector over every frame, keeping per-band levels and strength
+    uint32_t frames = song.samples / ONSET_FRAME;
+    double* flux[ONSET_BANDS];
+    int32_t* level[ONSET_BANDS];
+    for (int b = 0; b < ONSET_BANDS; b++) {
+        flux[b] = calloc(frames, sizeof(double));
+        level[b] = calloc(frames, sizeof(int32_t));
+    }
+    double* env = calloc(frames, sizeof(double));
+
+    OnsetDetector det;
+    onset_init(&det, song.sample_rate);
+    for (uint32_t f = 0; f < frames; f++) {
+        onset_process(&det, song.pcm + (size_t)f * ONSET_FRAME);
+        for (int b = 0; b < ONSET_BANDS; b++) {
+            level[b][f] = det.prev_level[b];
+            if (f > 0 && level[b][f] > level[b][f - 1]) flux[b][f] = level[b][f] - level[b][f - 1];
+        }
+        env[f] = det.strength;
+    }
+
+    // 2. Tempo over the whole song on the mean-removed strength envelope
+    double mean = 0;
+    for (uint32_t f = 0; f < frames; f++) mean += env[f];
+    if (frames) mean /= frames;
+    for (uint32_t f = 0; f < frames; f++) env[f] -= mean;
+    double phase = 0;
+    double period = fit_tempo(env, frames, song.sample_rate, &phase);
+
+    // 3. Notes: one per grid point, the strongest onset wins
+    Note* notes = calloc(frames + 1, sizeof(Note));
+    uint32_t count = 0;
+    double grid = period * ONSET_FRAME / div;             // Samples per grid step
+    double origin = phase * ONSET_FRAME + ONSET_OFFSET;   // Sample index of a beat
+    for (uint32_t f = 0; f < frames; f++) {
+        double margin;
+        int lane = pick_frame(flux, level, frames, f, &margin);
+        if (lane < 0) continue;
+
+        double t = (double)f * ONSET_FRAME + ONSET_OFFSET;
+        if (grid > 0) t = origin + floor((t - origin) / grid + 0.5) * grid;
+        if (t < 0) continue;
+        uint32_t sample = (uint32_t)(t * out_rate / song.sample_rate + 0.5);
+
+        if (count > 0 && sample <= notes[count - 1].sample) {
+            if (margin > notes[count - 1].margin) {
+                notes[count - 1].lanes = (uint8_t)(1 << lane);
+                notes[count - 1].margin = margin;
+            }
+            continue;
+        }
+        notes[count].sample = sample;
+        notes[count].lanes = (uint8_t)(1 << lane);
+        notes[count].margin = margin;
+        count++;
+    }
+
+    // 4. Write the chart
+    FILE* f = fopen(out, "wb");
+    if (!f) {
+        fprintf(stderr, "chartgen: cannot write %s\n", out);
+        return 1;
+    }
+    double bpm = (period > 0) ? 60.0 * song.sample_rate / (period * ONSET_FRAME) : 0;
+    uint8_t rec[CHART_HEADER_SIZE];
+    memcpy(rec, CHART_MAGIC, 4);
+    put_u32(rec + 4, out_rate);
+    put_u32(rec + 8, count);
+    put_u32(rec + 12, (uint32_t)(bpm * 100 + 0.5));
+    fwrite(rec, 1, CHART_HEADER_SIZE, f);
+    for (uint32_t i = 0; i < count; i++) {
+        memset(rec, 0, CHART_RECORD_SIZE);
+        put_u32(rec, notes[i].sample);
+        rec[4] = notes[i].lanes;
+        fwrite(rec, 1, CHART_RECORD_SIZE, f);
+    }
+    fclose(f);
+
+    printf("%s: %u Hz, %.1f s, %.2f BPM, %u notes -> %s\n", in, song.sample_rate,
+           (double)song.samples / song.sample_rate, bpm, count, out);
+    return 0;
+}
@@ -0,0 +1,109 @@
+// crcbench.c
+// Checks the firmware's slice-by-4 CRC16 against known check values and a plain
+// bit-at-a-time reference, then times it on SD-sized blocks.
+//
+// Build (Linux):  gcc -O2 -I../lib -o crcbench crcbench.c ../lib/STM32L432KC_CRC.c
+// Usage:          ./crcbench
+
+#include "STM32L432KC_CRC.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define BLOCK   512
+#define BLOCKS  4096 // Per timing pass
+#define REPEATS 50
+
+// --- Reference: the polynomial division one bit at a time ---
+
+static uint16_t ref_crc16(const uint8_t* p, uint32_t n) {
+    uint16_t crc = 0;
+    while (n--) {
+        crc ^= (uint16_t)(*p++ << 8);
+        for (int i = 0; i < 8; i++) crc = (uint16_t)((crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1);
+    }
+    return crc;
+}
+
+// --- Checks ---
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t ticks(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int check(const char* name, uint16_t got, uint16_t want) {
+    printf("%-32s 0x%04X  %s\n", name, got, got == want ? "ok" : "WRONG");
+    return got != want;
+}
+
+int main(void) {
+    int failed = 0;
+    crc16_init();
+
+    // Published check values: the CRC-16/XMODEM catalogue entry, and the SD
+    // specification's example of a block of 0xFF bytes
+    uint8_t block[BLOCK];
+    failed |= check("\"123456789\"", crc16((const uint8_t*)"123456789", 9), 0x31C3);
+    memset(block, 0xFF, BLOCK);
+    failed |= check("512 x 0xFF", crc16(block, BLOCK), 0x7FA1);
+    memset(block, 0x00, BLOCK);
+    failed |= check("512 x 0x00", crc16(block, BLOCK), 0x0000);
+
+    // Every length and alignment up to a block and a bit, and a split update
+    uint8_t* data = malloc(BLOCK * BLOCKS + 8);
+    srand(1);
+    for (int i = 0; i < BLOCK * BLOCKS + 8; i++) data[i] = (uint8_t)rand();
+    int mismatches = 0;
+    for (uint32_t len = 0; len <= BLOCK + 8; len++) {
+        for (uint32_t off = 0; off < 4; off++) {
+            uint16_t want = ref_crc16(data + off, len);
+            mismatches += crc16(data + off, len) != want;
+            mismatches += crc16_update(crc16(data + off, len / 3), data + off + len / 3, len - len / 3) != want;
+        }
+    }
+    printf("%-32s %d mismatches\n", "random lengths and alignments", mismatches);
+    if (mismatches) failed = 1;
+
+    // Speed over SD blocks
+    uint16_t sink = 0;
+    double t0 = now();
+    uint64_t c0 = ticks();
+    for (int r = 0; r < REPEATS; r++) {
+        for (int b = 0; b < BLOCKS; b++) sink ^= crc16(data + b * BLOCK, BLOCK);
+    }
+    uint64_t c1 = ticks();
+    double secs = now() - t0;
+    double bytes = (double)BLOCK * BLOCKS * REPEATS;
+    printf("slice-by-4: %.2f ns per byte, %.0f MB/s", 1e9 * secs / bytes, bytes / secs / 1e6);
+    if (c1 > c0) printf(", %.2f bytes per TSC cycle", bytes / (double)(c1 - c0));
+    printf("\n");
+
+    t0 = now();
+    c0 = ticks();
+    for (int b = 0; b < BLOCKS; b++) sink ^= ref_crc16(data + b * BLOCK, BLOCK);
+    c1 = ticks();
+    secs = now() - t0;
+    bytes = (double)BLOCK * BLOCKS;
+    printf("bitwise:    %.2f ns per byte, %.0f MB/s", 1e9 * secs / bytes, bytes / secs / 1e6);
+    if (c1 > c0) printf(", %.2f bytes per TSC cycle", bytes / (double)(c1 - c0));
+    printf(" (checksum %04X)\n", sink);
+
+    free(data);
+    printf(failed ? "FAILED\n" : "All checks passed.\n");
+    return failed;
+}
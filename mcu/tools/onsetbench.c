@@ -0,0 +1,284 @@
+// onsetbench.c
+// Times the firmware's fixed-point spectral-flux onset detector against the float
+// per-sample energy follower it replaced, and checks where the two put their beats.
+// Both run with the player's 6000-sample cooldown. Without a file, a synthetic song
+// (a chord under a kick on every beat, hats off the beat) is analysed and both are
+// also scored against its known attacks; with one, any WAV the player takes is, at
+// 16 kHz.
+//
+// Build (Linux):  gcc -O2 -I../src -o onsetbench onsetbench.c ../src/onset.c ../src/wav_decode.c ../src/adpcm.c -lm
+// Usage:          ./onsetbench [SONG.WAV]
+
+#include "onset.h"
+#include "wav_decode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define TEST_SECONDS    30
+#define TEST_RATE       16000 // The player analyses at its output rate
+#define COOLDOWN        6000  // BEAT_COOLDOWN_SAMPLES in main.c
+#define MATCH_MS        50    // Onsets this close count as the same beat
+#define MIN_PRECISION   0.9   // Share of the new detector's synthetic onsets that must land on an attack
+#define REPEATS         20    // Timed passes over the whole song, the fastest counts
+#define MAX_ONSETS      4096
+
+typedef struct {
+    uint32_t at[MAX_ONSETS];
+    int      n;
+} Onsets;
+
+static void add(Onsets* o, uint32_t at) {
+    if (o->n < MAX_ONSETS) o->at[o->n++] = at;
+}
+
+// --- Old path: process_beat as it was, one unsigned 8-bit sample at a time ---
+
+#define SENSITIVITY 1.2f
+#define MIN_VOLUME  15
+
+typedef struct {
+    float avg_energy;
+    int   beat_cooldown;
+} FloatDetector;
+
+static void float_process(FloatDetector* d, uint8_t sample, uint32_t sample_index, Onsets* out) {
+    int16_t amplitude = (int16_t)sample - 128;
+    if (amplitude < 0) amplitude = -amplitude;
+
+    float threshold = d->avg_energy * SENSITIVITY;
+    if (amplitude > threshold && amplitude > MIN_VOLUME && d->beat_cooldown == 0) {
+        add(out, sample_index);
+        d->beat_cooldown = COOLDOWN;
+    }
+
+    d->avg_energy = (d->avg_energy * 0.999f) + ((float)amplitude * 0.001f);
+    if (d->beat_cooldown > 0) d->beat_cooldown--;
+}
+
+static void run_float(const uint8_t* pcm8, long len, Onsets* out) {
+    FloatDetector d = { 20.0f, 0 };
+    out->n = 0;
+    for (long i = 0; i < len; i++) float_process(&d, pcm8[i], (uint32_t)i, out);
+}
+
+// --- New path: detect_beat's use of the detector, one frame at a time ---
+
+static void run_fixed(const int16_t* pcm, long len, Onsets* out) {
+    OnsetDetector det;
+    onset_init(&det, TEST_RATE);
+    int32_t cooldown = 0;
+    out->n = 0;
+    for (long f = 0; f + ONSET_FRAME <= len; f += ONSET_FRAME) {
+        uint8_t bands = onset_process(&det, pcm + f);
+        if (cooldown > 0) cooldown -= ONSET_FRAME;
+        if (bands == 0 || cooldown > 0) continue;
+        add(out, (uint32_t)f + ONSET_FRAME / 8);
+        cooldown = COOLDOWN;
+    }
+}
+
+// --- Synthetic song ---
+
+static void synth(int16_t* pcm, long len, Onsets* attacks) {
+    uint32_t seed = 1;
+    long beat = TEST_RATE / 2; // 120 BPM
+    attacks->n = 0;
+    for (long i = 0; i < len; i++) {
+        if (i % beat == 0 || i % beat == beat / 2 + 1) add(attacks, (uint32_t)i);
+        double t = (double)i / TEST_RATE;
+        double s = 0.1 * (sin(2 * M_PI * 220 * t) + sin(2 * M_PI * 277.2 * t) + sin(2 * M_PI * 329.6 * t));
+        double tb = (double)(i % beat) / TEST_RATE;
+        s += 0.5 * exp(-tb * 30) * sin(2 * M_PI * (60 + 200 * exp(-tb * 40)) * tb);
+        seed = seed * 1664525u + 1013904223u;
+        if (i % beat > beat / 2) s += 0.1 * exp(-(double)(i % beat - beat / 2) / 400) * ((int32_t)seed / 2147483648.0);
+        pcm[i] = (int16_t)lrint(32767.0 * (s > 1 ? 1 : s < -1 ? -1 : s));
+    }
+}
+
+// --- Checks ---
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t ticks(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Onsets of a that have one of b within MATCH_MS. Each of b is used once.
+static int matched(const Onsets* a, const Onsets* b, double* mean_ms) {
+    uint32_t tol = TEST_RATE * MATCH_MS / 1000;
+    int hits = 0, j = 0;
+    double off = 0;
+    for (int i = 0; i < a->n; i++) {
+        while (j < b->n && b->at[j] + tol < a->at[i]) j++;
+        if (j < b->n && b->at[j] <= a->at[i] + tol) {
+            off += fabs((double)b->at[j] - a->at[i]);
+            hits++;
+            j++;
+        }
+    }
+    *mean_ms = hits ? 1000.0 * off / hits / TEST_RATE : 0;
+    return hits;
+}
+
+static void report_timing(const char* name, const char* path, double secs, uint64_t cycles, long samples) {
+    printf("%s: %s %.2f ns per sample", name, path, 1e9 * secs / samples);
+    if (cycles) printf(", %.1f TSC cycles per sample", (double)cycles / samples);
+    printf(", %.0fx real time\n", (double)samples / TEST_RATE / secs);
+}
+
+static int run(const char* name, const int16_t* pcm, long len, const Onsets* attacks) {
+    uint8_t* pcm8 = malloc(len);
+    for (long i = 0; i < len; i++) pcm8[i] = (uint8_t)((pcm[i] >> 8) + 128); // The old 8-bit stream
+    Onsets* old_on = malloc(sizeof(Onsets));
+    Onsets* new_on = malloc(sizeof(Onsets));
+    int failed = 0;
+
+    run_float(pcm8, len, old_on);
+    run_fixed(pcm, len, new_on);
+    double off;
+    int both = matched(new_on, old_on, &off);
+    printf("%s: %.1f s, float path %d onsets, Q15 path %d, %d within %d ms of each other (mean %.1f ms apart)\n",
+           name, (double)len / TEST_RATE, old_on->n, new_on->n, both, MATCH_MS, off);
+
+    // The cooldown lets through about one attack in two, so score the onsets that were reported
+    if (attacks) {
+        double off_old, off_new;
+        int hit_old = matched(old_on, attacks, &off_old);
+        int hit_new = matched(new_on, attacks, &off_new);
+        printf("%s: on a kick or hat attack: float path %d of %d (mean %.1f ms off), Q15 path %d of %d (mean %.1f ms off)\n",
+               name, hit_old, old_on->n, off_old, hit_new, new_on->n, off_new);
+        if (hit_new < MIN_PRECISION * new_on->n) failed = 1;
+    }
+    if (new_on->n == 0) failed = 1;
+
+    // Speed over the whole song, per input sample. The passes alternate and the fastest
+    // of each counts, so a busy host slows both paths alike rather than one.
+    Onsets* sink = malloc(sizeof(Onsets));
+    long frames = len / ONSET_FRAME * ONSET_FRAME;
+    double float_secs = 1e9, fixed_secs = 1e9;
+    uint64_t float_cycles = 0, fixed_cycles = 0;
+    for (int r = 0; r < REPEATS; r++) {
+        double t0 = now();
+        uint64_t c0 = ticks();
+        run_float(pcm8, frames, sink);
+        uint64_t c1 = ticks();
+        double t1 = now();
+        if (t1 - t0 < float_secs) {
+            float_secs = t1 - t0;
+            float_cycles = c1 - c0;
+        }
+
+        t0 = now();
+        c0 = ticks();
+        run_fixed(pcm, frames, sink);
+        c1 = ticks();
+        t1 = now();
+        if (t1 - t0 < fixed_secs) {
+            fixed_secs = t1 - t0;
+            fixed_cycles = c1 - c0;
+        }
+    }
+    report_timing(name, "float path", float_secs, float_cycles, frames);
+    report_timing(name, "Q15 path  ", fixed_secs, fixed_cycles, frames);
+    printf("%s: Q15 path takes %.2fx the time of the float path\n", name, fixed_secs / float_secs);
+
+    free(sink);
+    free(old_on);
+    free(new_on);
+    free(pcm8);
+    return failed;
+}
+
+static uint32_t get_u32(const uint8_t* b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint16_t get_u16(const uint8_t* b) {
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+// Decodes a WAV to mono 16 kHz, as the player's analysis cursor sees it
+static int run_file(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "onsetbench: cannot open %s\n", path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* file = malloc(size);
+    if (fread(file, 1, size, f) != (size_t)size) size = 0;
+    fclose(f);
+    if (size < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "onsetbench: %s is not a WAV file\n", path);
+        return 1;
+    }
+
+    uint16_t format = 0, channels = 0, bits = 0, block_align = 0;
+    uint32_t rate = 0;
+    const uint8_t* data = 0;
+    long data_size = 0;
+    for (long off = 12; off + 8 <= size;) {
+        uint32_t id_size = get_u32(file + off + 4);
+        if (memcmp(file + off, "fmt ", 4) == 0) {
+            format = get_u16(file + off + 8);
+            channels = get_u16(file + off + 10);
+            rate = get_u32(file + off + 12);
+            block_align = get_u16(file + off + 20);
+            bits = get_u16(file + off + 22);
+        } else if (memcmp(file + off, "data", 4) == 0) {
+            data = file + off + 8;
+            data_size = (off + 8 + (long)id_size <= size) ? (long)id_size : size - off - 8;
+        }
+        off += 8 + id_size + (id_size & 1);
+    }
+    WavDecoder dec;
+    if (!data || wav_decoder_init(&dec, format, channels, bits, block_align, rate, TEST_RATE) != 0) {
+        fprintf(stderr, "onsetbench: %s is not in a format the player takes\n", path);
+        return 1;
+    }
+
+    long cap = (long)((double)data_size / (block_align ? block_align : 1) * 4 * TEST_RATE / rate) + 4096;
+    long len = 0;
+    int16_t* pcm = malloc(sizeof(int16_t) * cap);
+    while (data_size > 0 && len < cap) {
+        uint32_t used;
+        uint32_t n = wav_decode(&dec, data, (uint32_t)data_size, &used, pcm + len, (uint32_t)(cap - len));
+        len += n;
+        data += used;
+        data_size -= used;
+        if (n == 0 && used == 0) break;
+    }
+    int res = run(path, pcm, len, 0);
+    free(pcm);
+    free(file);
+    return res;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) return run_file(argv[1]);
+    long len = (long)TEST_SECONDS * TEST_RATE;
+    int16_t* pcm = malloc(sizeof(int16_t) * len);
+    Onsets* attacks = malloc(sizeof(Onsets));
+    synth(pcm, len, attacks);
+    int failed = run("synthetic", pcm, len, attacks);
+    free(attacks);
+    free(pcm);
+    return failed;
+}
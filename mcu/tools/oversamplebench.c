@@ -0,0 +1,350 @@
+// oversamplebench.c
+// Renders audio through the firmware's DAC output stage (4x half-band interpolation,
+// noise-shaped dither to 12 bits) and reports its SNR against a float version of
+// the same filters, its image rejection and its speed. The old output, 12 bits
+// straight from the song rate, is measured alongside. Without a file, a synthetic
+// song (a chord under a kick on every beat) is used; with one, the first channel of
+// a 16-bit PCM WAV is, taken as being at the song rate.
+//
+// Build (Linux):  gcc -O2 -I../src -I../host -o oversamplebench oversamplebench.c ../src/oversample.c -lm
+// Usage:          ./oversamplebench [-o OUT.WAV] [SONG.WAV]
+
+#include "oversample.h"
+#include "stm32l432xx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define SONG_RATE      16000
+#define OUT_RATE       (SONG_RATE * OVERSAMPLE_FACTOR)
+#define TEST_SECONDS   10
+#define BAND_HZ        8000.0 // Audio band: what the song rate can carry
+#define BAND_TAPS      1023   // Low-pass that picks the audio band out of an error signal
+#define MIN_IMAGE_DB   60.0   // Images below the tone, worst case
+#define MIN_GAIN_DB    10.0   // In-band SNR over the old output, with the player's shaping
+#define REPEATS        20
+#define BLOCK          256    // Frames per call: one DAC half, as the player calls it
+
+DWT_Type host_dwt; // oversample.c times itself on the cycle counter; it stays at 0 here
+
+static const int tones[] = { 100, 1000, 4000, 7000 };
+
+// --- Firmware stage ---
+
+// Renders len samples; out gets len * OVERSAMPLE_FACTOR values on the 16-bit scale
+static void run_fixed(const int16_t* pcm, long len, int shaping, double* out) {
+    Oversampler o;
+    uint16_t dac[BLOCK * OVERSAMPLE_FACTOR];
+    oversample_init(&o, 1, shaping);
+    for (long i = 0; i < len; i += BLOCK) {
+        uint32_t n = (len - i < BLOCK) ? (uint32_t)(len - i) : BLOCK;
+        oversample_process(&o, pcm + i, n, dac);
+        for (uint32_t k = 0; k < n * OVERSAMPLE_FACTOR; k++) {
+            out[i * OVERSAMPLE_FACTOR + k] = (double)dac[k] * 16.0 - 32768.0;
+        }
+    }
+}
+
+// --- Reference: the same half-bands in double, without quantisation ---
+
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 30; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static void build_halfband(double* g, int taps) {
+    double sum = 0;
+    for (int k = 0; k < taps; k++) {
+        double t = 2 * k - (taps - 1);
+        double r = t / taps;
+        g[k] = sin(M_PI * t / 2) / (M_PI * t / 2) * bessel_i0(7.0 * sqrt(1 - r * r)) / bessel_i0(7.0);
+        sum += g[k];
+    }
+    for (int k = 0; k < taps; k++) g[k] /= sum;
+}
+
+static void halfband(const double* x, long len, const double* g, int taps, double* out) {
+    for (long i = 0; i < len; i++) {
+        out[2 * i] = (i - taps / 2 >= 0) ? x[i - taps / 2] : 0.0;
+        double acc = 0;
+        for (int k = 0; k < taps; k++) {
+            long j = i - (taps - 1) + k;
+            if (j >= 0) acc += g[k] * x[j];
+        }
+        out[2 * i + 1] = acc;
+    }
+}
+
+static void run_float(const int16_t* pcm, long len, double* out) {
+    double g1[OVERSAMPLE_TAPS1], g2[OVERSAMPLE_TAPS2];
+    build_halfband(g1, OVERSAMPLE_TAPS1);
+    build_halfband(g2, OVERSAMPLE_TAPS2);
+    double* x = malloc(sizeof(double) * len);
+    double* mid = malloc(sizeof(double) * len * 2);
+    for (long i = 0; i < len; i++) x[i] = pcm[i];
+    halfband(x, len, g1, OVERSAMPLE_TAPS1, mid);
+    halfband(mid, len * 2, g2, OVERSAMPLE_TAPS2, out);
+    free(mid);
+    free(x);
+}
+
+// --- Measurements ---
+
+// Power of the audio band of x[0..len) at rate, through a Blackman-windowed sinc
+static double band_power(const double* x, long len, double rate) {
+    static double h[BAND_TAPS];
+    double fc = BAND_HZ / rate;
+    for (int k = 0; k < BAND_TAPS; k++) {
+        double t = k - (BAND_TAPS - 1) / 2.0;
+        double w = 0.42 - 0.5 * cos(2 * M_PI * k / (BAND_TAPS - 1)) + 0.08 * cos(4 * M_PI * k / (BAND_TAPS - 1));
+        h[k] = (t == 0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t)) * w;
+    }
+    double p = 0;
+    long n = 0;
+    for (long i = BAND_TAPS; i < len; i++, n++) {
+        double acc = 0;
+        for (int k = 0; k < BAND_TAPS; k++) acc += h[k] * x[i - k];
+        p += acc * acc;
+    }
+    return n ? p / n : 0;
+}
+
+static double power(const double* x, long len) {
+    double p = 0;
+    for (long i = 0; i < len; i++) p += x[i] * x[i];
+    return len ? p / len : 0;
+}
+
+// Power at f Hz, over a whole number of its cycles
+static double tone_power(const double* x, long len, double rate, double f) {
+    double re = 0, im = 0;
+    for (long i = 0; i < len; i++) {
+        re += x[i] * cos(2 * M_PI * f * i / rate);
+        im -= x[i] * sin(2 * M_PI * f * i / rate);
+    }
+    return (re * re + im * im) / ((double)len * len);
+}
+
+static double db(double ratio) {
+    return ratio > 0 ? 10 * log10(ratio) : -INFINITY;
+}
+
+// Gain at each tone and the worst image, from the float filters
+static int check_filters(void) {
+    long len = SONG_RATE + SONG_RATE / 4; // Analysed from 0.25 s, past the filters' start
+    int16_t* pcm = malloc(sizeof(int16_t) * len);
+    double* out = malloc(sizeof(double) * len * OVERSAMPLE_FACTOR);
+    double worst_image = -INFINITY, worst_gain = 0;
+    for (size_t t = 0; t < sizeof(tones) / sizeof(tones[0]); t++) {
+        double f = tones[t];
+        for (long i = 0; i < len; i++) pcm[i] = (int16_t)lrint(16384 * sin(2 * M_PI * f * i / SONG_RATE));
+        run_float(pcm, len, out);
+        const double* x = out + OUT_RATE / 4;
+        double in = tone_power(x, OUT_RATE, OUT_RATE, f);
+        double gain = db(in / (16384.0 * 16384.0 / 4));
+        if (fabs(gain) > fabs(worst_gain)) worst_gain = gain;
+        for (int m = 1; m < OVERSAMPLE_FACTOR; m++) {
+            double image = db(tone_power(x, OUT_RATE, OUT_RATE, m * SONG_RATE - f) / in);
+            if (image > worst_image) worst_image = image;
+            image = db(tone_power(x, OUT_RATE, OUT_RATE, m * SONG_RATE + f) / in);
+            if (image > worst_image) worst_image = image;
+        }
+    }
+    printf("Filters: gain within %.3f dB at %d to %d Hz, worst image %.1f dB below the tone\n",
+           fabs(worst_gain), tones[0], tones[sizeof(tones) / sizeof(tones[0]) - 1], -worst_image);
+    free(out);
+    free(pcm);
+    return -worst_image < MIN_IMAGE_DB;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t ticks(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void write_wav(const char* path, const double* x, long len) {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "oversamplebench: cannot write %s\n", path);
+        return;
+    }
+    uint32_t data = (uint32_t)len * 2, rate = OUT_RATE, bytes_per_sec = OUT_RATE * 2, fmt_len = 16;
+    uint32_t riff = 36 + data;
+    uint16_t fmt[] = { 1, 1, 2, 16 };
+    fwrite("RIFF", 1, 4, f);
+    fwrite(&riff, 4, 1, f);
+    fwrite("WAVEfmt ", 1, 8, f);
+    fwrite(&fmt_len, 4, 1, f);
+    fwrite(&fmt[0], 2, 2, f);
+    fwrite(&rate, 4, 1, f);
+    fwrite(&bytes_per_sec, 4, 1, f);
+    fwrite(&fmt[2], 2, 2, f);
+    fwrite("data", 1, 4, f);
+    fwrite(&data, 4, 1, f);
+    for (long i = 0; i < len; i++) {
+        int16_t s = (int16_t)x[i];
+        fwrite(&s, 2, 1, f);
+    }
+    fclose(f);
+}
+
+static int run(const char* name, const int16_t* pcm, long len, const char* out_path) {
+    long out_len = len * OVERSAMPLE_FACTOR;
+    double* ref = malloc(sizeof(double) * out_len);
+    double* dut = malloc(sizeof(double) * out_len);
+    double* err = malloc(sizeof(double) * out_len);
+    int failed = 0;
+    run_float(pcm, len, ref);
+    double sig = power(ref, out_len);
+
+    // Old output: 12 bits, truncated, at the song rate
+    double* old = malloc(sizeof(double) * len);
+    for (long i = 0; i < len; i++) old[i] = (double)(((pcm[i] + 32768) >> 4) << 4) - 32768 - pcm[i];
+    double old_snr = db(sig / band_power(old, len, SONG_RATE));
+    free(old);
+    printf("%s, 12 bits at %d Hz: SNR %.1f dB\n", name, SONG_RATE, old_snr);
+
+    for (int shaping = 0; shaping <= 2; shaping++) {
+        run_fixed(pcm, len, shaping, dut);
+        for (long i = 0; i < out_len; i++) err[i] = dut[i] - ref[i];
+        double in_band = db(sig / band_power(err, out_len, OUT_RATE));
+        double full = db(sig / power(err, out_len));
+        printf("%s, %dx, order %d shaping: SNR %.1f dB to %.0f kHz (%+.1f dB), %.1f dB over the whole band\n",
+               name, OVERSAMPLE_FACTOR, shaping, in_band, BAND_HZ / 1000, in_band - old_snr, full);
+        if (shaping == OVERSAMPLE_SHAPING) {
+            if (in_band - old_snr < MIN_GAIN_DB) failed = 1;
+            if (out_path) write_wav(out_path, dut, out_len);
+        }
+    }
+
+    // Speed, one DAC half per call
+    Oversampler o;
+    static uint16_t dac[BLOCK * OVERSAMPLE_FACTOR];
+    oversample_init(&o, 1, OVERSAMPLE_SHAPING);
+    long blocks = 0;
+    double t0 = now();
+    uint64_t c0 = ticks();
+    for (int r = 0; r < REPEATS; r++) {
+        for (long i = 0; i + BLOCK <= len; i += BLOCK, blocks++) {
+            oversample_process(&o, pcm + i, BLOCK, dac);
+        }
+    }
+    uint64_t c1 = ticks();
+    double secs = now() - t0;
+    if (blocks > 0) {
+        printf("%s: %.2f us per %d-sample block", name, 1e6 * secs / blocks, BLOCK);
+        if (c1 > c0) printf(", %.0f TSC cycles per block", (double)(c1 - c0) / blocks);
+        printf(", %.0fx real time\n", (double)blocks * BLOCK / SONG_RATE / secs);
+    }
+
+    free(err);
+    free(dut);
+    free(ref);
+    return failed;
+}
+
+// --- Input ---
+
+static void synth(int16_t* pcm, long len) {
+    uint32_t seed = 1;
+    long beat = SONG_RATE / 2; // 120 BPM
+    for (long i = 0; i < len; i++) {
+        double t = (double)i / SONG_RATE;
+        double s = 0.15 * (sin(2 * M_PI * 220 * t) + sin(2 * M_PI * 277.2 * t) + sin(2 * M_PI * 329.6 * t));
+        double tb = (double)(i % beat) / SONG_RATE;
+        s += 0.5 * exp(-tb * 30) * sin(2 * M_PI * (60 + 200 * exp(-tb * 40)) * tb);
+        seed = seed * 1664525u + 1013904223u;
+        if (i % beat > beat / 2) s += 0.1 * exp(-(double)(i % beat - beat / 2) / 400) * ((int32_t)seed / 2147483648.0);
+        pcm[i] = (int16_t)lrint(32767.0 * (s > 1 ? 1 : s < -1 ? -1 : s));
+    }
+}
+
+static uint32_t get_u32(const uint8_t* b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint16_t get_u16(const uint8_t* b) {
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static int run_file(const char* path, const char* out_path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "oversamplebench: cannot open %s\n", path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* file = malloc(size);
+    if (fread(file, 1, size, f) != (size_t)size) size = 0;
+    fclose(f);
+    if (size < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "oversamplebench: %s is not a WAV file\n", path);
+        return 1;
+    }
+
+    uint16_t format = 0, channels = 0, bits = 0;
+    const uint8_t* data = 0;
+    long data_size = 0;
+    for (long off = 12; off + 8 <= size;) {
+        uint32_t id_size = get_u32(file + off + 4);
+        if (memcmp(file + off, "fmt ", 4) == 0) {
+            format = get_u16(file + off + 8);
+            channels = get_u16(file + off + 10);
+            bits = get_u16(file + off + 22);
+        } else if (memcmp(file + off, "data", 4) == 0) {
+            data = file + off + 8;
+            data_size = (off + 8 + (long)id_size <= size) ? (long)id_size : size - off - 8;
+        }
+        off += 8 + id_size + (id_size & 1);
+    }
+    if (format != 1 || bits != 16 || !data || channels == 0) {
+        fprintf(stderr, "oversamplebench: %s is not a 16-bit PCM WAV\n", path);
+        return 1;
+    }
+
+    long len = data_size / (2 * channels);
+    int16_t* pcm = malloc(sizeof(int16_t) * len);
+    for (long i = 0; i < len; i++) pcm[i] = (int16_t)get_u16(data + i * 2 * channels);
+    int res = run(path, pcm, len, out_path);
+    free(pcm);
+    free(file);
+    return res;
+}
+
+int main(int argc, char** argv) {
+    const char* out_path = 0;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "-o") == 0) {
+        out_path = argv[arg + 1];
+        arg += 2;
+    }
+    int failed = check_filters();
+    if (arg < argc) return run_file(argv[arg], out_path) | failed;
+    long len = (long)TEST_SECONDS * SONG_RATE;
+    int16_t* pcm = malloc(sizeof(int16_t) * len);
+    synth(pcm, len);
+    failed |= run("synthetic", pcm, len, out_path);
+    free(pcm);
+    return failed;
+}
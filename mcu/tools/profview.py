@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+# profview.py
+# Prints the profiler frames the firmware sends over USART2 (built with
+# PROF_ENABLE=1) as a live table, one refresh per frame. Reads a serial port,
+# or a capture file / stdin with "-".
+#
+# Usage:  ./profview.py /dev/ttyACM0 [baud]
+#         ./profview.py capture.bin
+
+import os
+import struct
+import sys
+
+VERSION = 1
+BUCKETS = 16
+BUCKET_SHIFT = 5
+CPU_HZ = 80e6
+SCOPES = ["sd_read", "fat_next", "process_beat", "fpga_send", "dac_fill", "mix", "oversample",
+          "sd_start", "sd_poll"]
+SAMPLE_PERIOD = CPU_HZ / 16000  # Cycles per DAC sample
+
+
+def open_input(path, baud):
+    if path == "-":
+        return sys.stdin.buffer
+    f = open(path, "rb", buffering=0)
+    if os.isatty(f.fileno()):
+        import termios
+        import tty
+        tty.setraw(f.fileno())
+        attrs = termios.tcgetattr(f.fileno())
+        speed = getattr(termios, "B%d" % baud)
+        attrs[4] = attrs[5] = speed
+        termios.tcsetattr(f.fileno(), termios.TCSANOW, attrs)
+    return f
+
+
+def frames(stream):
+    """Yields (period, [(count, min, max, total, hist)]) for each frame with a good checksum."""
+    buf = b""
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            return
+        buf += chunk
+        while True:
+            start = buf.find(b"\xa5\x5a")
+            if start < 0:
+                buf = buf[-1:]
+                break
+            buf = buf[start:]
+            if len(buf) < 8:
+                break
+            version, count, period = struct.unpack_from("<BBI", buf, 2)
+            size = 8 + count * (16 + 2 * BUCKETS) + 1
+            if version != VERSION or count > 32:
+                buf = buf[2:]
+                continue
+            if len(buf) < size:
+                break
+            if sum(buf[2:size - 1]) & 0xFF != buf[size - 1]:
+                buf = buf[2:]
+                continue
+            scopes = []
+            off = 8
+            for _ in range(count):
+                c, lo, hi, total = struct.unpack_from("<IIII", buf, off)
+                hist = struct.unpack_from("<%dH" % BUCKETS, buf, off + 16)
+                scopes.append((c, lo, hi, total, hist))
+                off += 16 + 2 * BUCKETS
+            buf = buf[size:]
+            yield period, scopes
+
+
+def us(cycles):
+    return cycles * 1e6 / CPU_HZ
+
+
+def histogram(hist):
+    """One character per bucket, scaled to the busiest one."""
+    marks = " .:-=+*#"
+    top = max(hist) or 1
+    return "".join(marks[min(len(marks) - 1, (h * (len(marks) - 1) + top - 1) // top)] for h in hist)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.stderr.write("usage: profview.py PORT|FILE|- [baud]\n")
+        return 2
+    baud = int(sys.argv[2]) if len(sys.argv) > 2 else 115200
+    worst = {}
+    live = sys.stdout.isatty()
+    for n, (period, scopes) in enumerate(frames(open_input(sys.argv[1], baud))):
+        if live:
+            sys.stdout.write("\x1b[H\x1b[J")
+        print("frame %d, period %.3f s, one sample = %.1f us" % (n, period / CPU_HZ, us(SAMPLE_PERIOD)))
+        print("%-13s %7s %10s %10s %10s %10s %6s  %s" %
+              ("scope", "count", "min us", "mean us", "max us", "worst us", "load", "histogram (from 2^%d cycles)" % BUCKET_SHIFT))
+        for i, (count, lo, hi, total, hist) in enumerate(scopes):
+            name = SCOPES[i] if i < len(SCOPES) else "scope%d" % i
+            worst[name] = max(worst.get(name, 0), hi)
+            mean = total / count if count else 0
+            load = 100.0 * total / period if period else 0
+            print("%-13s %7d %10.1f %10.1f %10.1f %10.1f %5.1f%%  |%s|" %
+                  (name, count, us(lo), us(mean), us(hi), us(worst[name]), load, histogram(hist)))
+        sys.stdout.flush()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
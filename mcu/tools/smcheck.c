@@ -0,0 +1,86 @@
+// smcheck.c
+// Runs the firmware's StepMania parser over chart files on the host and reports
+// what it found and how fast it went, feeding it 512-byte sectors like the card does.
+//
+// Build (Linux):  gcc -O2 -I../src -o smcheck smcheck.c ../src/sm_chart.c
+// Usage:          ./smcheck SONG.sm [difficulty] [-v]
+
+#include "sm_chart.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_RATE 16000
+#define REPEATS     20 // Parses per file when timing
+
+static int read_sector(void* ctx, uint8_t* buf) {
+    FILE* f = (FILE*)ctx;
+    size_t n = fread(buf, 1, SM_BUF_SIZE, f);
+    if (n == 0 && ferror(f)) return -1;
+    return (int)n;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: smcheck SONG.sm [difficulty] [-v]\n");
+        return 2;
+    }
+    const char* difficulty = 0;
+    int verbose = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) verbose = 1;
+        else difficulty = argv[i];
+    }
+
+    FILE* f = fopen(argv[1], "rb");
+    if (!f) {
+        fprintf(stderr, "smcheck: cannot open %s\n", argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+
+    static SmParser p;
+    SmNote note;
+    uint32_t notes = 0, first = 0, last = 0;
+    int res = 0;
+    double start = now();
+    for (int r = 0; r < REPEATS; r++) {
+        fseek(f, 0, SEEK_SET);
+        sm_init(&p, read_sector, f, difficulty, SAMPLE_RATE);
+        notes = 0;
+        uint32_t prev = 0;
+        while ((res = sm_next(&p, &note)) == 1) {
+            if (notes == 0) first = note.sample;
+            if (note.sample < prev) printf("out of order at note %u\n", notes);
+            prev = last = note.sample;
+            if (verbose && r == 0) printf("%10.3f s  %c%c%c%c\n", (double)note.sample / SAMPLE_RATE,
+                                          (note.lanes & 1) ? '<' : '.', (note.lanes & 2) ? 'v' : '.',
+                                          (note.lanes & 4) ? '^' : '.', (note.lanes & 8) ? '>' : '.');
+            notes++;
+        }
+    }
+    double secs = (now() - start) / REPEATS;
+    fclose(f);
+
+    if (res == -1) {
+        printf("%s: no matching dance-single chart\n", argv[1]);
+        return 1;
+    }
+    if (res == -2) {
+        printf("%s: read error\n", argv[1]);
+        return 1;
+    }
+    printf("%s: %u notes, %.2f s to %.2f s, %u BPM changes, %u stops, %u timing entries dropped\n",
+           argv[1], notes, (double)first / SAMPLE_RATE, (double)last / SAMPLE_RATE,
+           p.num_bpms > 0 ? p.num_bpms - 1 : 0, p.num_stops, p.dropped);
+    printf("parsed %ld bytes in %.3f ms (%.1f MB/s), parser state %u bytes\n",
+           size, secs * 1e3, size / secs / 1e6, (unsigned)sizeof(SmParser));
+    return 0;
+}
@@ -0,0 +1,242 @@
+// stretchbench.c
+// Checks the firmware's fixed-point WSOLA time-stretcher against a float version of
+// the same algorithm and reports its speed. Without a file, a synthetic song (a
+// chord under a kick on every beat) is stretched; with one, the first channel of a
+// 16-bit PCM WAV is, at its own rate.
+//
+// Build (Linux):  gcc -O2 -I../src -I../host -o stretchbench stretchbench.c ../src/stretch.c -lm
+// Usage:          ./stretchbench [SONG.WAV]
+
+#include "stretch.h"
+#include "stm32l432xx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define TEST_SECONDS 10
+#define TEST_RATE    16000
+#define MIN_SNR_DB   60.0 // Fixed point against float, over the whole output
+#define REPEATS      10   // Stretches of the whole song when timing
+
+DWT_Type host_dwt; // stretch.c times itself on the cycle counter; it stays at 0 here
+
+static const int speeds[] = { 50, 75, 90, 100 };
+
+// --- Input for the firmware stretcher ---
+
+typedef struct {
+    const int16_t* pcm;
+    long len;
+    long pos;
+} Song;
+
+static uint32_t song_read(void* ctx, int16_t* out, uint32_t max) {
+    Song* s = (Song*)ctx;
+    long n = s->len - s->pos;
+    if (n > (long)max) n = max;
+    memcpy(out, s->pcm + s->pos, n * sizeof(int16_t));
+    s->pos += n;
+    return (uint32_t)n;
+}
+
+static long run_fixed(const int16_t* pcm, long len, int pct, int16_t* out, long max_out) {
+    Stretch st;
+    Song song = { pcm, len, 0 };
+    stretch_init(&st, song_read, &song, 1, 0, pct);
+    long n = 0;
+    while (n + STRETCH_HOP <= max_out) {
+        uint32_t got = stretch_process(&st, out + n);
+        n += got;
+        if (got < STRETCH_HOP) break;
+    }
+    return n;
+}
+
+// --- Reference: the same WSOLA steps in float, with the normalised correlation ---
+
+static float in_at(const int16_t* pcm, long len, long i) {
+    return (i >= 0 && i < len) ? (float)pcm[i] : 0.0f;
+}
+
+static long run_float(const int16_t* pcm, long len, int pct, float* out, long max_out) {
+    uint32_t hop_q16 = (uint32_t)pct * ((uint32_t)STRETCH_HOP << 16) / 100;
+    long pos = 0;
+    uint32_t frac = 0;
+    float tail[STRETCH_HOP];
+    for (int i = 0; i < STRETCH_HOP; i++) tail[i] = in_at(pcm, len, i);
+    long n = 0;
+    while (pos < len && n + STRETCH_HOP <= max_out) {
+        long lo = pos > STRETCH_SEEK ? pos - STRETCH_SEEK : 0;
+        long best = pos;
+        double best_score = -INFINITY;
+        for (long k = lo; k <= pos + STRETCH_SEEK; k++) {
+            double c = 0, e = 0;
+            for (int i = 0; i < STRETCH_HOP; i++) {
+                double x = in_at(pcm, len, k + i);
+                c += tail[i] * x;
+                e += x * x;
+            }
+            double score = e > 0 ? c / sqrt(e) : 0;
+            if (score > best_score || (score == best_score && k == pos)) {
+                best_score = score;
+                best = k;
+            }
+        }
+        for (int i = 0; i < STRETCH_HOP; i++) {
+            double s = sin(M_PI * i / STRETCH_FRAME);
+            double w = s * s;
+            out[n + i] = (float)(tail[i] * (1 - w) + in_at(pcm, len, best + i) * w);
+        }
+        for (int i = 0; i < STRETCH_HOP; i++) tail[i] = in_at(pcm, len, best + STRETCH_HOP + i);
+        long left = (long)(((uint64_t)(len - pos) << 16) * STRETCH_HOP / hop_q16);
+        n += left < STRETCH_HOP ? left : STRETCH_HOP;
+        frac += hop_q16;
+        pos += frac >> 16;
+        frac &= 0xFFFF;
+    }
+    return n;
+}
+
+// --- Synthetic song ---
+
+static void synth(int16_t* pcm, long len) {
+    uint32_t seed = 1;
+    long beat = TEST_RATE / 2; // 120 BPM
+    for (long i = 0; i < len; i++) {
+        double t = (double)i / TEST_RATE;
+        double s = 0.15 * (sin(2 * M_PI * 220 * t) + sin(2 * M_PI * 277.2 * t) + sin(2 * M_PI * 329.6 * t));
+        double tb = (double)(i % beat) / TEST_RATE;
+        s += 0.5 * exp(-tb * 30) * sin(2 * M_PI * (60 + 200 * exp(-tb * 40)) * tb);
+        seed = seed * 1664525u + 1013904223u;
+        if (i % beat > beat / 2) s += 0.1 * exp(-(double)(i % beat - beat / 2) / 400) * ((int32_t)seed / 2147483648.0);
+        pcm[i] = (int16_t)lrint(32767.0 * (s > 1 ? 1 : s < -1 ? -1 : s));
+    }
+}
+
+// --- Checks ---
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t ticks(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int run(const char* name, const int16_t* pcm, long len, uint32_t rate) {
+    long max_out = len * 100 / STRETCH_MIN_PCT + 2 * STRETCH_HOP;
+    int16_t* dut = malloc(sizeof(int16_t) * max_out);
+    float* ref = malloc(sizeof(float) * max_out);
+    int failed = 0;
+
+    for (size_t s = 0; s < sizeof(speeds) / sizeof(speeds[0]); s++) {
+        int pct = speeds[s];
+        long n = run_fixed(pcm, len, pct, dut, max_out);
+        long n_ref = run_float(pcm, len, pct, ref, max_out);
+        double sig = 0, err = 0;
+        long worst = 0;
+        for (long i = 0; i < n && i < n_ref; i++) {
+            double d = dut[i] - ref[i];
+            sig += (double)ref[i] * ref[i];
+            err += d * d;
+            if (fabs(d) > worst) worst = (long)ceil(fabs(d));
+        }
+        double snr = err > 0 ? 10 * log10(sig / err) : INFINITY;
+        if (n != n_ref || snr < MIN_SNR_DB) failed = 1;
+        printf("%s at %d%%: %ld samples (%.3f s), %s, SNR %.1f dB against float, worst error %ld\n", name, pct,
+               n, (double)n / rate, n == n_ref ? "length matches" : "LENGTH DIFFERS", snr, worst);
+    }
+
+    // Speed at the slowest setting, where the most hops come out per input sample
+    double t0 = now();
+    uint64_t c0 = ticks();
+    long hops = 0;
+    for (int r = 0; r < REPEATS; r++) hops += run_fixed(pcm, len, STRETCH_MIN_PCT, dut, max_out) / STRETCH_HOP;
+    uint64_t c1 = ticks();
+    double secs = now() - t0;
+    printf("%s: %.2f us per %d-sample block", name, 1e6 * secs / hops, STRETCH_HOP);
+    if (c1 > c0) printf(", %.0f TSC cycles per block", (double)(c1 - c0) / hops);
+    printf(", %.0fx real time at %d%%\n", (double)hops * STRETCH_HOP / rate / secs, STRETCH_MIN_PCT);
+
+    free(dut);
+    free(ref);
+    return failed;
+}
+
+static uint32_t get_u32(const uint8_t* b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint16_t get_u16(const uint8_t* b) {
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static int run_file(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "stretchbench: cannot open %s\n", path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* file = malloc(size);
+    if (fread(file, 1, size, f) != (size_t)size) size = 0;
+    fclose(f);
+    if (size < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "stretchbench: %s is not a WAV file\n", path);
+        return 1;
+    }
+
+    uint16_t format = 0, channels = 0, bits = 0;
+    uint32_t rate = 0;
+    const uint8_t* data = 0;
+    long data_size = 0;
+    for (long off = 12; off + 8 <= size;) {
+        uint32_t id_size = get_u32(file + off + 4);
+        if (memcmp(file + off, "fmt ", 4) == 0) {
+            format = get_u16(file + off + 8);
+            channels = get_u16(file + off + 10);
+            rate = get_u32(file + off + 12);
+            bits = get_u16(file + off + 22);
+        } else if (memcmp(file + off, "data", 4) == 0) {
+            data = file + off + 8;
+            data_size = (off + 8 + (long)id_size <= size) ? (long)id_size : size - off - 8;
+        }
+        off += 8 + id_size + (id_size & 1);
+    }
+    if (format != 1 || bits != 16 || !data || channels == 0) {
+        fprintf(stderr, "stretchbench: %s is not a 16-bit PCM WAV\n", path);
+        return 1;
+    }
+
+    long len = data_size / (2 * channels);
+    int16_t* pcm = malloc(sizeof(int16_t) * len);
+    for (long i = 0; i < len; i++) pcm[i] = (int16_t)get_u16(data + i * 2 * channels);
+    int res = run(path, pcm, len, rate);
+    free(pcm);
+    free(file);
+    return res;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) return run_file(argv[1]);
+    long len = (long)TEST_SECONDS * TEST_RATE;
+    int16_t* pcm = malloc(sizeof(int16_t) * len);
+    synth(pcm, len);
+    int failed = run("synthetic", pcm, len, TEST_RATE);
+    free(pcm);
+    return failed;
+}